@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <sym/symdef.h>
 
@@ -12,6 +13,12 @@ namespace chrono
 {
     ///< 获取并返回当前微秒级时间戳。
     int64_t now();   
+
+    ///< 获取并返回当前线程已消耗的CPU时间，单位纳秒。
+    int64_t thread_cputime();
+
+    ///< 获取并返回单调时钟的微秒级时间，不受系统时间调整影响，用于计算时间间隔。
+    int64_t steady_now();
 }
 
 inline
@@ -22,4 +29,20 @@ int64_t chrono::now()
     return tv.tv_sec * 1000000LL + tv.tv_usec;
 }
 
+inline
+int64_t chrono::thread_cputime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+inline
+int64_t chrono::steady_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 END_SYM_NAMESPACE
@@ -1,9 +1,15 @@
 #pragma once 
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 #include <memory.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 # include <sym/symdef.h>
 
 BEGIN_SYM_NAMESPACE
@@ -11,14 +17,23 @@ BEGIN_SYM_NAMESPACE
 /// 包含基本IO操作和数据结构的名称空间。
 namespace io {
 
-    /// big endian to host endian
-    int16_t btoh(int16_t n);
-    int32_t btoh(int32_t n);
-    int64_t btoh(int64_t n);
+    /// big endian to host endian，编译期可求值
+    constexpr int16_t btoh(int16_t n);
+    constexpr int32_t btoh(int32_t n);
+    constexpr int64_t btoh(int64_t n);
+
+    constexpr int16_t htob(int16_t n);
+    constexpr int32_t htob(int32_t n);
+    constexpr int64_t htob(int64_t n);
+
+    /// 批量字节序转换，运行时按CPU支持选择AVX2/SSSE3实现。dst与src可以相同，否则不能重叠。
+    void btoh(int16_t * dst, const int16_t * src, size_t n);
+    void btoh(int32_t * dst, const int32_t * src, size_t n);
+    void btoh(int64_t * dst, const int64_t * src, size_t n);
 
-    int16_t htob(int16_t n);
-    int32_t htob(int32_t n);
-    int64_t htob(int64_t n);
+    void htob(int16_t * dst, const int16_t * src, size_t n);
+    void htob(int32_t * dst, const int32_t * src, size_t n);
+    void htob(int64_t * dst, const int64_t * src, size_t n);
 
     class BufferBase {
     private:
@@ -117,6 +132,7 @@ namespace io {
 } // end namespace io
 
 
+/// 逐字节转换的宏，保留给外部代码使用，库内使用io::btoh/htob。
 #ifndef SYM_BYTEORDER_CONVERT_16
 #define SYM_BYTEORDER_CONVERT_16(s, t) \
 do {    \
@@ -149,83 +165,107 @@ do { \
 } while (0)
 #endif // SYM_BYTEORDER_CONVERT_64
 
-
-inline 
-int64_t io::btoh(int64_t n) {
 # ifdef HOST_BIG_ENDIAN
 # error("big-endian not supported")
-# else 
-    int64_t r;
-    unsigned char * p0 = (unsigned char *)&n;
-    unsigned char * p1 = (unsigned char *)&r;
-    SYM_BYTEORDER_CONVERT_64(p0, p1);
-    return r;
 # endif
-}
 
-inline 
-int32_t io::btoh(int32_t n) {
-# ifdef HOST_BIG_ENDIAN
-# error("big-endian not supported")
-# else 
-    int32_t r;
-    unsigned char * p0 = (unsigned char *)&n;
-    unsigned char * p1 = (unsigned char *)&r;
-    SYM_BYTEORDER_CONVERT_32(p0, p1);
-    return r;
-# endif
-}
+inline constexpr
+int64_t io::btoh(int64_t n) { return (int64_t)__builtin_bswap64((uint64_t)n); }
 
-inline 
-int16_t io::btoh(int16_t n) {
-# ifdef HOST_BIG_ENDIAN
-# error("big-endian not supported")
-# else 
-    int32_t r;
-    unsigned char * p0 = (unsigned char *)&n;
-    unsigned char * p1 = (unsigned char *)&r;
-    SYM_BYTEORDER_CONVERT_16(p0, p1);
-    return r;
-# endif
-}
+inline constexpr
+int32_t io::btoh(int32_t n) { return (int32_t)__builtin_bswap32((uint32_t)n); }
 
-inline 
-int64_t io::htob(int64_t n) {
-# ifdef HOST_BIG_ENDIAN
-# error("big-endian not supported")
-# else 
-    int64_t r;
-    unsigned char * p0 = (unsigned char *)&n;
-    unsigned char * p1 = (unsigned char *)&r;
-    SYM_BYTEORDER_CONVERT_64(p0, p1);
-    return r;
-# endif
-}
+inline constexpr
+int16_t io::btoh(int16_t n) { return (int16_t)__builtin_bswap16((uint16_t)n); }
 
-inline 
-int32_t io::htob(int32_t n) {
-# ifdef HOST_BIG_ENDIAN
-# error("big-endian not supported")
-# else 
-    int32_t r;
-    unsigned char * p0 = (unsigned char *)&n;
-    unsigned char * p1 = (unsigned char *)&r;
-    SYM_BYTEORDER_CONVERT_32(p0, p1);
-    return r;
-# endif
-}
+inline constexpr
+int64_t io::htob(int64_t n) { return (int64_t)__builtin_bswap64((uint64_t)n); }
 
-inline 
-int16_t io::htob(int16_t n) {
-# ifdef HOST_BIG_ENDIAN
-# error("big-endian not supported")
-# else 
-    int16_t r;
-    unsigned char * p0 = (unsigned char *)&n;
-    unsigned char * p1 = (unsigned char *)&r;
-    SYM_BYTEORDER_CONVERT_16(p0, p1);
-    return r;
-# endif
-}
+inline constexpr
+int32_t io::htob(int32_t n) { return (int32_t)__builtin_bswap32((uint32_t)n); }
+
+inline constexpr
+int16_t io::htob(int16_t n) { return (int16_t)__builtin_bswap16((uint16_t)n); }
+
+namespace io {
+
+    namespace bswapimpl {
+
+        template<class T>
+        inline void swapScalar(T * dst, const T * src, size_t n)
+        {
+            for ( size_t i = 0; i < n; ++i ) dst[i] = btoh(src[i]);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        /// 16字节内按sizeof(T)反转字节顺序的pshufb掩码
+        template<class T>
+        inline __m128i shuffleMask()
+        {
+            alignas(16) char mask[16];
+            for ( int i = 0; i < 16; ++i ) mask[i] = (char)(i - i % sizeof(T) + sizeof(T) - 1 - i % sizeof(T));
+            return _mm_load_si128((const __m128i *)mask);
+        }
+
+        template<class T>
+        __attribute__((target("ssse3")))
+        inline void swapSsse3(T * dst, const T * src, size_t n)
+        {
+            const size_t step = 16 / sizeof(T);
+            const __m128i mask = shuffleMask<T>();
+            size_t i = 0;
+            for ( ; i + step <= n; i += step ) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+                _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, mask));
+            }
+            swapScalar(dst + i, src + i, n - i);
+        }
+
+        template<class T>
+        __attribute__((target("avx2")))
+        inline void swapAvx2(T * dst, const T * src, size_t n)
+        {
+            const size_t step = 32 / sizeof(T);
+            const __m256i mask = _mm256_broadcastsi128_si256(shuffleMask<T>());
+            size_t i = 0;
+            for ( ; i + step <= n; i += step ) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+                _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, mask));
+            }
+            swapScalar(dst + i, src + i, n - i);
+        }
+
+        /// 0: 标量, 1: SSSE3, 2: AVX2
+        inline int simdLevel()
+        {
+            static const int level = __builtin_cpu_supports("avx2") ? 2 : ( __builtin_cpu_supports("ssse3") ? 1 : 0 );
+            return level;
+        }
+#endif
+
+        template<class T>
+        inline void swapArray(T * dst, const T * src, size_t n)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            if ( n * sizeof(T) >= 32 ) {
+                int level = simdLevel();
+                if ( level == 2 ) return swapAvx2(dst, src, n);
+                if ( level == 1 ) return swapSsse3(dst, src, n);
+            }
+#endif
+            swapScalar(dst, src, n);
+        }
+
+    } // end namespace bswapimpl
+
+    inline void btoh(int16_t * dst, const int16_t * src, size_t n) { bswapimpl::swapArray(dst, src, n); }
+    inline void btoh(int32_t * dst, const int32_t * src, size_t n) { bswapimpl::swapArray(dst, src, n); }
+    inline void btoh(int64_t * dst, const int64_t * src, size_t n) { bswapimpl::swapArray(dst, src, n); }
+
+    inline void htob(int16_t * dst, const int16_t * src, size_t n) { bswapimpl::swapArray(dst, src, n); }
+    inline void htob(int32_t * dst, const int32_t * src, size_t n) { bswapimpl::swapArray(dst, src, n); }
+    inline void htob(int64_t * dst, const int64_t * src, size_t n) { bswapimpl::swapArray(dst, src, n); }
+
+} // end namespace io
 
 END_SYM_NAMESPACE
\ No newline at end of file
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <sym/symdef.h>
+
+#include <stdint.h>
+#include <string.h>
+
+BEGIN_SYM_NAMESPACE
+
+namespace io {
+
+    /// LZ块压缩后可能的最大长度，用于分配压缩输出缓存。
+    int lz_compress_bound(int size);
+
+    /// \brief 块压缩，输出格式与LZ4 block格式兼容。
+    ///
+    ///     贪心匹配，4K项哈希表在栈上分配，无堆内存分配。
+    /// \return 压缩后长度，输出缓存不足时返回0。
+    int lz_compress(const char * src, int size, char * dst, int capacity);
+
+    /// \brief 块解压，对输入做完整边界检查，可安全处理来自网络的数据。
+    /// \return 解压后长度，输入格式错误或输出缓存不足时返回-1。
+    int lz_decompress(const char * src, int size, char * dst, int capacity);
+
+} // end namespace io
+
+namespace io {
+
+    namespace lzimpl {
+        const int minMatch     = 4;
+        const int lastLiterals = 5;    ///< 块末尾必须是字面量的字节数
+        const int mfLimit      = 12;   ///< 最后一个匹配的起点距块末尾的最小距离
+        const int hashLog      = 12;
+        const int maxOffset    = 65535;
+
+        inline uint32_t read32(const uint8_t * p) { uint32_t v; memcpy(&v, p, 4); return v; }
+        inline uint32_t hash(uint32_t v) { return (v * 2654435761U) >> (32 - hashLog); }
+
+        /// 写入长度扩展字节，返回写入后的位置
+        inline uint8_t * writeLength(uint8_t * op, int len) {
+            for ( ; len >= 255; len -= 255 ) *op++ = 255;
+            *op++ = (uint8_t)len;
+            return op;
+        }
+    } // end namespace lzimpl
+
+    inline
+    int lz_compress_bound(int size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    inline
+    int lz_compress(const char * src, int size, char * dst, int capacity)
+    {
+        using namespace lzimpl;
+
+        const uint8_t * base    = (const uint8_t *)src;
+        const uint8_t * ip      = base;
+        const uint8_t * anchor  = base;
+        const uint8_t * iend    = base + size;
+        uint8_t * op   = (uint8_t *)dst;
+        uint8_t * oend = op + capacity;
+
+        uint32_t table[1 << hashLog];   // 位置+1，0表示空
+        memset(table, 0, sizeof(table));
+
+        if ( size >= mfLimit + 1 ) {
+            const uint8_t * mflimit = iend - mfLimit;
+            const uint8_t * mlimit  = iend - lastLiterals;
+            int misses = 0;
+            while ( ip < mflimit ) {
+                uint32_t seq = read32(ip);
+                uint32_t h   = hash(seq);
+                uint32_t ref = table[h];
+                table[h] = (uint32_t)(ip - base) + 1;
+
+                const uint8_t * match = ref ? base + (ref - 1) : nullptr;
+                if ( match == nullptr || ip - match > maxOffset || read32(match) != seq ) {
+                    ip += 1 + (misses++ >> 6);   // 连续未命中时加大步长，不可压缩数据快速跳过
+                    continue;
+                }
+                misses = 0;
+
+                int mlen = minMatch;
+                while ( ip + mlen < mlimit && match[mlen] == ip[mlen] ) ++mlen;
+
+                // 输出序列：token + 字面量长度扩展 + 字面量 + 偏移 + 匹配长度扩展
+                int llen = (int)(ip - anchor);
+                if ( oend - op < 1 + llen / 255 + 1 + llen + 2 + (mlen - minMatch) / 255 + 1 ) return 0;
+
+                uint8_t * token = op++;
+                *token = (uint8_t)((llen >= 15 ? 15 : llen) << 4);
+                if ( llen >= 15 ) op = writeLength(op, llen - 15);
+                memcpy(op, anchor, llen);
+                op += llen;
+
+                uint16_t offset = (uint16_t)(ip - match);
+                *op++ = (uint8_t)(offset & 0xff);
+                *op++ = (uint8_t)(offset >> 8);
+
+                int ml = mlen - minMatch;
+                *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+                if ( ml >= 15 ) op = writeLength(op, ml - 15);
+
+                ip += mlen;
+                anchor = ip;
+            }
+        }
+
+        // 最后的字面量序列
+        int llen = (int)(iend - anchor);
+        if ( oend - op < 1 + llen / 255 + 1 + llen ) return 0;
+        *op++ = (uint8_t)((llen >= 15 ? 15 : llen) << 4);
+        if ( llen >= 15 ) op = writeLength(op, llen - 15);
+        memcpy(op, anchor, llen);
+        op += llen;
+
+        return (int)(op - (uint8_t *)dst);
+    }
+
+    inline
+    int lz_decompress(const char * src, int size, char * dst, int capacity)
+    {
+        using namespace lzimpl;
+
+        const uint8_t * ip   = (const uint8_t *)src;
+        const uint8_t * iend = ip + size;
+        uint8_t * op   = (uint8_t *)dst;
+        uint8_t * oend = op + capacity;
+
+        while ( ip < iend ) {
+            int token = *ip++;
+
+            // 字面量
+            size_t llen = token >> 4;
+            if ( llen == 15 ) {
+                uint8_t b;
+                do {
+                    if ( ip >= iend ) return -1;
+                    b = *ip++;
+                    llen += b;
+                } while ( b == 255 );
+            }
+            if ( llen > (size_t)(iend - ip) || llen > (size_t)(oend - op) ) return -1;
+            memcpy(op, ip, llen);
+            ip += llen;
+            op += llen;
+            if ( ip == iend ) break;   // 最后一个序列只有字面量
+
+            // 匹配
+            if ( iend - ip < 2 ) return -1;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if ( offset == 0 || offset > (size_t)(op - (uint8_t *)dst) ) return -1;
+
+            size_t mlen = token & 15;
+            if ( mlen == 15 ) {
+                uint8_t b;
+                do {
+                    if ( ip >= iend ) return -1;
+                    b = *ip++;
+                    mlen += b;
+                } while ( b == 255 );
+            }
+            mlen += minMatch;
+            if ( mlen > (size_t)(oend - op) ) return -1;
+
+            // 匹配区可能与输出重叠，逐字节复制
+            const uint8_t * match = op - offset;
+            for ( size_t i = 0; i < mlen; ++i ) op[i] = match[i];
+            op += mlen;
+        }
+
+        return (int)(op - (uint8_t *)dst);
+    }
+
+} // end namespace io
+
+END_SYM_NAMESPACE
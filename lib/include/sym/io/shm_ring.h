@@ -0,0 +1,388 @@
+#pragma once
+
+#include <sym/symdef.h>
+#include <sym/error.h>
+#include <sym/chrono.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <new>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+BEGIN_SYM_NAMESPACE
+
+namespace io {
+
+    /**
+     * @brief 共享内存单生产者单消费者消息环，用于同一主机的两个进程之间传递报文。
+     *
+     * 环形缓存和读写位置放在memfd创建的共享内存中，两个eventfd作为门铃：
+     *      1. 消费者在环为空时等待dataFd，生产者在环满时等待spaceFd。
+     *      2. 只有对端声明正在等待时才写eventfd，连续收发时不产生系统调用。
+     *      3. 每条消息前有4字节长度，按8字节对齐；写到缓存末尾放不下时写入跳转标记，从头开始写。
+     *      4. 共享内存对端可写，读取时按环容量检查读写位置和消息长度，不一致时置损坏标志，不再读取。
+     *
+     * create创建后，通过net::Socket::sendFds把memFd、dataFd、spaceFd传给对端进程，由对端attach。
+     * 只有一个线程写、一个线程读；dataFd可以注册到事件循环，可读时先调用clearDoorbell再读取。
+     */
+    class ShmRing {
+        static const uint32_t wrapMark = 0xffffffff;
+
+        /// 共享内存开头的控制块，生产者和消费者各自修改的字段放在不同的缓存行
+        struct Control {
+            alignas(64) std::atomic<uint64_t> head;            ///< 写位置，只由生产者修改
+            alignas(64) std::atomic<uint64_t> tail;            ///< 读位置，只由消费者修改
+            alignas(64) std::atomic<uint32_t> readerWaiting;   ///< 消费者等待dataFd
+            std::atomic<uint32_t> writerWaiting;               ///< 生产者等待spaceFd
+            uint64_t capacity;
+        };
+
+    private:
+        Control * m_ctl      { nullptr };
+        char *    m_data     { nullptr };
+        size_t    m_capacity { 0 };
+        size_t    m_mapSize  { 0 };
+        int       m_memFd    { -1 };
+        int       m_dataFd   { -1 };
+        int       m_spaceFd  { -1 };
+        bool      m_corrupt  { false };
+
+    public:
+        ShmRing() {}
+        ~ShmRing() { this->close(); }
+        SYM_NONCOPYABLE(ShmRing)
+
+        /// 创建消息环，capacity向上取整为2的幂
+        bool   create(size_t capacity, err::Error * e = nullptr);
+
+        /// 接管对端传来的描述字并映射共享内存，失败时描述字被关闭
+        bool   attach(int memFd, int dataFd, int spaceFd, err::Error * e = nullptr);
+        void   close();
+        bool   isOpen() const { return m_ctl != nullptr; }
+        /// peek发现读写位置或消息长度超出环容量，对端写坏了共享内存
+        bool   corrupt() const { return m_corrupt; }
+
+        int    memFd() const   { return m_memFd; }
+        int    dataFd() const  { return m_dataFd; }
+        int    spaceFd() const { return m_spaceFd; }
+        size_t capacity() const { return m_capacity; }
+
+        /// 单条消息的最大长度
+        size_t maxMessage() const { return m_capacity / 2 - sizeof(uint32_t); }
+
+        /// 写入一条消息，空间不足时返回false
+        bool   tryWrite(const char * data, size_t size);
+
+        /// 把多段数据作为一条消息写入，空间不足时返回false
+        bool   tryWritev(const struct iovec * iov, int count);
+
+        /// 写入一条消息，空间不足时等待，timeout毫秒(-1不超时)。超时或出错返回false。
+        bool   write(const char * data, size_t size, int timeout, err::Error * e = nullptr);
+
+        /// 取得第一条消息，不复制，环为空或损坏时返回nullptr。数据在pop之前有效。
+        const char * peek(size_t * size);
+        void   pop();
+
+        /// 等待并取得第一条消息，timeout毫秒(-1不超时)，超时或出错返回nullptr
+        const char * wait(size_t * size, int timeout, err::Error * e = nullptr);
+
+        /// 准备在dataFd上等待：声明消费者将等待后再确认环为空，返回false表示已有消息不需要等待
+        bool   prepareWait();
+
+        /// 读空dataFd的计数，事件循环中dataFd可读时调用
+        void   clearDoorbell() { uint64_t n; while ( ::read(m_dataFd, &n, sizeof(n)) > 0 ) ; }
+
+        /// 准备在spaceFd上等待写入size字节的空间，返回false表示空间已经足够不需要等待
+        bool   prepareWriteWait(size_t size);
+
+        /// 读空spaceFd的计数，事件循环中spaceFd可读时调用
+        void   clearSpaceDoorbell() { uint64_t n; while ( ::read(m_spaceFd, &n, sizeof(n)) > 0 ) ; }
+
+    private:
+        static size_t align(size_t n) { return (n + 7) & ~(size_t)7; }
+        static void   ring(int fd) { uint64_t n = 1; ssize_t r = ::write(fd, &n, sizeof(n)); (void)r; }
+        static bool   pollFd(int fd, int64_t deadline, err::Error * e);
+        /// 从head开始写need字节需要跳过的末尾空间，放不下时返回false
+        bool   fits(uint64_t head, uint64_t tail, size_t need, size_t * skip) const;
+        bool   map(err::Error * e);
+    }; // end class ShmRing
+
+} // end namespace io
+
+namespace io {
+
+    inline
+    bool ShmRing::create(size_t capacity, err::Error * e)
+    {
+        assert( m_ctl == nullptr );
+        size_t cap = 4096;
+        while ( cap < capacity ) cap <<= 1;
+
+        m_memFd   = ::memfd_create("sym-shm-ring", MFD_CLOEXEC);
+        m_dataFd  = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        m_spaceFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if ( m_memFd < 0 || m_dataFd < 0 || m_spaceFd < 0 || ::ftruncate(m_memFd, sizeof(Control) + cap) != 0 ) {
+            if ( e ) *e = err::Error(errno, err::dmSystem);
+            this->close();
+            return false;
+        }
+        if ( !this->map(e) ) return false;
+
+        new (m_ctl) Control();
+        m_ctl->head.store(0);
+        m_ctl->tail.store(0);
+        m_ctl->readerWaiting.store(0);
+        m_ctl->writerWaiting.store(0);
+        m_ctl->capacity = cap;
+        m_capacity = cap;
+        return true;
+    }
+
+    inline
+    bool ShmRing::attach(int memFd, int dataFd, int spaceFd, err::Error * e)
+    {
+        assert( m_ctl == nullptr );
+        m_memFd   = memFd;
+        m_dataFd  = dataFd;
+        m_spaceFd = spaceFd;
+        if ( !this->map(e) ) return false;
+
+        // 容量来自对端写入的共享内存，需要与映射大小一致
+        size_t cap = m_ctl->capacity;
+        if ( cap < 4096 || (cap & (cap - 1)) != 0 || sizeof(Control) + cap != m_mapSize ) {
+            if ( e ) *e = err::Error(-1, "bad shared memory ring");
+            this->close();
+            return false;
+        }
+        m_capacity = cap;
+        return true;
+    }
+
+    inline
+    bool ShmRing::map(err::Error * e)
+    {
+        static_assert( ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared memory atomics must be lock free" );
+
+        struct stat st;
+        if ( ::fstat(m_memFd, &st) != 0 ) {
+            if ( e ) *e = err::Error(errno, err::dmSystem);
+            this->close();
+            return false;
+        }
+        if ( st.st_size <= (off_t)sizeof(Control) ) {
+            if ( e ) *e = err::Error(-1, "bad shared memory size");
+            this->close();
+            return false;
+        }
+
+        void * p = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memFd, 0);
+        if ( p == MAP_FAILED ) {
+            if ( e ) *e = err::Error(errno, err::dmSystem);
+            this->close();
+            return false;
+        }
+        m_mapSize = st.st_size;
+        m_ctl  = (Control *)p;
+        m_data = (char *)p + sizeof(Control);
+        return true;
+    }
+
+    inline
+    void ShmRing::close()
+    {
+        if ( m_ctl ) ::munmap(m_ctl, m_mapSize);
+        if ( m_memFd >= 0 )   ::close(m_memFd);
+        if ( m_dataFd >= 0 )  ::close(m_dataFd);
+        if ( m_spaceFd >= 0 ) ::close(m_spaceFd);
+        m_ctl  = nullptr;
+        m_data = nullptr;
+        m_capacity = m_mapSize = 0;
+        m_memFd = m_dataFd = m_spaceFd = -1;
+        m_corrupt = false;
+    }
+
+    inline
+    bool ShmRing::fits(uint64_t head, uint64_t tail, size_t need, size_t * skip) const
+    {
+        // 末尾放不下时跳到开头，跳过的空间也要计入
+        size_t pos = head & (m_capacity - 1);
+        *skip = m_capacity - pos < need ? m_capacity - pos : 0;
+        return m_capacity - (head - tail) >= *skip + need;
+    }
+
+    inline
+    bool ShmRing::tryWrite(const char * data, size_t size)
+    {
+        struct iovec iov { (void *)data, size };
+        return this->tryWritev(&iov, 1);
+    }
+
+    inline
+    bool ShmRing::tryWritev(const struct iovec * iov, int count)
+    {
+        size_t size = 0;
+        for ( int i = 0; i < count; ++i ) size += iov[i].iov_len;
+        assert( size <= this->maxMessage() );
+
+        uint64_t head = m_ctl->head.load(std::memory_order_relaxed);
+        uint64_t tail = m_ctl->tail.load(std::memory_order_seq_cst);   // 与prepareWriteWait中writerWaiting的设置配合
+        size_t   need = align(sizeof(uint32_t) + size);
+        size_t   skip;
+        if ( !this->fits(head, tail, need, &skip) ) return false;
+
+        size_t pos = head & (m_capacity - 1);
+        if ( skip > 0 ) {
+            uint32_t mark = wrapMark;
+            memcpy(m_data + pos, &mark, sizeof(mark));
+            pos = 0;
+        }
+        uint32_t len = (uint32_t)size;
+        memcpy(m_data + pos, &len, sizeof(len));
+        pos += sizeof(len);
+        for ( int i = 0; i < count; ++i ) {
+            memcpy(m_data + pos, iov[i].iov_base, iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
+
+        // 发布写位置后检查消费者是否在等待，与prepareWait的顺序配合，不会丢失唤醒
+        m_ctl->head.store(head + skip + need, std::memory_order_seq_cst);
+        if ( m_ctl->readerWaiting.load(std::memory_order_seq_cst) && m_ctl->readerWaiting.exchange(0) ) {
+            ring(m_dataFd);
+        }
+        return true;
+    }
+
+    inline
+    bool ShmRing::write(const char * data, size_t size, int timeout, err::Error * e)
+    {
+        if ( size > this->maxMessage() ) {
+            if ( e ) *e = err::Error(-1, "message is too large for the ring");
+            return false;
+        }
+        int64_t deadline = timeout < 0 ? 0 : chrono::steady_now() + timeout * 1000LL;
+        while ( !this->tryWrite(data, size) ) {
+            if ( !this->prepareWriteWait(size) ) continue;
+            if ( !pollFd(m_spaceFd, deadline, e) ) return false;
+            this->clearSpaceDoorbell();
+        }
+        return true;
+    }
+
+    inline
+    bool ShmRing::prepareWriteWait(size_t size)
+    {
+        m_ctl->writerWaiting.store(1, std::memory_order_seq_cst);
+        size_t skip;
+        uint64_t head = m_ctl->head.load(std::memory_order_relaxed);
+        uint64_t tail = m_ctl->tail.load(std::memory_order_seq_cst);
+        if ( this->fits(head, tail, align(sizeof(uint32_t) + size), &skip) ) {
+            m_ctl->writerWaiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    const char * ShmRing::peek(size_t * size)
+    {
+        if ( m_corrupt ) return nullptr;
+        uint64_t tail = m_ctl->tail.load(std::memory_order_relaxed);
+        uint64_t head = m_ctl->head.load(std::memory_order_acquire);
+        if ( head == tail ) return nullptr;
+
+        // 位置和长度都来自共享内存，先按容量检查再使用，对端写坏时不越界读取
+        uint64_t used = head - tail;
+        size_t   pos  = tail & (m_capacity - 1);
+        uint32_t len;
+        memcpy(&len, m_data + pos, sizeof(len));
+        if ( used <= m_capacity && len == wrapMark && m_capacity - pos < used ) {
+            // 跳转标记由生产者和消息一起发布，跳过后一定有消息
+            used -= m_capacity - pos;
+            tail += m_capacity - pos;
+            m_ctl->tail.store(tail, std::memory_order_release);
+            pos = 0;
+            memcpy(&len, m_data, sizeof(len));
+        }
+        if ( used > m_capacity || len > this->maxMessage() || pos + align(sizeof(len) + len) > m_capacity
+          || align(sizeof(len) + len) > used ) {
+            m_corrupt = true;
+            return nullptr;
+        }
+        *size = len;
+        return m_data + pos + sizeof(len);
+    }
+
+    inline
+    void ShmRing::pop()
+    {
+        size_t size;
+        if ( this->peek(&size) == nullptr ) return;
+        uint64_t tail = m_ctl->tail.load(std::memory_order_relaxed);
+        m_ctl->tail.store(tail + align(sizeof(uint32_t) + size), std::memory_order_seq_cst);
+        if ( m_ctl->writerWaiting.load(std::memory_order_seq_cst) && m_ctl->writerWaiting.exchange(0) ) {
+            ring(m_spaceFd);
+        }
+    }
+
+    inline
+    bool ShmRing::prepareWait()
+    {
+        m_ctl->readerWaiting.store(1, std::memory_order_seq_cst);
+        if ( m_ctl->head.load(std::memory_order_seq_cst) != m_ctl->tail.load(std::memory_order_relaxed) ) {
+            m_ctl->readerWaiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    const char * ShmRing::wait(size_t * size, int timeout, err::Error * e)
+    {
+        int64_t deadline = timeout < 0 ? 0 : chrono::steady_now() + timeout * 1000LL;
+        const char * p;
+        while ( (p = this->peek(size)) == nullptr ) {
+            if ( m_corrupt ) {
+                if ( e ) *e = err::Error(-1, "shared memory ring is corrupt");
+                return nullptr;
+            }
+            if ( !this->prepareWait() ) continue;
+            if ( !pollFd(m_dataFd, deadline, e) ) return nullptr;
+            this->clearDoorbell();
+        }
+        return p;
+    }
+
+    inline
+    bool ShmRing::pollFd(int fd, int64_t deadline, err::Error * e)
+    {
+        struct pollfd pfd { fd, POLLIN, 0 };
+        while ( true ) {
+            int timeout = -1;
+            if ( deadline > 0 ) {
+                int64_t left = deadline - chrono::steady_now();
+                if ( left <= 0 ) {
+                    if ( e ) *e = err::Error(-1, "wait timeout");
+                    return false;
+                }
+                timeout = (int)((left + 999) / 1000);
+            }
+            int r = ::poll(&pfd, 1, timeout);
+            if ( r > 0 ) return true;
+            if ( r < 0 && errno != EINTR ) {
+                if ( e ) *e = err::Error(errno, err::dmSystem);
+                return false;
+            }
+        }
+    }
+
+} // end namespace io
+
+END_SYM_NAMESPACE
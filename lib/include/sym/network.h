@@ -7,6 +7,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -15,10 +16,13 @@
 #include <netdb.h>
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <string>
+
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX 108
 #endif
@@ -28,6 +32,7 @@
     do { \
         if ( rv == 0 ) return true; \
         if (e) *e = err::Error(errno, err::dmSystem); \
+        return false; \
     } while (0)
 
 # include <sym/net/url.h>
@@ -53,8 +58,18 @@ namespace net {
     public:
         Address() { ((sockaddr *)m_addrbuf)->sa_family = AF_UNSPEC; }
         Address(const char * host, int port, err::Error *e );
+
+        /// UNIX域地址，path以'@'开头时为抽象名称空间，不在文件系统中创建文件
+        Address(const char * path, err::Error *e );
         
         int af() const { return data()->sa_family; }
+        bool isUnix() const { return af() == AF_UNIX; }
+
+        /// UNIX域地址的路径，抽象名称空间以'@'开头；其他地址返回空串
+        std::string path() const;
+
+        /// 是否与other在同一主机：都是UNIX域地址，或IP相同，或都是回环地址
+        bool sameHost(const Address & other) const;
         socklen_t capacity() const { return ADDR_BUFFER_LEN; }
         sockaddr * data() { return (sockaddr *)m_addrbuf; }
         const sockaddr * data() const {return (const sockaddr *)m_addrbuf;} 
@@ -80,8 +95,18 @@ namespace net {
         int  fd() const  { return m_fd; }
         bool listen(err::Error * e = nullptr);
         int  receive(char * buf, int len, err::Error * e = nullptr);
-        int  send(const char * buf, int len, err::Error *e = nullptr);
+        int  send(const char * buf, int len, err::Error *e = nullptr, int flags = 0);
+        /// 集中写，一次发送多个缓存，返回发送的字节数，输出缓存已满时返回0
+        int  sendv(const struct iovec * iov, int count, err::Error *e = nullptr);
         bool shutdown(int how, err::Error *e = nullptr);
+
+        bool localAddress(Address * addr, err::Error *e = nullptr) const;
+        bool remoteAddress(Address * addr, err::Error *e = nullptr) const;
+
+        /// 通过UNIX域连接传递描述字(SCM_RIGHTS)，同时发送1字节数据
+        bool sendFds(const int * fds, int count, err::Error *e = nullptr);
+        /// 接收描述字，返回收到的个数，连接关闭或出错返回-1
+        int  receiveFds(int * fds, int count, err::Error *e = nullptr);
     }; // end class Socket
 
     class SocketOption 
@@ -112,6 +137,15 @@ namespace net {
         {}
     };
 
+    /// 关闭Nagle算法，流水线发送的小请求不必等待前一个请求的确认
+    class SocketOptNoDelay : public SocketOption 
+    {
+    public:
+        SocketOptNoDelay(Socket & sock, int value, err::Error * e = nullptr)
+            : SocketOption(sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value), e)
+        {}
+    };
+
 } // end namespace net 
 
 namespace net
@@ -221,9 +255,9 @@ namespace net
     }
 
     inline 
-    int Socket::send(const char * buf, int len, err::Error *e)
+    int Socket::send(const char * buf, int len, err::Error *e, int flags)
     {
-        ssize_t rv = ::send(m_fd, buf, len, 0);
+        ssize_t rv = ::send(m_fd, buf, len, flags);
         if ( rv >= 0 )  return (int)rv;
         else {
             int eno = errno;
@@ -235,6 +269,110 @@ namespace net
         }
     }
 
+    inline 
+    int Socket::sendv(const struct iovec * iov, int count, err::Error *e)
+    {
+        ssize_t rv = ::writev(m_fd, iov, count);
+        if ( rv >= 0 )  return (int)rv;
+        else {
+            int eno = errno;
+            if ( eno == EAGAIN || eno == EINTR ) return 0;
+            else {
+                if ( e ) *e = err::Error(errno, err::dmSystem);
+                return -1;
+            }
+        }
+    }
+
+    inline
+    bool Socket::localAddress(Address * addr, err::Error *e) const
+    {
+        socklen_t len = addr->capacity();
+        int rv = ::getsockname(m_fd, addr->data(), &len);
+        if ( rv == 0 ) addr->resize(len);
+        SYM_SOCK_RV_RETURN(rv);
+    }
+
+    inline
+    bool Socket::remoteAddress(Address * addr, err::Error *e) const
+    {
+        socklen_t len = addr->capacity();
+        int rv = ::getpeername(m_fd, addr->data(), &len);
+        if ( rv == 0 ) addr->resize(len);
+        SYM_SOCK_RV_RETURN(rv);
+    }
+
+    inline
+    bool Socket::sendFds(const int * fds, int count, err::Error *e)
+    {
+        assert( count > 0 && count <= 16 );
+        char byte = 0;
+        struct iovec iov { &byte, 1 };
+        char control[CMSG_SPACE(sizeof(int) * 16)];
+        memset(control, 0, sizeof(control));
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+        ssize_t rv;
+        while ( (rv = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR ) ;
+        if ( rv == 1 ) return true;
+        if ( e ) *e = rv < 0 ? err::Error(errno, err::dmSystem) : err::Error(-1, "send fds failed");
+        return false;
+    }
+
+    inline
+    int Socket::receiveFds(int * fds, int count, err::Error *e)
+    {
+        assert( count > 0 && count <= 16 );
+        char byte;
+        struct iovec iov { &byte, 1 };
+        char control[CMSG_SPACE(sizeof(int) * 16)];
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        ssize_t rv;
+        while ( (rv = ::recvmsg(m_fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR ) ;
+        if ( rv <= 0 ) {
+            if ( e ) *e = rv < 0 ? err::Error(errno, err::dmSystem) : err::Error(-1, "connection is reset by peer");
+            return -1;
+        }
+
+        int n = 0;
+        for ( struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+            if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ) continue;
+            int m = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for ( int i = 0; i < m; ++i ) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if ( n < count ) fds[n++] = fd;
+                else ::close(fd);
+            }
+        }
+        if ( msg.msg_flags & MSG_CTRUNC ) {
+            // 控制数据被截断，收到的描述字不完整
+            for ( int i = 0; i < n; ++i ) ::close(fds[i]);
+            if ( e ) *e = err::Error(-1, "fds truncated");
+            return -1;
+        }
+        return n;
+    }
+
 } // end namespace net
 
 namespace net
@@ -259,6 +397,62 @@ namespace net
         return ;
     }
 
+    inline
+    Address::Address(const char * path, err::Error *e)
+    {
+        assert(path);
+        sockaddr_un * un = (sockaddr_un *)m_addrbuf;
+        memset(un, 0, sizeof(sockaddr_un));
+        un->sun_family = AF_UNIX;
+
+        size_t len = strlen(path);
+        if ( len == 0 || len >= sizeof(un->sun_path) ) {
+            un->sun_family = AF_UNSPEC;
+            if ( e ) *e = err::Error(-1, "unix socket path is empty or too long");
+            return ;
+        }
+        memcpy(un->sun_path, path, len);
+        if ( path[0] == '@' ) un->sun_path[0] = '\0';   // 抽象名称空间，长度不含结尾0
+        else ++len;
+        m_size = offsetof(sockaddr_un, sun_path) + len;
+    }
+
+    inline
+    std::string Address::path() const
+    {
+        if ( !this->isUnix() ) return std::string();
+        const sockaddr_un * un = (const sockaddr_un *)m_addrbuf;
+        size_t len = m_size > offsetof(sockaddr_un, sun_path) ? m_size - offsetof(sockaddr_un, sun_path) : 0;
+        if ( len == 0 ) return std::string();   // 未命名的客户端地址
+        if ( un->sun_path[0] == '\0' ) return "@" + std::string(un->sun_path + 1, len - 1);
+        return std::string(un->sun_path, strnlen(un->sun_path, len));
+    }
+
+    inline
+    bool Address::sameHost(const Address & other) const
+    {
+        if ( this->isUnix() || other.isUnix() ) return this->isUnix() && other.isUnix();
+
+        // 两端都是回环地址时视为同一主机，IPv4回环地址是整个127.0.0.0/8
+        auto loopback = [](const Address & a) {
+            if ( a.af() == AF_INET )
+                return (ntohl(((const sockaddr_in *)a.data())->sin_addr.s_addr) >> 24) == 127;
+            if ( a.af() == AF_INET6 ) {
+                const in6_addr & in6 = ((const sockaddr_in6 *)a.data())->sin6_addr;
+                return IN6_IS_ADDR_LOOPBACK(&in6) || ( IN6_IS_ADDR_V4MAPPED(&in6) && in6.s6_addr[12] == 127 );
+            }
+            return false;
+        };
+        if ( loopback(*this) && loopback(other) ) return true;
+
+        if ( this->af() != other.af() ) return false;
+        if ( af() == AF_INET )
+            return ((const sockaddr_in *)data())->sin_addr.s_addr == ((const sockaddr_in *)other.data())->sin_addr.s_addr;
+        if ( af() == AF_INET6 )
+            return memcmp(&((const sockaddr_in6 *)data())->sin6_addr, &((const sockaddr_in6 *)other.data())->sin6_addr, sizeof(in6_addr)) == 0;
+        return false;
+    }
+
     inline 
     socklen_t Address::HostNameToAddress(const char *host, sockaddr * addr, socklen_t len, err::Error *e)
     {
@@ -10,6 +10,7 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <unistd.h>
 #include <assert.h>
@@ -78,11 +79,15 @@ namespace nio
 
     class SocketChannel;
     class SocketListener;
+    class EventNotifier;
+    class FdWatcher;
 
     enum class EnumIoType
     {
         ioSocketChannel,
-        ioSocketListener
+        ioSocketListener,
+        ioEventNotifier,
+        ioFdWatcher
     };
 
     /**
@@ -105,6 +110,8 @@ namespace nio
         typedef std::function<void (int fd)>     CloseCallback; 
         typedef std::function<void (int status)> ServerCallback;
         typedef std::function<bool (int timer)>  TimerCallback;
+        typedef std::function<void ()>           PostedCallback;
+        typedef std::function<void (int watcher)> WatcherCallback;
 
         enum {
             statusOk     =  0,     ///< 正常状态
@@ -121,14 +128,39 @@ namespace nio
 
         int   addListener(const net::Address &loc, const ListenerCallback & callback, err::Error * e = nullptr);
 
+        /// 添加定时器，interval毫秒后在循环线程中回调，回调返回true时按相同间隔继续，返回false时定时器删除。
+        /// 返回定时器ID。与cancelTimer一样不是线程安全的，须在循环线程中或循环未运行时调用，其他线程用post转交。
+        int   addTimer(int interval, const TimerCallback & callback, err::Error * e = nullptr);
+
         bool  beginReceive(int channel, io::MutableBuffer & buffer, err::Error *e = nullptr);
 
         void  exitLoop();
 
+        bool  cancelTimer(int timer);
         bool  closeChannel(int fd, err::Error * e = nullptr);
         bool  closeListener(int fd, err::Error * e = nullptr);
 
+        /// 监视描述字(如eventfd)的可读事件，可读时在循环线程回调，回调中应读空描述字。
+        /// 事件循环使用fd的副本，调用方可以随时关闭原描述字。返回监视ID，失败返回-1。
+        int   addWatcher(int fd, const WatcherCallback & callback, err::Error * e = nullptr);
+
+        /// 删除监视，之后不再回调，副本在下一次处理请求时关闭
+        void  removeWatcher(int watcher);
+
         bool  send(int channel, io::ConstBuffer & buffer, err::Error * e = nullptr);
+
+        /// \brief 设置是否合并发送，默认关闭。
+        ///
+        ///     开启后，一次循环迭代中对同一连接发起的send先放入发送队列，在迭代结束、进入等待之前
+        ///     用一次集中写(writev)发送，未发完的部分由可写事件继续集中写。
+        ///     响应最多延迟到本次迭代结束，流水线请求的多个响应合并为一次系统调用。
+        void  setCorked(bool corked);
+
+        /// \brief 设置连接的接收方式，默认收满buffer.limit()才回调。
+        ///
+        ///     partial为true时，每次可读事件读完当前可读的数据后即回调，buffer.size()为已收到的长度，
+        ///     适用于RESP等没有固定长度报文头的协议。回调中应取走数据并重置缓存。
+        bool  setPartialReceive(int channel, bool partial, err::Error * e = nullptr);
         
         void  setIdleInterval(int interval); 
         void  setServerCallback(const ServerCallback & callback);
@@ -136,7 +168,13 @@ namespace nio
         bool  shutdownChannel(int fd, int how, err::Error * e = nullptr);
 
         bool  run(err::Error * e);
+
+        /// 唤醒阻塞在select等待中的事件循环，可在任意线程调用。
         bool  wakeup();
+
+        /// 投递回调到事件循环线程执行，可在任意线程调用。
+        /// 两次循环迭代之间投递的所有回调合并为一次唤醒，并在下一次迭代中按投递顺序批量执行。
+        void  post(const PostedCallback & callback);
     }; // end class SimpleSocketServer
 
 } // end namespace nio
@@ -174,6 +212,11 @@ namespace nio
         bool open(const net::Address & remote, int timeout, err::Error * e = nullptr);
         bool close(err::Error * e = nullptr);
 
+        /// 接管已连接的描述字，当前不能有打开的连接
+        void attach(int fd) { assert( m_sock.fd() == -1 ); m_sock = net::Socket(fd); m_shutFlags = 0; }
+        /// 放弃描述字的所有权并返回，不关闭连接
+        int  detach() { int fd = m_sock.fd(); m_sock = net::Socket(); return fd; }
+
         /// 执行一次recv操作，无论是否收到数据。收到的数据写入队列缓存。
         int  receive(err::Error * e = nullptr);
 
@@ -186,6 +229,10 @@ namespace nio
         /// 对当前发送队列缓存执行一次send操作，无论是否有数据发送出去都将返回。
         int  send(err::Error * e = nullptr);
 
+        /// 对发送队列中的多个缓存执行一次集中写，返回发送的字节数，0表示输出缓存已满，-1表示失败。
+        /// 调用方根据返回值推进各缓存的position。
+        int  sendv(err::Error * e = nullptr);
+
         /// 执行一次或多次send操作，直到limit大小的数据被发送，或者超时，才返回。
         int  sendN(io::ConstBuffer & buffer, int timeout, err::Error *e = nullptr);
 
@@ -218,14 +265,51 @@ namespace nio
     class SocketListener : public IoBase {
     private:
         net::Socket m_sock;
+        std::string m_path;    ///< UNIX域监听的文件路径，关闭时删除
     public:
         SocketListener() : IoBase( EnumIoType::ioSocketListener ) {}
-        ~SocketListener() { if ( m_sock.fd() >= 0 ) m_sock.close();}
+        ~SocketListener() { 
+            if ( m_sock.fd() >= 0 ) m_sock.close();
+            if ( !m_path.empty() ) ::unlink(m_path.c_str());
+        }
         int fd() const { return m_sock.fd(); }
         bool open(const net::Address & localAddr, err::Error * e= nullptr);
         int acceptFd(net::Address * remote, err::Error * e); 
     }; // end class SocketListener
 
+    /// 基于eventfd的事件通知器，用于跨线程唤醒事件循环。
+    class EventNotifier : public IoBase {
+    private:
+        int m_fd { -1 };
+    public:
+        EventNotifier() : IoBase(EnumIoType::ioEventNotifier) {
+            m_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            assert( m_fd >= 0 );
+        }
+        ~EventNotifier() { if ( m_fd >= 0 ) ::close(m_fd); }
+
+        int  fd() const { return m_fd; }
+        bool notify(err::Error * e = nullptr);
+
+        /// 读取并清除通知计数
+        void reset();
+    }; // end class EventNotifier
+
+    /// 只关心可读事件的描述字，如其他进程写入的eventfd门铃。持有描述字的副本，析构时关闭。
+    class FdWatcher : public IoBase {
+    private:
+        int m_fd { -1 };
+    public:
+        SimpleSocketServer::WatcherCallback callback;   ///< 为空表示已删除
+
+        FdWatcher(int fd, const SimpleSocketServer::WatcherCallback & cb)
+            : IoBase(EnumIoType::ioFdWatcher), m_fd(fd), callback(cb) {}
+        ~FdWatcher() { if ( m_fd >= 0 ) ::close(m_fd); }
+        SYM_NONCOPYABLE(FdWatcher)
+
+        int  fd() const { return m_fd; }
+    }; // end class FdWatcher
+
     class SimpleSocketServer::ImplClass {
     public:
         struct ListenerEntry {
@@ -237,32 +321,70 @@ namespace nio
             RecvCallback    recvCb;
             SendCallback    sendCb;
             CloseCallback   closeCb;
+            bool            corked;    ///< 已加入本次迭代的合并发送列表
+            bool            partial;   ///< 读到数据即回调，不必收满缓存
         };
 
         using ChannelMap  = std::unordered_map<int, ChannelEntry>;
         using ListenerMap = std::unordered_map<int, ListenerEntry>;
+        using WatcherMap  = std::unordered_map<int, std::unique_ptr<FdWatcher> >;
 
         using Request = std::function<void ()>;
 
+        struct TimerEntry {
+            int64_t       interval;   ///< 微秒
+            int64_t       expire;     ///< 到期时间，单调时钟的微秒，不受系统时间调整影响
+            TimerCallback callback;
+        };
+        using TimerMap   = std::unordered_map<int, TimerEntry>;
+        using TimerQueue = std::priority_queue<std::pair<int64_t, int>, 
+                                std::vector<std::pair<int64_t, int> >, 
+                                std::greater<std::pair<int64_t, int> > >;
+
     public:
         Selector       m_selector;
         ListenerMap    m_listenerMap;
         ChannelMap     m_channelMap;
+        WatcherMap     m_watcherMap;
         int            m_idleInterval {-1};
+        int64_t        m_lastActive { 0 };    ///< 最后一次处理IO事件的时间，用于判断空闲，单调时钟
+        TimerMap       m_timers;
+        TimerQueue     m_timerQueue;          ///< 按到期时间排序，取消的定时器出队时跳过
+        int            m_timerSeq { 0 };
         int            m_exitloop { false };
         ServerCallback m_serverCb;
         std::queue<Request> m_requestQueue;
 
+        EventNotifier               m_notifier;
+        mt::mutex_t                 m_postMutex;
+        std::vector<PostedCallback> m_postQueue;   ///< 其他线程投递的回调，m_postMutex保护
+        std::vector<PostedCallback> m_postBatch;   ///< 本次迭代待执行的回调，仅循环线程访问
+
+        bool             m_corked { false };
+        std::vector<int> m_corkedChannels;         ///< 本次迭代有待发送数据的连接
+        std::vector<int> m_flushBatch;
+
     public:
-        ImplClass()   {}
-        ~ImplClass()  {}
+        ImplClass()   { mt::mutex_init(&m_postMutex); }
+        ~ImplClass()  { mt::mutex_free(&m_postMutex); }
 
         SocketChannel * getChannel(int fd);
 
         void onListenerEvent(Selector::Event * event);
         void onChannelEvent(Selector::Event * event);
+        void onNotifierEvent(Selector::Event * event);
+        void onWatcherEvent(Selector::Event * event);
         void onServerIdle();
 
+        /// 执行所有到期的定时器回调
+        void onTimers(int64_t now);
+
+        /// 计算本次select等待的超时时间，毫秒，-1表示不超时
+        int  waitTimeout(int64_t now) const;
+
+        /// 合并发送本次迭代中各连接排队的数据
+        void flushCorked();
+
         bool pushShutdownRequest(int channel, int how);
         bool pushChannelCloseRequest(int channel);
 
@@ -275,6 +397,7 @@ namespace nio
 
     private:
         void onChannelWritable(ChannelEntry & entry);
+        void sendQueued(ChannelEntry & entry);
         void onChannelReadable(ChannelEntry & entry);
         void onChannelError(ChannelEntry & entry);
     }; // end classs SimpleSocketServer::ImplClass
@@ -355,6 +478,7 @@ namespace nio
         Event & event = it->second;
         
         int sevents = event.sevents() | events;
+        if ( sevents == event.sevents() ) return true;   // 监听事件未变化，省去epoll_ctl
 
         struct epoll_event evt;
         evt.data.fd = fd;
@@ -381,6 +505,7 @@ namespace nio
         Event & event = it->second;
         
         int sevents = event.sevents() &  (~events);
+        if ( sevents == event.sevents() ) return true;
 
         struct epoll_event evt;
         evt.data.fd = fd;
@@ -542,7 +667,7 @@ namespace nio
 
         do {
             e1.clear();
-            int n = m_sock.receive(ptr + total, remain - total, e);  // 收一次
+            int n = m_sock.receive(ptr + total, remain, e);  // 收一次
             if ( n > 0 ) {
                 total += n;
                 remain -= n;
@@ -587,8 +712,10 @@ namespace nio
         }
         auto & buffer = m_outputBuffers.front();
         int remain = buffer.limit() - buffer.position();
-        
-        int n = m_sock.send(buffer.data() + buffer.position(), remain, e);
+
+        // 队列中还有后续缓存时(如分段发送的同一报文)，提示内核等待后续数据合并发送
+        int flags = m_outputBuffers.size() > 1 ? MSG_MORE : 0;
+        int n = m_sock.send(buffer.data() + buffer.position(), remain, e, flags);
         if ( n > 0 ) {
             buffer.position( buffer.position() + n );
             remain = buffer.limit() - buffer.position();
@@ -601,6 +728,20 @@ namespace nio
         }
     }
     
+    inline
+    int SocketChannel::sendv(err::Error * e)
+    {
+        struct iovec iov[64];
+        int count = 0;
+        for ( auto it = m_outputBuffers.begin(); it != m_outputBuffers.end() && count < 64; ++it ) {
+            iov[count].iov_base = (void *)(it->data() + it->position());
+            iov[count].iov_len  = it->limit() - it->position();
+            ++count;
+        }
+        if ( count == 0 ) return 0;
+        return m_sock.sendv(iov, count, e);
+    }
+
     inline
     int SocketChannel::sendSome(io::ConstBuffer & buffer, int timeout, err::Error * e)
     {
@@ -649,7 +790,7 @@ namespace nio
 
         do {
             e1.clear();
-            int n = m_sock.send(ptr + total, remain - total, e);  // 发一次
+            int n = m_sock.send(ptr + total, remain, e);  // 发一次
             if ( n > 0 ) {
                 total += n;
                 remain -= n;
@@ -709,6 +850,7 @@ namespace nio
         isok = m_sock.connect(remote, e);
         if (!isok ) {
             m_sock.close();
+            m_sock = net::Socket();
             return false;
         }
 
@@ -718,6 +860,7 @@ namespace nio
         } else {
             // wait error
             m_sock.close();
+            m_sock = net::Socket();
             return false;
         }
     }
@@ -729,7 +872,21 @@ namespace nio
         isok = m_sock.create(localAddr.af(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, e);
         if ( !isok ) return false;
 
-        net::SocketOptReuseAddr soReuseAddr(m_sock, true);
+        std::string path = localAddr.path();
+        if ( localAddr.isUnix() ) {
+            // 上次进程异常退出残留的socket文件会导致bind失败，确认没有进程在监听后删除
+            if ( !path.empty() && path[0] != '@' ) {
+                net::Socket probe;
+                if ( probe.create(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC) ) {
+                    if ( ::connect(probe.fd(), localAddr.data(), localAddr.size()) == -1 && errno == ECONNREFUSED ) {
+                        ::unlink(path.c_str());
+                    }
+                    probe.close();
+                }
+            }
+        } else {
+            net::SocketOptReuseAddr soReuseAddr(m_sock, true);
+        }
 
         isok = m_sock.bind(localAddr, e);
         if ( !isok ) {
@@ -740,9 +897,11 @@ namespace nio
         isok = m_sock.listen(e);
         if ( !isok ) {
             m_sock.close();
+            if ( localAddr.isUnix() && path[0] != '@' ) ::unlink(path.c_str());
             return false;
         }
 
+        if ( localAddr.isUnix() && path[0] != '@' ) m_path = path;
         return true;
     }
 
@@ -773,6 +932,7 @@ namespace nio
         };
 
         m_requestQueue.push(request);
+        return true;
     }
 
     inline 
@@ -799,6 +959,7 @@ namespace nio
             }
         };
         m_requestQueue.push(request);
+        return true;
     }
 
     inline 
@@ -826,6 +987,7 @@ namespace nio
         ssize_t recvSize = 0;
 
         // 循环接收，直到没有数据可收
+        bool called = false;
         while ( ( recvSize = channel->receive() ) > 0 ) {
             io::MutableBuffer * buf = channel->peekInputBuffer();
             SYM_TRACE_VA("[trace] ON_READABLE, received: %d, limit: %d, size: %d", 
@@ -833,15 +995,28 @@ namespace nio
             if ( buf->size() == buf->limit() ) {
                 entry.recvCb(channel->fd(), statusOk, *buf);
                 if (buf->data() == nullptr ) channel->popInputBuffer();  // 接收缓存被清空，则删除队列缓存，不再监听接收任务
+                called = true;
                 break;  // 回调执行后不再继续读，因为如果收到的数据异常，再回调中channel已经被执行close操作。
             }
         } // end while
 
+        // 部分接收模式下，已读完当前可读数据但未收满缓存，也回调一次；连接出错前收到的数据同样先交给回调
+        if ( recvSize <= 0 && !called && entry.partial ) {
+            io::MutableBuffer * buf = channel->peekInputBuffer();
+            if ( buf && buf->size() > 0 ) {
+                entry.recvCb(channel->fd(), statusOk, *buf);
+                if ( buf->data() == nullptr ) channel->popInputBuffer();
+            }
+        }
+
         // 接收失败，回调
         if ( recvSize < 0 )  {
             SYM_TRACE_VA("[error] ON_READABLE_ERROR, received: %d", (recvSize));
-            entry.recvCb(channel->fd(), statusError, *channel->peekInputBuffer());
-            channel->popInputBuffer();
+            io::MutableBuffer * buf = channel->peekInputBuffer();
+            if ( buf ) {
+                entry.recvCb(channel->fd(), statusError, *buf);
+                channel->popInputBuffer();
+            }
             m_selector.cancel(channel->fd(), selectRead);
         } else {
             // 接收成功，所有接收任务都完成，没有继续接收的需求，就取消读事件监听
@@ -852,6 +1027,11 @@ namespace nio
     inline 
     void SimpleSocketServer::ImplClass::onChannelWritable(ChannelEntry & entry)
     {
+        if ( m_corked ) {
+            this->sendQueued(entry);
+            return;
+        }
+
         SocketChannel * channel = entry.channel;
         ssize_t n = channel->send();
         io::ConstBuffer * buf = channel->peekOutputBuffer();
@@ -877,6 +1057,57 @@ namespace nio
         }
     }
 
+    inline 
+    void SimpleSocketServer::ImplClass::sendQueued(ChannelEntry & entry)
+    {
+        SocketChannel * channel = entry.channel;
+        int fd = channel->fd();
+        int n  = channel->sendv();
+
+        if ( n >= 0 ) {
+            // 按发送的字节数依次推进各缓存，发送完成的缓存执行回调并出队
+            size_t sent = n;
+            io::ConstBuffer * buf;
+            while ( (buf = channel->peekOutputBuffer()) ) {
+                size_t remain = buf->limit() - buf->position();
+                if ( sent < remain ) {
+                    buf->position(buf->position() + sent);
+                    break;
+                }
+                sent -= remain;
+                buf->position(buf->limit());
+                entry.sendCb(fd, statusOk, *buf);
+                channel->popOutputBuffer();
+            }
+        } else {
+            // 发送失败，与非合并模式相同，只回调当前缓存，其余缓存在shutdownWrite时逐个返回
+            io::ConstBuffer * buf = channel->peekOutputBuffer();
+            entry.sendCb(fd, statusError, *buf);
+            channel->popOutputBuffer();
+        }
+
+        // 还有未发完的数据时由可写事件继续发送
+        if ( channel->peekOutputBuffer() ) {
+            m_selector.set(fd, selectWrite);
+        } else {
+            m_selector.cancel(fd, selectWrite);
+        }
+    }
+
+    inline 
+    void SimpleSocketServer::ImplClass::flushCorked()
+    {
+        // 回调中可能再次发送，先取出本次的列表
+        m_flushBatch.swap(m_corkedChannels);
+        for ( auto it = m_flushBatch.begin(); it != m_flushBatch.end(); ++it ) {
+            auto itEntry = m_channelMap.find(*it);
+            if ( itEntry == m_channelMap.end() ) continue;   // 已关闭
+            itEntry->second.corked = false;
+            if ( itEntry->second.channel->peekOutputBuffer() ) this->sendQueued(itEntry->second);
+        }
+        m_flushBatch.clear();
+    }
+
     inline 
     void SimpleSocketServer::ImplClass::onChannelEvent(Selector::Event * event)
     {
@@ -926,12 +1157,95 @@ namespace nio
         } // end if 
     } 
 
+    inline 
+    bool EventNotifier::notify(err::Error * e)
+    {
+        uint64_t n = 1;
+        ssize_t  r = ::write(m_fd, &n, sizeof(n));
+        if ( r == sizeof(n) || errno == EAGAIN ) return true;  // 计数溢出时循环必然尚未处理通知，无需再写
+        if ( e ) *e = err::Error(errno, err::dmSystem);
+        return false;
+    }
+
+    inline 
+    void EventNotifier::reset()
+    {
+        uint64_t n;
+        ssize_t  r = ::read(m_fd, &n, sizeof(n));
+        (void)r;
+    }
+
+    inline 
+    void SimpleSocketServer::ImplClass::onNotifierEvent(Selector::Event * event)
+    {
+        m_notifier.reset();
+
+        // 一次性取出所有投递的回调，锁外执行，回调中可以再次投递
+        mt::mutex_lock(&m_postMutex);
+        m_postBatch.swap(m_postQueue);
+        mt::mutex_unlock(&m_postMutex);
+
+        for ( auto it = m_postBatch.begin(); it != m_postBatch.end(); ++it ) (*it)();
+        m_postBatch.clear();
+    }
+
+    inline 
+    void SimpleSocketServer::ImplClass::onWatcherEvent(Selector::Event * event)
+    {
+        // 已删除的监视在本次迭代结束后才从selector移除，期间的事件忽略
+        FdWatcher * watcher = (FdWatcher *)event->data();
+        if ( watcher->callback ) watcher->callback(watcher->fd());
+    }
+
     inline 
     void SimpleSocketServer::ImplClass::onServerIdle()
     {
         if ( m_serverCb ) m_serverCb(statusIdle);
     }
 
+    inline 
+    void SimpleSocketServer::ImplClass::onTimers(int64_t now)
+    {
+        while ( !m_timerQueue.empty() && m_timerQueue.top().first <= now ) {
+            int timer = m_timerQueue.top().second;
+            int64_t expire = m_timerQueue.top().first;
+            m_timerQueue.pop();
+
+            auto it = m_timers.find(timer);
+            if ( it == m_timers.end() || it->second.expire != expire ) continue;   // 已取消
+
+            // 回调中可能增删定时器，先复制回调对象
+            TimerCallback callback = it->second.callback;
+            bool again = callback(timer);
+
+            it = m_timers.find(timer);
+            if ( it == m_timers.end() ) continue;   // 回调中取消
+            if ( again ) {
+                it->second.expire = now + it->second.interval;
+                m_timerQueue.push(std::make_pair(it->second.expire, timer));
+            } else {
+                m_timers.erase(it);
+            }
+        }
+    }
+
+    inline 
+    int SimpleSocketServer::ImplClass::waitTimeout(int64_t now) const
+    {
+        int64_t timeout = -1;
+        if ( m_idleInterval >= 0 ) {
+            timeout = m_lastActive + m_idleInterval * 1000LL - now;
+            if ( timeout < 0 ) timeout = 0;
+        }
+        if ( !m_timerQueue.empty() ) {
+            int64_t t = m_timerQueue.top().first - now;
+            if ( t < 0 ) t = 0;
+            if ( timeout < 0 || t < timeout ) timeout = t;
+        }
+        // 微秒向上取整为毫秒，避免定时器未到期时提前醒来空转
+        return timeout < 0 ? -1 : (int)((timeout + 999) / 1000);
+    }
+
     inline 
     SocketChannel * SimpleSocketServer::ImplClass::getChannel(int fd)
     {
@@ -948,6 +1262,9 @@ namespace nio
     SimpleSocketServer::SimpleSocketServer() 
         : m_impl(new ImplClass)
     {
+        EventNotifier * notifier = &m_impl->m_notifier;
+        bool isok = m_impl->m_selector.add(notifier->fd(), selectRead, notifier);
+        assert( isok );
     }
 
     inline 
@@ -973,17 +1290,40 @@ namespace nio
 
         auto it = m_impl->m_channelMap.find(fd);
         assert ( it == m_impl->m_channelMap.end() );
-        ImplClass::ChannelEntry entry { ptrChannel.release(), rcb, scb, ccb};
+        ImplClass::ChannelEntry entry { ptrChannel.release(), rcb, scb, ccb, false, false };
         m_impl->m_channelMap[fd] = entry;
         return fd;
     }
 
+    inline 
+    int SimpleSocketServer::addTimer(int interval, const TimerCallback & cb, err::Error * e)
+    {
+        if ( interval < 0 ) {
+            if ( e ) *e = err::Error(-1, "negative timer interval");
+            return -1;
+        }
+        int timer = ++m_impl->m_timerSeq;
+        ImplClass::TimerEntry entry;
+        entry.interval = interval * 1000LL;
+        entry.expire   = chrono::steady_now() + entry.interval;
+        entry.callback = cb;
+        m_impl->m_timers[timer] = entry;
+        m_impl->m_timerQueue.push(std::make_pair(entry.expire, timer));
+        return timer;
+    }
+
+    inline 
+    bool SimpleSocketServer::cancelTimer(int timer)
+    {
+        return m_impl->m_timers.erase(timer) > 0;
+    }
+
     inline 
     int SimpleSocketServer::addListener(const net::Address & localAddr, const ListenerCallback & cb, err::Error * e)
     {
         std::unique_ptr<SocketListener> ptrListener(new SocketListener());
         bool isok = ptrListener->open(localAddr, e);
-        if ( !isok ) return false;
+        if ( !isok ) return -1;
 
         // 监听成功, 注册到Selector，然后放入表中，最后返回监听器描述字表示当前监听器的ID。
         //
@@ -1016,6 +1356,35 @@ namespace nio
         return true;
     }
 
+    inline
+    int SimpleSocketServer::addWatcher(int fd, const WatcherCallback & callback, err::Error * e)
+    {
+        int dupfd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if ( dupfd < 0 ) {
+            if ( e ) *e = err::Error(errno, err::dmSystem);
+            return -1;
+        }
+        std::unique_ptr<FdWatcher> ptrWatcher(new FdWatcher(dupfd, callback));
+        if ( !m_impl->m_selector.add(dupfd, selectRead, ptrWatcher.get(), e) ) return -1;
+        m_impl->m_watcherMap[dupfd] = std::move(ptrWatcher);
+        return dupfd;
+    }
+
+    inline
+    void SimpleSocketServer::removeWatcher(int watcher)
+    {
+        auto it = m_impl->m_watcherMap.find(watcher);
+        if ( it == m_impl->m_watcherMap.end() || !it->second->callback ) return;
+        it->second->callback = nullptr;
+
+        // 可能在事件分派中调用，本次迭代的事件列表仍引用该对象，移除推迟到请求处理时执行
+        ImplClass * impl = m_impl;
+        impl->m_requestQueue.push([impl, watcher]() {
+            impl->m_selector.remove(watcher);
+            impl->m_watcherMap.erase(watcher);
+        });
+    }
+
     inline 
     void SimpleSocketServer::exitLoop() {
         m_impl->m_exitloop = true;
@@ -1027,6 +1396,12 @@ namespace nio
         m_impl->m_idleInterval = sec * 1000;
     }
 
+    inline
+    void SimpleSocketServer::setCorked(bool corked)
+    {
+        m_impl->m_corked = corked;
+    }
+
     inline
     void SimpleSocketServer::setServerCallback(const ServerCallback & cb)
     {
@@ -1037,6 +1412,7 @@ namespace nio
     bool SimpleSocketServer::run(err::Error * e)
     {
         m_impl->m_exitloop = false;
+        m_impl->m_lastActive = chrono::steady_now();
         while ( !m_impl->m_exitloop ) {
             // 执行异步请求
             while ( m_impl->hasRequest() ) {
@@ -1044,8 +1420,15 @@ namespace nio
                 request();
             }
 
-            int r = m_impl->m_selector.wait(m_impl->m_idleInterval, e);
+            // 合并模式下，上一次迭代排队的数据在进入等待前发送
+            if ( !m_impl->m_corkedChannels.empty() ) m_impl->flushCorked();
+
+            int r = m_impl->m_selector.wait(m_impl->waitTimeout(chrono::steady_now()), e);
+            int64_t now = chrono::steady_now();
+            m_impl->onTimers(now);
+
             if ( r > 0 ) {
+                m_impl->m_lastActive = now;
                 for ( int i = 0; i < r; ++i ) {
                     Selector::Event * event = m_impl->m_selector.revents(i);
                     IoBase * base = (IoBase*)event->data();
@@ -1053,13 +1436,21 @@ namespace nio
                         m_impl->onChannelEvent(event);
                     } else if ( base->type() == EnumIoType::ioSocketListener) {
                         m_impl->onListenerEvent(event);
+                    } else if ( base->type() == EnumIoType::ioEventNotifier) {
+                        m_impl->onNotifierEvent(event);
+                    } else if ( base->type() == EnumIoType::ioFdWatcher) {
+                        m_impl->onWatcherEvent(event);
                     } else {
                         assert("unknown io type" == nullptr);
                     }
                 } // end for
             }
             else if ( r == 0 ) {
-                m_impl->onServerIdle();
+                // 超时可能是定时器到期，只有空闲时长达到设置的间隔才回调空闲
+                if ( m_impl->m_idleInterval >= 0 && now - m_impl->m_lastActive >= m_impl->m_idleInterval * 1000LL ) {
+                    m_impl->m_lastActive = now;
+                    m_impl->onServerIdle();
+                }
                 continue;
             }
             else {
@@ -1085,10 +1476,49 @@ namespace nio
         ImplClass::ChannelEntry & entry = it->second;
         entry.channel->pushOutputBuffer(buffer);
 
+        if ( m_impl->m_corked ) {
+            // 合并模式下在本次迭代结束时统一发送
+            if ( !entry.corked ) {
+                entry.corked = true;
+                m_impl->m_corkedChannels.push_back(channel);
+            }
+            return true;
+        }
+
         bool isok = m_impl->m_selector.set(channel, selectWrite, e);
         return isok;
     }
 
+    inline 
+    bool SimpleSocketServer::setPartialReceive(int channel, bool partial, err::Error * e)
+    {
+        auto it = m_impl->m_channelMap.find(channel);
+        if ( it == m_impl->m_channelMap.end()) {
+            if ( e ) *e = err::Error(-1, "channel id not exists");
+            return false;
+        }
+        it->second.partial = partial;
+        return true;
+    }
+
+    inline 
+    bool SimpleSocketServer::wakeup()
+    {
+        return m_impl->m_notifier.notify();
+    }
+
+    inline 
+    void SimpleSocketServer::post(const PostedCallback & callback)
+    {
+        mt::mutex_lock(&m_impl->m_postMutex);
+        bool first = m_impl->m_postQueue.empty();
+        m_impl->m_postQueue.push_back(callback);
+        mt::mutex_unlock(&m_impl->m_postMutex);
+
+        // 队列由空变为非空时才需要唤醒，后续投递随同一次唤醒批量处理
+        if ( first ) this->wakeup();
+    }
+
     inline
     bool SimpleSocketServer::shutdownChannel(int channel, int how, err::Error * e)
     {
@@ -1,10 +1,19 @@
 #pragma once 
 
+#include <assert.h>
 #include <memory.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
 #include <vector>
 #include <functional>
+#include <type_traits>
 #include <sym/error.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 # include <sym/symdef.h>
 
 BEGIN_SYM_NAMESPACE 
@@ -19,9 +28,15 @@ namespace redis
             vtStatus,
             vtString,
             vtInteger,
-            vtList
+            vtList,
+            vtMap,          ///< RESP3映射，list()中键和值交替存放
+            vtSet,          ///< RESP3集合
+            vtPush          ///< RESP3推送消息，不是任何命令的回复
         };
 
+        /// 是否为包含元素的聚合类型，元素在list()中
+        static bool isAggregate(int type) { return type >= vtList; }
+
         using ValueList = std::vector<Value>;
     private:
         int         m_type { vtNull };
@@ -44,7 +59,7 @@ namespace redis
 
         void setType(int type) { m_type = type; } 
 
-        void setNull() { m_type == vtNull; }
+        void setNull() { m_type = vtNull; }
 
         void setString(const char * data, int len) {
             m_type = vtString;
@@ -65,87 +80,573 @@ namespace redis
         void reset() {
             m_type = vtNull;
             m_str.clear();
+            m_list.clear();
             m_status = true;
         }
     }; // end class Value
 
+    class ValueRef;
+
+    /**
+     * @brief 零拷贝的回复。
+     *
+     * 全部元素存放在一个连续的节点数组中，数组元素占用相邻的节点，字符串只记录在接收缓存中的位置，
+     * 解析一个回复不再为每个元素分配内存，clear一次释放全部元素，节点数组的空间留给下一个回复复用。
+     * 字符串指向Reader的接收缓存，在下一次向Reader写入数据(feed/prepare)之前有效，
+     * 需要长期保存时用ValueRef::toValue或getString复制。
+     */
+    class Reply
+    {
+        friend class Reader;
+        friend class ValueRef;
+
+    private:
+        struct Node {
+            int     type;       ///< Value::vtXXX
+            bool    status;
+            int64_t n;          ///< 整数值，字符串长度，或数组元素个数
+            size_t  off;        ///< 字符串相对m_base的位置，或数组首元素的节点下标
+        };
+
+        std::vector<Node> m_nodes;
+        const char *      m_base { nullptr };
+
+    public:
+        bool     empty() const { return m_nodes.empty(); }
+        void     clear()       { m_nodes.clear(); m_base = nullptr; }
+
+        /// 回复的根元素，回复为空时不可用
+        ValueRef root() const;
+
+        /// 全部元素的个数，包括嵌套数组中的元素
+        size_t   nodes() const { return m_nodes.size(); }
+    }; // end class Reply
+
+    /// Reply中一个元素的引用，只在所属Reply不变时有效
+    class ValueRef
+    {
+    private:
+        const Reply * m_reply;
+        size_t        m_index;
+
+        const Reply::Node & node() const { return m_reply->m_nodes[m_index]; }
+
+    public:
+        ValueRef(const Reply * reply, size_t index) : m_reply(reply), m_index(index) {}
+
+        int          type()   const { return node().type; }
+        bool         status() const { return node().status; }
+        int64_t      getInt() const { return node().n; }
+
+        /// 字符串或状态信息，不以'\0'结尾
+        const char * data()   const { return m_reply->m_base + node().off; }
+        size_t       length() const { return (size_t)node().n; }
+        std::string  getString() const { return std::string(data(), length()); }
+
+        /// 数组元素个数，映射为键和值的总数，非聚合类型为0
+        size_t       size()   const { return Value::isAggregate(node().type) ? (size_t)node().n : 0; }
+        ValueRef     operator[](size_t i) const { return ValueRef(m_reply, node().off + i); }
+
+        /// 复制为独立的Value，嵌套结构逐层展开，不会因嵌套过深而递归溢出
+        void         toValue(Value * value) const;
+    }; // end class ValueRef
+
+    /// 查找[p, end)中第一个'\n'，没有时返回nullptr。短行用SSE2一次比较16字节，长行在支持AVX2时每次32字节
+    const char * find_newline(const char * p, const char * end);
+
     using SendHandler = std::function<int (const char * cmd, int len, int timeout, err::Error * e)>;
     using RecvHandler = std::function<int (char * buf, int len, int timeout, err::Error *e)>;
 
-    class ValueDecoder
+    /// RESP3推送消息的回调，value可被移走
+    using PushHandler = std::function<void (Value & value)>;
+
+    /// 流式接收字符串的回调，每次交出一段数据，返回false中止接收
+    using ChunkSink = std::function<bool (const char * data, size_t len)>;
+
+    /**
+     * @brief 增量RESP解码器，不做任何I/O，可在事件循环中使用。
+     *
+     * 收到的数据通过feed(或prepare/commit直接写入内部缓存)交给解码器，next每次取出一个完整的回复，
+     * 数据不足时返回needMore并保留嵌套数组的解析状态，下次从中断处继续。
+     * 每个字节只扫描一次，解析耗时与输入长度成线性关系，与数组嵌套深度无关。
+     * 协议错误后解码器状态不再可用，需要reset并关闭连接。
+     * 数组的元素节点在收到长度行时一次预留，一个回复的元素总数超过setMaxElements的上限时报错，
+     * 避免对端的一个长度行就让解码器分配大量内存。
+     *
+     * 同时支持RESP3(HELLO 3)的类型：映射、集合和推送消息解码为vtMap、vtSet和vtPush；
+     * 空值'_'为vtNull，布尔值'#'为0/1的vtInteger，浮点数','和大整数'('保留文本为vtString，
+     * 二进制错误'!'为失败的vtStatus，verbatim字符串'='去掉格式前缀后为vtString。不支持属性'|'和流式字符串。
+     */
+    class Reader
     {
-    private:
-        static const int stateInit   = 0;
-        static const int stateFinish = 1;
-        static const int stateArray  = 2;
+    public:
+        static const int needMore = 0;
+        static const int complete = 1;
+        static const int failed   = -1;
+        static const int notBulk  = 2;
+
+        /// 一个回复默认最多包含的元素数，包括嵌套数组中的元素，映射的键和值各算一个
+        static const size_t defaultMaxElements = 1 << 24;
 
-        struct ValueItem {
-            int type;
+    private:
+        /// 未接收完的数组
+        struct Frame {
+            size_t  next;       ///< 下一个元素的节点下标
+            int64_t remain;     ///< 还差的元素个数
         };
 
+        std::vector<char>  m_buf;
+        size_t             m_start { 0 };   ///< 当前回复的起始位置，回复完成前其数据不会被移走
+        size_t             m_pos  { 0 };    ///< 下一个待解析元素的起始位置
+        size_t             m_len  { 0 };    ///< 缓存中有效数据长度
+        size_t             m_scan { 0 };    ///< 行结束符的查找起点，避免数据不足时重复扫描
+        size_t             m_maxElements { defaultMaxElements };
+        std::vector<Frame> m_stack;
+        Reply              m_reply;         ///< 解析中的回复，完成后交换给调用者
+        Reply              m_scratch;       ///< next(Value *)使用的临时回复
+
+    public:
+        /// 追加收到的数据
+        void   feed(const char * data, size_t size);
+
+        /// 预留至少size字节的写入空间，返回写入位置，*avail为可写长度。写入后调用commit。
+        char * prepare(size_t size, size_t * avail);
+        void   commit(size_t size) { m_len += size; }
+
+        /// 取出下一个完整的回复，返回complete、needMore或failed
+        int    next(Value * value, err::Error * e = nullptr);
+
+        /// 零拷贝地取出下一个完整的回复，reply原有的节点空间被复用。字符串在下一次feed/prepare前有效。
+        int    next(Reply * reply, err::Error * e = nullptr);
+
+        /// 已收到未解析的字节数
+        size_t buffered() const { return m_len - m_pos; }
+
+        void   reset() { m_start = m_pos = m_len = m_scan = 0; m_stack.clear(); m_reply.clear(); }
+
+        /// 设置一个回复最多包含的元素数，超出时next返回failed，错误为"array too long"。不超过INT32_MAX
+        void   setMaxElements(size_t n) { m_maxElements = std::min(n, (size_t)INT32_MAX); }
+
+        /**
+         * 流式接收字符串，只能在两个回复之间使用。下一个回复是字符串时解析并跳过长度行，*length为字符串长度，
+         * 空值为-1，返回complete；不是字符串时返回notBulk，用next解析。之后用peek/consume取走已缓存的数据，
+         * 其余数据由调用者直接接收，全部取走后调用endBulk跳过结尾的CRLF。
+         */
+        int    nextBulk(int64_t * length, err::Error * e = nullptr);
+        const char * peek(size_t * avail) const { *avail = m_len - m_pos; return m_buf.data() + m_pos; }
+        void   consume(size_t n) { m_pos += n; m_start = m_scan = m_pos; }
+        int    endBulk(err::Error * e = nullptr);
+
+    private:
+        /// 长度或整数行的类型字符
+        static bool isNumberType(char type);
+
+        /// 解析p开始的十进制数和行尾的CRLF，*cr为'\r'的位置。返回1成功，0数据不足，-1格式错误或超出int64_t
+        static int  scanNumber(const char * p, const char * end, int64_t * n, const char ** cr);
+    }; // end class Reader
+
+    /**
+     * @brief 通过阻塞的RecvHandler读取数据并解码的同步解码器，多收到的数据保留给下一次parse。
+     *
+     * 设置了PushHandler时，夹在回复之间的RESP3推送消息交给回调，parse只返回命令的回复。
+     */
+    class ValueDecoder
+    {
     private:
         RecvHandler            m_rh;
-        std::vector<char>      m_buf;
-        int                    m_len;   // m_buf中收到的有效数据总长
-        int                    m_pos;   // m_buf中当前解析位置
+        Reader                 m_reader;
+        PushHandler            m_push;
 
     public:
         ValueDecoder(RecvHandler rh) : m_rh(rh) {}
 
+        /// 解析一个回复，成功返回1，网络错误、超时或协议错误返回-1
         int  parse(Value * value, int timeout, err::Error *e = nullptr);
+
+        /// 零拷贝地解析一个回复，字符串在下一次parse或receiveData之前有效
+        int  parse(Reply * reply, int timeout, err::Error *e = nullptr);
+
+        /**
+         * 解析一个回复，是字符串时数据不经过解码缓存：已缓存的部分交给sink，其余每收到一段交给sink，
+         * 内存占用与字符串长度无关。*length为字符串长度；回复是空值或其他类型时解码到value，*length为-1。
+         * sink中止或出错返回-1，连接上的数据不再完整，需要关闭连接。
+         */
+        int  parse(Value * value, const ChunkSink & sink, int64_t * length, int timeout, err::Error *e = nullptr);
+
+        /// 同上，字符串直接接收到buf。*length为实际长度，大于size时只保存前size字节，其余数据被丢弃
+        int  parse(Value * value, char * buf, size_t size, int64_t * length, int timeout, err::Error *e = nullptr);
+
+        /// 接收一次数据，返回收到的字节数，0表示超时
         int  receiveData(int timeout, err::Error *e = nullptr);
 
+        /// 缓存中是否还有未解析的数据
+        bool pending() const { return m_reader.buffered() > 0; }
+
+        void setPushHandler(const PushHandler & handler) { m_push = handler; }
+
+        /// 不阻塞地处理已收到的推送消息，返回处理的个数，网络错误或收到推送以外的数据返回-1
+        int  dispatch(err::Error *e = nullptr);
+
     private:
-        int parseStatus(Value * value, int timeout, err::Error * e = nullptr);
-        int parseInteger(Value * value, int timeout, err::Error * e = nullptr);
-        int parseBulkStrings(Value * value, int timeout, err::Error * e = nullptr);
-        int parseArray(Value * value, int timeout, err::Error * e = nullptr);
+        int  parseBulk(Value * value, char * buf, size_t size, const ChunkSink * sink, int64_t * length, int timeout, err::Error * e);
     }; // end class ValueDecoder
 
+    /// 无符号整数的十进制表示写入p，返回长度，p至少有20字节
+    size_t format_uint(uint64_t n, char * p);
+
+    /// 整数的十进制表示写入p，返回长度，p至少有20字节
+    size_t format_int(int64_t n, char * p);
+
+    /**
+     * @brief 命令参数，引用字符串或二进制数据而不复制，整数直接格式化在对象内部。
+     *
+     * 只在构造它的表达式中使用，引用的数据需要在编码完成前有效。
+     */
+    class Arg
+    {
+    private:
+        const char * m_data { nullptr };    ///< 为空时数据在m_num中，复制后仍然有效
+        size_t       m_len  { 0 };
+        char         m_num[20];
+
+    public:
+        Arg(const char * str) : m_data(str ? str : ""), m_len(str ? strlen(str) : 0) {}
+        Arg(const char * data, size_t len) : m_data(data), m_len(len) {}
+        Arg(const std::string & str) : m_data(str.data()), m_len(str.length()) {}
+
+        template<class T, class = typename std::enable_if<std::is_integral<T>::value>::type>
+        Arg(T n) : m_len( std::is_signed<T>::value ? format_int((int64_t)n, m_num) : format_uint((uint64_t)n, m_num) ) {}
+
+        const char * data()   const { return m_data ? m_data : m_num; }
+        size_t       length() const { return m_len; }
+    }; // end class Arg
+
+    /// 把count个参数编码为RESP数组追加到out末尾，out的空间足够时不分配内存
+    void encode_command(const Arg * args, size_t count, std::vector<char> * out);
+
+    /// 把参数编码为RESP数组追加到out末尾，参数可以是字符串、std::string、整数或Arg
+    template<class... T>
+    void encode_args(std::vector<char> * out, const T &... args)
+    {
+        const Arg list[] = { Arg(args)... };
+        encode_command(list, sizeof...(T), out);
+    }
+
     class Command 
     {
     private:
         std::vector<char> m_buf;
-        std::vector<std::string> m_args;
+        std::vector<char> m_body;           ///< 已编码的参数，执行时加上数组头
+        size_t            m_argc { 0 };
         SendHandler       m_sh;
         RecvHandler       m_rh;
         int               m_timeout;
+        ValueDecoder      m_decoder;    ///< 连接上的接收缓存，多收到的数据保留给下一个命令
 
     public:
-        Command(SendHandler sh, RecvHandler rh) : m_sh(sh), m_rh(rh) {}
+        Command(SendHandler sh, RecvHandler rh) : m_sh(sh), m_rh(rh), m_decoder(rh) {}
 
         Command & operator<<(const char * str) { return this->append(str); }
+        Command & operator<<(const Arg & arg)  { return this->append(arg); }
 
         Command & assign(const char * str);
-        Command & append(const char * str);
+        Command & append(const char * str) { return this->append(Arg(str)); }
+        Command & append(const Arg & arg);
+
+        /// 重新设置全部参数，如assign("SET", key, 100)
+        template<class... T>
+        Command & assign(const Arg & first, const T &... args)
+        {
+            this->reset();
+            const Arg list[] = { first, Arg(args)... };
+            for ( size_t i = 0; i < sizeof...(T) + 1; ++i ) this->append(list[i]);
+            return *this;
+        }
         
         bool execute(Value * value, err::Error *e = nullptr);
         bool execute(Value * value, const char * text, err::Error *e = nullptr);
+
+        /// 执行命令，回复零拷贝地解码到reply，在下一次执行之前有效
+        bool execute(Reply * reply, err::Error *e = nullptr);
+
+        /// 执行命令，回复为字符串时分段交给sink而不在接收缓存中保存完整的值，用于很大的值，如GET。
+        /// *length为字符串长度，回复为空值或其他类型时解码到value，*length为-1。sink中止后需要关闭连接
+        bool execute(Value * value, const ChunkSink & sink, int64_t * length, err::Error *e = nullptr);
+
+        /// 执行命令，回复为字符串时直接接收到buf。*length为实际长度，大于size时只保存前size字节
+        bool execute(Value * value, char * buf, size_t size, int64_t * length, err::Error *e = nullptr);
         
         void setTimeout(int timeout) { m_timeout = timeout; };
 
+        /// 设置推送消息的回调，执行命令时夹在回复之间的推送消息交给回调
+        void setPushHandler(const PushHandler & handler) { m_decoder.setPushHandler(handler); }
+
+        /// 不阻塞地处理连接上已到达的推送消息，返回处理的个数，出错返回-1
+        int  poll(err::Error *e = nullptr) { return m_decoder.dispatch(e); }
+
         /// 重置当前命令，删除之前的命令缓存
-        void reset() { m_buf.resize(0); m_args.resize(0); }
+        void reset() { m_buf.resize(0); m_body.resize(0); m_argc = 0; }
+
+        /// 把参数编码为RESP数组追加到out末尾
+        void encode(std::vector<char> * out) const;
     }; // end class Command
 
-    Command & Command::assign(const char * str) 
+    /**
+     * @brief 流水线命令。
+     *
+     * 多个命令编码到同一个发送缓存，一次发送后按顺序解析各自的回复，N个命令只需要少数几次往返。
+     * 命令按batchBytes分批发送，每批发送后读取该批的全部回复，限制双方缓存中积压的数据量。
+     * 执行后命令保留，可再次执行，reset清空。
+     */
+    class Pipeline
     {
-        m_buf.resize(0);
-        m_args.resize(0);
+    public:
+        /// 回复回调，index为命令在流水线中的序号，value可被移走
+        using ReplyHandler = std::function<void (size_t index, Value & value)>;
 
-        int len1 = str?strlen(str):0;
-        if( m_args.capacity() == m_args.size() ) m_args.reserve(m_args.capacity() + 8);
-        m_args.push_back(std::string(str, len1));
-        return *this;
+    private:
+        std::vector<char>   m_buf;
+        std::vector<size_t> m_ends;         ///< 每个命令在m_buf中的结束位置
+        SendHandler         m_sh;
+        RecvHandler         m_rh;
+        int                 m_timeout    { 5000 };
+        size_t              m_batchBytes { 1 << 20 };
+        ValueDecoder        m_decoder;
+
+    public:
+        Pipeline(SendHandler sh, RecvHandler rh) : m_sh(sh), m_rh(rh), m_decoder(rh) {}
+
+        /// 追加命令，参数中可以包含任意二进制数据
+        Pipeline & add(const Command & cmd);
+        Pipeline & add(const std::vector<std::string> & args);
+
+        /// 追加命令，参数可以是字符串、std::string、整数或Arg，如append("SET", key, 100)
+        template<class... T>
+        Pipeline & append(const T &... args)
+        {
+            encode_args(&m_buf, args...);
+            m_ends.push_back(m_buf.size());
+            return *this;
+        }
+
+        /// 追加inline格式的文本命令，如"set a 1"
+        Pipeline & add(const char * text);
+
+        /// 在第index个命令之前插入命令，index为size()时等同add
+        Pipeline & insert(size_t index, const std::vector<std::string> & args);
+
+        /// 删除[from, to)的命令
+        void       erase(size_t from, size_t to);
+
+        /// 执行全部命令，回复按命令顺序回调。网络或协议错误时返回false，之后的命令回复不再回调。
+        bool execute(const ReplyHandler & handler, err::Error * e = nullptr);
+
+        /// 执行全部命令，回复按命令顺序存入values
+        bool execute(std::vector<Value> * values, err::Error * e = nullptr);
+
+        /// 分步执行：从第from个命令起发送一批，*to为该批之后的命令序号。多个连接可以先各自发送再依次接收。
+        bool send(size_t from, size_t * to, err::Error * e = nullptr);
+
+        /// 接收[from, to)命令的回复
+        bool receive(size_t from, size_t to, const ReplyHandler & handler, err::Error * e = nullptr);
+
+        /// 重新执行其中的部分命令，indices为命令序号，回复按indices的顺序回调，index为命令在流水线中的序号
+        bool execute(const std::vector<size_t> & indices, const ReplyHandler & handler, err::Error * e = nullptr);
+
+        size_t size() const { return m_ends.size(); }
+        void setTimeout(int timeout) { m_timeout = timeout; }
+        void setPushHandler(const PushHandler & handler) { m_decoder.setPushHandler(handler); }
+
+        /// 设置每批发送的字节数上限，单个命令超过上限时单独成批
+        void setBatchBytes(size_t bytes) { m_batchBytes = bytes; }
+
+        void reset() { m_buf.clear(); m_ends.clear(); }
+    }; // end class Pipeline
+
+    /// 把args编码为RESP数组追加到out末尾
+    void encode_command(const std::vector<std::string> & args, std::vector<char> * out);
+
+    namespace respimpl {
+
+        inline const char * findScalar(const char * p, const char * end)
+        {
+            return (const char *)memchr(p, '\n', end - p);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        __attribute__((target("sse2")))
+        inline const char * findSse2(const char * p, const char * end)
+        {
+            const __m128i nl = _mm_set1_epi8('\n');
+            for ( ; end - p >= 16; p += 16 ) {
+                unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), nl));
+                if ( m ) return p + __builtin_ctz(m);
+            }
+            return findScalar(p, end);
+        }
+
+        __attribute__((target("avx2")))
+        inline const char * findAvx2(const char * p, const char * end)
+        {
+            const __m256i nl = _mm256_set1_epi8('\n');
+            for ( ; end - p >= 32; p += 32 ) {
+                unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl));
+                if ( m ) return p + __builtin_ctz(m);
+            }
+            return findSse2(p, end);
+        }
+
+        /// 0: 标量, 1: SSE2, 2: AVX2
+        inline int simdLevel()
+        {
+            static const int level = __builtin_cpu_supports("avx2") ? 2 : ( __builtin_cpu_supports("sse2") ? 1 : 0 );
+            return level;
+        }
+#endif
+
+    } // end namespace respimpl
+
+    inline
+    const char * find_newline(const char * p, const char * end)
+    {
+#if defined(__SSE2__)
+        // RESP的类型行大多不超过16字节，第一块内联比较，省去函数调用和分派
+        if ( end - p >= 16 ) {
+            unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8('\n')));
+            if ( m ) return p + __builtin_ctz(m);
+            p += 16;
+            return respimpl::simdLevel() == 2 ? respimpl::findAvx2(p, end) : respimpl::findSse2(p, end);
+        }
+#elif defined(__x86_64__) || defined(__i386__)
+        int level = respimpl::simdLevel();
+        if ( level == 2 ) return respimpl::findAvx2(p, end);
+        if ( level == 1 ) return respimpl::findSse2(p, end);
+#endif
+        return respimpl::findScalar(p, end);
+    }
+
+    inline
+    size_t format_uint(uint64_t n, char * p)
+    {
+        // 每次转换两位数字，从低位向高位写入临时缓存
+        static const char digits[] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+        char   tmp[20];
+        char * q = tmp + sizeof(tmp);
+        while ( n >= 100 ) {
+            unsigned i = (unsigned)(n % 100) * 2;
+            n /= 100;
+            *--q = digits[i + 1];
+            *--q = digits[i];
+        }
+        if ( n < 10 ) {
+            *--q = (char)('0' + n);
+        } else {
+            *--q = digits[n * 2 + 1];
+            *--q = digits[n * 2];
+        }
+        size_t len = tmp + sizeof(tmp) - q;
+        memcpy(p, q, len);
+        return len;
+    }
+
+    inline
+    size_t format_int(int64_t n, char * p)
+    {
+        if ( n >= 0 ) return format_uint((uint64_t)n, p);
+        *p = '-';
+        return 1 + format_uint(0 - (uint64_t)n, p + 1);   // 最小负数取反溢出，按无符号计算
+    }
+
+    /// 写入"<prefix><n>\r\n"，返回结束位置
+    inline
+    char * encode_header(char * p, char prefix, size_t n)
+    {
+        *p++ = prefix;
+        p += format_uint(n, p);
+        *p++ = '\r';
+        *p++ = '\n';
+        return p;
+    }
+
+    inline
+    void encode_command(const Arg * args, size_t count, std::vector<char> * out)
+    {
+        // 每个长度头最多1+20+2字节，先按上限扩充，写完后去掉多余部分
+        size_t total = 23;
+        for ( size_t i = 0; i < count; ++i ) total += args[i].length() + 25;
+        size_t pos = out->size();
+        out->resize(pos + total);
+
+        char * p = encode_header(&(*out)[pos], '*', count);
+        for ( size_t i = 0; i < count; ++i ) {
+            p = encode_header(p, '$', args[i].length());
+            memcpy(p, args[i].data(), args[i].length());
+            p += args[i].length();
+            *p++ = '\r';
+            *p++ = '\n';
+        }
+        out->resize(p - out->data());
     }
 
-    Command & Command::append(const char * str) {
-        int len1 = str?strlen(str):0;
-        if( m_args.capacity() == m_args.size() ) m_args.reserve(m_args.capacity() + 8);
-        m_args.push_back(std::string(str, len1));
+    inline
+    void encode_command(const std::vector<std::string> & args, std::vector<char> * out)
+    {
+        size_t total = 23;
+        for ( auto it = args.begin(); it != args.end(); ++it ) total += it->length() + 25;
+        size_t pos = out->size();
+        out->resize(pos + total);
+
+        char * p = encode_header(&(*out)[pos], '*', args.size());
+        for ( auto it = args.begin(); it != args.end(); ++it ) {
+            p = encode_header(p, '$', it->length());
+            memcpy(p, it->data(), it->length());
+            p += it->length();
+            *p++ = '\r';
+            *p++ = '\n';
+        }
+        out->resize(p - out->data());   // 去掉多分配的
+    }
+
+    inline
+    void Command::encode(std::vector<char> * out) const
+    {
+        size_t pos = out->size();
+        out->resize(pos + 23 + m_body.size());
+        char * p = encode_header(&(*out)[pos], '*', m_argc);
+        if ( !m_body.empty() ) memcpy(p, m_body.data(), m_body.size());
+        out->resize(p + m_body.size() - out->data());
+    }
+
+    inline
+    Command & Command::assign(const char * str) 
+    {
+        this->reset();
+        return this->append(str);
+    }
+
+    inline
+    Command & Command::append(const Arg & arg)
+    {
+        // 参数直接编码到m_body，缓存的完整命令失效
+        m_buf.resize(0);
+        size_t pos = m_body.size();
+        m_body.resize(pos + arg.length() + 25);
+        char * p = encode_header(&m_body[pos], '$', arg.length());
+        memcpy(p, arg.data(), arg.length());
+        p += arg.length();
+        *p++ = '\r';
+        *p++ = '\n';
+        m_body.resize(p - m_body.data());
+        ++m_argc;
         return *this;
     }
 
+    inline
     bool Command::execute(Value * value, const char * text, err::Error * e) 
     {
         if ( text ) {
@@ -166,232 +667,660 @@ namespace redis
         return this->execute(value, e);
     }
 
+    inline
     bool Command::execute(Value * value, err::Error * e ) 
     {
-        if ( m_buf.empty() ) {
-            int total_len = 0;
-            for ( auto it = m_args.begin(); it != m_args.end(); ++it) {
-                total_len +=it->length();
-            }
-            total_len += m_args.size() * 32;
-            m_buf.resize(total_len);
-
-            int pos = 0;
-            int remain = total_len;
-            int r = snprintf(&m_buf[pos], remain, "*%d\r\n", (int)m_args.size());
-            pos += r; remain -= r;
-
-            for ( auto it = m_args.begin(); it != m_args.end(); ++it) {
-                int len = it->length();
-                r = snprintf(&m_buf[pos], remain, "$%d\r\n", len);
-                pos += r; remain -= r;
-                memcpy(&m_buf[pos], it->data(), len);
-                pos += len; remain -= len;
-                m_buf[pos] = '\r';
-                m_buf[pos + 1] = '\n';
-                pos += 2; remain -= 2;
-            } 
-            m_buf.resize( total_len - remain );  // 去掉多分配的
-        }
+        if ( m_buf.empty() ) this->encode(&m_buf);
 
         int r = m_sh(&m_buf[0], (int)m_buf.size(), m_timeout, e);
         if ( r != (int)m_buf.size() ) return false;
 
-        int  len = 0;   // 收到的长度
-        int  pos = 0;   // 每次解析位置
-        
         // 接收回复数据并解码到value中
-        ValueDecoder decoder(m_rh);
-        return decoder.parse(value, m_timeout, e);
+        return m_decoder.parse(value, m_timeout, e) > 0;
     }
 
-    int ValueDecoder::receiveData(int timeout, err::Error * e)
+    inline
+    bool Command::execute(Reply * reply, err::Error * e)
     {
-        if ( m_len == m_buf.size() ) m_buf.resize(m_buf.size() * 2);
-        int r = m_rh(&m_buf[m_len], (int)m_buf.size() - m_len, timeout, e);
-        if ( r > 0 ) m_len += r;
-        return r;
+        if ( m_buf.empty() ) this->encode(&m_buf);
+
+        int r = m_sh(&m_buf[0], (int)m_buf.size(), m_timeout, e);
+        if ( r != (int)m_buf.size() ) return false;
+        return m_decoder.parse(reply, m_timeout, e) > 0;
     }
 
-    int ValueDecoder::parse(Value * value, int timeout, err::Error * e)
+    inline
+    bool Command::execute(Value * value, const ChunkSink & sink, int64_t * length, err::Error * e)
     {
-        if ( m_buf.size() < 128) m_buf.resize(128);
-        m_pos = 0;
-        m_len = 0;
-
-        // 循环收消息，直到收到至少一个字符，或者异常退出
-        while ( m_len < 1 ) {
-            int n = m_rh(&m_buf[m_len], (int)m_buf.size() - m_len, timeout, e);
-            if ( n < 0 ) return -1;   // 异常退出
-            m_len += n;
-        }
-        SYM_TRACE_VA("+++ type: %c", m_buf[0]);
-        if ( m_buf[0] == '+' || m_buf[0] == '-')
-            return this->parseStatus(value, timeout, e);
-        else if ( m_buf[0] == '$') 
-            return this->parseBulkStrings(value, timeout, e);
-        else if ( m_buf[0] == ':')
-            return this->parseInteger(value, timeout, e);
-        else if ( m_buf[0] == '*')
-            return this->parseArray(value, timeout, e);
-        else {
-            if ( e ) {
-                char err[64];
-                snprintf(err, 64, "first char error %c", m_buf[0]);
-                *e = err::Error(-1, "first char error");
-            }
-            return -1;
+        if ( m_buf.empty() ) this->encode(&m_buf);
+
+        int r = m_sh(&m_buf[0], (int)m_buf.size(), m_timeout, e);
+        if ( r != (int)m_buf.size() ) return false;
+        return m_decoder.parse(value, sink, length, m_timeout, e) > 0;
+    }
+
+    inline
+    bool Command::execute(Value * value, char * buf, size_t size, int64_t * length, err::Error * e)
+    {
+        if ( m_buf.empty() ) this->encode(&m_buf);
+
+        int r = m_sh(&m_buf[0], (int)m_buf.size(), m_timeout, e);
+        if ( r != (int)m_buf.size() ) return false;
+        return m_decoder.parse(value, buf, size, length, m_timeout, e) > 0;
+    }
+
+    inline
+    Pipeline & Pipeline::add(const Command & cmd)
+    {
+        cmd.encode(&m_buf);
+        m_ends.push_back(m_buf.size());
+        return *this;
+    }
+
+    inline
+    Pipeline & Pipeline::add(const std::vector<std::string> & args)
+    {
+        encode_command(args, &m_buf);
+        m_ends.push_back(m_buf.size());
+        return *this;
+    }
+
+    inline
+    Pipeline & Pipeline::insert(size_t index, const std::vector<std::string> & args)
+    {
+        assert( index <= m_ends.size() );
+        std::vector<char> cmd;
+        encode_command(args, &cmd);
+        size_t pos = index ? m_ends[index - 1] : 0;
+        m_buf.insert(m_buf.begin() + pos, cmd.begin(), cmd.end());
+        for ( size_t i = index; i < m_ends.size(); ++i ) m_ends[i] += cmd.size();
+        m_ends.insert(m_ends.begin() + index, pos + cmd.size());
+        return *this;
+    }
+
+    inline
+    void Pipeline::erase(size_t from, size_t to)
+    {
+        assert( from <= to && to <= m_ends.size() );
+        if ( from == to ) return;
+        size_t begin = from ? m_ends[from - 1] : 0;
+        size_t len   = m_ends[to - 1] - begin;
+        m_buf.erase(m_buf.begin() + begin, m_buf.begin() + begin + len);
+        m_ends.erase(m_ends.begin() + from, m_ends.begin() + to);
+        for ( size_t i = from; i < m_ends.size(); ++i ) m_ends[i] -= len;
+    }
+
+    inline
+    Pipeline & Pipeline::add(const char * text)
+    {
+        size_t len = text ? strlen(text) : 0;
+        m_buf.insert(m_buf.end(), text, text + len);
+        if ( len < 2 || text[len - 2] != '\r' || text[len - 1] != '\n' ) {
+            m_buf.push_back('\r');
+            m_buf.push_back('\n');
         }
+        m_ends.push_back(m_buf.size());
+        return *this;
+    }
 
-        return 0;
+    inline
+    bool Pipeline::execute(const ReplyHandler & handler, err::Error * e)
+    {
+        // 解码器在各批之间保留多收到的数据
+        size_t index = 0;
+        while ( index < m_ends.size() ) {
+            size_t to;
+            if ( !this->send(index, &to, e) || !this->receive(index, to, handler, e) ) return false;
+            index = to;
+        }
+        return true;
     }
 
-    int ValueDecoder::parseStatus(Value * value, int timeout, err::Error * e)
+    inline
+    bool Pipeline::send(size_t from, size_t * to, err::Error * e)
     {
-        bool status = false;
-        if ( m_buf[m_pos] == '+' ) status = true;
-        m_pos += 1;
+        size_t begin = from > 0 ? m_ends[from - 1] : 0;
+        size_t last  = from;
+        while ( last + 1 < m_ends.size() && m_ends[last + 1] - begin <= m_batchBytes ) ++last;
 
-        int end = m_pos;
+        int len = (int)(m_ends[last] - begin);
+        int r = m_sh(&m_buf[begin], len, m_timeout, e);
+        if ( r != len ) return false;
+        *to = last + 1;
+        return true;
+    }
 
-        while (1) {
-            SYM_TRACE_VA("parseStatus while %d", end);
-            for(; end < m_len && m_buf[end] != '\n'; ++end) ;
-            if ( end < m_len ) break; 
+    inline
+    bool Pipeline::receive(size_t from, size_t to, const ReplyHandler & handler, err::Error * e)
+    {
+        for ( size_t index = from; index < to; ++index ) {
+            Value value;
+            if ( m_decoder.parse(&value, m_timeout, e) < 0 ) return false;
+            handler(index, value);
+        }
+        return true;
+    }
 
-            if ( m_len == m_buf.size() ) m_buf.resize(m_buf.size() * 2);
-            int r = m_rh(&m_buf[m_len], (int)m_buf.size() - m_len, timeout, e);
-            if ( r < 0 ) return -1;   // 异常退出
-            m_len += r;
+    inline
+    bool Pipeline::execute(const std::vector<size_t> & indices, const ReplyHandler & handler, err::Error * e)
+    {
+        std::vector<char> buf;
+        for ( auto it = indices.begin(); it != indices.end(); ++it ) {
+            size_t begin = *it > 0 ? m_ends[*it - 1] : 0;
+            buf.insert(buf.end(), m_buf.begin() + begin, m_buf.begin() + m_ends[*it]);
         }
-        
-        value->setStatus(status, &m_buf[m_pos], end - m_pos - 1);
-        return end + 1;
+        if ( buf.empty() ) return true;
+        int r = m_sh(buf.data(), (int)buf.size(), m_timeout, e);
+        if ( r != (int)buf.size() ) return false;
+
+        for ( auto it = indices.begin(); it != indices.end(); ++it ) {
+            Value value;
+            if ( m_decoder.parse(&value, m_timeout, e) < 0 ) return false;
+            handler(*it, value);
+        }
+        return true;
     }
 
-    int ValueDecoder::parseInteger(Value * value, int timeout, err::Error * e)
+    inline
+    bool Pipeline::execute(std::vector<Value> * values, err::Error * e)
     {
-        assert(m_buf[m_pos] == ':');
-        m_pos += 1;
-        
-        int end = m_pos;
-        while (1) {
-            for( ; end < m_len && m_buf[end] != '\n'; ++end) ;
-            if ( end < m_len ) break;
-            
-            int r = this->receiveData(timeout, e);
-            if ( r < 0 ) return -1;   // 异常退出
+        values->clear();
+        values->reserve(m_ends.size());
+        return this->execute([values](size_t index, Value & value) { values->push_back(std::move(value)); }, e);
+    }
+
+    inline
+    void Reader::feed(const char * data, size_t size)
+    {
+        size_t avail;
+        char * p = this->prepare(size, &avail);
+        memcpy(p, data, size);
+        this->commit(size);
+    }
+
+    inline
+    char * Reader::prepare(size_t size, size_t * avail)
+    {
+        if ( m_buf.size() - m_len < size ) {
+            // 已完成的回复不再需要，先移走再考虑扩充，摊还代价与输入长度成线性关系。
+            // 未完成的回复整体保留，其中字符串的位置相对回复起点记录，移动后仍然有效
+            if ( m_start > 0 ) {
+                memmove(m_buf.data(), m_buf.data() + m_start, m_len - m_start);
+                m_len  -= m_start;
+                m_scan -= m_start;
+                m_pos  -= m_start;
+                m_start = 0;
+            }
+            if ( m_buf.size() - m_len < size ) m_buf.resize(std::max(m_buf.size() * 2, m_len + size));
         }
-        
-        int64_t n = atoll(&m_buf[m_pos]);
-        value->setInt(n);
-        return end + 1;
+        *avail = m_buf.size() - m_len;
+        return m_buf.data() + m_len;
     }
 
-    int ValueDecoder::parseBulkStrings(Value * value, int timeout, err::Error * e)
+    inline
+    bool Reader::isNumberType(char type)
     {
-        assert(m_buf[m_pos] == '$');
-        m_pos += 1;
-        int end = m_pos;
+        switch ( type ) {
+        case ':': case '$': case '*': case '!': case '=': case '%': case '~': case '>':
+            return true;
+        default:
+            return false;
+        }
+    }
 
-        // 读size部分
-        while (1) {
-            for( ; end < m_len && m_buf[end] != '\n'; ++end) ;
-            if ( end < m_len ) break;
-            
-            int r = this->receiveData(timeout, e);
-            if (r < 0 ) return -1;
+    inline
+    int Reader::scanNumber(const char * p, const char * end, int64_t * n, const char ** cr)
+    {
+        bool neg = ( p < end && *p == '-' );
+        if ( neg ) ++p;
+        // 最多读19位，19位十进制数不会超出uint64_t，累加后再检查int64_t的范围
+        const char * digits = p;
+        const char * limit  = ( end - p > 19 ) ? p + 19 : end;
+        uint64_t     v      = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // 长整数每次转换8位：8个字节都是数字时，相邻位两两合并，三次乘法得到结果
+        while ( limit - p >= 8 ) {
+            uint64_t c;
+            memcpy(&c, p, 8);
+            if ( (c & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL
+              || ((c + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) != 0x3030303030303030ULL ) break;
+            c -= 0x3030303030303030ULL;
+            c = (c * 10 + (c >> 8)) & 0x00ff00ff00ff00ffULL;
+            c = (c * 100 + (c >> 16)) & 0x0000ffff0000ffffULL;
+            c = (c * 10000 + (c >> 32)) & 0xffffffffULL;
+            v = v * 100000000 + c;
+            p += 8;
         }
+#endif
+        for ( ; p < limit; ++p ) {
+            unsigned d = (unsigned)(unsigned char)*p - '0';
+            if ( d > 9 ) break;
+            v = v * 10 + d;
+        }
+        if ( p == end ) return 0;
+        if ( p == digits || *p != '\r' ) return -1;
+        if ( p + 1 == end ) return 0;
+        if ( p[1] != '\n' || v > (uint64_t)INT64_MAX + neg ) return -1;
+        *n  = neg ? (int64_t)(0 - v) : (int64_t)v;
+        *cr = p;
+        return 1;
+    }
 
-        int size = atoi(&m_buf[ m_pos ]);   // 获取到长度。
-        if ( size < 0 ) {
-            value->setNull();
-            return end + 1;
+    inline
+    int Reader::next(Value * value, err::Error * e)
+    {
+        int r = this->next(&m_scratch, e);
+        if ( r == complete ) {
+            m_scratch.root().toValue(value);
+            m_scratch.clear();
         }
+        return r;
+    }
 
-        // 读字符串
-        m_pos = end + 1;
+    inline
+    int Reader::next(Reply * reply, err::Error * e)
+    {
+        while ( m_pos < m_len ) {
+            // 每个元素以一行开始：类型字符、内容、CRLF
+            const char * base   = m_buf.data();
+            char         type   = base[m_pos];
+            const char * line   = base + m_pos + 1;
+            const char * lend;
+            int64_t      n      = 0;
+            bool         number = isNumberType(type);
 
-        while (1) {
-            if ( m_len >= m_pos + size + 2 ) {
-                if (m_buf[m_pos + size + 1] == '\n') {
-                    break;
+            if ( number ) {
+                // 长度和整数行很短，解析数字的同时找到行尾，不再单独扫描一遍
+                int r = scanNumber(line, base + m_len, &n, &lend);
+                if ( r == 0 ) return needMore;
+                if ( r < 0 ) {
+                    if ( e ) *e = err::Error(-1, "bad number");
+                    return failed;
+                }
+            } else {
+                size_t from = std::max(m_scan, m_pos);
+                const char * nl = find_newline(base + from, base + m_len);
+                if ( nl == nullptr ) {
+                    m_scan = m_len;
+                    return needMore;
+                }
+                m_scan = nl - base;
+                if ( nl < line + 1 || nl[-1] != '\r' ) {
+                    if ( e ) *e = err::Error(-1, "bad line terminator");
+                    return failed;
+                }
+                lend = nl - 1;
+            }
+
+            size_t       next  = lend + 2 - base;
+            Reply::Node  item  { Value::vtNull, true, 0, 0 };
+
+            if ( type == '+' || type == '-' ) {
+                item.type   = Value::vtStatus;
+                item.status = ( type == '+' );
+                item.n      = lend - line;
+                item.off    = m_pos + 1 - m_start;
+            }
+            else if ( type == '_' || type == '#' ) {
+                if ( type == '_' ? lend != line : ( lend != line + 1 || (*line != 't' && *line != 'f') ) ) {
+                    if ( e ) *e = err::Error(-1, "bad null or boolean");
+                    return failed;
+                }
+                if ( type == '#' ) {
+                    item.type = Value::vtInteger;
+                    item.n    = ( *line == 't' );
+                }
+            }
+            else if ( type == ',' || type == '(' ) {
+                item.type = Value::vtString;
+                item.n    = lend - line;
+                item.off  = m_pos + 1 - m_start;
+            }
+            else if ( number ) {
+                if ( type == ':' ) {
+                    item.type = Value::vtInteger;
+                    item.n    = n;
+                } else if ( n < 0 ) {
+                    // 空值
+                } else if ( type == '$' || type == '!' || type == '=' ) {
+                    // 数据不足时停在本元素开头，下次重新解析长度行
+                    if ( m_len < next + n + 2 ) return needMore;
+                    if ( m_buf[next + n] != '\r' || m_buf[next + n + 1] != '\n' ) {
+                        if ( e ) *e = err::Error(-1, "bad bulk string format");
+                        return failed;
+                    }
+                    item.type   = ( type == '!' ) ? Value::vtStatus : Value::vtString;
+                    item.status = ( type != '!' );
+                    item.n      = n;
+                    item.off    = next - m_start;
+                    if ( type == '=' ) {
+                        // verbatim字符串以"txt:"这样的3字节格式加冒号开头
+                        if ( n < 4 || m_buf[next + 3] != ':' ) {
+                            if ( e ) *e = err::Error(-1, "bad verbatim string format");
+                            return failed;
+                        }
+                        item.n   -= 4;
+                        item.off += 4;
+                    }
+                    next += n + 2;
                 } else {
-                    if ( e )  *e  = err::Error(-1, "bad bulk string format");
-                    return -1;
+                    // 元素节点一次预留，先检查整个回复的元素总数。limit不超过INT32_MAX，n * 2不会溢出
+                    size_t used  = m_stack.empty() ? 0 : m_reply.m_nodes.size() - 1;   // 不计根元素
+                    int64_t limit = (int64_t)( m_maxElements - std::min(m_maxElements, used) );
+                    if ( n > limit || ( type == '%' && n * 2 > limit ) ) {
+                        if ( e ) *e = err::Error(-1, "array too long");
+                        return failed;
+                    }
+                    switch ( type ) {
+                    case '*': item.type = Value::vtList; break;
+                    case '%': item.type = Value::vtMap;  n *= 2; break;
+                    case '~': item.type = Value::vtSet;  break;
+                    default:  item.type = Value::vtPush; break;
+                    }
+                    item.n = n;
                 }
             }
+            else {
+                if ( e ) {
+                    char msg[64];
+                    snprintf(msg, sizeof(msg), "first char error %c", type);
+                    *e = err::Error(-1, msg);
+                }
+                return failed;
+            }
+
+            // 根元素追加到节点数组，数组元素放入上层数组预留的节点
+            std::vector<Reply::Node> & nodes = m_reply.m_nodes;
+            size_t slot;
+            if ( m_stack.empty() ) {
+                slot = nodes.size();
+                nodes.push_back(item);
+            } else {
+                slot = m_stack.back().next++;
+                nodes[slot] = item;
+            }
+            m_pos = m_scan = next;
+
+            if ( Value::isAggregate(item.type) && n > 0 ) {
+                // 非空数组的元素占用相邻的节点，一次预留，元素到齐后作为一个元素交给上一层
+                nodes[slot].off = nodes.size();
+                nodes.resize(nodes.size() + n);
+                m_stack.push_back(Frame { nodes[slot].off, n });
+                continue;
+            }
 
-            int r = this->receiveData(timeout, e);
-            if (r < 0 ) return -1;
+            // 完成的元素逐层计入所在数组，数组元素到齐后继续向上
+            bool done = true;
+            while ( !m_stack.empty() ) {
+                if ( --m_stack.back().remain > 0 ) {
+                    done = false;
+                    break;
+                }
+                m_stack.pop_back();
+            }
+            if ( done ) {
+                // 节点数组与调用者交换，双方的空间都得到复用
+                reply->m_nodes.clear();
+                reply->m_nodes.swap(m_reply.m_nodes);
+                reply->m_base = m_buf.data() + m_start;
+                m_start = m_pos;
+                return complete;
+            }
         }
-        
-        value->setString(&m_buf[m_pos], size);
-        return m_pos + size + 2;
+        return needMore;
     }
 
-    int ValueDecoder::parseArray(Value * value, int timeout, err::Error * e)
+    inline
+    int Reader::nextBulk(int64_t * length, err::Error * e)
     {
-        assert(m_buf[m_pos] == '*');
-        m_pos += 1;
-        int end = m_pos;
-        value->setType(Value::vtList);
+        if ( !m_stack.empty() ) return notBulk;
+        if ( m_pos >= m_len ) return needMore;
+        if ( m_buf[m_pos] != '$' ) return notBulk;
 
-        // array length
-        while (1) {
-            for( ; end < m_len && m_buf[end] != '\n'; ++end) ;
-            if ( end < m_len ) break;
-            
-            int r = this->receiveData(timeout, e);
-            if ( r < 0 ) return -1;   // 异常退出
+        int64_t n;
+        const char * cr;
+        int r = scanNumber(m_buf.data() + m_pos + 1, m_buf.data() + m_len, &n, &cr);
+        if ( r == 0 ) return needMore;
+        if ( r < 0 ) {
+            if ( e ) *e = err::Error(-1, "bad number");
+            return failed;
         }
+        this->consume(cr + 2 - m_buf.data() - m_pos);
+        *length = n < 0 ? -1 : n;
+        return complete;
+    }
 
-        int n = atoi( &m_buf[m_pos]);
-        if ( n < 0 ) {
-            value->setNull();
-            return end + 1;
+    inline
+    int Reader::endBulk(err::Error * e)
+    {
+        if ( m_len - m_pos < 2 ) return needMore;
+        if ( m_buf[m_pos] != '\r' || m_buf[m_pos + 1] != '\n' ) {
+            if ( e ) *e = err::Error(-1, "bad bulk string format");
+            return failed;
         }
-        m_pos = end + 1;
+        this->consume(2);
+        return complete;
+    }
+
+    inline
+    ValueRef Reply::root() const
+    {
+        return ValueRef(this, 0);
+    }
 
-        for ( int i = 0; i < n; ++i ) {
-            while ( m_pos >= m_len ) {
-                int r = this->receiveData(timeout, e);
-                if ( r < 0 ) return -1;
+    inline
+    void ValueRef::toValue(Value * value) const
+    {
+        // 待复制的元素和目标，数组先确定元素个数，元素地址此后不再变化
+        std::vector<std::pair<size_t, Value *> > todo { std::make_pair(m_index, value) };
+        const std::vector<Reply::Node> & nodes = m_reply->m_nodes;
+        while ( !todo.empty() ) {
+            size_t  index = todo.back().first;
+            Value * out   = todo.back().second;
+            todo.pop_back();
+
+            const Reply::Node & node = nodes[index];
+            out->reset();
+            switch ( node.type ) {
+            case Value::vtStatus:
+                out->setStatus(node.status, m_reply->m_base + node.off, (int)node.n);
+                break;
+            case Value::vtString:
+                out->setString(m_reply->m_base + node.off, (int)node.n);
+                break;
+            case Value::vtInteger:
+                out->setInt(node.n);
+                break;
+            case Value::vtList:
+            case Value::vtMap:
+            case Value::vtSet:
+            case Value::vtPush:
+                out->setType(node.type);
+                out->list().resize(node.n);
+                for ( int64_t i = 0; i < node.n; ++i ) todo.push_back(std::make_pair(node.off + i, &out->list()[i]));
+                break;
+            default:
+                out->setNull();
             }
+        }
+    }
+
+    inline
+    int ValueDecoder::receiveData(int timeout, err::Error * e)
+    {
+        size_t avail;
+        char * p = m_reader.prepare(4096, &avail);
+        int r = m_rh(p, (int)std::min(avail, (size_t)INT32_MAX), timeout, e);
+        if ( r > 0 ) m_reader.commit(r);
+        return r;
+    }
 
-            Value value1;
-            if ( m_buf[m_pos] == '+' || m_buf[m_pos] == '-') {
-                int r = this->parseStatus(&value1, timeout, e);
-                if ( r < 0  )  return -1;
-                m_pos = r;
-            } 
-            else if ( m_buf[m_pos] == '$') {
-                int r = this->parseBulkStrings(&value1, timeout, e);
-                if ( r < 0 ) return -1;
-                m_pos = r;
+    inline
+    int ValueDecoder::parse(Value * value, int timeout, err::Error * e)
+    {
+        while ( true ) {
+            int r = m_reader.next(value, e);
+            if ( r == Reader::complete ) {
+                if ( !m_push || value->type() != Value::vtPush ) return 1;
+                m_push(*value);
+                continue;
             }
-            else if ( m_buf[m_pos] == ':') {
-                int r = this->parseInteger(&value1, timeout, e);
-                if ( r < 0 ) return -1;
-                m_pos = r;
+            if ( r == Reader::failed ) return -1;
+
+            r = this->receiveData(timeout, e);
+            if ( r < 0 ) return -1;
+            if ( r == 0 ) {
+                if ( e ) *e = err::Error(-1, "receive timeout");
+                return -1;
             }
-            else if ( m_buf[m_pos] == '*') {
-                int r = this->parseArray(&value1, timeout, e);
-                if ( r < 0 ) return -1;
-                m_pos = r;
+        }
+    }
+
+    inline
+    int ValueDecoder::parse(Reply * reply, int timeout, err::Error * e)
+    {
+        while ( true ) {
+            int r = m_reader.next(reply, e);
+            if ( r == Reader::complete ) {
+                if ( !m_push || reply->root().type() != Value::vtPush ) return 1;
+                Value value;
+                reply->root().toValue(&value);
+                m_push(value);
+                continue;
             }
-            else {
-                if ( e ) {
-                    char err[64];
-                    snprintf(err, 64, "first char error %c", m_buf[m_pos]);
-                    *e = err::Error(-1, "first char error");
+            if ( r == Reader::failed ) return -1;
+
+            r = this->receiveData(timeout, e);
+            if ( r < 0 ) return -1;
+            if ( r == 0 ) {
+                if ( e ) *e = err::Error(-1, "receive timeout");
+                return -1;
+            }
+        }
+    }
+
+    inline
+    int ValueDecoder::dispatch(err::Error * e)
+    {
+        int count = 0;
+        Value value;
+        while ( true ) {
+            int r = m_reader.next(&value, e);
+            if ( r == Reader::failed ) return -1;
+            if ( r == Reader::complete ) {
+                if ( !m_push || value.type() != Value::vtPush ) {
+                    if ( e ) *e = err::Error(-1, "unexpected reply without command");
+                    return -1;
+                }
+                m_push(value);
+                ++count;
+                continue;
+            }
+
+            // 超时为0，只取已到达的数据
+            r = this->receiveData(0, e);
+            if ( r < 0 ) return -1;
+            if ( r == 0 ) return count;
+        }
+    }
+
+    inline
+    int ValueDecoder::parse(Value * value, const ChunkSink & sink, int64_t * length, int timeout, err::Error * e)
+    {
+        return this->parseBulk(value, nullptr, 0, &sink, length, timeout, e);
+    }
+
+    inline
+    int ValueDecoder::parse(Value * value, char * buf, size_t size, int64_t * length, int timeout, err::Error * e)
+    {
+        return this->parseBulk(value, buf, size, nullptr, length, timeout, e);
+    }
+
+    inline
+    int ValueDecoder::parseBulk(Value * value, char * buf, size_t size, const ChunkSink * sink, int64_t * length,
+        int timeout, err::Error * e)
+    {
+        // 先等到长度行，其他类型的回复按原方式解码
+        while ( true ) {
+            int r = m_reader.nextBulk(length, e);
+            if ( r == Reader::complete ) break;
+            if ( r == Reader::failed ) return -1;
+            if ( r == Reader::notBulk ) {
+                r = m_reader.next(value, e);
+                if ( r == Reader::failed ) return -1;
+                if ( r == Reader::complete ) {
+                    if ( !m_push || value->type() != Value::vtPush ) {
+                        *length = -1;
+                        return 1;
+                    }
+                    m_push(*value);
+                    continue;
+                }
+            }
+            r = this->receiveData(timeout, e);
+            if ( r < 0 ) return -1;
+            if ( r == 0 ) {
+                if ( e ) *e = err::Error(-1, "receive timeout");
+                return -1;
+            }
+        }
+        value->reset();
+        if ( *length < 0 ) return 1;
+
+        // 已缓存的部分从解码缓存取走，其余直接接收：有buf时收到buf中，buf之外的部分和sink模式
+        // 借用解码缓存的空闲空间中转，不提交给解码器，缓存不会增长
+        uint64_t total = (uint64_t)*length;
+        uint64_t got = 0;
+        while ( got < total ) {
+            size_t avail;
+            const char * p = m_reader.peek(&avail);
+            if ( avail > 0 ) {
+                size_t k = (size_t)std::min<uint64_t>(avail, total - got);
+                if ( sink && !(*sink)(p, k) ) {
+                    if ( e ) *e = err::Error(-1, "bulk string receiving aborted");
+                    return -1;
                 }
+                if ( buf && got < size ) memcpy(buf + got, p, (size_t)std::min<uint64_t>(k, size - got));
+                m_reader.consume(k);
+                got += k;
+                continue;
+            }
+
+            char * dst;
+            size_t cap;
+            bool direct = ( buf && got < size );
+            if ( direct ) {
+                dst = buf + got;
+                cap = size - got;
+            } else {
+                dst = m_reader.prepare(4096, &cap);
+            }
+            cap = (size_t)std::min<uint64_t>(std::min<uint64_t>(cap, total - got), INT32_MAX);
+            int r = m_rh(dst, (int)cap, timeout, e);
+            if ( r < 0 ) return -1;
+            if ( r == 0 ) {
+                if ( e ) *e = err::Error(-1, "receive timeout");
+                return -1;
+            }
+            if ( sink && !(*sink)(dst, r) ) {
+                if ( e ) *e = err::Error(-1, "bulk string receiving aborted");
+                return -1;
+            }
+            got += r;
+        }
+
+        while ( true ) {
+            int r = m_reader.endBulk(e);
+            if ( r == Reader::complete ) return 1;
+            if ( r == Reader::failed ) return -1;
+            r = this->receiveData(timeout, e);
+            if ( r < 0 ) return -1;
+            if ( r == 0 ) {
+                if ( e ) *e = err::Error(-1, "receive timeout");
                 return -1;
             }
-            value->list().push_back(value1);
         }
-        return m_pos;
     }
 } // end namespace redis
 
-END_SYM_NAMESPACE 
\ No newline at end of file
+END_SYM_NAMESPACE
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <sym/redis.h>
+#include <sym/nio.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace redis
+{
+    /**
+     * @brief 基于SimpleSocketServer的异步Redis客户端。
+     *
+     * 命令自动流水线化：发出的命令按顺序排队，回复按同样的顺序与回调一一对应。
+     * 同一次循环迭代中发出的全部命令编码到一个缓存，在下一次迭代开始时一次写出。
+     * 连接建立时先发送PING，收到回复后才写出排队的命令，连接失败不会丢失命令。
+     * 连接断开后，已写出但未收到回复的命令以statusError回调，是否执行过无法确定，由调用者决定是否重试；
+     * 尚未写出的命令保留在队列中，重连成功后按原顺序发出，不会与之后的命令乱序。
+     *
+     * 除构造外的全部方法，以及所有回调，都在事件循环线程中执行。
+     * 析构时关闭连接，未完成的命令不再回调。
+     */
+    class AsyncClient
+    {
+    public:
+        /// 回复回调。status为nio::SimpleSocketServer::statusOk时value为回复，Redis错误回复的value.status()为false
+        using ReplyCallback = std::function<void (int status, Value & value)>;
+
+    private:
+        class ImplClass;
+        std::shared_ptr<ImplClass> m_impl;
+
+    public:
+        AsyncClient(nio::SimpleSocketServer & loop, const net::Address & remote);
+        ~AsyncClient();
+
+        AsyncClient(const AsyncClient &) = delete;
+        AsyncClient & operator=(const AsyncClient &) = delete;
+
+        /// 发起连接，不等待连接完成，连接前发出的命令在连接建立后发送
+        bool connect(err::Error * e = nullptr);
+
+        /// 连接已建立并收到握手回复
+        bool isConnected() const;
+
+        /// 发出命令，参数中可以包含任意二进制数据
+        void command(const std::vector<std::string> & args, const ReplyCallback & cb);
+
+        /// 发出命令，参数可以是字符串、std::string、整数或Arg，直接编码到发送缓存，如command(cb, "GET", key)
+        template<class... T>
+        void command(const ReplyCallback & cb, const T &... args);
+
+        /// 关闭连接，不再自动重连。已写出的命令以statusError回调，未写出的命令保留到下次connect。
+        void close();
+
+        /// 已发出尚未收到回复的命令数，包括还没有写出的
+        size_t pending() const;
+
+        /// 设置断线后的重连间隔，ms，小于0时不自动重连
+        void   setReconnectInterval(int ms);
+    }; // end class AsyncClient
+
+    class AsyncClient::ImplClass : public std::enable_shared_from_this<AsyncClient::ImplClass>
+    {
+    public:
+        using CallbackQueue = std::deque<ReplyCallback>;
+
+        nio::SimpleSocketServer & m_loop;
+        net::Address              m_remote;
+        int                       m_channel   { -1 };
+        bool                      m_ready     { false };   ///< 握手完成，可以写出命令
+        bool                      m_handshake { false };   ///< 等待握手回复，排在所有命令的回复之前
+        bool                      m_closing   { false };   ///< 主动关闭，不重连
+        bool                      m_flushPosted { false };
+        int                       m_reconnectInterval { 1000 };
+        int                       m_timer     { -1 };
+
+        std::vector<char>         m_out;        ///< 本次迭代发出的命令
+        CallbackQueue             m_queued;     ///< m_out中命令的回调
+        CallbackQueue             m_waiting;    ///< 已写出，等待回复的回调
+        std::deque<std::vector<char> *> m_sending;  ///< 交给循环发送中的缓存，按发送顺序回调释放
+
+        Reader                    m_reader;
+        io::MutableBuffer         m_inbuf;
+        Value                     m_value;
+
+        static const size_t       recvChunk = 16 * 1024;
+
+    public:
+        ImplClass(nio::SimpleSocketServer & loop, const net::Address & remote)
+            : m_loop(loop), m_remote(remote) {}
+        ~ImplClass() { this->freeSending(); }
+
+        bool connect(err::Error * e);
+        void postFlush();
+        void flush();
+        bool sendBuffer(std::vector<char> * out);
+        void onHandshake(const Value & value);
+        void scheduleReconnect();
+        void freeSending();
+
+        void onReceived(int fd, int status, io::MutableBuffer & buf);
+        void onSent(int fd, int status, io::ConstBuffer & buf);
+        void onClosed(int fd);
+        void attachInput(io::MutableBuffer & buf);
+    }; // end class AsyncClient::ImplClass
+
+    inline
+    AsyncClient::AsyncClient(nio::SimpleSocketServer & loop, const net::Address & remote)
+        : m_impl(std::make_shared<ImplClass>(loop, remote))
+    {}
+
+    inline
+    AsyncClient::~AsyncClient()
+    {
+        m_impl->m_queued.clear();
+        m_impl->m_waiting.clear();
+        this->close();
+    }
+
+    inline
+    bool AsyncClient::connect(err::Error * e)
+    {
+        m_impl->m_closing = false;
+        if ( m_impl->m_channel >= 0 ) return true;
+        return m_impl->connect(e);
+    }
+
+    inline
+    void AsyncClient::command(const std::vector<std::string> & args, const ReplyCallback & cb)
+    {
+        encode_command(args, &m_impl->m_out);
+        m_impl->m_queued.push_back(cb);
+        m_impl->postFlush();
+    }
+
+    template<class... T>
+    void AsyncClient::command(const ReplyCallback & cb, const T &... args)
+    {
+        encode_args(&m_impl->m_out, args...);
+        m_impl->m_queued.push_back(cb);
+        m_impl->postFlush();
+    }
+
+    inline
+    void AsyncClient::close()
+    {
+        m_impl->m_closing = true;
+        if ( m_impl->m_timer >= 0 ) {
+            m_impl->m_loop.cancelTimer(m_impl->m_timer);
+            m_impl->m_timer = -1;
+        }
+        if ( m_impl->m_channel >= 0 ) m_impl->m_loop.closeChannel(m_impl->m_channel);
+    }
+
+    inline
+    bool AsyncClient::isConnected() const
+    {
+        return m_impl->m_ready;
+    }
+
+    inline
+    size_t AsyncClient::pending() const
+    {
+        return m_impl->m_queued.size() + m_impl->m_waiting.size();
+    }
+
+    inline
+    void AsyncClient::setReconnectInterval(int ms)
+    {
+        m_impl->m_reconnectInterval = ms;
+    }
+
+    inline
+    bool AsyncClient::ImplClass::connect(err::Error * e)
+    {
+        net::Socket sock;
+        bool isok = sock.create(m_remote.af(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, e);
+        if ( !isok ) return false;
+
+        // 非阻塞连接立即返回，连接完成前写入的数据由循环在可写时发出
+        isok = sock.connect(m_remote, e);
+        if ( !isok ) {
+            sock.close();
+            return false;
+        }
+
+        auto self = this->shared_from_this();
+        int fd = sock.fd();
+        m_channel = m_loop.acceptChannel(fd,
+            [self](int fd, int status, io::MutableBuffer & buf) { self->onReceived(fd, status, buf); },
+            [self](int fd, int status, io::ConstBuffer & buf)   { self->onSent(fd, status, buf); },
+            [self](int fd) { self->onClosed(fd); },
+            e);
+        if ( m_channel < 0 ) {
+            sock.close();
+            return false;
+        }
+
+        m_ready = false;
+        m_reader.reset();
+        m_loop.setPartialReceive(m_channel, true);
+        this->attachInput(m_inbuf);
+        m_loop.beginReceive(m_channel, m_inbuf);
+
+        // 握手命令单独发送，排在所有命令之前
+        std::vector<char> * ping = new std::vector<char>();
+        encode_args(ping, "PING");
+        if ( !this->sendBuffer(ping) ) {
+            delete ping;
+            m_loop.closeChannel(m_channel);
+            return true;    // 关闭后按断线处理，定时重连
+        }
+        m_handshake = true;
+        return true;
+    }
+
+    inline
+    void AsyncClient::ImplClass::onHandshake(const Value & value)
+    {
+        m_handshake = false;
+        if ( value.type() == Value::vtStatus && !value.status() ) {
+            SYM_TRACE_VA("[error] redis handshake failed, %s", value.getString().c_str());
+            m_loop.closeChannel(m_channel);
+            return;
+        }
+        m_ready = true;
+        if ( !m_out.empty() ) this->postFlush();
+    }
+
+    inline
+    void AsyncClient::ImplClass::postFlush()
+    {
+        if ( m_flushPosted || !m_ready ) return;
+        m_flushPosted = true;
+        auto self = this->shared_from_this();
+        m_loop.post([self]() { self->flush(); });
+    }
+
+    inline
+    void AsyncClient::ImplClass::flush()
+    {
+        m_flushPosted = false;
+        if ( !m_ready || m_out.empty() ) return;
+
+        // 发送缓存整体交给循环，回调按顺序移入等待队列，之后发出的命令不会插到前面
+        std::vector<char> * out = new std::vector<char>();
+        out->swap(m_out);
+        if ( !this->sendBuffer(out) ) {
+            out->swap(m_out);
+            delete out;
+            return;
+        }
+        for ( auto it = m_queued.begin(); it != m_queued.end(); ++it ) m_waiting.push_back(std::move(*it));
+        m_queued.clear();
+    }
+
+    inline
+    bool AsyncClient::ImplClass::sendBuffer(std::vector<char> * out)
+    {
+        io::ConstBuffer buf(out->data(), out->size(), out->size());
+        if ( !m_loop.send(m_channel, buf) ) return false;
+        m_sending.push_back(out);
+        return true;
+    }
+
+    inline
+    void AsyncClient::ImplClass::attachInput(io::MutableBuffer & buf)
+    {
+        size_t avail;
+        char * p = m_reader.prepare(recvChunk, &avail);
+        buf.attach(p, 0, avail);
+    }
+
+    inline
+    void AsyncClient::ImplClass::onReceived(int fd, int status, io::MutableBuffer & buf)
+    {
+        if ( status != nio::SimpleSocketServer::statusOk ) {
+            SYM_TRACE_VA("[trace] redis connection %d lost", fd);
+            m_loop.closeChannel(fd);
+            return;
+        }
+
+        m_reader.commit(buf.size());
+        while ( true ) {
+            err::Error e;
+            int r = m_reader.next(&m_value, &e);
+            if ( r == Reader::needMore ) break;
+            if ( r == Reader::complete && m_handshake ) {
+                this->onHandshake(m_value);
+                continue;
+            }
+            if ( r == Reader::failed || m_waiting.empty() ) {
+                SYM_TRACE_VA("[error] redis connection %d, bad reply, %s", fd, e ? e.message() : "unexpected reply");
+                m_loop.closeChannel(fd);
+                buf.detach();
+                return;
+            }
+
+            ReplyCallback cb = std::move(m_waiting.front());
+            m_waiting.pop_front();
+            if ( cb ) cb(nio::SimpleSocketServer::statusOk, m_value);
+        }
+
+        // Reader的缓存可能已移动或扩充，重新挂到接收缓存上
+        this->attachInput(buf);
+    }
+
+    inline
+    void AsyncClient::ImplClass::onSent(int fd, int status, io::ConstBuffer & buf)
+    {
+        if ( !m_sending.empty() ) {
+            delete m_sending.front();
+            m_sending.pop_front();
+        }
+        if ( status != nio::SimpleSocketServer::statusOk ) m_loop.closeChannel(fd);
+    }
+
+    inline
+    void AsyncClient::ImplClass::freeSending()
+    {
+        for ( auto it = m_sending.begin(); it != m_sending.end(); ++it ) delete *it;
+        m_sending.clear();
+    }
+
+    inline
+    void AsyncClient::ImplClass::onClosed(int fd)
+    {
+        m_channel = -1;
+        m_ready   = false;
+        m_handshake = false;
+        m_inbuf.detach();
+        m_reader.reset();
+        this->freeSending();   // 关闭时循环丢弃未发完的缓存，不再回调
+
+        // 已写出的命令结果不确定，按顺序失败；之后的回调中可能再发命令，先取出等待队列
+        CallbackQueue failed;
+        failed.swap(m_waiting);
+        Value value;
+        for ( auto it = failed.begin(); it != failed.end(); ++it ) {
+            if ( *it ) (*it)(nio::SimpleSocketServer::statusError, value);
+        }
+
+        if ( !m_closing ) this->scheduleReconnect();
+    }
+
+    inline
+    void AsyncClient::ImplClass::scheduleReconnect()
+    {
+        if ( m_reconnectInterval < 0 || m_timer >= 0 ) return;
+        std::weak_ptr<ImplClass> weak = this->shared_from_this();
+        m_timer = m_loop.addTimer(m_reconnectInterval, [weak](int timer) {
+            auto self = weak.lock();
+            if ( !self ) return false;
+            self->m_timer = -1;
+            if ( self->m_closing || self->m_channel >= 0 ) return false;
+
+            err::Error e;
+            if ( !self->connect(&e) ) {
+                SYM_TRACE_VA("[error] redis reconnect failed, %s", e.message());
+                self->scheduleReconnect();
+            }
+            return false;
+        });
+    }
+
+} // end namespace redis
+
+END_SYM_NAMESPACE
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <sym/redis/pool.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace redis
+{
+    /// 客户端缓存的统计
+    struct CacheStats {
+        uint64_t hits          { 0 };
+        uint64_t misses        { 0 };
+        uint64_t invalidations { 0 };  ///< 因服务端失效消息、断开连接或clear删除的条目数
+        uint64_t evictions     { 0 };  ///< 超过容量按LRU淘汰的条目数
+    };
+
+    /**
+     * @brief 服务端辅助失效的客户端缓存。
+     *
+     * 连接建立时发送HELLO 3切换到RESP3，并用CLIENT TRACKING ON让服务端记录本连接读过的key，
+     * 这些key被修改、过期或淘汰时，服务端在同一连接上推送invalidate消息。get的结果(包括key不存在)
+     * 存入按条目数限制的LRU缓存，命中时不访问网络；每次查缓存前先不阻塞地处理已到达的推送消息。
+     * 连接断开期间的失效消息会丢失，因此连接关闭时缓存全部清空。非线程安全，每个线程使用各自的客户端。
+     */
+    class CachingClient
+    {
+    private:
+        struct Entry {
+            std::string key;
+            std::string value;
+            bool        exists;
+        };
+        using EntryList = std::list<Entry>;
+
+        net::Address       m_remote;
+        size_t             m_capacity;
+        int                m_timeout { 5000 };
+        Connection         m_conn;
+        EntryList          m_lru;       ///< 最近使用的在前
+        std::unordered_map<std::string, EntryList::iterator> m_index;
+        CacheStats         m_stats;
+
+    public:
+        CachingClient(const net::Address & remote, size_t capacity = 10000);
+        SYM_NONCOPYABLE(CachingClient)
+
+        /// 建立连接并开启跟踪，get和execute在连接关闭时自动调用
+        bool open(err::Error * e = nullptr);
+        void close();
+        bool isOpen() const { return m_conn.isOpen(); }
+
+        /// 读取key，优先使用缓存。key不存在时*exists为false。网络错误或命令错误返回false
+        bool get(const std::string & key, std::string * value, bool * exists, err::Error * e = nullptr);
+
+        /// 执行其他命令，不经过缓存。修改的key由服务端推送失效消息，包括本连接读过的key
+        bool execute(const std::vector<std::string> & args, Value * value, err::Error * e = nullptr);
+
+        /// 清空缓存，统计保留
+        void clear();
+
+        size_t size() const { return m_index.size(); }
+        size_t capacity() const { return m_capacity; }
+        const CacheStats & stats() const { return m_stats; }
+        void   setTimeout(int timeout) { m_timeout = timeout; m_conn.setTimeout(timeout); }
+
+    private:
+        void onPush(Value & value);
+        void invalidate(const std::string & key);
+        void store(const std::string & key, const Value & value);
+    }; // end class CachingClient
+
+} // end namespace redis
+
+namespace redis
+{
+    inline
+    CachingClient::CachingClient(const net::Address & remote, size_t capacity)
+        : m_remote(remote), m_capacity(capacity)
+    {
+        PushHandler handler = [this](Value & value) { this->onPush(value); };
+        m_conn.command().setPushHandler(handler);
+        m_conn.pipeline().setPushHandler(handler);
+    }
+
+    inline
+    bool CachingClient::open(err::Error * e)
+    {
+        this->close();
+        if ( !m_conn.open(m_remote, m_timeout, e) ) return false;
+
+        Value value;
+        if ( !m_conn.command().assign("HELLO", 3).execute(&value, e) ) return false;
+        if ( value.type() != Value::vtMap ) {
+            if ( e ) *e = err::Error(-1, value.type() == Value::vtStatus ? value.getString().c_str() : "RESP3 not supported");
+            m_conn.close();
+            return false;
+        }
+        if ( !m_conn.command().assign("CLIENT", "TRACKING", "ON").execute(&value, e) ) return false;
+        if ( value.type() != Value::vtStatus || !value.status() ) {
+            if ( e ) *e = err::Error(-1, value.type() == Value::vtStatus ? value.getString().c_str() : "enable tracking failed");
+            m_conn.close();
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    void CachingClient::close()
+    {
+        m_conn.close();
+        this->clear();
+    }
+
+    inline
+    void CachingClient::clear()
+    {
+        m_stats.invalidations += m_index.size();
+        m_index.clear();
+        m_lru.clear();
+    }
+
+    inline
+    bool CachingClient::get(const std::string & key, std::string * value, bool * exists, err::Error * e)
+    {
+        if ( !m_conn.isOpen() && !this->open(e) ) return false;
+
+        // 先处理已到达的失效消息，再查缓存
+        if ( m_conn.command().poll(e) < 0 ) {
+            this->close();
+            return false;
+        }
+        auto it = m_index.find(key);
+        if ( it != m_index.end() ) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            ++m_stats.hits;
+            *exists = it->second->exists;
+            if ( *exists ) *value = it->second->value;
+            return true;
+        }
+
+        ++m_stats.misses;
+        Value reply;
+        if ( !m_conn.command().assign("GET", key).execute(&reply, e) ) {
+            this->close();
+            return false;
+        }
+        if ( reply.type() == Value::vtStatus ) {
+            if ( e ) *e = err::Error(-1, reply.getString().c_str());   // 如WRONGTYPE
+            return false;
+        }
+        this->store(key, reply);
+        *exists = ( reply.type() == Value::vtString );
+        if ( *exists ) *value = reply.getString();
+        return true;
+    }
+
+    inline
+    bool CachingClient::execute(const std::vector<std::string> & args, Value * value, err::Error * e)
+    {
+        if ( !m_conn.isOpen() && !this->open(e) ) return false;
+
+        Command & cmd = m_conn.command();
+        cmd.reset();
+        for ( auto it = args.begin(); it != args.end(); ++it ) cmd.append(*it);
+        if ( !cmd.execute(value, e) ) {
+            this->close();
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    void CachingClient::onPush(Value & value)
+    {
+        // ["invalidate", [key ...]]，key列表为空值时表示全部失效，如FLUSHALL
+        Value::ValueList & items = value.list();
+        if ( items.size() < 2 || items[0].type() != Value::vtString || items[0].getString() != "invalidate" ) return;
+        if ( items[1].type() == Value::vtNull ) {
+            this->clear();
+            return;
+        }
+        Value::ValueList & keys = items[1].list();
+        for ( auto it = keys.begin(); it != keys.end(); ++it ) this->invalidate(it->getString());
+    }
+
+    inline
+    void CachingClient::invalidate(const std::string & key)
+    {
+        auto it = m_index.find(key);
+        if ( it == m_index.end() ) return;
+        m_lru.erase(it->second);
+        m_index.erase(it);
+        ++m_stats.invalidations;
+    }
+
+    inline
+    void CachingClient::store(const std::string & key, const Value & value)
+    {
+        if ( m_capacity == 0 ) return;
+        while ( m_index.size() >= m_capacity ) {
+            m_index.erase(m_lru.back().key);
+            m_lru.pop_back();
+            ++m_stats.evictions;
+        }
+        bool exists = ( value.type() == Value::vtString );
+        m_lru.push_front(Entry { key, exists ? value.getString() : std::string(), exists });
+        m_index[key] = m_lru.begin();
+    }
+
+} // end namespace redis
+
+END_SYM_NAMESPACE
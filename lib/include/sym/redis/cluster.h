@@ -0,0 +1,411 @@
+#pragma once
+
+#include <sym/redis/pool.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace redis
+{
+    /// 集群的哈希槽个数
+    static const int clusterSlots = 16384;
+
+    /// CRC16/XMODEM，Redis集群计算哈希槽使用的校验
+    uint16_t crc16(const char * data, size_t len);
+
+    /// key所属的哈希槽。key中包含非空的{...}时只计算第一个花括号中的部分，便于把相关的key放在同一节点。
+    int      key_slot(const char * key, size_t len);
+
+    /**
+     * @brief Redis集群客户端。
+     *
+     * 通过CLUSTER SLOTS加载哈希槽到节点的映射，按命令的key计算哈希槽发送到对应节点，每个节点一个连接。
+     * 收到MOVED时更新该槽的节点并重发，下一次调用前重新加载完整的映射；收到ASK时在目标节点上先发ASKING再重发，
+     * 不修改映射。流水线命令按节点拆分，各节点先发送一批再依次接收，多个节点并行处理。
+     * 非线程安全，每个线程使用各自的客户端。
+     */
+    class ClusterClient
+    {
+    public:
+        using Args = std::vector<std::string>;
+
+    private:
+        struct Node {
+            std::string                 name;   ///< host:port
+            net::Address                addr;
+            std::unique_ptr<Connection> conn;
+        };
+
+        std::vector<std::string>           m_seeds;
+        std::vector<std::unique_ptr<Node>> m_nodes;
+        std::map<std::string, int>         m_nodeIndex;
+        std::vector<int>                   m_slots;
+        int                                m_timeout      { 5000 };
+        int                                m_maxRedirects { 5 };
+        bool                               m_stale        { true };   ///< 需要重新加载映射
+
+    public:
+        /// seeds为"host:port"形式的种子节点，任一节点可用即可加载映射
+        ClusterClient(const std::vector<std::string> & seeds);
+        SYM_NONCOPYABLE(ClusterClient)
+
+        /// 加载哈希槽映射
+        bool refresh(err::Error * e = nullptr);
+
+        /// 执行命令，按args[keyIndex]路由，keyIndex小于0或超出参数个数时发送到任一节点
+        bool execute(const Args & args, Value * value, err::Error * e = nullptr, int keyIndex = 1);
+
+        /// 执行多个命令，按节点拆分后并行发送，回复按命令顺序存入values。重定向的命令逐个重发。
+        bool execute(const std::vector<Args> & cmds, std::vector<Value> * values, err::Error * e = nullptr, int keyIndex = 1);
+
+        void setTimeout(int timeout) { m_timeout = timeout; }
+        void setMaxRedirects(int n)  { m_maxRedirects = n; }
+
+        /// key当前路由到的节点，映射中没有时返回空串
+        std::string nodeOf(const std::string & key) const;
+
+    private:
+        int          nodeByName(const std::string & name, err::Error * e);
+        Connection * connection(int node, err::Error * e);
+        void         dropConnection(int node);
+        int          route(const Args & args, int keyIndex) const;
+        bool         loadSlots(Connection * conn, err::Error * e);
+
+        /// 解析MOVED/ASK错误回复，返回0表示不是重定向，1为MOVED，2为ASK
+        static int   parseRedirect(const Value & value, int * slot, std::string * target);
+    }; // end class ClusterClient
+
+} // end namespace redis
+
+namespace redis
+{
+    /// crc16的查表数据，多项式0x1021
+    struct Crc16Table {
+        uint16_t t[256];
+        Crc16Table() {
+            for ( int i = 0; i < 256; ++i ) {
+                uint16_t c = (uint16_t)(i << 8);
+                for ( int k = 0; k < 8; ++k ) c = (c & 0x8000) ? (uint16_t)((c << 1) ^ 0x1021) : (uint16_t)(c << 1);
+                t[i] = c;
+            }
+        }
+    };
+
+    inline
+    uint16_t crc16(const char * data, size_t len)
+    {
+        static const Crc16Table crcTable;   // 局部静态对象的初始化是线程安全的
+        const uint16_t * table = crcTable.t;
+        uint16_t crc = 0;
+        for ( size_t i = 0; i < len; ++i ) crc = (uint16_t)((crc << 8) ^ table[((crc >> 8) ^ (uint8_t)data[i]) & 0xff]);
+        return crc;
+    }
+
+    inline
+    int key_slot(const char * key, size_t len)
+    {
+        const char * l = (const char *)memchr(key, '{', len);
+        if ( l ) {
+            const char * r = (const char *)memchr(l + 1, '}', key + len - l - 1);
+            if ( r && r > l + 1 ) {
+                key = l + 1;
+                len = r - l - 1;
+            }
+        }
+        return crc16(key, len) & (clusterSlots - 1);
+    }
+
+    inline
+    ClusterClient::ClusterClient(const std::vector<std::string> & seeds)
+        : m_seeds(seeds), m_slots(clusterSlots, -1)
+    {}
+
+    inline
+    int ClusterClient::nodeByName(const std::string & name, err::Error * e)
+    {
+        auto it = m_nodeIndex.find(name);
+        if ( it != m_nodeIndex.end() ) return it->second;
+
+        size_t colon = name.rfind(':');
+        if ( colon == std::string::npos ) {
+            if ( e ) *e = err::Error(-1, "bad node address, host:port expected");
+            return -1;
+        }
+        std::string host = name.substr(0, colon);
+        err::Error error;
+        net::Address addr(host.c_str(), atoi(name.c_str() + colon + 1), &error);
+        if ( error ) {
+            if ( e ) *e = error;
+            return -1;
+        }
+
+        std::unique_ptr<Node> node(new Node());
+        node->name = name;
+        node->addr = addr;
+        m_nodes.push_back(std::move(node));
+        int index = (int)m_nodes.size() - 1;
+        m_nodeIndex[name] = index;
+        return index;
+    }
+
+    inline
+    Connection * ClusterClient::connection(int node, err::Error * e)
+    {
+        Node * n = m_nodes[node].get();
+        if ( n->conn && n->conn->isOpen() ) return n->conn.get();
+        if ( !n->conn ) n->conn.reset(new Connection());
+        if ( !n->conn->open(n->addr, m_timeout, e) ) return nullptr;
+        return n->conn.get();
+    }
+
+    inline
+    void ClusterClient::dropConnection(int node)
+    {
+        if ( m_nodes[node]->conn ) m_nodes[node]->conn->close();
+        m_stale = true;     // 节点故障时映射可能已经变化
+    }
+
+    inline
+    bool ClusterClient::loadSlots(Connection * conn, err::Error * e)
+    {
+        Value value;
+        if ( !conn->command().assign("CLUSTER", "SLOTS").execute(&value, e) ) return false;
+        if ( value.type() != Value::vtList ) {
+            if ( e ) *e = err::Error(-1, ("CLUSTER SLOTS failed, " + value.getString()).c_str());
+            return false;
+        }
+
+        // 每项为[起始槽, 结束槽, [主节点ip, 端口, id], 从节点...]，只使用主节点
+        std::vector<int> slots(clusterSlots, -1);
+        for ( auto it = value.list().begin(); it != value.list().end(); ++it ) {
+            Value::ValueList & item = it->list();
+            if ( item.size() < 3 || item[2].list().size() < 2 ) continue;
+            int64_t from = item[0].getInt(), to = item[1].getInt();
+            std::string name = item[2].list()[0].getString() + ":" + std::to_string(item[2].list()[1].getInt());
+            int node = this->nodeByName(name, e);
+            if ( node < 0 ) return false;
+            for ( int64_t s = std::max<int64_t>(from, 0); s <= to && s < clusterSlots; ++s ) slots[s] = node;
+        }
+        m_slots.swap(slots);
+        m_stale = false;
+        return true;
+    }
+
+    inline
+    bool ClusterClient::refresh(err::Error * e)
+    {
+        // 先尝试已知节点，再尝试种子节点
+        std::vector<std::string> names;
+        for ( auto it = m_nodes.begin(); it != m_nodes.end(); ++it ) names.push_back((*it)->name);
+        names.insert(names.end(), m_seeds.begin(), m_seeds.end());
+
+        for ( auto it = names.begin(); it != names.end(); ++it ) {
+            int node = this->nodeByName(*it, e);
+            if ( node < 0 ) continue;
+            Connection * conn = this->connection(node, e);
+            if ( conn && this->loadSlots(conn, e) ) return true;
+        }
+        return false;
+    }
+
+    inline
+    int ClusterClient::route(const Args & args, int keyIndex) const
+    {
+        if ( keyIndex >= 0 && keyIndex < (int)args.size() ) {
+            const std::string & key = args[keyIndex];
+            int node = m_slots[key_slot(key.data(), key.size())];
+            if ( node >= 0 ) return node;
+        }
+        // 没有key或映射中没有该槽，发送到任一已知节点，必要时由重定向纠正
+        for ( size_t i = 0; i < m_nodes.size(); ++i ) {
+            if ( m_nodes[i]->conn && m_nodes[i]->conn->isOpen() ) return (int)i;
+        }
+        return m_nodes.empty() ? -1 : 0;
+    }
+
+    inline
+    std::string ClusterClient::nodeOf(const std::string & key) const
+    {
+        int node = m_slots[key_slot(key.data(), key.size())];
+        return node >= 0 ? m_nodes[node]->name : std::string();
+    }
+
+    inline
+    int ClusterClient::parseRedirect(const Value & value, int * slot, std::string * target)
+    {
+        if ( value.type() != Value::vtStatus || value.status() ) return 0;
+        std::string msg = value.getString();
+        int kind = msg.compare(0, 6, "MOVED ") == 0 ? 1 : msg.compare(0, 4, "ASK ") == 0 ? 2 : 0;
+        if ( kind == 0 ) return 0;
+
+        // "MOVED 3999 127.0.0.1:6381"
+        size_t p1 = msg.find(' ');
+        size_t p2 = msg.find(' ', p1 + 1);
+        if ( p2 == std::string::npos ) return 0;
+        *slot   = atoi(msg.c_str() + p1 + 1);
+        *target = msg.substr(p2 + 1);
+        return kind;
+    }
+
+    inline
+    bool ClusterClient::execute(const Args & args, Value * value, err::Error * e, int keyIndex)
+    {
+        if ( m_stale ) {
+            err::Error error;
+            if ( !this->refresh(&error) && m_nodes.empty() ) {
+                if ( e ) *e = error;
+                return false;
+            }
+        }
+
+        int  node = this->route(args, keyIndex);
+        bool ask  = false;
+        for ( int redirects = 0; node >= 0; ++redirects ) {
+            Connection * conn = this->connection(node, e);
+            if ( conn == nullptr ) {
+                this->dropConnection(node);
+                return false;
+            }
+
+            bool isok;
+            if ( ask ) {
+                // ASKING只对紧随其后的一个命令有效，两者一次写出
+                std::vector<Value> values;
+                Pipeline & p = conn->pipeline();
+                p.reset();
+                p.append("ASKING").add(args);
+                isok = p.execute(&values, e) && values.size() == 2;
+                if ( isok ) *value = std::move(values[1]);
+            } else {
+                Command & cmd = conn->command();
+                cmd.reset();
+                for ( auto it = args.begin(); it != args.end(); ++it ) cmd.append(Arg(*it));
+                isok = cmd.execute(value, e);
+            }
+            if ( !isok ) {
+                this->dropConnection(node);
+                return false;
+            }
+
+            int slot;
+            std::string target;
+            int kind = parseRedirect(*value, &slot, &target);
+            if ( kind == 0 ) return true;
+            if ( redirects >= m_maxRedirects ) {
+                if ( e ) *e = err::Error(-1, "too many cluster redirects");
+                return false;
+            }
+
+            node = this->nodeByName(target, e);
+            if ( node < 0 ) return false;
+            ask = ( kind == 2 );
+            if ( kind == 1 && slot >= 0 && slot < clusterSlots ) {
+                m_slots[slot] = node;
+                m_stale = true;     // 槽在迁移，下次调用前加载完整映射
+            }
+        }
+        if ( e ) *e = err::Error(-1, "no cluster node available");
+        return false;
+    }
+
+    inline
+    bool ClusterClient::execute(const std::vector<Args> & cmds, std::vector<Value> * values, err::Error * e, int keyIndex)
+    {
+        if ( m_stale ) {
+            err::Error error;
+            if ( !this->refresh(&error) && m_nodes.empty() ) {
+                if ( e ) *e = error;
+                return false;
+            }
+        }
+
+        // 按节点分组，每组的命令编码到该节点连接的流水线
+        std::map<int, std::vector<size_t> > groups;
+        for ( size_t i = 0; i < cmds.size(); ++i ) {
+            int node = this->route(cmds[i], keyIndex);
+            if ( node < 0 ) {
+                if ( e ) *e = err::Error(-1, "no cluster node available");
+                return false;
+            }
+            groups[node].push_back(i);
+        }
+
+        struct Batch {
+            int                         node;
+            Pipeline *                  pipeline;
+            const std::vector<size_t> * indexes;
+            size_t                      from;
+            size_t                      to;
+        };
+        std::vector<Batch> batches;
+        for ( auto it = groups.begin(); it != groups.end(); ++it ) {
+            Connection * conn = this->connection(it->first, e);
+            if ( conn == nullptr ) {
+                this->dropConnection(it->first);
+                return false;
+            }
+            Pipeline & p = conn->pipeline();
+            p.reset();
+            for ( auto ix = it->second.begin(); ix != it->second.end(); ++ix ) p.add(cmds[*ix]);
+            batches.push_back(Batch { it->first, &p, &it->second, 0, 0 });
+        }
+
+        // 出错时，已发出一批但没有收完回复的连接上还有未读的回复，之后的命令会读到错位的回复，一起关闭
+        auto abort = [this, &batches](int node) {
+            this->dropConnection(node);
+            for ( auto b = batches.begin(); b != batches.end(); ++b ) {
+                if ( b->to > b->from ) this->dropConnection(b->node);
+            }
+            return false;
+        };
+
+        values->clear();
+        values->resize(cmds.size());
+        std::vector<size_t> redirected;
+        bool pending = true;
+        while ( pending ) {
+            // 各节点先发送一批，再依次接收，节点之间的往返时间重叠
+            pending = false;
+            for ( auto b = batches.begin(); b != batches.end(); ++b ) {
+                if ( b->from >= b->pipeline->size() ) continue;
+                if ( !b->pipeline->send(b->from, &b->to, e) ) return abort(b->node);
+            }
+            for ( auto b = batches.begin(); b != batches.end(); ++b ) {
+                if ( b->from >= b->pipeline->size() ) continue;
+                const std::vector<size_t> & indexes = *b->indexes;
+                bool isok = b->pipeline->receive(b->from, b->to, [&](size_t index, Value & value) {
+                    size_t global = indexes[index];
+                    int slot;
+                    std::string target;
+                    int kind = parseRedirect(value, &slot, &target);
+                    if ( kind == 0 ) {
+                        (*values)[global] = std::move(value);
+                        return;
+                    }
+                    redirected.push_back(global);
+                    if ( kind == 1 && slot >= 0 && slot < clusterSlots ) {
+                        int node = this->nodeByName(target, nullptr);
+                        if ( node >= 0 ) m_slots[slot] = node;
+                        m_stale = true;
+                    }
+                }, e);
+                if ( !isok ) return abort(b->node);
+                b->from = b->to;
+                if ( b->from < b->pipeline->size() ) pending = true;
+            }
+        }
+
+        // 重定向的命令逐个按新的路由重发
+        for ( auto it = redirected.begin(); it != redirected.end(); ++it ) {
+            if ( !this->execute(cmds[*it], &(*values)[*it], e, keyIndex) ) return false;
+        }
+        return true;
+    }
+
+} // end namespace redis
+
+END_SYM_NAMESPACE
@@ -0,0 +1,421 @@
+#pragma once
+
+#include <sym/redis.h>
+#include <sym/nio.h>
+#include <sym/thread.h>
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace redis
+{
+    /**
+     * @brief 同步Redis连接，包装SocketChannel和在其上执行的Command、Pipeline。
+     *
+     * 发送失败、接收失败或超时后连接关闭，此时连接上可能还有未读的回复，不能继续使用，
+     * 归还连接池时被删除。连接记录在其上确认加载过的脚本，关闭时清空。
+     */
+    class Connection
+    {
+    private:
+        nio::SocketChannel m_channel;
+        int                m_timeout    { 5000 };
+        int64_t            m_lastActive { 0 };
+        Command            m_command;
+        Pipeline           m_pipeline;
+        std::set<std::string> m_scripts;   ///< 已加载的脚本SHA1
+
+    public:
+        Connection();
+        ~Connection() { this->close(); }
+        SYM_NONCOPYABLE(Connection)
+
+        bool open(const net::Address & remote, int timeout, err::Error * e = nullptr);
+        void close();
+        bool isOpen() const { return m_channel.fd() >= 0; }
+
+        /// 连接上的命令对象，如command().assign("GET", key).execute(&value, &e)
+        Command  & command()  { return m_command; }
+        Pipeline & pipeline() { return m_pipeline; }
+
+        /// 发送PING并检查回复
+        bool ping(err::Error * e = nullptr);
+
+        /// 最后一次收到数据的时间，us
+        int64_t lastActive() const { return m_lastActive; }
+
+        /// 脚本是否已在本连接的服务端加载，见execute_with_scripts
+        bool hasScript(const std::string & sha1) const { return m_scripts.count(sha1) > 0; }
+        void addScript(const std::string & sha1) { m_scripts.insert(sha1); }
+        void clearScripts() { m_scripts.clear(); }
+
+        void setTimeout(int timeout);
+
+    private:
+        int  onSend(const char * data, int len, int timeout, err::Error * e);
+        int  onRecv(char * buf, int len, int timeout, err::Error * e);
+    }; // end class Connection
+
+    /**
+     * @brief 线程安全的有界Redis连接池。
+     *
+     * 空闲连接放在固定数量的原子槽位中，checkout和checkin各自从线程固定的起点扫描槽位，
+     * 用一次原子交换取得或放入连接，不经过互斥锁；只有连接数已达上限、需要等待归还时才使用锁和条件变量。
+     * 健康检查由事件循环的定时器触发：空闲超过检查间隔的连接发送PING，失败的删除；
+     * 设置空闲超时后，空闲过久的连接在保留minIdle个之后关闭。PING是阻塞调用，在连接池自己的
+     * 检查线程中执行，定时器只投递检查任务，服务端无响应时不会阻塞事件循环；上一轮检查未结束时跳过本轮。
+     */
+    class Pool
+    {
+    private:
+        net::Address          m_remote;
+        size_t                m_maxSize;
+        std::unique_ptr<std::atomic<Connection *>[]> m_slots;
+        std::atomic<size_t>   m_total   { 0 };    ///< 已建立的连接数，包括取出的和空闲的
+        std::atomic<int>      m_waiters { 0 };
+        mt::mutex_t           m_mutex;
+        pthread_cond_t        m_cond;
+        int                   m_timeout { 5000 };
+
+        nio::SimpleSocketServer * m_loop  { nullptr };
+        int                   m_timer     { -1 };
+        int                   m_interval  { 0 };
+        int                   m_idleTimeout { 0 };
+        size_t                m_minIdle   { 0 };
+        mt::WorkerPool        m_checker;           ///< 执行健康检查的线程
+
+    public:
+        Pool(const net::Address & remote, size_t maxSize = 16);
+        ~Pool();
+        SYM_NONCOPYABLE(Pool)
+
+        /// 取出一个连接，没有空闲连接时新建；连接数已达上限时最多等待wait毫秒，超时返回nullptr
+        Connection * checkout(int wait = 0, err::Error * e = nullptr);
+
+        /// 归还连接，已关闭的连接被删除
+        void     checkin(Connection * conn);
+
+        /// 预先建立n个连接放入池中，不超过连接数上限
+        bool     prewarm(size_t n, err::Error * e = nullptr);
+
+        /// 设置新建连接的连接和读写超时，ms
+        void     setTimeout(int timeout) { m_timeout = timeout; }
+
+        /// 空闲超过timeout毫秒的连接在健康检查时关闭，至少保留minIdle个空闲连接，0表示不关闭
+        void     setIdleTimeout(int timeout, size_t minIdle = 0) { m_idleTimeout = timeout; m_minIdle = minIdle; }
+
+        /// 在事件循环上启动健康检查，interval毫秒。loop的生命周期必须长于连接池。
+        /// 定时器的增删不是线程安全的，keepAlive和stopKeepAlive(包括析构)须在循环线程中或循环未运行时调用。
+        bool     keepAlive(nio::SimpleSocketServer & loop, int interval, err::Error * e = nullptr);
+
+        /// 停止健康检查，等待正在进行的检查结束
+        void     stopKeepAlive();
+
+        size_t   size() const { return m_total.load(); }
+        size_t   idle() const;
+
+    private:
+        size_t   startSlot() const;
+        Connection * takeIdle();
+        bool     putIdle(Connection * conn);
+        void     discard(Connection * conn);
+        void     notifyWaiters();
+        /// 检查空闲连接，在检查线程中执行
+        void     checkIdle();
+    }; // end class Pool
+
+} // end namespace redis
+
+namespace redis
+{
+    inline
+    Connection::Connection()
+        : m_command ([this](const char * d, int n, int t, err::Error * e) { return this->onSend(d, n, t, e); },
+                     [this](char * b, int n, int t, err::Error * e) { return this->onRecv(b, n, t, e); }),
+          m_pipeline([this](const char * d, int n, int t, err::Error * e) { return this->onSend(d, n, t, e); },
+                     [this](char * b, int n, int t, err::Error * e) { return this->onRecv(b, n, t, e); })
+    {
+        this->setTimeout(m_timeout);
+    }
+
+    inline
+    bool Connection::open(const net::Address & remote, int timeout, err::Error * e)
+    {
+        this->close();
+        this->setTimeout(timeout);
+        if ( !m_channel.open(remote, timeout, e) ) return false;
+        m_lastActive = chrono::now();
+        return true;
+    }
+
+    inline
+    void Connection::close()
+    {
+        if ( m_channel.fd() >= 0 ) {
+            m_channel.close();
+            m_channel.detach();
+        }
+        m_scripts.clear();   // 重连后可能是重启过的服务端
+    }
+
+    inline
+    void Connection::setTimeout(int timeout)
+    {
+        m_timeout = timeout;
+        m_command.setTimeout(timeout);
+        m_pipeline.setTimeout(timeout);
+    }
+
+    inline
+    bool Connection::ping(err::Error * e)
+    {
+        Value value;
+        if ( !m_command.assign("PING").execute(&value, e) ) return false;
+        if ( value.type() != Value::vtStatus || !value.status() ) {
+            if ( e ) *e = err::Error(-1, "unexpected PING reply");
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    int Connection::onSend(const char * data, int len, int timeout, err::Error * e)
+    {
+        if ( m_channel.fd() < 0 ) {
+            if ( e ) *e = err::Error(-1, "connection closed");
+            return -1;
+        }
+        io::ConstBuffer buffer(data, len, len);
+        int r = m_channel.sendN(buffer, timeout, e);
+        if ( r != len ) this->close();
+        return r;
+    }
+
+    inline
+    int Connection::onRecv(char * buf, int len, int timeout, err::Error * e)
+    {
+        if ( m_channel.fd() < 0 ) {
+            if ( e ) *e = err::Error(-1, "connection closed");
+            return -1;
+        }
+        io::MutableBuffer buffer(buf, 0, len);
+        int r = m_channel.receiveSome(buffer, timeout, e);
+        if ( r > 0 ) {
+            m_lastActive = chrono::now();
+        } else if ( r < 0 || timeout > 0 ) {
+            this->close();  // 超时后回复可能晚到，连接上的请求和回复不再对应。超时为0只是查看已到达的数据
+        }
+        return r;
+    }
+
+    inline
+    Pool::Pool(const net::Address & remote, size_t maxSize)
+        : m_remote(remote), m_maxSize(maxSize > 0 ? maxSize : 1),
+          m_slots(new std::atomic<Connection *>[m_maxSize])
+    {
+        for ( size_t i = 0; i < m_maxSize; ++i ) m_slots[i].store(nullptr);
+        mt::mutex_init(&m_mutex);
+        pthread_cond_init(&m_cond, nullptr);
+    }
+
+    inline
+    Pool::~Pool()
+    {
+        this->stopKeepAlive();
+        for ( size_t i = 0; i < m_maxSize; ++i ) delete m_slots[i].exchange(nullptr);
+        pthread_cond_destroy(&m_cond);
+        mt::mutex_free(&m_mutex);
+    }
+
+    inline
+    size_t Pool::startSlot() const
+    {
+        // 每个线程固定一个起点，线程之间分散在不同槽位上，减少对同一缓存行的竞争
+        static std::atomic<size_t> seq { 0 };
+        static thread_local size_t slot = seq.fetch_add(1);
+        return slot % m_maxSize;
+    }
+
+    inline
+    Connection * Pool::takeIdle()
+    {
+        size_t start = this->startSlot();
+        for ( size_t i = 0; i < m_maxSize; ++i ) {
+            std::atomic<Connection *> & slot = m_slots[(start + i) % m_maxSize];
+            if ( slot.load(std::memory_order_relaxed) == nullptr ) continue;
+            Connection * conn = slot.exchange(nullptr, std::memory_order_acquire);
+            if ( conn ) return conn;
+        }
+        return nullptr;
+    }
+
+    inline
+    bool Pool::putIdle(Connection * conn)
+    {
+        size_t start = this->startSlot();
+        for ( size_t i = 0; i < m_maxSize; ++i ) {
+            Connection * expect = nullptr;
+            if ( m_slots[(start + i) % m_maxSize].compare_exchange_strong(expect, conn, std::memory_order_release) ) {
+                return true;
+            }
+        }
+        return false;   // 连接数不超过槽位数，不会发生
+    }
+
+    inline
+    void Pool::notifyWaiters()
+    {
+        if ( m_waiters.load() == 0 ) return;
+        mt::mutex_lock(&m_mutex);
+        pthread_cond_signal(&m_cond);
+        mt::mutex_unlock(&m_mutex);
+    }
+
+    inline
+    void Pool::discard(Connection * conn)
+    {
+        delete conn;
+        --m_total;
+        this->notifyWaiters();  // 腾出的名额可以新建连接
+    }
+
+    inline
+    Connection * Pool::checkout(int wait, err::Error * e)
+    {
+        int64_t deadline = chrono::steady_now() + wait * 1000LL;
+        while ( true ) {
+            Connection * conn = this->takeIdle();
+            if ( conn ) return conn;
+
+            // 没有空闲连接，名额未满时新建
+            size_t total = m_total.load();
+            while ( total < m_maxSize ) {
+                if ( !m_total.compare_exchange_weak(total, total + 1) ) continue;
+                conn = new Connection();
+                if ( conn->open(m_remote, m_timeout, e) ) return conn;
+                this->discard(conn);
+                return nullptr;
+            }
+
+            // 等待归还。先登记等待者再检查槽位，归还方放入连接后看到登记就会唤醒
+            int64_t now = chrono::steady_now();
+            if ( now >= deadline ) {
+                if ( e ) *e = err::Error(-1, "redis pool exhausted");
+                return nullptr;
+            }
+            ++m_waiters;
+            mt::mutex_lock(&m_mutex);
+            conn = this->takeIdle();
+            if ( conn == nullptr && m_total.load() >= m_maxSize ) {
+                int64_t abstime = chrono::now() + (deadline - now);
+                struct timespec ts { (time_t)(abstime / 1000000), (long)(abstime % 1000000 * 1000) };
+                pthread_cond_timedwait(&m_cond, &m_mutex, &ts);
+            }
+            mt::mutex_unlock(&m_mutex);
+            --m_waiters;
+            if ( conn ) return conn;
+        }
+    }
+
+    inline
+    void Pool::checkin(Connection * conn)
+    {
+        if ( conn == nullptr ) return;
+        if ( !conn->isOpen() || !this->putIdle(conn) ) {
+            this->discard(conn);
+            return;
+        }
+        this->notifyWaiters();
+    }
+
+    inline
+    bool Pool::prewarm(size_t n, err::Error * e)
+    {
+        std::vector<Connection *> conns;
+        bool isok = true;
+        for ( size_t i = 0; i < n && m_total.load() < m_maxSize; ++i ) {
+            Connection * conn = this->checkout(0, e);
+            if ( conn == nullptr ) {
+                isok = false;
+                break;
+            }
+            conns.push_back(conn);
+        }
+        for ( auto it = conns.begin(); it != conns.end(); ++it ) this->checkin(*it);
+        return isok;
+    }
+
+    inline
+    size_t Pool::idle() const
+    {
+        size_t n = 0;
+        for ( size_t i = 0; i < m_maxSize; ++i ) {
+            if ( m_slots[i].load(std::memory_order_relaxed) ) ++n;
+        }
+        return n;
+    }
+
+    inline
+    bool Pool::keepAlive(nio::SimpleSocketServer & loop, int interval, err::Error * e)
+    {
+        this->stopKeepAlive();
+        if ( !m_checker.start(1, 1, e) ) return false;
+        m_loop = &loop;
+        m_interval = interval;
+        m_timer = loop.addTimer(interval, [this](int timer) {
+            // 只投递，不在循环线程中等待PING回复；队列已满说明上一轮还没结束
+            m_checker.post([this]() { this->checkIdle(); });
+            return true;
+        }, e);
+        if ( m_timer < 0 ) {
+            this->stopKeepAlive();
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    void Pool::stopKeepAlive()
+    {
+        if ( m_loop && m_timer >= 0 ) m_loop->cancelTimer(m_timer);
+        m_loop  = nullptr;
+        m_timer = -1;
+        m_checker.stop();
+    }
+
+    inline
+    void Pool::checkIdle()
+    {
+        // 逐个取出空闲连接检查，期间这些连接不会被checkout
+        int64_t now     = chrono::now();
+        int64_t expire  = now - m_interval * 1000LL;
+        int64_t evict   = now - m_idleTimeout * 1000LL;
+        size_t  idle    = this->idle();
+        for ( size_t i = 0; i < m_maxSize; ++i ) {
+            if ( m_slots[i].load(std::memory_order_relaxed) == nullptr ) continue;
+            Connection * conn = m_slots[i].exchange(nullptr, std::memory_order_acquire);
+            if ( conn == nullptr ) continue;
+
+            if ( m_idleTimeout > 0 && idle > m_minIdle && conn->lastActive() < evict ) {
+                --idle;
+                this->discard(conn);
+                continue;
+            }
+            if ( conn->lastActive() < expire ) {
+                err::Error error;
+                if ( !conn->ping(&error) ) {
+                    SYM_TRACE_VA("[warn] pooled redis connection health check failed, %s", error.message());
+                }
+            }
+            this->checkin(conn);   // 检查失败的连接已关闭，checkin时删除
+        }
+    }
+
+} // end namespace redis
+
+END_SYM_NAMESPACE
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <sym/redis/pool.h>
+#include <sym/utilities/sha1.h>
+
+#include <string>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace redis
+{
+    /// 是否为服务端没有缓存脚本的错误回复
+    bool is_noscript(const Value & value);
+
+    /**
+     * @brief 按SHA1调用的Lua脚本。
+     *
+     * SHA1在本地计算，调用时只发送EVALSHA和摘要，不再每次发送脚本内容，服务端也不用每次解析脚本。
+     * 服务端没有缓存该脚本时(第一次使用、重启或SCRIPT FLUSH之后)回复NOSCRIPT，call自动SCRIPT LOAD后重发。
+     * 对象创建后不再修改，可在多个线程和连接间共用。
+     */
+    class Script
+    {
+    private:
+        std::string m_body;
+        std::string m_sha1;
+
+    public:
+        explicit Script(const std::string & body) : m_body(body), m_sha1(util::sha1_hex(body.data(), body.size())) {}
+
+        const std::string & body() const { return m_body; }
+        const std::string & sha1() const { return m_sha1; }
+
+        /// 用SCRIPT LOAD加载到服务端，可在启动时预先加载
+        bool load(Command & cmd, err::Error * e = nullptr) const;
+
+        /// 执行脚本，numkeys之后依次为key和其他参数，如call(cmd, &value, &e, 1, key, 100)
+        template<class... T>
+        bool call(Command & cmd, Value * value, err::Error * e, int numkeys, const T &... args) const
+        {
+            if ( !cmd.assign("EVALSHA", m_sha1, numkeys, args...).execute(value, e) ) return false;
+            if ( !is_noscript(*value) ) return true;
+            return this->load(cmd, e) && cmd.assign("EVALSHA", m_sha1, numkeys, args...).execute(value, e);
+        }
+
+        /// 向流水线追加一次调用，与普通命令一样只编码参数。用execute_with_scripts执行以处理NOSCRIPT
+        template<class... T>
+        Pipeline & append(Pipeline & pipeline, int numkeys, const T &... args) const
+        {
+            return pipeline.append("EVALSHA", m_sha1, numkeys, args...);
+        }
+    }; // end class Script
+
+    /**
+     * 执行连接上包含脚本调用的流水线，回复按命令顺序存入values。scripts中本连接还没有确认加载的脚本，
+     * 其SCRIPT LOAD插入到流水线最前面一起发出，调用与其他命令保持原来的顺序，执行后流水线恢复原样。
+     * 连接期间服务端清空过脚本(SCRIPT FLUSH)时仍可能回复NOSCRIPT，此时重新加载全部脚本后重发这些调用，
+     * 重发的调用在流水线中其他命令之后执行。
+     */
+    bool execute_with_scripts(Connection & conn, const std::vector<const Script *> & scripts, std::vector<Value> * values,
+        err::Error * e = nullptr);
+
+} // end namespace redis
+
+namespace redis
+{
+    inline
+    bool is_noscript(const Value & value)
+    {
+        return value.type() == Value::vtStatus && !value.status() && value.getString().compare(0, 8, "NOSCRIPT") == 0;
+    }
+
+    inline
+    bool Script::load(Command & cmd, err::Error * e) const
+    {
+        Value value;
+        if ( !cmd.assign("SCRIPT", "LOAD", m_body).execute(&value, e) ) return false;
+        if ( value.type() != Value::vtString || value.getString() != m_sha1 ) {
+            if ( e ) *e = err::Error(-1, value.type() == Value::vtStatus ? value.getString().c_str() : "unexpected SCRIPT LOAD reply");
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    bool execute_with_scripts(Connection & conn, const std::vector<const Script *> & scripts, std::vector<Value> * values,
+        err::Error * e)
+    {
+        Pipeline & pipeline = conn.pipeline();
+
+        // 未确认加载的脚本排在全部命令之前，同一次写出，不多一次往返
+        std::vector<const Script *> loading;
+        for ( auto it = scripts.begin(); it != scripts.end(); ++it ) {
+            if ( conn.hasScript((*it)->sha1()) ) continue;
+            pipeline.insert(loading.size(), { "SCRIPT", "LOAD", (*it)->body() });
+            loading.push_back(*it);
+        }
+        bool isok = pipeline.execute(values, e);
+        pipeline.erase(0, loading.size());
+        if ( !isok ) return false;
+
+        for ( size_t i = 0; i < loading.size(); ++i ) {
+            const Value & value = (*values)[i];
+            if ( value.type() != Value::vtString || value.getString() != loading[i]->sha1() ) {
+                if ( e ) *e = err::Error(-1, value.type() == Value::vtStatus ? value.getString().c_str() : "unexpected SCRIPT LOAD reply");
+                return false;
+            }
+            conn.addScript(loading[i]->sha1());
+        }
+        values->erase(values->begin(), values->begin() + loading.size());
+
+        std::vector<size_t> missing;
+        for ( size_t i = 0; i < values->size(); ++i ) {
+            if ( is_noscript((*values)[i]) ) missing.push_back(i);
+        }
+        if ( missing.empty() ) return true;
+
+        conn.clearScripts();
+        for ( auto it = scripts.begin(); it != scripts.end(); ++it ) {
+            if ( !(*it)->load(conn.command(), e) ) return false;
+            conn.addScript((*it)->sha1());
+        }
+        return pipeline.execute(missing, [values](size_t index, Value & value) { (*values)[index] = std::move(value); }, e);
+    }
+
+} // end namespace redis
+
+END_SYM_NAMESPACE
@@ -0,0 +1,712 @@
+#pragma once
+
+#include <sym/redis.h>
+#include <sym/nio.h>
+#include <sym/thread.h>
+#include <sym/chrono.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace redis
+{
+    /// 订阅收到的一条消息。指针直接指向接收缓存，不以'\0'结尾，只在回调期间有效
+    struct Message {
+        const char * channel;
+        size_t       channelLength;
+        const char * pattern;           ///< 模式订阅(pmessage)匹配的模式，普通订阅为nullptr
+        size_t       patternLength;
+        const char * data;              ///< 消息内容不是字符串(如空值)时为nullptr，length为0
+        size_t       length;
+    };
+
+    class MessageQueue;
+
+    /// 批量交付消息的回调，返回取走的条数，少于count时暂停接收，剩余的消息在resume后重新交付
+    using BatchHandler = std::function<size_t (const Message * messages, size_t count)>;
+
+    /// 订阅者的统计
+    struct SubscriberStats {
+        uint64_t messages { 0 };    ///< 交付的消息数
+        uint64_t batches  { 0 };    ///< 回调次数
+        uint64_t pauses   { 0 };    ///< 回调没有取完一批而暂停接收的次数
+    };
+
+    /**
+     * @brief 基于SimpleSocketServer的发布/订阅客户端，用于高频率的频道。
+     *
+     * 数据直接接收到解码器的缓存中，按零拷贝方式解码，消息内容不复制；一次可读事件中解码出的消息
+     * 合并为一批(最多maxBatch条)调用一次回调，解码用的缓存和批次数组在消息之间重复使用。
+     * 回调返回少于count时停止从连接读取，数据积压在TCP缓冲区和服务端，由服务端的
+     * client-output-buffer-limit pubsub决定何时断开过慢的订阅者；调用resume后继续交付和接收。
+     * 需要在其他线程处理消息时，用setQueue把消息放入有界的MessageQueue，代替回调。
+     *
+     * 订阅的频道和模式记录在本地，断线重连后自动重新订阅，断线期间发布的消息会丢失。
+     * 除构造外的全部方法，以及所有回调，都在事件循环线程中执行。
+     */
+    class Subscriber
+    {
+    private:
+        class ImplClass;
+        std::shared_ptr<ImplClass> m_impl;
+
+    public:
+        Subscriber(nio::SimpleSocketServer & loop, const net::Address & remote);
+        ~Subscriber();
+
+        Subscriber(const Subscriber &) = delete;
+        Subscriber & operator=(const Subscriber &) = delete;
+
+        void setHandler(const BatchHandler & handler);
+
+        /// 把消息放入队列，backpressure策略下由队列的空位通知恢复接收。队列需比订阅者存活更久
+        void setQueue(MessageQueue & queue);
+
+        /// 发起连接，不等待连接完成
+        bool connect(err::Error * e = nullptr);
+
+        /// 连接已建立并收到握手回复
+        bool isConnected() const;
+
+        /// 关闭连接，不再自动重连，订阅记录保留到下次connect
+        void close();
+
+        void subscribe(const std::vector<std::string> & channels);
+        void unsubscribe(const std::vector<std::string> & channels);
+        void psubscribe(const std::vector<std::string> & patterns);
+        void punsubscribe(const std::vector<std::string> & patterns);
+
+        /// 回调暂停接收后继续
+        void resume();
+        bool isPaused() const;
+
+        /// 每次回调最多交付的条数，默认1024
+        void setMaxBatch(size_t n);
+
+        /// 设置断线后的重连间隔，ms，小于0时不自动重连
+        void setReconnectInterval(int ms);
+
+        const SubscriberStats & stats() const;
+    }; // end class Subscriber
+
+    /// 复制到MessageQueue中的消息，字符串在出队时与调用者的对象交换，内存循环使用
+    struct QueuedMessage {
+        std::string channel;
+        std::string pattern;
+        std::string data;
+    };
+
+    /**
+     * @brief 订阅者与处理线程之间的有界消息队列。
+     *
+     * 队列满时按策略处理：dropNewest丢弃新到的消息，dropOldest覆盖最早的消息，
+     * backpressure让订阅者暂停接收，处理线程取走消息后通过事件循环的post恢复。
+     * 槽位在构造时一次分配，入队用assign复用槽位中字符串的容量，出队与调用者的对象交换，稳定运行后不再分配内存。
+     * push在事件循环线程调用，pop可在任意线程调用。
+     */
+    class MessageQueue
+    {
+    public:
+        enum OverflowPolicy {
+            dropNewest,
+            dropOldest,
+            backpressure
+        };
+
+        /// 有空位时的通知，可在任意线程执行
+        using SpaceCallback = std::function<void ()>;
+
+    private:
+        std::vector<QueuedMessage> m_slots;
+        size_t                     m_head    { 0 };
+        size_t                     m_count   { 0 };
+        OverflowPolicy             m_policy;
+        bool                       m_blocked { false };    ///< 因队列满拒绝过消息，等待空位
+        bool                       m_closed  { false };
+        uint64_t                   m_dropped { 0 };
+        SpaceCallback              m_onSpace;
+        mt::mutex_t                m_mutex;
+        pthread_cond_t             m_cond;
+
+    public:
+        MessageQueue(size_t capacity, OverflowPolicy policy = backpressure);
+        ~MessageQueue();
+        SYM_NONCOPYABLE(MessageQueue)
+
+        /// 放入一批消息，返回接受的条数。只有backpressure策略会少于count
+        size_t push(const Message * messages, size_t count);
+
+        /// 取出最多max条消息放到out中，没有消息时最多等待timeout毫秒(-1不超时)，返回取出的条数，0表示超时或已关闭
+        size_t pop(std::vector<QueuedMessage> * out, size_t max, int timeout = -1);
+
+        /// 唤醒全部等待的pop，之后pop不再等待
+        void   close();
+
+        void   setSpaceCallback(const SpaceCallback & callback);
+
+        size_t size();
+        size_t capacity() const { return m_slots.size(); }
+        uint64_t dropped();
+    }; // end class MessageQueue
+
+} // end namespace redis
+
+namespace redis
+{
+    class Subscriber::ImplClass : public std::enable_shared_from_this<Subscriber::ImplClass>
+    {
+    public:
+        nio::SimpleSocketServer & m_loop;
+        net::Address              m_remote;
+        int                       m_channel   { -1 };
+        bool                      m_ready     { false };
+        bool                      m_handshake { false };
+        bool                      m_closing   { false };
+        bool                      m_paused    { false };
+        int                       m_reconnectInterval { 1000 };
+        int                       m_timer     { -1 };
+        size_t                    m_maxBatch  { 1024 };
+
+        std::set<std::string>     m_channels;
+        std::set<std::string>     m_patterns;
+        std::deque<std::vector<char> *> m_sending;
+
+        Reader                    m_reader;
+        Reply                     m_reply;
+        io::MutableBuffer         m_inbuf;
+        std::vector<Message>      m_batch;      ///< 待交付的消息，暂停时保留未取走的部分
+        BatchHandler              m_handler;
+        SubscriberStats           m_stats;
+
+        static const size_t       recvChunk = 64 * 1024;
+
+    public:
+        ImplClass(nio::SimpleSocketServer & loop, const net::Address & remote)
+            : m_loop(loop), m_remote(remote) {}
+        ~ImplClass() { this->freeSending(); }
+
+        bool connect(err::Error * e);
+        void sendCommand(const char * cmd, const std::set<std::string> & names);
+        void sendCommand(const char * cmd, const std::vector<std::string> & names);
+        bool sendBuffer(std::vector<char> * out);
+        void scheduleReconnect();
+        void freeSending();
+
+        bool drain();
+        bool deliver();
+        void onReply(int fd);
+        void resume();
+
+        void onReceived(int fd, int status, io::MutableBuffer & buf);
+        void onSent(int fd, int status, io::ConstBuffer & buf);
+        void onClosed(int fd);
+        void attachInput(io::MutableBuffer & buf);
+    }; // end class Subscriber::ImplClass
+
+    inline
+    Subscriber::Subscriber(nio::SimpleSocketServer & loop, const net::Address & remote)
+        : m_impl(std::make_shared<ImplClass>(loop, remote))
+    {}
+
+    inline
+    Subscriber::~Subscriber()
+    {
+        m_impl->m_handler = nullptr;
+        this->close();
+    }
+
+    inline
+    void Subscriber::setHandler(const BatchHandler & handler)
+    {
+        m_impl->m_handler = handler;
+    }
+
+    inline
+    void Subscriber::setQueue(MessageQueue & queue)
+    {
+        m_impl->m_handler = [&queue](const Message * messages, size_t count) { return queue.push(messages, count); };
+
+        // 空位通知在处理线程中执行，投递到循环线程恢复
+        std::weak_ptr<ImplClass> weak = m_impl;
+        nio::SimpleSocketServer * loop = &m_impl->m_loop;
+        queue.setSpaceCallback([weak, loop]() {
+            loop->post([weak]() {
+                auto self = weak.lock();
+                if ( self ) self->resume();
+            });
+        });
+    }
+
+    inline
+    bool Subscriber::connect(err::Error * e)
+    {
+        m_impl->m_closing = false;
+        if ( m_impl->m_channel >= 0 ) return true;
+        return m_impl->connect(e);
+    }
+
+    inline
+    bool Subscriber::isConnected() const
+    {
+        return m_impl->m_ready;
+    }
+
+    inline
+    void Subscriber::close()
+    {
+        m_impl->m_closing = true;
+        if ( m_impl->m_timer >= 0 ) {
+            m_impl->m_loop.cancelTimer(m_impl->m_timer);
+            m_impl->m_timer = -1;
+        }
+        if ( m_impl->m_channel >= 0 ) m_impl->m_loop.closeChannel(m_impl->m_channel);
+    }
+
+    inline
+    void Subscriber::subscribe(const std::vector<std::string> & channels)
+    {
+        m_impl->m_channels.insert(channels.begin(), channels.end());
+        m_impl->sendCommand("SUBSCRIBE", channels);
+    }
+
+    inline
+    void Subscriber::unsubscribe(const std::vector<std::string> & channels)
+    {
+        // 空列表退订全部，重连后也不再订阅
+        if ( channels.empty() ) m_impl->m_channels.clear();
+        for ( auto it = channels.begin(); it != channels.end(); ++it ) m_impl->m_channels.erase(*it);
+        m_impl->sendCommand("UNSUBSCRIBE", channels);
+    }
+
+    inline
+    void Subscriber::psubscribe(const std::vector<std::string> & patterns)
+    {
+        m_impl->m_patterns.insert(patterns.begin(), patterns.end());
+        m_impl->sendCommand("PSUBSCRIBE", patterns);
+    }
+
+    inline
+    void Subscriber::punsubscribe(const std::vector<std::string> & patterns)
+    {
+        if ( patterns.empty() ) m_impl->m_patterns.clear();
+        for ( auto it = patterns.begin(); it != patterns.end(); ++it ) m_impl->m_patterns.erase(*it);
+        m_impl->sendCommand("PUNSUBSCRIBE", patterns);
+    }
+
+    inline
+    void Subscriber::resume()
+    {
+        m_impl->resume();
+    }
+
+    inline
+    bool Subscriber::isPaused() const
+    {
+        return m_impl->m_paused;
+    }
+
+    inline
+    void Subscriber::setMaxBatch(size_t n)
+    {
+        m_impl->m_maxBatch = std::max<size_t>(n, 1);
+    }
+
+    inline
+    void Subscriber::setReconnectInterval(int ms)
+    {
+        m_impl->m_reconnectInterval = ms;
+    }
+
+    inline
+    const SubscriberStats & Subscriber::stats() const
+    {
+        return m_impl->m_stats;
+    }
+
+    inline
+    bool Subscriber::ImplClass::connect(err::Error * e)
+    {
+        net::Socket sock;
+        bool isok = sock.create(m_remote.af(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, e);
+        if ( !isok ) return false;
+
+        isok = sock.connect(m_remote, e);
+        if ( !isok ) {
+            sock.close();
+            return false;
+        }
+
+        auto self = this->shared_from_this();
+        int fd = sock.fd();
+        m_channel = m_loop.acceptChannel(fd,
+            [self](int fd, int status, io::MutableBuffer & buf) { self->onReceived(fd, status, buf); },
+            [self](int fd, int status, io::ConstBuffer & buf)   { self->onSent(fd, status, buf); },
+            [self](int fd) { self->onClosed(fd); },
+            e);
+        if ( m_channel < 0 ) {
+            sock.close();
+            return false;
+        }
+
+        m_ready = false;
+        m_reader.reset();
+        m_loop.setPartialReceive(m_channel, true);
+        this->attachInput(m_inbuf);
+        m_loop.beginReceive(m_channel, m_inbuf);
+
+        // PING的回复在进入订阅状态之前返回，作为握手；之后恢复全部订阅
+        std::vector<char> * out = new std::vector<char>();
+        encode_args(out, "PING");
+        if ( !this->sendBuffer(out) ) {
+            delete out;
+            m_loop.closeChannel(m_channel);
+            return true;    // 关闭后按断线处理，定时重连
+        }
+        m_handshake = true;
+        this->sendCommand("SUBSCRIBE", m_channels);
+        this->sendCommand("PSUBSCRIBE", m_patterns);
+        return true;
+    }
+
+    inline
+    void Subscriber::ImplClass::sendCommand(const char * cmd, const std::set<std::string> & names)
+    {
+        this->sendCommand(cmd, std::vector<std::string>(names.begin(), names.end()));
+    }
+
+    inline
+    void Subscriber::ImplClass::sendCommand(const char * cmd, const std::vector<std::string> & names)
+    {
+        // 未连接时只记录，连接建立后统一订阅。空的UNSUBSCRIBE表示退订全部，不能省略
+        if ( m_channel < 0 || ( names.empty() && strstr(cmd, "UNSUBSCRIBE") == nullptr ) ) return;
+
+        std::vector<std::string> args;
+        args.reserve(names.size() + 1);
+        args.push_back(cmd);
+        args.insert(args.end(), names.begin(), names.end());
+
+        std::vector<char> * out = new std::vector<char>();
+        encode_command(args, out);
+        if ( !this->sendBuffer(out) ) {
+            delete out;
+            m_loop.closeChannel(m_channel);
+        }
+    }
+
+    inline
+    bool Subscriber::ImplClass::sendBuffer(std::vector<char> * out)
+    {
+        io::ConstBuffer buf(out->data(), out->size(), out->size());
+        if ( !m_loop.send(m_channel, buf) ) return false;
+        m_sending.push_back(out);
+        return true;
+    }
+
+    inline
+    void Subscriber::ImplClass::attachInput(io::MutableBuffer & buf)
+    {
+        size_t avail;
+        char * p = m_reader.prepare(recvChunk, &avail);
+        buf.attach(p, 0, avail);
+    }
+
+    inline
+    void Subscriber::ImplClass::onReceived(int fd, int status, io::MutableBuffer & buf)
+    {
+        if ( status != nio::SimpleSocketServer::statusOk ) {
+            SYM_TRACE_VA("[trace] redis subscriber %d lost", fd);
+            m_loop.closeChannel(fd);
+            return;
+        }
+
+        m_reader.commit(buf.size());
+        if ( !this->drain() ) {
+            // 暂停或出错，不再挂接收缓存，循环停止读取这个连接。已交付的消息仍在Reader的缓存中，不能prepare
+            buf.detach();
+            return;
+        }
+        this->attachInput(buf);
+    }
+
+    inline
+    bool Subscriber::ImplClass::drain()
+    {
+        if ( !m_batch.empty() && !this->deliver() ) return false;
+
+        while ( true ) {
+            err::Error e;
+            int r = m_reader.next(&m_reply, &e);
+            if ( r == Reader::needMore ) break;
+            if ( r == Reader::failed ) {
+                SYM_TRACE_VA("[error] redis subscriber %d, bad reply, %s", m_channel, e.message());
+                m_loop.closeChannel(m_channel);
+                return false;
+            }
+            this->onReply(m_channel);
+            if ( m_batch.size() >= m_maxBatch && !this->deliver() ) return false;
+        }
+        return m_batch.empty() || this->deliver();
+    }
+
+    inline
+    void Subscriber::ImplClass::onReply(int fd)
+    {
+        ValueRef root = m_reply.root();
+        if ( m_handshake ) {
+            m_handshake = false;
+            if ( root.type() == Value::vtStatus && !root.status() ) {
+                SYM_TRACE_VA("[error] redis subscriber handshake failed, %s", root.getString().c_str());
+                m_loop.closeChannel(fd);
+                return;
+            }
+            m_ready = true;
+            return;
+        }
+
+        // RESP2为数组，RESP3为推送消息：[message, channel, data]、[pmessage, pattern, channel, data]、
+        // [smessage, channel, data]，其他(订阅确认等)忽略
+        int type = root.type();
+        if ( type == Value::vtStatus && !root.status() ) {
+            SYM_TRACE_VA("[error] redis subscriber %d, %s", fd, root.getString().c_str());
+            return;
+        }
+        if ( type != Value::vtList && type != Value::vtPush ) return;
+        size_t n = root.size();
+        if ( n < 3 || root[0].type() != Value::vtString ) return;
+
+        ValueRef kind = root[0];
+        Message msg;
+        if ( n == 3 && ( ( kind.length() == 7 && memcmp(kind.data(), "message", 7) == 0 )
+                      || ( kind.length() == 8 && memcmp(kind.data(), "smessage", 8) == 0 ) ) ) {
+            msg.pattern       = nullptr;
+            msg.patternLength = 0;
+        } else if ( n == 4 && kind.length() == 8 && memcmp(kind.data(), "pmessage", 8) == 0 ) {
+            msg.pattern       = root[1].data();
+            msg.patternLength = root[1].length();
+        } else {
+            return;
+        }
+        ValueRef channel = root[n - 2];
+        ValueRef data    = root[n - 1];
+        if ( channel.type() != Value::vtString ) return;
+        bool isString     = ( data.type() == Value::vtString );
+        msg.channel       = channel.data();
+        msg.channelLength = channel.length();
+        msg.data          = isString ? data.data() : nullptr;   // 非字符串节点的位置不指向有效数据
+        msg.length        = isString ? data.length() : 0;
+        m_batch.push_back(msg);
+    }
+
+    inline
+    bool Subscriber::ImplClass::deliver()
+    {
+        size_t count = m_batch.size();
+        size_t taken = m_handler ? std::min(m_handler(m_batch.data(), count), count) : count;
+        if ( m_closing ) return false;          // 回调中关闭了连接
+
+        ++m_stats.batches;
+        m_stats.messages += taken;
+        if ( taken == count ) {
+            m_batch.clear();
+            m_paused = false;
+            return true;
+        }
+        m_batch.erase(m_batch.begin(), m_batch.begin() + taken);
+        if ( !m_paused ) ++m_stats.pauses;
+        m_paused = true;
+        return false;
+    }
+
+    inline
+    void Subscriber::ImplClass::resume()
+    {
+        if ( !m_paused || m_channel < 0 ) return;
+        m_paused = false;
+
+        // 先交付暂停时留下的消息和缓存中已收到的数据，全部交付后再恢复接收
+        if ( !this->drain() ) return;
+        this->attachInput(m_inbuf);
+        m_loop.beginReceive(m_channel, m_inbuf);
+    }
+
+    inline
+    void Subscriber::ImplClass::onSent(int fd, int status, io::ConstBuffer & buf)
+    {
+        if ( !m_sending.empty() ) {
+            delete m_sending.front();
+            m_sending.pop_front();
+        }
+        if ( status != nio::SimpleSocketServer::statusOk ) m_loop.closeChannel(fd);
+    }
+
+    inline
+    void Subscriber::ImplClass::freeSending()
+    {
+        for ( auto it = m_sending.begin(); it != m_sending.end(); ++it ) delete *it;
+        m_sending.clear();
+    }
+
+    inline
+    void Subscriber::ImplClass::onClosed(int fd)
+    {
+        m_channel   = -1;
+        m_ready     = false;
+        m_handshake = false;
+        m_paused    = false;
+        m_batch.clear();        // 指向的缓存随reset失效
+        m_reply.clear();
+        m_inbuf.detach();
+        m_reader.reset();
+        this->freeSending();
+
+        if ( !m_closing ) this->scheduleReconnect();
+    }
+
+    inline
+    void Subscriber::ImplClass::scheduleReconnect()
+    {
+        if ( m_reconnectInterval < 0 || m_timer >= 0 ) return;
+        std::weak_ptr<ImplClass> weak = this->shared_from_this();
+        m_timer = m_loop.addTimer(m_reconnectInterval, [weak](int timer) {
+            auto self = weak.lock();
+            if ( !self ) return false;
+            self->m_timer = -1;
+            if ( self->m_closing || self->m_channel >= 0 ) return false;
+
+            err::Error e;
+            if ( !self->connect(&e) ) {
+                SYM_TRACE_VA("[error] redis subscriber reconnect failed, %s", e.message());
+                self->scheduleReconnect();
+            }
+            return false;
+        });
+    }
+
+    inline
+    MessageQueue::MessageQueue(size_t capacity, OverflowPolicy policy)
+        : m_slots(std::max<size_t>(capacity, 1)), m_policy(policy)
+    {
+        mt::mutex_init(&m_mutex);
+        pthread_cond_init(&m_cond, nullptr);
+    }
+
+    inline
+    MessageQueue::~MessageQueue()
+    {
+        pthread_cond_destroy(&m_cond);
+        mt::mutex_free(&m_mutex);
+    }
+
+    inline
+    size_t MessageQueue::push(const Message * messages, size_t count)
+    {
+        size_t capacity = m_slots.size();
+        size_t i = 0;
+        mt::mutex_lock(&m_mutex);
+        for ( ; i < count; ++i ) {
+            if ( m_count == capacity ) {
+                if ( m_policy == backpressure ) {
+                    m_blocked = true;
+                    break;
+                }
+                ++m_dropped;
+                if ( m_policy == dropNewest ) continue;
+                m_head = ( m_head + 1 ) % capacity;     // dropOldest，最早的槽位留给新消息
+                --m_count;
+            }
+
+            const Message & msg = messages[i];
+            QueuedMessage & slot = m_slots[( m_head + m_count ) % capacity];
+            slot.channel.assign(msg.channel, msg.channelLength);
+            slot.pattern.assign(msg.pattern ? msg.pattern : "", msg.patternLength);
+            slot.data.assign(msg.data ? msg.data : "", msg.length);
+            ++m_count;
+        }
+        pthread_cond_signal(&m_cond);
+        mt::mutex_unlock(&m_mutex);
+        return i;
+    }
+
+    inline
+    size_t MessageQueue::pop(std::vector<QueuedMessage> * out, size_t max, int timeout)
+    {
+        int64_t deadline = chrono::now() + timeout * 1000LL;
+        mt::mutex_lock(&m_mutex);
+        while ( m_count == 0 && !m_closed && timeout != 0 ) {
+            if ( timeout < 0 ) {
+                pthread_cond_wait(&m_cond, &m_mutex);
+                continue;
+            }
+            if ( chrono::now() >= deadline ) break;
+            struct timespec ts { (time_t)(deadline / 1000000), (long)(deadline % 1000000 * 1000) };
+            pthread_cond_timedwait(&m_cond, &m_mutex, &ts);
+        }
+
+        // 与槽位交换字符串，调用者上一批用过的内存回到槽位中
+        size_t n = std::min(m_count, max);
+        if ( out->size() < n ) out->resize(n);
+        size_t capacity = m_slots.size();
+        for ( size_t i = 0; i < n; ++i ) {
+            QueuedMessage & slot = m_slots[m_head];
+            (*out)[i].channel.swap(slot.channel);
+            (*out)[i].pattern.swap(slot.pattern);
+            (*out)[i].data.swap(slot.data);
+            m_head = ( m_head + 1 ) % capacity;
+        }
+        m_count -= n;
+
+        SpaceCallback notify;
+        if ( n > 0 && m_blocked ) {
+            m_blocked = false;
+            notify = m_onSpace;
+        }
+        mt::mutex_unlock(&m_mutex);
+
+        if ( notify ) notify();
+        return n;
+    }
+
+    inline
+    void MessageQueue::close()
+    {
+        mt::mutex_lock(&m_mutex);
+        m_closed = true;
+        pthread_cond_broadcast(&m_cond);
+        mt::mutex_unlock(&m_mutex);
+    }
+
+    inline
+    void MessageQueue::setSpaceCallback(const SpaceCallback & callback)
+    {
+        mt::mutex_lock(&m_mutex);
+        m_onSpace = callback;
+        mt::mutex_unlock(&m_mutex);
+    }
+
+    inline
+    size_t MessageQueue::size()
+    {
+        mt::mutex_lock(&m_mutex);
+        size_t n = m_count;
+        mt::mutex_unlock(&m_mutex);
+        return n;
+    }
+
+    inline
+    uint64_t MessageQueue::dropped()
+    {
+        mt::mutex_lock(&m_mutex);
+        uint64_t n = m_dropped;
+        mt::mutex_unlock(&m_mutex);
+        return n;
+    }
+
+} // end namespace redis
+
+END_SYM_NAMESPACE
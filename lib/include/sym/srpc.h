@@ -3,6 +3,11 @@
 #include <sym/nio.h>
 #include <sym/network.h>
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
 BEGIN_SYM_NAMESPACE
 
 namespace srpc {
@@ -22,8 +27,57 @@ namespace srpc {
 		TYPE_HEARTBEAT_RES = 0x08,   ///< 心跳帧响应
 
         typeServiceRequest  = 0x11,   ///< RPC服务执行请求
-        typeServiceResponse = 0x12   ///< RPC服务执行响应
+        typeServiceResponse = 0x12,   ///< RPC服务执行响应
+        typeStreamRequest   = 0x13,   ///< 流式请求分块
+        typeStreamResponse  = 0x14    ///< 流式响应分块
 	};
+
+    /// 服务执行结果，填入service_header_t::result
+    enum ServiceResult
+    {
+        resultOk       = 0,       ///< 执行成功
+        resultOverload   = 0x101,    ///< 服务端过载，请求未执行，客户端可稍后重试
+        resultBadMessage = 0x102,    ///< 请求报文格式错误，如压缩数据无法解压
+        resultTimeout    = 0x103     ///< 请求在执行前已超过截止时间，未执行
+    };
+
+    /// 登录报文header.option中的特性协商标志。
+    /// 客户端在登录请求中声明支持的特性，服务端在登录响应中返回双方都支持的特性，该连接后续报文按协商结果处理。
+    enum LogonOption
+    {
+        optionCompress = 0x0001,   ///< 支持服务报文体压缩
+        optionLocal    = 0x0002,   ///< 同一主机通过TCP登录时，由服务端在登录响应中给出UNIX域地址，客户端改用该地址
+        optionStream   = 0x0004,   ///< 支持流式请求和响应
+        optionWindow   = 0x0008,   ///< 服务端按负载下发发送窗口(登录和心跳应答)，客户端据此限制并发请求数
+        optionTrace    = 0x0010,   ///< 服务端在服务响应末尾附加trace_stamps_t数据块，记录请求在服务端各阶段的时间
+        optionShm      = 0x0020    ///< UNIX域连接登录后改用共享内存消息环收发报文，见srpc::Server的说明
+    };
+
+    /// \brief 流式分块报文header.option中的标志。
+    ///
+    ///     流式调用的请求和响应都拆成多个分块报文，格式与service_request_t/service_response_t相同，
+    ///     报文体是原始字节而不是数据块序列，不压缩，rpc_body_len为分块长度。同一调用的分块使用相同的sequence，
+    ///     最后一个分块带streamEnd标志，响应的最后一个分块中service.result为调用结果。
+    enum StreamFlag
+    {
+        streamEnd = 0x0001    ///< 最后一个分块
+    };
+
+    /// 服务响应header.option中的标志，与StreamFlag不重叠
+    enum ResponseFlag
+    {
+        responseTraced = 0x0002   ///< 报文体最后一个数据块为trace_stamps_t，不属于服务返回的数据
+    };
+
+    /// 上游请求已超时时下游请求的ttl和task_timeout，收到该值的服务端不执行处理函数，直接返回resultTimeout
+    static const int32_t budgetExpired = INT32_MIN;
+
+    /// 服务报文体压缩类型，填入service_header_t::compress
+    enum CompressType
+    {
+        compressNone = 0,
+        compressLz   = 1     ///< LZ块压缩(与LZ4 block格式兼容)，此时rpc_body_len为压缩前长度
+    };
     
     /// SRPC Message Header
     typedef struct srpc_message_header
@@ -56,9 +110,10 @@ namespace srpc {
     typedef struct sprc_logon_reply {
         srpc_message_header header;
         int32_t result;      ///< 登录结果状态值，参阅下文CCP_LOGONRES_RESULT_宏定义
-	    int16_t window;      ///< 消息发送窗口大小
-	    int16_t suspend;     ///< 服务器满载后，客户端连接需要挂起的时间秒数
+	    int16_t window;      ///< 消息发送窗口大小，协商了optionWindow时为客户端的建议并发请求数
+	    int16_t suspend;     ///< 服务器满载后，客户端连接需要挂起的时间秒数，非0时result为resultOverload
 	    int64_t regcode;     ///< 注册码
+        char    body[0];     ///< 协商了optionLocal时为服务端UNIX域监听地址，不含结尾0
     } logon_reply_t;
 
 #define    RPC_MAX_SERVICE_NAME_LEN  128
@@ -94,10 +149,104 @@ namespace srpc {
         service_header_t service;
         datablock_t      data[0];
     } service_response_t;
+
+    /// 服务端处理请求各阶段的时间戳(us，服务端时钟，网络字节序)，只用于计算服务端内部的时间差
+    typedef struct srpc_trace_stamps {
+        int64_t recv;          ///< 请求报文接收完成
+        int64_t dispatch;      ///< 开始执行(出队)
+        int64_t handler_end;   ///< 处理函数返回
+    } trace_stamps_t;
+
+    /// 数据块视图，指向报文中的数据，不复制。报文缓存释放后失效。
+    struct BlockView {
+        const char * data { nullptr };
+        int32_t      size { 0 };
+
+        BlockView() {}
+        BlockView(const char * d, int32_t n) : data(d), size(n) {}
+
+        std::string str() const { return std::string(data, size); }
+    };
+
+    /**
+     * @brief 报文体中datablock_t序列的只读视图。
+     *
+     * 构造时按报文体长度检查全部数据块，长度越界的数据块及其后的内容不可见，此时valid()返回false。
+     * 迭代器依次返回各数据块的BlockView。
+     */
+    class DataBlocks {
+    public:
+        class iterator {
+        private:
+            const char * m_pos { nullptr };
+        public:
+            iterator() {}
+            explicit iterator(const char * pos) : m_pos(pos) {}
+
+            BlockView  operator*() const;
+            iterator & operator++();
+            iterator   operator++(int) { iterator it = *this; ++*this; return it; }
+            bool operator==(const iterator & other) const { return m_pos == other.m_pos; }
+            bool operator!=(const iterator & other) const { return m_pos != other.m_pos; }
+        }; // end class iterator
+
+    private:
+        const char * m_begin { nullptr };
+        const char * m_end   { nullptr };   ///< 最后一个完整数据块之后
+        size_t       m_count { 0 };
+        bool         m_valid { true };
+
+    public:
+        DataBlocks() {}
+        DataBlocks(const char * body, int32_t size);
+
+        /// 请求报文的数据块，报文体长度按header.length计算，报文必须未压缩
+        explicit DataBlocks(const service_request_t * req);
+
+        iterator begin() const { return iterator(m_begin); }
+        iterator end() const   { return iterator(m_end); }
+        size_t   size() const  { return m_count; }
+        bool     valid() const { return m_valid; }
+
+        /// 第n个数据块，超出范围时返回空视图
+        BlockView at(size_t n) const;
+    }; // end class DataBlocks
     
     /// check the magic of the message.
     bool message_check_magic(const message_t * m);  
 
+    /// \brief 报文头整体字节序转换，一次处理全部多字节字段。
+    ///
+    ///     encode为主机序转网络序，decode为网络序转主机序。magic按原始字节比较，不做转换。dst与src可以相同。
+    void message_header_encode(message_header_t * dst, const message_header_t * src);
+    void message_header_decode(message_header_t * dst, const message_header_t * src);
+
+    /// 服务头整体字节序转换，service_name按原样复制。dst与src可以相同。
+    void service_header_encode(service_header_t * dst, const service_header_t * src);
+    void service_header_decode(service_header_t * dst, const service_header_t * src);
+
+    /// 获取服务名称
+    std::string service_name(const service_header_t * svc);
+
+    /// \brief 计算请求在本机的截止时间(us)。
+    ///
+    ///     ttl和task_timeout按相对预算处理，从本机收到请求的时间arrival起算，取两者中较小者；
+    ///     不使用对端填写的timestamp和task_create_time，主机之间的时钟偏差不影响超时判断。
+    ///     超时值小于等于0的字段视为不限时，都不限时返回0；任一字段为budgetExpired时返回arrival，即到达时已超时。
+    int64_t request_deadline(const service_request_t * req, int64_t arrival);
+
+    /// 截止时间距now的剩余预算，单位毫秒，已超时返回0，deadline为0时返回-1表示不限时。
+    int32_t deadline_remaining(int64_t deadline, int64_t now);
+
+    /// 当前线程正在执行的服务请求的截止时间，没有时返回0。
+    /// Server在调用服务处理函数前设置，处理函数发起下游调用时据此传递剩余预算。
+    int64_t current_deadline();
+    void    set_current_deadline(int64_t deadline);
+
+    /// 按截止时间设置下游请求的ttl、timestamp、task_create_time和task_timeout，deadline为0时不限时，
+    /// 已超时时设为budgetExpired。
+    void    request_set_deadline(service_request_t * req, int64_t deadline);
+
 } // end namespace srpc
 
 namespace srpc {
@@ -108,6 +257,152 @@ namespace srpc {
         return ( m->header.magic == srpc_magic_word);
     }
 
+    inline
+    void message_header_encode(message_header_t * dst, const message_header_t * src)
+    {
+        dst->magic     = src->magic;
+        dst->version   = src->version;
+        dst->domain    = src->domain;
+        dst->length    = io::htob(src->length);
+        dst->sequence  = io::htob(src->sequence);
+        dst->ttl       = io::htob(src->ttl);
+        dst->timestamp = io::htob(src->timestamp);
+        dst->body_type = io::htob(src->body_type);
+        dst->reserved  = io::htob(src->reserved);
+        dst->option    = io::htob(src->option);
+    }
+
+    inline
+    void message_header_decode(message_header_t * dst, const message_header_t * src)
+    {
+        message_header_encode(dst, src);    // 字节交换是对称的
+    }
+
+    inline
+    void service_header_encode(service_header_t * dst, const service_header_t * src)
+    {
+        dst->reg_code            = io::htob(src->reg_code);
+        dst->session_id          = io::htob(src->session_id);
+        dst->tenant_id           = io::htob(src->tenant_id);
+        dst->task_create_time    = io::htob(src->task_create_time);
+        dst->task_timeout        = io::htob(src->task_timeout);
+        dst->result              = io::htob(src->result);
+        dst->rpc_body_len        = io::htob(src->rpc_body_len);
+        dst->compress            = src->compress;
+        dst->encrypt             = src->encrypt;
+        dst->service_name_length = io::htob(src->service_name_length);
+        if ( dst != src ) memcpy(dst->service_name, src->service_name, sizeof(dst->service_name));
+    }
+
+    inline
+    void service_header_decode(service_header_t * dst, const service_header_t * src)
+    {
+        service_header_encode(dst, src);
+    }
+
+    inline
+    BlockView DataBlocks::iterator::operator*() const
+    {
+        int32_t len;
+        memcpy(&len, m_pos, sizeof(len));
+        return BlockView(m_pos + sizeof(int32_t), io::btoh(len));
+    }
+
+    inline
+    DataBlocks::iterator & DataBlocks::iterator::operator++()
+    {
+        int32_t len;
+        memcpy(&len, m_pos, sizeof(len));
+        m_pos += sizeof(int32_t) + io::btoh(len);
+        return *this;
+    }
+
+    inline
+    DataBlocks::DataBlocks(const char * body, int32_t size)
+        : m_begin(body), m_end(body)
+    {
+        const char * limit = body + (size > 0 ? size : 0);
+        while ( m_end < limit ) {
+            int32_t len;
+            if ( limit - m_end < (ptrdiff_t)sizeof(len) ) break;
+            memcpy(&len, m_end, sizeof(len));
+            len = io::btoh(len);
+            if ( len < 0 || len > limit - m_end - (ptrdiff_t)sizeof(len) ) break;
+            m_end += sizeof(len) + len;
+            ++m_count;
+        }
+        m_valid = ( m_end == limit );
+    }
+
+    inline
+    DataBlocks::DataBlocks(const service_request_t * req)
+        : DataBlocks((const char *)req->data, io::btoh(req->header.length) - (int32_t)sizeof(service_request_t))
+    {}
+
+    inline
+    BlockView DataBlocks::at(size_t n) const
+    {
+        if ( n >= m_count ) return BlockView();
+        iterator it = this->begin();
+        while ( n-- > 0 ) ++it;
+        return *it;
+    }
+
+    inline 
+    std::string service_name(const service_header_t * svc)
+    {
+        int len = io::btoh(svc->service_name_length);
+        if ( len < 0 ) len = 0;
+        if ( len > RPC_MAX_SERVICE_NAME_LEN ) len = RPC_MAX_SERVICE_NAME_LEN;
+        return std::string(svc->service_name, len);
+    }
+
+    inline 
+    int64_t request_deadline(const service_request_t * req, int64_t arrival)
+    {
+        int32_t budget  = io::btoh(req->header.ttl);
+        int32_t timeout = io::btoh(req->service.task_timeout);
+        if ( budget == budgetExpired || timeout == budgetExpired ) return arrival;
+        if ( timeout > 0 && ( budget <= 0 || timeout < budget ) ) budget = timeout;
+        return budget > 0 ? arrival + budget * 1000LL : 0;
+    }
+
+    inline 
+    int32_t deadline_remaining(int64_t deadline, int64_t now)
+    {
+        if ( deadline == 0 ) return -1;
+        if ( deadline <= now ) return 0;
+        int64_t ms = (deadline - now) / 1000;
+        return ms > INT32_MAX ? INT32_MAX : (int32_t)ms;
+    }
+
+    inline 
+    int64_t & current_deadline_ref()
+    {
+        static thread_local int64_t deadline = 0;
+        return deadline;
+    }
+
+    inline 
+    int64_t current_deadline() { return current_deadline_ref(); }
+
+    inline 
+    void set_current_deadline(int64_t deadline) { current_deadline_ref() = deadline; }
+
+    inline 
+    void request_set_deadline(service_request_t * req, int64_t deadline)
+    {
+        int64_t now = chrono::now();
+        int32_t remain = deadline_remaining(deadline, now);
+        if ( remain < 0 ) remain = 0;                    // 不限时
+        else if ( remain == 0 ) remain = budgetExpired;  // 已超时，由下游直接拒绝
+
+        req->header.timestamp = io::htob(now);
+        req->header.ttl = io::htob(remain);
+        req->service.task_create_time = io::htob(now);
+        req->service.task_timeout = io::htob(remain);
+    }
+
 } // end namespace srpc 
 
 END_SYM_NAMESPACE
@@ -0,0 +1,940 @@
+#pragma once
+
+#include <sym/srpc.h>
+#include <sym/thread.h>
+#include <sym/io/lz.h>
+#include <sym/io/shm_ring.h>
+#include <sym/utilities/histogram.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace srpc {
+
+    /// 服务调用结果
+    struct Reply {
+        int                      result { resultOk };   ///< service_header_t::result
+        std::vector<std::string> blocks;               ///< 响应数据块
+    };
+
+    /// 单个服务的调用耗时分布，us
+    struct TraceStats {
+        util::Histogram total;      ///< 客户端观察到的调用耗时
+        util::Histogram network;    ///< 总耗时减去服务端驻留时间，包括网络传输和双方的收发处理
+        util::Histogram queue;      ///< 服务端从接收完成到开始执行，即排队时间
+        util::Histogram handler;    ///< 服务端处理函数执行时间
+    };
+    typedef std::map<std::string, TraceStats> TraceStatsMap;
+
+    /// 按服务名汇总调用耗时，线程安全，可由多个客户端共用
+    class TraceCollector {
+    private:
+        mt::mutex_t   m_mutex;
+        TraceStatsMap m_stats;
+
+    public:
+        TraceCollector()  { mt::mutex_init(&m_mutex); }
+        ~TraceCollector() { mt::mutex_free(&m_mutex); }
+        SYM_NONCOPYABLE(TraceCollector)
+
+        /// 记录一次调用，total为客户端测得的耗时，stamps为服务端时间戳(主机字节序)
+        void record(const std::string & service, int64_t total, const trace_stamps_t & stamps);
+
+        TraceStatsMap snapshot();
+        void reset();
+    }; // end class TraceCollector
+
+    /**
+     * @brief 同步SRPC客户端，call一个连接同一时间只执行一个调用。
+     *
+     * 也可以用send连续发出多个调用再用receive逐个收取响应(流水线)，两种方式不能在同一连接上交错使用。
+     * open时完成连接和登录，并协商压缩等特性。在服务处理函数中调用时，
+     * 自动按current_deadline()把剩余预算传递给下游请求。
+     * UNIX域连接协商optionShm后，报文经服务端创建的共享内存消息环收发，超出环容量的报文仍走套接字。
+     */
+    class Client {
+    private:
+        nio::SocketChannel m_channel;
+        io::ShmRing        m_shmOut;              ///< 协商optionShm后的请求环
+        io::ShmRing        m_shmIn;               ///< 协商optionShm后的响应环
+        int                m_timeout  { 5000 };   ///< 调用超时，毫秒
+        int                m_options  { 0 };      ///< 登录协商的特性
+        int                m_domain   { 0 };      ///< 报文头的应用域，服务端据此选择优先级类别
+        int                m_window   { 0 };      ///< 服务端下发的建议并发请求数，0表示未协商optionWindow
+        int                m_inflight { 0 };      ///< 已发出未收到响应的请求数
+        int64_t            m_suspendUntil { 0 };  ///< 服务端要求挂起到该时刻(steady时钟)，期间open直接失败
+        TraceCollector *   m_trace    { nullptr };
+        int64_t            m_regcode  { 0 };
+        int32_t            m_sequence { 0 };
+        int64_t            m_lastActive { 0 };    ///< 最后一次收发报文的时间
+        int                m_compressThreshold { 512 };
+        size_t             m_streamChunk { 64 * 1024 };
+        std::vector<char>  m_sendbuf;
+        std::vector<char>  m_recvbuf;
+
+    public:
+        Client() {}
+        ~Client() { this->close(); }
+        SYM_NONCOPYABLE(Client)
+
+        /// 连接服务端并登录，options为希望启用的特性(LogonOption组合)。
+        /// 声明optionLocal且服务端确认在同一主机时，自动改用服务端的UNIX域地址，在UNIX域连接上再协商optionShm。
+        /// 服务端满载拒绝登录时返回false，错误码为resultOverload，挂起时间内再次open不连接直接失败。
+        bool open(const net::Address & remote, int options = optionCompress | optionLocal | optionShm, err::Error * e = nullptr);
+        void close();
+        bool isOpen() const { return m_channel.fd() >= 0; }
+
+        /// 调用服务，blocks为请求数据块。返回false表示网络或协议错误，连接已不可用；
+        /// 服务执行结果见reply->result。
+        bool call(const std::string & service, const std::vector<std::string> & blocks, Reply * reply, err::Error * e = nullptr);
+
+        /// 发出调用不等待响应，sequence输出请求序号。在途请求数已达到服务端下发的窗口时不发送，
+        /// 返回false，错误码为resultOverload，连接仍可用，收取响应后再发；其他情况返回false时连接已关闭
+        bool send(const std::string & service, const std::vector<std::string> & blocks, int32_t * sequence, err::Error * e = nullptr);
+
+        /// 接收下一个服务响应，sequence输出对应请求的序号。服务端不保证按发送顺序响应，流水线调用不记录耗时统计。
+        /// 返回false时连接已关闭
+        bool receive(int32_t * sequence, Reply * reply, err::Error * e = nullptr);
+
+        /// 流式请求数据源，向buf写入不超过cap字节并返回写入的长度，返回0表示请求结束
+        typedef std::function<size_t (char * buf, size_t cap)> StreamSource;
+        /// 流式响应分块回调
+        typedef std::function<void (const char * data, size_t size)> StreamSink;
+
+        /// \brief 流式调用，请求和响应都分块传输，需要服务端支持optionStream。
+        ///
+        ///     按分块大小从source读取请求数据逐块发送，发送间隙收取已到达的响应分块交给sink，
+        ///     请求发送完后继续收取直到响应结束。服务端提前结束响应时停止读取source。
+        ///     result为服务端返回的调用结果。返回false表示网络或协议错误，连接已不可用。
+        bool callStream(const std::string & service, const StreamSource & source, const StreamSink & sink,
+                        int * result, err::Error * e = nullptr);
+
+        /// 设置流式请求的分块大小，默认64KB
+        void setStreamChunkSize(size_t size) { m_streamChunk = size; }
+
+        /// 发送心跳并等待应答
+        bool heartbeat(err::Error * e = nullptr);
+
+        int     options() const    { return m_options; }
+        int64_t lastActive() const { return m_lastActive; }
+        void    setTimeout(int timeout) { m_timeout = timeout; }
+        /// 设置后续报文的应用域(0~255)
+        void    setDomain(int domain)   { m_domain = domain; }
+        /// 服务端在登录或最近一次心跳时下发的建议并发请求数，0表示不限制
+        int     window() const          { return m_window; }
+        /// 已发出未收到响应的请求数
+        int     inflight() const        { return m_inflight; }
+        int64_t suspendUntil() const    { return m_suspendUntil; }
+
+        /// 设置耗时统计，之后open的连接协商optionTrace，服务响应附带服务端时间戳并记录到collector。
+        /// collector的生命周期必须长于客户端，nullptr表示不统计。
+        void    setTraceCollector(TraceCollector * collector) { m_trace = collector; }
+
+    private:
+        /// 填写报文头，sequence为0时分配新的序号
+        void initHeader(message_header_t * header, int32_t length, int16_t type, int32_t sequence = 0);
+        /// 解码m_recvbuf中的服务响应，服务端附带的时间戳从数据块中去掉，存入stamps
+        bool decodeReply(Reply * reply, trace_stamps_t * stamps, bool * traced, err::Error * e);
+        bool logon(int options, std::string * localPath, err::Error * e);
+        /// 接收服务端在登录响应之后传来的消息环描述字
+        bool attachShm(err::Error * e);
+        bool sendMessage(err::Error * e);
+        /// 接收指定类型的报文，sequence为0时接收任意序号
+        bool receiveMessage(int32_t sequence, int16_t type, err::Error * e);
+        /// 从套接字接收一个完整报文到m_recvbuf
+        bool receiveFrame(err::Error * e);
+        /// 从响应环或套接字接收一个完整报文到m_recvbuf，两者都没有数据时等待
+        bool receiveShm(err::Error * e);
+        /// 是否有已到达的报文，不等待
+        bool readable();
+        bool sendStreamChunk(const std::string & service, int32_t sequence, size_t size, bool last, err::Error * e);
+        bool receiveStreamChunk(int32_t sequence, const StreamSink & sink, int * result, bool * end, err::Error * e);
+    }; // end class Client
+
+    /**
+     * @brief 到同一个服务端的客户端连接池，线程安全。
+     *
+     * keepAlive在指定的事件循环上注册定时器，定时向空闲超过间隔的池内连接发送心跳，
+     * 保持连接不被服务端空闲超时关闭，心跳失败的连接从池中删除。心跳是阻塞调用，在连接池自己的
+     * 探测线程中执行，定时器只投递探测任务，对端无响应时不会阻塞事件循环；上一轮探测未结束时跳过本轮。
+     *
+     * 服务端协商optionWindow时，同时取出的连接数不超过最近一次登录或心跳得到的窗口；
+     * 服务端要求挂起时，挂起期间不建立新连接。两种情况checkout都直接失败，错误码为resultOverload，
+     * 由调用方降级处理，不在客户端排队。
+     */
+    class ClientPool {
+    private:
+        net::Address          m_remote;
+        int                   m_options;
+        size_t                m_maxIdle;
+        mt::mutex_t           m_mutex;
+        std::vector<Client *> m_idle;
+        nio::SimpleSocketServer * m_loop  { nullptr };
+        int                   m_timer     { -1 };
+        int                   m_interval  { 0 };
+        size_t                m_active    { 0 };   ///< 已取出未归还的连接数
+        int                   m_window    { 0 };   ///< 服务端下发的窗口，0表示不限制
+        int64_t               m_suspendUntil { 0 };
+        TraceCollector *      m_trace     { nullptr };
+        mt::WorkerPool        m_prober;            ///< 执行心跳的线程
+
+    public:
+        ClientPool(const net::Address & remote, int options = optionCompress | optionLocal | optionShm, size_t maxIdle = 16);
+        ~ClientPool();
+        SYM_NONCOPYABLE(ClientPool)
+
+        /// 取出一个连接，池中没有空闲连接时新建。超出服务端窗口或服务端要求挂起时返回nullptr。
+        Client * checkout(err::Error * e = nullptr);
+
+        /// 归还连接，已关闭的连接或池已满时删除
+        void     checkin(Client * client);
+
+        /// 预先建立n个连接放入池中
+        bool     prewarm(size_t n, err::Error * e = nullptr);
+
+        /// 之后新建的连接记录耗时统计到collector，见Client::setTraceCollector
+        void     setTraceCollector(TraceCollector * collector) { m_trace = collector; }
+
+        /// 在事件循环上启动心跳保活，interval毫秒，应小于服务端空闲超时。
+        /// 定时器的增删不是线程安全的，keepAlive和stopKeepAlive(包括析构)须在循环线程中或循环未运行时调用。
+        /// loop的生命周期必须长于连接池。
+        bool     keepAlive(nio::SimpleSocketServer & loop, int interval, err::Error * e = nullptr);
+
+        /// 停止保活，等待正在进行的探测结束
+        void     stopKeepAlive();
+
+    private:
+        /// 向空闲超过间隔的连接发送心跳，在探测线程中执行
+        void     probeIdle();
+        /// 连接放回空闲列表并更新窗口，不改变取出计数
+        void     release(Client * client);
+    }; // end class ClientPool
+
+} // end namespace srpc
+
+namespace srpc {
+
+    inline
+    void Client::initHeader(message_header_t * header, int32_t length, int16_t type, int32_t sequence)
+    {
+        message_header_t h;
+        h.magic     = srpc_magic_word;
+        h.version   = 1;
+        h.domain    = (char)m_domain;
+        h.length    = length;
+        h.sequence  = sequence != 0 ? sequence : ++m_sequence;
+        h.ttl       = m_timeout;
+        h.timestamp = chrono::now();
+        h.body_type = type;
+        h.reserved  = 0;
+        h.option    = 0;
+        message_header_encode(header, &h);
+    }
+
+    inline
+    bool Client::open(const net::Address & remote, int options, err::Error * e)
+    {
+        if ( chrono::steady_now() < m_suspendUntil ) {
+            if ( e ) *e = err::Error(resultOverload, "server suspended, retry later");
+            return false;
+        }
+
+        // 已经是UNIX域地址时不需要再协商切换；消息环只在UNIX域连接上协商
+        int shm = options & optionShm;
+        if ( remote.isUnix() ) options &= ~optionLocal;
+        else options &= ~optionShm;
+        if ( !m_channel.open(remote, m_timeout, e) ) return false;
+
+        // 流水线请求是连续的小报文，Nagle会让后一个请求等前一个的延迟确认
+        if ( !remote.isUnix() ) {
+            net::Socket sock(m_channel.fd());
+            net::SocketOptNoDelay(sock, 1);
+        }
+
+        std::string path;
+        if ( !this->logon(options, &path, e) ) {
+            this->close();
+            return false;
+        }
+        if ( !( m_options & optionLocal ) ) return true;
+
+        // 服务端确认同一主机，改用UNIX域连接重新登录；失败时继续使用原连接
+        err::Error error;
+        net::Address local(path.c_str(), &error);
+        int     tcpfd      = m_channel.detach();
+        int     tcpOptions = m_options & ~optionLocal;
+        int64_t tcpRegcode = m_regcode;
+        if ( local.isUnix() && m_channel.open(local, m_timeout, &error) ) {
+            if ( this->logon(( options & ~optionLocal ) | shm, nullptr, &error) ) {
+                ::close(tcpfd);
+                return true;
+            }
+            m_channel.close();
+            m_channel.detach();
+            m_shmOut.close();
+            m_shmIn.close();
+        }
+
+        SYM_TRACE_VA("[warn] switch to local transport %s failed, %s", path.c_str(), error.message());
+        m_channel.attach(tcpfd);
+        m_options = tcpOptions;
+        m_regcode = tcpRegcode;
+        return true;
+    }
+
+    inline
+    bool Client::logon(int options, std::string * localPath, err::Error * e)
+    {
+        const char * client = "symx";
+        const char * server = "srpc";
+        int16_t clen = strlen(client), slen = strlen(server);
+        int32_t length = sizeof(logon_request_t) + clen + slen;
+
+        m_sendbuf.resize(length);
+        logon_request_t * req = (logon_request_t *)&m_sendbuf[0];
+        this->initHeader(&req->header, length, typeLogonRequest);
+        options |= optionStream | optionWindow;   // 是否使用流式调用由调用方决定；窗口总是遵从
+        if ( m_trace ) options |= optionTrace;
+        req->header.option = io::htob((int32_t)options);
+        req->client_length = io::htob(clen);
+        req->server_length = io::htob(slen);
+        memcpy(req->body, client, clen);
+        memcpy(req->body + clen, server, slen);
+
+        int32_t sequence = m_sequence;
+        if ( !this->sendMessage(e) || !this->receiveMessage(sequence, typeLogonResponse, e) ) return false;
+        if ( m_recvbuf.size() < sizeof(logon_reply_t) ) {
+            if ( e ) *e = err::Error(-1, "bad logon reply length");
+            return false;
+        }
+
+        const logon_reply_t * reply = (const logon_reply_t *)&m_recvbuf[0];
+        int16_t suspend = io::btoh(reply->suspend);
+        if ( suspend > 0 ) {
+            m_suspendUntil = chrono::steady_now() + suspend * 1000000LL;
+        }
+        if ( io::btoh(reply->result) != 0 ) {
+            if ( e ) *e = err::Error(io::btoh(reply->result), "logon rejected");
+            return false;
+        }
+        m_options = io::btoh(reply->header.option) & options;
+        m_regcode = io::btoh(reply->regcode);
+        m_window  = ( m_options & optionWindow ) ? std::max(1, (int)io::btoh(reply->window)) : 0;
+
+        size_t pathlen = m_recvbuf.size() - sizeof(logon_reply_t);
+        if ( ( m_options & optionLocal ) && ( localPath == nullptr || pathlen == 0 ) ) m_options &= ~optionLocal;
+        if ( m_options & optionLocal ) localPath->assign(reply->body, pathlen);
+        if ( m_options & optionShm ) return this->attachShm(e);
+        return true;
+    }
+
+    inline
+    bool Client::attachShm(err::Error * e)
+    {
+        struct pollfd pfd { m_channel.fd(), POLLIN, 0 };
+        int r = ::poll(&pfd, 1, m_timeout);
+        if ( r <= 0 ) {
+            if ( e ) *e = r == 0 ? err::Error(-1, "receive timeout") : err::Error(errno, err::dmSystem);
+            return false;
+        }
+
+        // 依次为请求环和响应环的memFd、dataFd、spaceFd，attach失败时描述字已关闭
+        int fds[6];
+        int n = net::Socket(m_channel.fd()).receiveFds(fds, 6, e);
+        if ( n != 6 ) {
+            for ( int i = 0; i < n; ++i ) ::close(fds[i]);
+            if ( n >= 0 && e ) *e = err::Error(-1, "bad shared memory fds");
+            return false;
+        }
+        if ( !m_shmOut.attach(fds[0], fds[1], fds[2], e) ) {
+            for ( int i = 3; i < 6; ++i ) ::close(fds[i]);
+            return false;
+        }
+        if ( !m_shmIn.attach(fds[3], fds[4], fds[5], e) ) {
+            m_shmOut.close();
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    void Client::close()
+    {
+        if ( m_channel.fd() >= 0 ) {
+            m_channel.close();
+            m_channel = nio::SocketChannel();
+        }
+        m_shmOut.close();
+        m_shmIn.close();
+        m_options  = 0;
+        m_inflight = 0;
+    }
+
+    inline
+    bool Client::call(const std::string & service, const std::vector<std::string> & blocks, Reply * reply, err::Error * e)
+    {
+        int32_t sequence;
+        int64_t begin = chrono::steady_now();
+        if ( !this->send(service, blocks, &sequence, e) ) return false;
+
+        trace_stamps_t stamps;
+        bool traced;
+        if ( !this->receiveMessage(sequence, typeServiceResponse, e) || !this->decodeReply(reply, &stamps, &traced, e) ) {
+            this->close();
+            return false;
+        }
+        --m_inflight;
+        if ( traced && m_trace ) m_trace->record(service, chrono::steady_now() - begin, stamps);
+        return true;
+    }
+
+    inline
+    bool Client::receive(int32_t * sequence, Reply * reply, err::Error * e)
+    {
+        trace_stamps_t stamps;
+        bool traced;
+        if ( !this->receiveMessage(0, typeServiceResponse, e) || !this->decodeReply(reply, &stamps, &traced, e) ) {
+            this->close();
+            return false;
+        }
+        --m_inflight;
+        *sequence = io::btoh(((const message_header_t *)&m_recvbuf[0])->sequence);
+        return true;
+    }
+
+    inline
+    bool Client::send(const std::string & service, const std::vector<std::string> & blocks, int32_t * sequence, err::Error * e)
+    {
+        // 超出窗口的请求由调用方降级处理，不在客户端排队
+        if ( m_window > 0 && m_inflight >= m_window ) {
+            if ( e ) *e = err::Error(resultOverload, "server window exhausted");
+            return false;
+        }
+
+        int32_t bodylen = 0;
+        for ( auto it = blocks.begin(); it != blocks.end(); ++it ) bodylen += sizeof(int32_t) + it->size();
+
+        int16_t namelen = service.size() > RPC_MAX_SERVICE_NAME_LEN ? RPC_MAX_SERVICE_NAME_LEN : service.size();
+        bool compress = ( m_options & optionCompress ) && bodylen >= m_compressThreshold;
+
+        // 压缩时报文体先写到接收缓存暂存，再压缩到发送缓存
+        std::vector<char> & bodybuf = compress ? m_recvbuf : m_sendbuf;
+        size_t offset = compress ? 0 : sizeof(service_request_t);
+        bodybuf.resize(offset + bodylen);
+        char * p = bodybuf.data() + offset;
+        for ( auto it = blocks.begin(); it != blocks.end(); ++it ) {
+            int32_t len = it->size();
+            int32_t blen = io::htob(len);
+            memcpy(p, &blen, sizeof(blen));
+            memcpy(p + sizeof(blen), it->data(), len);
+            p += sizeof(blen) + len;
+        }
+
+        int32_t wirelen = bodylen;
+        if ( compress ) {
+            m_sendbuf.resize(sizeof(service_request_t) + io::lz_compress_bound(bodylen));
+            int n = io::lz_compress(m_recvbuf.data(), bodylen, &m_sendbuf[sizeof(service_request_t)],
+                (int)(m_sendbuf.size() - sizeof(service_request_t)));
+            if ( n > 0 && n < bodylen ) {
+                wirelen = n;
+            } else {
+                // 压缩后没有变小，按原文发送
+                compress = false;
+                memcpy(&m_sendbuf[sizeof(service_request_t)], m_recvbuf.data(), bodylen);
+            }
+        }
+        m_sendbuf.resize(sizeof(service_request_t) + wirelen);
+
+        service_request_t * req = (service_request_t *)&m_sendbuf[0];
+        int32_t length = sizeof(service_request_t) + wirelen;
+        this->initHeader(&req->header, length, typeServiceRequest);
+
+        service_header_t svc;
+        memset(&svc, 0, sizeof(svc));
+        svc.reg_code         = m_regcode;
+        svc.task_create_time = io::btoh(req->header.timestamp);
+        svc.task_timeout     = m_timeout;
+        svc.rpc_body_len     = bodylen;
+        svc.compress         = compress ? compressLz : compressNone;
+        svc.service_name_length = namelen;
+        memcpy(svc.service_name, service.data(), namelen);
+        service_header_encode(&req->service, &svc);
+
+        // 在服务处理函数中发起的下游调用，传递剩余预算
+        int64_t deadline = current_deadline();
+        if ( deadline != 0 ) request_set_deadline(req, deadline);
+
+        *sequence = m_sequence;
+        if ( !this->sendMessage(e) ) {
+            this->close();
+            return false;
+        }
+        ++m_inflight;
+        return true;
+    }
+
+    inline
+    bool Client::decodeReply(Reply * reply, trace_stamps_t * stamps, bool * traced, err::Error * e)
+    {
+        *traced = false;
+        if ( m_recvbuf.size() < sizeof(service_response_t) ) {
+            if ( e ) *e = err::Error(-1, "bad service response length");
+            return false;
+        }
+
+        const service_response_t * resp = (const service_response_t *)&m_recvbuf[0];
+        reply->result = io::btoh(resp->service.result);
+        reply->blocks.clear();
+
+        const char * body = (const char *)resp->data;
+        int32_t size = m_recvbuf.size() - sizeof(service_response_t);
+        std::vector<char> raw;
+        if ( resp->service.compress == compressLz ) {
+            int32_t rawlen = io::btoh(resp->service.rpc_body_len);
+            raw.resize(rawlen > 0 ? rawlen : 0);
+            if ( rawlen < 0 || io::lz_decompress(body, size, raw.data(), rawlen) != rawlen ) {
+                if ( e ) *e = err::Error(-1, "bad compressed service response");
+                return false;
+            }
+            body = raw.data();
+            size = rawlen;
+        }
+
+        DataBlocks rblocks(body, size);
+        if ( !rblocks.valid() ) {
+            if ( e ) *e = err::Error(-1, "bad data block length");
+            return false;
+        }
+        for ( auto it = rblocks.begin(); it != rblocks.end(); ++it ) reply->blocks.push_back((*it).str());
+
+        // 最后一个数据块为服务端时间戳，不返回给调用方
+        if ( ( io::btoh(resp->header.option) & responseTraced ) && !reply->blocks.empty()
+          && reply->blocks.back().size() == sizeof(trace_stamps_t) ) {
+            const trace_stamps_t * p = (const trace_stamps_t *)reply->blocks.back().data();
+            stamps->recv        = io::btoh(p->recv);
+            stamps->dispatch    = io::btoh(p->dispatch);
+            stamps->handler_end = io::btoh(p->handler_end);
+            reply->blocks.pop_back();
+            *traced = true;
+        }
+        return true;
+    }
+
+    inline
+    bool Client::callStream(const std::string & service, const StreamSource & source, const StreamSink & sink,
+                            int * result, err::Error * e)
+    {
+        if ( !( m_options & optionStream ) ) {
+            if ( e ) *e = err::Error(-1, "stream is not supported by the server");
+            return false;
+        }
+
+        int32_t sequence = ++m_sequence;
+        bool end = false;     // 响应已结束
+        bool sent = false;    // 请求已结束
+        *result = resultOk;
+        while ( !sent ) {
+            m_sendbuf.resize(sizeof(service_request_t) + m_streamChunk);
+            size_t n = end ? 0 : source(&m_sendbuf[sizeof(service_request_t)], m_streamChunk);
+            sent = ( n == 0 );
+            if ( !this->sendStreamChunk(service, sequence, n, sent, e) ) {
+                this->close();
+                return false;
+            }
+
+            // 收取已经到达的响应分块，避免双方都阻塞在发送上
+            while ( !end && this->readable() ) {
+                if ( !this->receiveStreamChunk(sequence, sink, result, &end, e) ) {
+                    this->close();
+                    return false;
+                }
+            }
+        }
+
+        while ( !end ) {
+            if ( !this->receiveStreamChunk(sequence, sink, result, &end, e) ) {
+                this->close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline
+    bool Client::sendStreamChunk(const std::string & service, int32_t sequence, size_t size, bool last, err::Error * e)
+    {
+        m_sendbuf.resize(sizeof(service_request_t) + size);
+        service_request_t * req = (service_request_t *)&m_sendbuf[0];
+        int32_t length = sizeof(service_request_t) + size;
+        this->initHeader(&req->header, length, typeStreamRequest, sequence);   // 同一个流的分块使用相同的sequence
+        req->header.option = io::htob((int32_t)( last ? streamEnd : 0 ));
+
+        int16_t namelen = service.size() > RPC_MAX_SERVICE_NAME_LEN ? RPC_MAX_SERVICE_NAME_LEN : service.size();
+        service_header_t svc;
+        memset(&svc, 0, sizeof(svc));
+        svc.reg_code         = m_regcode;
+        svc.task_create_time = io::btoh(req->header.timestamp);
+        svc.task_timeout     = m_timeout;
+        svc.rpc_body_len     = size;
+        svc.compress         = compressNone;
+        svc.service_name_length = namelen;
+        memcpy(svc.service_name, service.data(), namelen);
+        service_header_encode(&req->service, &svc);
+
+        int64_t deadline = current_deadline();
+        if ( deadline != 0 ) request_set_deadline(req, deadline);
+        return this->sendMessage(e);
+    }
+
+    inline
+    bool Client::receiveStreamChunk(int32_t sequence, const StreamSink & sink, int * result, bool * end, err::Error * e)
+    {
+        if ( !this->receiveMessage(sequence, typeStreamResponse, e) ) return false;
+        if ( m_recvbuf.size() < sizeof(service_response_t) ) {
+            if ( e ) *e = err::Error(-1, "bad stream response length");
+            return false;
+        }
+
+        const service_response_t * resp = (const service_response_t *)&m_recvbuf[0];
+        size_t size = m_recvbuf.size() - sizeof(service_response_t);
+        if ( size > 0 ) sink((const char *)resp->data, size);
+        if ( io::btoh(resp->header.option) & streamEnd ) {
+            *result = io::btoh(resp->service.result);
+            *end = true;
+        }
+        return true;
+    }
+
+    inline
+    bool Client::heartbeat(err::Error * e)
+    {
+        m_sendbuf.resize(sizeof(message_header_t));
+        this->initHeader((message_header_t *)&m_sendbuf[0], sizeof(message_header_t), TYPE_HEARTBEAT_REQ);
+
+        int32_t sequence = m_sequence;
+        if ( !this->sendMessage(e) || !this->receiveMessage(sequence, TYPE_HEARTBEAT_RES, e) ) {
+            this->close();
+            return false;
+        }
+        if ( m_options & optionWindow ) {
+            // 心跳应答的header.option为服务端当前的窗口，满载时为0，已有连接按最小窗口继续使用
+            int32_t window = io::btoh(((const message_header_t *)&m_recvbuf[0])->option);
+            m_window = std::max(1, (int)window);
+        }
+        return true;
+    }
+
+    inline
+    bool Client::sendMessage(err::Error * e)
+    {
+        if ( m_shmOut.isOpen() && m_sendbuf.size() <= m_shmOut.maxMessage() ) {
+            if ( !m_shmOut.write(m_sendbuf.data(), m_sendbuf.size(), m_timeout, e) ) return false;
+            m_lastActive = chrono::now();
+            return true;
+        }
+
+        io::ConstBuffer buffer(m_sendbuf.data(), m_sendbuf.size(), m_sendbuf.size());
+        int r = m_channel.sendN(buffer, m_timeout, e);
+        if ( r != (int)m_sendbuf.size() ) {
+            if ( r == 0 && e ) *e = err::Error(-1, "send timeout");
+            return false;
+        }
+        m_lastActive = chrono::now();
+        return true;
+    }
+
+    inline
+    bool Client::receiveMessage(int32_t sequence, int16_t type, err::Error * e)
+    {
+        if ( !( m_shmIn.isOpen() ? this->receiveShm(e) : this->receiveFrame(e) ) ) return false;
+
+        message_header_t header;
+        message_header_decode(&header, (const message_header_t *)m_recvbuf.data());
+        if ( ( sequence != 0 && header.sequence != sequence ) || header.body_type != type ) {
+            if ( e ) *e = err::Error(-1, "unexpected message");
+            return false;
+        }
+        m_lastActive = chrono::now();
+        return true;
+    }
+
+    inline
+    bool Client::receiveFrame(err::Error * e)
+    {
+        m_recvbuf.resize(sizeof(message_header_t));
+        io::MutableBuffer head(m_recvbuf.data(), 0, m_recvbuf.size());
+        head.limit(sizeof(message_header_t));
+        int r = m_channel.receiveN(head, m_timeout, e);
+        if ( r != (int)sizeof(message_header_t) ) {
+            if ( r == 0 && e ) *e = err::Error(-1, "receive timeout");
+            return false;
+        }
+
+        message_header_t header;
+        message_header_decode(&header, (const message_header_t *)m_recvbuf.data());
+        int32_t length = header.length;
+        if ( header.magic != srpc_magic_word || length < (int32_t)sizeof(message_header_t) ) {
+            if ( e ) *e = err::Error(-1, "unexpected message");
+            return false;
+        }
+
+        if ( length > (int32_t)sizeof(message_header_t) ) {
+            m_recvbuf.resize(length);
+            io::MutableBuffer body(m_recvbuf.data(), sizeof(message_header_t), length);
+            r = m_channel.receiveN(body, m_timeout, e);
+            if ( r != length - (int32_t)sizeof(message_header_t) ) {
+                if ( r == 0 && e ) *e = err::Error(-1, "receive timeout");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline
+    bool Client::receiveShm(err::Error * e)
+    {
+        int64_t deadline = chrono::steady_now() + m_timeout * 1000LL;
+        while ( true ) {
+            size_t size;
+            const char * p = m_shmIn.peek(&size);
+            if ( p != nullptr ) {
+                m_recvbuf.assign(p, p + size);
+                m_shmIn.pop();
+                message_header_t header;
+                if ( size >= sizeof(message_header_t) ) message_header_decode(&header, (const message_header_t *)m_recvbuf.data());
+                if ( size < sizeof(message_header_t) || header.magic != srpc_magic_word || header.length != (int32_t)size ) {
+                    if ( e ) *e = err::Error(-1, "unexpected message");
+                    return false;
+                }
+                return true;
+            }
+            if ( m_shmIn.corrupt() ) {
+                if ( e ) *e = err::Error(-1, "shared memory ring is corrupt");
+                return false;
+            }
+            if ( !m_shmIn.prepareWait() ) continue;
+
+            // 超出环容量的报文和连接关闭都从套接字到达
+            int64_t left = deadline - chrono::steady_now();
+            struct pollfd pfds[2] = { { m_shmIn.dataFd(), POLLIN, 0 }, { m_channel.fd(), POLLIN, 0 } };
+            int r = left > 0 ? ::poll(pfds, 2, (int)((left + 999) / 1000)) : 0;
+            if ( r == 0 ) {
+                if ( e ) *e = err::Error(-1, "receive timeout");
+                return false;
+            }
+            if ( r < 0 && errno != EINTR ) {
+                if ( e ) *e = err::Error(errno, err::dmSystem);
+                return false;
+            }
+            if ( r > 0 && pfds[1].revents != 0 ) return this->receiveFrame(e);
+            m_shmIn.clearDoorbell();
+        }
+    }
+
+    inline
+    bool Client::readable()
+    {
+        size_t size;
+        if ( m_shmIn.isOpen() && m_shmIn.peek(&size) != nullptr ) return true;
+        struct pollfd pfd { m_channel.fd(), POLLIN, 0 };
+        return ::poll(&pfd, 1, 0) > 0;
+    }
+
+} // end namespace srpc
+
+namespace srpc {
+
+    inline
+    void TraceCollector::record(const std::string & service, int64_t total, const trace_stamps_t & stamps)
+    {
+        // 服务端时间戳只取差值，不受两端时钟偏差影响
+        int64_t queue   = stamps.dispatch - stamps.recv;
+        int64_t handler = stamps.handler_end - stamps.dispatch;
+        mt::mutex_lock(&m_mutex);
+        TraceStats & stats = m_stats[service];
+        stats.total.record(total);
+        stats.network.record(total - queue - handler);
+        stats.queue.record(queue);
+        stats.handler.record(handler);
+        mt::mutex_unlock(&m_mutex);
+    }
+
+    inline
+    TraceStatsMap TraceCollector::snapshot()
+    {
+        mt::mutex_lock(&m_mutex);
+        TraceStatsMap stats = m_stats;
+        mt::mutex_unlock(&m_mutex);
+        return stats;
+    }
+
+    inline
+    void TraceCollector::reset()
+    {
+        mt::mutex_lock(&m_mutex);
+        m_stats.clear();
+        mt::mutex_unlock(&m_mutex);
+    }
+
+    inline
+    ClientPool::ClientPool(const net::Address & remote, int options, size_t maxIdle)
+        : m_remote(remote), m_options(options), m_maxIdle(maxIdle)
+    {
+        mt::mutex_init(&m_mutex);
+    }
+
+    inline
+    ClientPool::~ClientPool()
+    {
+        this->stopKeepAlive();
+        for ( auto it = m_idle.begin(); it != m_idle.end(); ++it ) delete *it;
+        mt::mutex_free(&m_mutex);
+    }
+
+    inline
+    Client * ClientPool::checkout(err::Error * e)
+    {
+        Client * client = nullptr;
+        mt::mutex_lock(&m_mutex);
+        if ( m_window > 0 && m_active >= (size_t)m_window ) {
+            mt::mutex_unlock(&m_mutex);
+            if ( e ) *e = err::Error(resultOverload, "server window exhausted");
+            return nullptr;
+        }
+        if ( !m_idle.empty() ) {
+            client = m_idle.back();
+            m_idle.pop_back();
+        } else if ( chrono::steady_now() < m_suspendUntil ) {
+            mt::mutex_unlock(&m_mutex);
+            if ( e ) *e = err::Error(resultOverload, "server suspended, retry later");
+            return nullptr;
+        }
+        ++m_active;
+        mt::mutex_unlock(&m_mutex);
+        if ( client ) return client;
+
+        client = new Client();
+        client->setTraceCollector(m_trace);
+        bool isok = client->open(m_remote, m_options, e);
+        mt::mutex_lock(&m_mutex);
+        if ( isok ) {
+            if ( client->window() > 0 ) m_window = client->window();
+        } else {
+            --m_active;
+            m_suspendUntil = std::max(m_suspendUntil, client->suspendUntil());
+        }
+        mt::mutex_unlock(&m_mutex);
+        if ( isok ) return client;
+        delete client;
+        return nullptr;
+    }
+
+    inline
+    void ClientPool::checkin(Client * client)
+    {
+        if ( client == nullptr ) return;
+        mt::mutex_lock(&m_mutex);
+        --m_active;
+        mt::mutex_unlock(&m_mutex);
+        this->release(client);
+    }
+
+    inline
+    void ClientPool::release(Client * client)
+    {
+        if ( client->isOpen() ) {
+            mt::mutex_lock(&m_mutex);
+            if ( client->window() > 0 ) m_window = client->window();
+            if ( m_idle.size() < m_maxIdle ) {
+                m_idle.push_back(client);
+                client = nullptr;
+            }
+            mt::mutex_unlock(&m_mutex);
+        }
+        delete client;
+    }
+
+    inline
+    bool ClientPool::prewarm(size_t n, err::Error * e)
+    {
+        std::vector<Client *> clients;
+        bool isok = true;
+        for ( size_t i = 0; i < n; ++i ) {
+            Client * client = new Client();
+            client->setTraceCollector(m_trace);
+            if ( !client->open(m_remote, m_options, e) ) {
+                mt::mutex_lock(&m_mutex);
+                m_suspendUntil = std::max(m_suspendUntil, client->suspendUntil());
+                mt::mutex_unlock(&m_mutex);
+                delete client;
+                isok = false;
+                break;
+            }
+            clients.push_back(client);
+        }
+        for ( auto it = clients.begin(); it != clients.end(); ++it ) this->release(*it);
+        return isok;
+    }
+
+    inline
+    bool ClientPool::keepAlive(nio::SimpleSocketServer & loop, int interval, err::Error * e)
+    {
+        this->stopKeepAlive();
+        if ( !m_prober.start(1, 1, e) ) return false;
+        m_loop = &loop;
+        m_interval = interval;
+        m_timer = loop.addTimer(interval, [this](int timer) {
+            // 只投递，不在循环线程中等待心跳应答；队列已满说明上一轮还没结束
+            m_prober.post([this]() { this->probeIdle(); });
+            return true;
+        }, e);
+        if ( m_timer < 0 ) {
+            this->stopKeepAlive();
+            return false;
+        }
+        return true;
+    }
+
+    inline
+    void ClientPool::stopKeepAlive()
+    {
+        if ( m_loop && m_timer >= 0 ) m_loop->cancelTimer(m_timer);
+        m_loop  = nullptr;
+        m_timer = -1;
+        m_prober.stop();
+    }
+
+    inline
+    void ClientPool::probeIdle()
+    {
+        // 取出空闲超过间隔的连接，在锁外发送心跳，期间这些连接不会被checkout
+        int64_t expire = chrono::now() - m_interval * 1000LL;
+        std::vector<Client *> stale;
+        mt::mutex_lock(&m_mutex);
+        for ( size_t i = 0; i < m_idle.size(); ) {
+            if ( m_idle[i]->lastActive() < expire ) {
+                stale.push_back(m_idle[i]);
+                m_idle[i] = m_idle.back();
+                m_idle.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        mt::mutex_unlock(&m_mutex);
+
+        for ( auto it = stale.begin(); it != stale.end(); ++it ) {
+            err::Error error;
+            if ( !(*it)->heartbeat(&error) ) {
+                SYM_TRACE_VA("[warn] pooled connection heartbeat failed, %s", error.message());
+            }
+            this->release(*it);   // 心跳失败的连接已关闭，release时删除
+        }
+    }
+
+} // end namespace srpc
+
+END_SYM_NAMESPACE
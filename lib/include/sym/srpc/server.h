@@ -0,0 +1,1725 @@
+#pragma once
+
+#include <sym/srpc.h>
+#include <sym/thread.h>
+#include <sym/io/lz.h>
+#include <sym/io/shm_ring.h>
+#include <sym/utilities/buffer_pool.h>
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+BEGIN_SYM_NAMESPACE
+
+namespace srpc {
+
+    /**
+     * @brief 服务响应构造器，由Server创建后交给服务处理函数填写数据块。
+     *
+     * 响应报文直接写入缓存池分配的输出缓存，空间不足时按级别扩充。addBlockRef引用请求报文中的数据块而不复制，
+     * 发送时输出缓存和被引用的数据按顺序分段进入连接的发送队列，请求缓存在全部发送完成后才释放。
+     * 小于minRefSize的数据块分段发送的开销大于复制，仍然复制。
+     */
+    class Response {
+        friend class Server;
+    public:
+        static const int32_t minRefSize = 4096;
+
+        /// 在输出缓存offset处插入的引用数据
+        struct Segment {
+            size_t       offset;
+            const char * data;
+            int32_t      size;
+        };
+
+    private:
+        util::BufferPool *        m_pool     { nullptr };
+        const service_request_t * m_request  { nullptr };   ///< 可被引用的请求报文
+        char *                    m_buf      { nullptr };
+        size_t                    m_cap      { 0 };
+        size_t                    m_size     { 0 };         ///< 输出缓存已写入长度
+        size_t                    m_refBytes { 0 };         ///< 引用的数据总长
+        std::vector<Segment>      m_segments;
+        char *                    m_hold     { nullptr };   ///< 发送完成前需要保留的请求缓存
+        size_t                    m_holdCap  { 0 };
+        bool                      m_traced   { false };     ///< 已附加trace_stamps_t数据块
+        trace_stamps_t            m_trace;                  ///< 附加的时间戳，主机字节序
+
+    public:
+        Response() {}
+        Response(util::BufferPool & pool, const service_request_t * req);
+
+        void   setResult(int32_t result) { this->header()->service.result = io::htob(result); }
+
+        /// 复制一个数据块
+        void   addBlock(const char * data, int32_t size);
+        void   addBlock(const std::string & value) { this->addBlock(value.data(), (int32_t)value.size()); }
+
+        /// 引用请求报文中的数据块，view不在请求报文内时复制
+        void   addBlockRef(const BlockView & view);
+
+        /// 预留size字节的数据块，返回数据写入位置，下一次添加数据块前有效
+        char * allocBlock(int32_t size);
+
+        service_response_t * header() { return (service_response_t *)m_buf; }
+
+        /// 报文总长，包括引用的数据
+        size_t length() const { return m_size + m_refBytes; }
+
+    private:
+        void   reserve(size_t n);
+        void   finish();
+        void   copyBody(char * dst) const;
+        void   assign(char * p, size_t size, size_t cap);
+        void   hold(char * p, size_t cap) { m_hold = p; m_holdCap = cap; }
+        void   release();
+    }; // end class Response
+
+    /// 服务请求处理函数。in为完整的请求报文(已解压)，响应数据块写入out，报文头由Server填写。
+    typedef std::function<void (const service_request_t * in, Response & out)> ServiceHandler;
+
+    class Server;
+
+    /**
+     * @brief 流式调用的服务端上下文，同一个流的所有分块共用。
+     *
+     * 请求分块按到达顺序交给StreamHandler，同一个流不会并发回调。处理函数用write分块返回响应，
+     * 处理完成后调用finish；最后一个请求分块处理完仍未finish时，Server以resultOk结束该流。
+     * finish之后到达的请求分块不再回调。连接在流结束前关闭时，以空分块和last=true回调一次，此时aborted()为true。
+     */
+    class Stream {
+        friend class Server;
+    private:
+        Server *          m_server   { nullptr };
+        int               m_fd       { -1 };
+        uint64_t          m_serial   { 0 };
+        bool              m_inline   { false };     ///< 处理函数在事件循环线程执行
+        bool              m_finished { false };
+        bool              m_aborted  { false };
+        void *            m_context  { nullptr };
+        service_request_t m_request;                ///< 第一个分块的报文头，网络字节序
+        int64_t           m_deadline { 0 };         ///< 按第一个分块到达时间计算的截止时间
+
+    public:
+        /// 第一个请求分块的报文头(网络字节序)，报文体不可访问
+        const service_request_t & request() const { return m_request; }
+        std::string service() const { return service_name(&m_request.service); }
+
+        /// 处理函数自行管理的上下文，在最后一次回调中释放
+        void * context() const       { return m_context; }
+        void   setContext(void * ctx) { m_context = ctx; }
+
+        /// 写响应数据，超过分块上限时拆成多个分块。数据复制后立即返回，不等待发送完成。
+        void   write(const char * data, size_t size);
+        void   write(const std::string & data) { this->write(data.data(), data.size()); }
+
+        /// 结束响应，发送带streamEnd标志的空分块
+        void   finish(int32_t result = resultOk);
+
+        bool   finished() const { return m_finished; }
+        bool   aborted() const  { return m_aborted; }
+
+    private:
+        void   sendChunk(const char * data, size_t size, int32_t flags, int32_t result);
+    }; // end class Stream
+
+    /// 流式请求处理函数，chunk在返回后失效，last表示该流的最后一次回调
+    typedef std::function<void (Stream & stream, const BlockView & chunk, bool last)> StreamHandler;
+
+    /// 协商了optionTrace的请求在服务端的处理时间线，us
+    struct TraceRecord {
+        std::string service;
+        int32_t     sequence;
+        int64_t     recv;           ///< 请求报文接收完成
+        int64_t     dispatch;       ///< 开始执行
+        int64_t     handlerEnd;     ///< 处理函数返回
+        int64_t     sendComplete;   ///< 响应全部写入socket，尚未完成时为0
+    };
+
+    /// 单个服务的压缩统计，用于评估压缩是否值得
+    struct CompressCounter {
+        uint64_t compressCount   { 0 };   ///< 响应压缩次数
+        uint64_t decompressCount { 0 };   ///< 请求解压次数
+        uint64_t skipCount       { 0 };   ///< 压缩后未变小而按原文发送的次数
+        uint64_t rawBytes        { 0 };   ///< 压缩前总字节数
+        uint64_t packedBytes     { 0 };   ///< 压缩后总字节数
+        uint64_t cpuNanos        { 0 };   ///< 压缩和解压消耗的CPU时间，纳秒
+    };
+    typedef std::map<std::string, CompressCounter> CompressCounterMap;
+
+    /**
+     * @brief SRPC服务端。
+     *
+     * 基于SimpleSocketServer事件循环，完成报文收发、连接登录和服务请求分派：
+     *      1. 所有网络操作都在事件循环线程执行。
+     *      2. 启动工作线程池后，服务处理函数在工作线程执行，响应报文投递回事件循环，
+     *         同一次循环迭代内完成的响应批量发送，网络I/O延迟与处理函数耗时无关。
+     *      3. 工作队列已满时不执行处理函数，直接返回resultOverload响应。
+     *      4. 请求到达时按ttl和task_timeout计算截止时间，已超时的请求不执行处理函数，直接返回resultTimeout；
+     *         排队的请求按截止时间从早到晚执行，出队时再次检查；处理函数中可通过current_deadline()获取截止时间传递给下游调用。
+     *      5. 登录时协商optionCompress后，压缩的请求先解压再交给处理函数，超过阈值的响应压缩后发送。
+     *         压缩和解压在处理函数所在线程执行，缓存从缓存池分配。
+     *      6. 心跳请求在报文接收层直接应答，不经过服务分派；设置空闲超时后，由事件循环定时器
+     *         关闭超时未收到任何报文的连接。
+     *      7. 处理函数通过Response把数据块直接写入缓存池分配的输出缓存，较大的请求数据块可按引用原样返回。
+     *      8. 可同时监听TCP和UNIX域地址，同一主机的客户端登录时协商optionLocal切换到UNIX域连接。
+     *      9. 设置StreamHandler后支持流式调用(optionStream)，请求按分块交给处理函数，响应分块返回，
+     *         内存占用取决于分块大小而不是报文总长。连接上待处理的分块或待发送的数据过多时暂停接收；
+     *         工作队列已满时流不在事件循环线程处理，连接暂停接收，定时重新投递。
+     *     10. 按报文头的domain把请求分派到不同的优先级类别，各类别有独立的工作队列和上限，工作线程按权重
+     *         加权公平地取任务；健康检查等极轻量的域可直接在事件循环线程执行，不受工作线程积压影响。
+     *     11. 设置过载保护后协商optionWindow，登录和心跳应答按负载(所属类别的队列占用、事件循环延迟)
+     *         下发建议并发数，满载时拒绝登录并要求客户端挂起若干秒。
+     *     12. 客户端协商optionTrace后，服务响应末尾附带接收、开始执行、处理函数返回的时间戳，
+     *         由客户端统计网络、排队和处理耗时；设置跟踪环后，服务端同时记录包括发送完成时间的最近若干条时间线。
+     *     13. UNIX域连接登录时协商optionShm后，服务端创建请求和响应两个共享内存消息环，登录响应发送完后
+     *         通过该连接把描述字传给客户端，之后报文经消息环收发，不再压缩，请求环的门铃注册到事件循环；
+     *         超出环容量的报文仍走套接字，套接字关闭即连接关闭。
+     */
+    class Server {
+        friend class Stream;
+        class ImplClass;
+        ImplClass * m_impl;
+
+    public:
+        Server(nio::SimpleSocketServer & loop);
+        ~Server();
+        SYM_NONCOPYABLE(Server)
+
+        int  addListener(const net::Address & loc, err::Error * e = nullptr);
+
+        /// 监听UNIX域地址。与服务端同一主机、通过TCP登录并声明optionLocal的客户端，
+        /// 在登录响应中得到该地址后改用UNIX域连接，不再经过TCP协议栈；UNIX域连接上同时支持optionShm。只需调用一次。
+        int  addLocalListener(const char * path, err::Error * e = nullptr);
+
+        void setServiceHandler(const ServiceHandler & handler);
+
+        /// 设置流式请求处理函数，并在登录时声明支持optionStream
+        void setStreamHandler(const StreamHandler & handler);
+
+        /// 非流式报文的长度上限，超过时关闭连接，0表示不限制(默认)。压缩请求解压后的长度超过上限时返回resultBadMessage。
+        /// 大数据应使用流式调用。
+        void setMaxMessageSize(size_t bytes);
+
+        /// 启动工作线程池。未启动时服务处理函数在事件循环线程中执行。
+        /// maxQueue为默认优先级类别(0)的队列上限，未指定类别的域都使用默认类别。
+        bool startWorkers(int threads, int maxQueue, err::Error * e = nullptr);
+        void stopWorkers();
+
+        /// 在事件循环线程直接执行的优先级类别
+        static const int inlineClass = -1;
+
+        /// 增加优先级类别，返回类别编号。各类别都有积压时，权重为weight的类别得到
+        /// weight/总权重的工作线程时间，默认类别的权重为1；maxQueue为该类别的队列上限。
+        int  addPriorityClass(int weight, int maxQueue);
+
+        /// 把应用域domain(0~255)的请求分派到优先级类别cls，cls为inlineClass时在事件循环线程执行，
+        /// 只适合耗时极短的处理函数。应在开始监听之前设置。
+        /// cls不是inlineClass、0或addPriorityClass返回的类别，或domain超出范围时返回false，映射不变。
+        bool setDomainClass(int domain, int cls);
+
+        /// \brief 启用过载保护。
+        ///
+        ///     负载取请求所属类别队列占用比例与事件循环延迟/maxLoopLag(毫秒)中的较大值，
+        ///     登录应答的window为maxWindow*(1-负载)，至少为1，心跳应答的header.option为当前window。
+        ///     负载达到1时拒绝登录，要求客户端挂起suspend秒后再连接。
+        void setLoadShedding(int maxWindow, int maxLoopLag, int suspend);
+
+        /// 保留最近capacity条协商了optionTrace的请求的时间线，0表示不记录(默认)
+        void setTraceRing(size_t capacity);
+
+        /// 获取跟踪环中的时间线快照，从旧到新
+        std::vector<TraceRecord> traceRecords();
+
+        /// 设置响应压缩阈值，报文体不小于bytes字节时才压缩，小于0时不压缩响应。默认512。
+        void setCompressThreshold(int bytes);
+
+        /// 获取各服务的压缩统计快照
+        CompressCounterMap compressCounters();
+
+        /// 设置连接空闲超时，毫秒。连接超过该时长没有收到任何报文(包括心跳)时关闭，小于等于0时不检查。
+        void setIdleTimeout(int timeout);
+    }; // end class Server
+
+} // end namespace srpc
+
+namespace srpc {
+
+    inline
+    Response::Response(util::BufferPool & pool, const service_request_t * req)
+        : m_pool(&pool), m_request(req)
+    {
+        m_buf  = m_pool->allocate(1024, &m_cap);
+        m_size = sizeof(service_response_t);
+
+        service_response_t * resp = this->header();
+        resp->header = req->header;
+        resp->header.body_type = io::htob((int16_t)typeServiceResponse);
+        resp->service = req->service;
+        resp->service.result = io::htob((int32_t)resultOk);
+        resp->service.rpc_body_len = 0;
+        resp->service.compress = compressNone;
+    }
+
+    inline
+    void Response::reserve(size_t n)
+    {
+        if ( m_size + n <= m_cap ) return;
+        size_t cap;
+        char * p = m_pool->allocate(std::max(m_size + n, m_cap * 2), &cap);
+        memcpy(p, m_buf, m_size);
+        m_pool->deallocate(m_buf, m_cap);
+        m_buf = p;
+        m_cap = cap;
+    }
+
+    inline
+    char * Response::allocBlock(int32_t size)
+    {
+        this->reserve(sizeof(int32_t) + size);
+        int32_t len = io::htob(size);
+        memcpy(m_buf + m_size, &len, sizeof(len));
+        char * p = m_buf + m_size + sizeof(len);
+        m_size += sizeof(len) + size;
+        return p;
+    }
+
+    inline
+    void Response::addBlock(const char * data, int32_t size)
+    {
+        memcpy(this->allocBlock(size), data, size);
+    }
+
+    inline
+    void Response::addBlockRef(const BlockView & view)
+    {
+        const char * begin = (const char *)m_request;
+        const char * end   = begin ? begin + io::btoh(m_request->header.length) : nullptr;
+        if ( view.size < minRefSize || view.data < begin || view.data + view.size > end ) {
+            this->addBlock(view.data, view.size);
+            return;
+        }
+
+        this->allocBlock(0);
+        int32_t len = io::htob(view.size);
+        memcpy(m_buf + m_size - sizeof(len), &len, sizeof(len));
+        m_segments.push_back(Segment { m_size, view.data, view.size });
+        m_refBytes += view.size;
+    }
+
+    inline
+    void Response::finish()
+    {
+        int32_t total = (int32_t)this->length();
+        service_response_t * resp = this->header();
+        resp->header.length = io::htob(total);
+        resp->header.timestamp = io::htob((int64_t)chrono::now());
+        resp->service.rpc_body_len = io::htob(total - (int32_t)sizeof(service_response_t));
+        m_request = nullptr;
+    }
+
+    inline
+    void Response::copyBody(char * dst) const
+    {
+        size_t pos = sizeof(service_response_t);
+        for ( auto it = m_segments.begin(); it != m_segments.end(); ++it ) {
+            memcpy(dst, m_buf + pos, it->offset - pos);
+            dst += it->offset - pos;
+            memcpy(dst, it->data, it->size);
+            dst += it->size;
+            pos = it->offset;
+        }
+        memcpy(dst, m_buf + pos, m_size - pos);
+    }
+
+    inline
+    void Response::assign(char * p, size_t size, size_t cap)
+    {
+        m_pool->deallocate(m_buf, m_cap);
+        m_buf  = p;
+        m_cap  = cap;
+        m_size = size;
+        m_refBytes = 0;
+        m_segments.clear();
+    }
+
+    inline
+    void Response::release()
+    {
+        if ( m_pool ) {
+            m_pool->deallocate(m_buf, m_cap);
+            m_pool->deallocate(m_hold, m_holdCap);
+        }
+        m_buf  = m_hold = nullptr;
+        m_cap  = m_size = m_refBytes = m_holdCap = 0;
+        m_segments.clear();
+    }
+
+} // end namespace srpc
+
+namespace srpc {
+
+    class Server::ImplClass {
+    public:
+        /// 发送队列中每个缓存对应一项，发送完成(或取消)时按顺序归还其中的缓存
+        struct SendSlot {
+            char * buf;
+            size_t cap;
+            char * hold;      ///< 被引用的请求缓存
+            size_t holdCap;
+            int64_t trace;    ///< 跟踪环中的记录序号，发送完成时填写sendComplete，-1表示无
+        };
+
+        /// 待处理的流式请求分块，buf为整个分块报文的缓存
+        struct StreamChunk {
+            char *       buf;
+            size_t       cap;
+            const char * data;
+            int32_t      size;
+            bool         last;
+        };
+
+        /// 流的分块队列，由事件循环线程入队，处理线程依次出队回调
+        struct StreamState {
+            Stream                  stream;
+            mt::mutex_t             mutex;
+            std::deque<StreamChunk> pending;
+            bool                    running { false };   ///< 已有处理任务在执行或排队
+
+            StreamState()  { mt::mutex_init(&mutex); }
+            ~StreamState() { mt::mutex_free(&mutex); }
+        };
+        using StreamPtr = std::shared_ptr<StreamState>;
+
+        /// 共享内存环已满时排队的报文，pieces引用slot中的缓存
+        struct ShmFrame {
+            std::vector<struct iovec> pieces;
+            size_t   size;
+            SendSlot slot;
+        };
+
+        /// 协商了optionShm的连接的两个消息环，只在事件循环线程访问
+        struct ShmLink {
+            io::ShmRing requests;               ///< 客户端写、服务端读
+            io::ShmRing responses;              ///< 服务端写、客户端读
+            int  dataWatcher  { -1 };           ///< 请求环门铃的监视ID
+            int  spaceWatcher { -1 };           ///< 响应环空间门铃的监视ID
+            bool fdsPending   { true };         ///< 描述字还未发给客户端，期间报文仍走套接字
+            std::deque<ShmFrame> backlog;
+        };
+        using ShmPtr = std::shared_ptr<ShmLink>;
+
+        struct ChannelState {
+            uint64_t serial;    ///< 连接序号，fd被复用时用于识别工作线程返回的过期响应
+            int      options;   ///< 登录时协商的特性
+            int64_t  lastRecv;  ///< 最后一次收到数据的时间，用于检测半死连接
+            bool     sameHost;  ///< TCP连接的对端与服务端在同一主机
+            bool     local;     ///< UNIX域连接
+            std::deque<SendSlot> sending;
+            size_t   pendingOut    { 0 };       ///< 发送队列中的字节数
+            int      pendingChunks { 0 };       ///< 已收到未处理完的流式分块数
+            int      stalled       { 0 };       ///< 因工作队列已满等待重新投递的流数
+            bool     paused        { false };   ///< 流量控制暂停了接收
+            bool     detached      { false };   ///< 暂停时套接字没有接收缓存，恢复时需要重新开始接收
+            ShmPtr   shm;                       ///< 协商了optionShm时的消息环
+            std::map<int32_t, StreamPtr> streams;   ///< 未收到最后一个分块的流，按sequence索引，拒绝的流为空指针
+        };
+        using ChannelMap = std::unordered_map<int, ChannelState>;
+
+        static const int    streamChunkSize = 64 * 1024;   ///< 响应分块上限
+        static const int    maxPendingChunks = 4;           ///< 连接上待处理的分块达到该数量时暂停接收
+        static const size_t maxPendingOut = 1 << 20;        ///< 连接上待发送的字节数达到该值时暂停接收
+        static const int    lagInterval = 100;              ///< 事件循环延迟检测间隔，毫秒
+        static const size_t shmRingSize = 1 << 20;          ///< 共享内存消息环的容量
+        static const int    stallRetryInterval = 1;         ///< 重新投递等待中的流的间隔，毫秒
+
+    public:
+        nio::SimpleSocketServer & m_loop;
+        Server *        m_owner { nullptr };
+        ServiceHandler  m_handler;
+        StreamHandler   m_streamHandler;
+        size_t          m_maxMessage { 0 };
+        mt::WorkerPool  m_workers;
+        int             m_domainClass[256] = {};   ///< 应用域到优先级类别的映射
+        ChannelMap      m_channels;
+        uint64_t        m_serial { 0 };
+        int             m_options { optionCompress | optionTrace };   ///< 服务端支持的特性
+        int             m_compressThreshold { 512 };
+        int             m_idleTimeout { 0 };
+        int             m_idleTimer   { -1 };
+        int             m_maxWindow   { 0 };    ///< 过载保护的最大窗口，0表示未启用
+        int             m_maxLoopLag  { 0 };
+        int             m_suspend     { 0 };
+        int             m_lagTimer    { -1 };
+        int64_t         m_lagCheck    { 0 };    ///< 上次延迟检测的时间
+        int             m_loopLag     { 0 };    ///< 最近一次检测到的事件循环延迟，毫秒
+        std::deque<StreamPtr> m_stalled;        ///< 工作队列已满、等待重新投递的流，按投递顺序
+        int             m_stallTimer  { -1 };
+        std::string     m_localPath;    ///< UNIX域监听地址，登录时告知同一主机的客户端
+
+        util::BufferPool   m_pool;
+        mt::mutex_t        m_statMutex;
+        CompressCounterMap m_compressCounters;
+        std::vector<TraceRecord> m_traces;     ///< 跟踪环，由m_statMutex保护
+        int64_t            m_traceCount { 0 }; ///< 写入跟踪环的记录总数
+
+    public:
+        ImplClass(nio::SimpleSocketServer & loop) : m_loop(loop) { mt::mutex_init(&m_statMutex); }
+        ~ImplClass() { mt::mutex_free(&m_statMutex); }
+
+        void onAccepted(int sfd, int cfd, const net::Address * remote);
+        void onReceived(int fd, int status, io::MutableBuffer & buffer);
+        void onSent(int fd, int status, io::ConstBuffer & buffer);
+        void onClosed(int fd);
+
+        void onMessageReceived(int fd, message_t * in);
+        void onHeartbeatRequestReceived(int fd, message_t * in);
+        void onLogonRequestReceived(int fd, logon_request_t * in);
+        void onServiceRequestReceived(int fd, service_request_t * in, size_t cap);
+        void onServiceCompleted(int fd, uint64_t serial, Response & out);
+
+        /// 收到流式请求分块，返回true表示需要暂停接收
+        bool onStreamChunkReceived(int fd, service_request_t * in, size_t cap);
+        void onStreamChunkDone(int fd, uint64_t serial);
+        void scheduleStream(const StreamPtr & st);
+        void drainStream(const StreamPtr & st);
+        /// 投递到流所属类别的工作队列，队列已满时返回false
+        bool postStream(const StreamPtr & st);
+        /// 流所在连接的状态，连接已关闭时返回nullptr
+        ChannelState * streamChannel(const StreamPtr & st);
+        /// 重新投递等待中的流，投递成功的流所在连接恢复接收
+        void retryStalled();
+        void sendStreamChunk(int fd, uint64_t serial, char * p, size_t size, size_t cap);
+        void resumeReceive(int fd, ChannelState & state);
+
+        /// 请求所属的优先级类别
+        int  requestClass(const message_header_t & header) const { return m_domainClass[(uint8_t)header.domain]; }
+
+        /// 执行服务处理函数，recvTime不为0时在响应中附加时间戳
+        void executeService(service_request_t * in, size_t cap, int options, int64_t deadline, int64_t recvTime, Response & out);
+        void attachTrace(Response & out, int64_t recvTime, int64_t dispatch);
+        int64_t recordTrace(const Response & out);
+        int  decompressRequest(service_request_t ** in, size_t * cap);
+        void compressResponse(Response & out);
+
+        void sendMessage(int fd, io::ConstBuffer & out);
+        void sendResponse(int fd, Response & out);
+        bool sendSegment(int fd, const char * data, size_t size, const SendSlot & slot);
+        /// 发送完成，记录跟踪时间后归还缓存
+        void completeSlot(const SendSlot & slot);
+        void releaseSlot(const SendSlot & slot);
+
+        /// 创建消息环并注册门铃，失败时不协商optionShm
+        bool openShm(int fd, ChannelState & state);
+        void closeShm(ChannelState & state);
+        /// 登录响应发出后把消息环的描述字传给客户端
+        void sendShmFds(int fd, ChannelState & state);
+        /// 读取请求环中的报文，流量控制暂停时留在环中
+        void onShmReadable(int fd, uint64_t serial);
+        void onShmWritable(int fd, uint64_t serial);
+        /// 写入响应环，返回false表示连接未启用消息环或报文超出环容量，由调用方走套接字
+        bool sendShm(int fd, const struct iovec * iov, int count, const SendSlot & slot);
+        void flushShm(ChannelState & state);
+        void makeResultResponse(const service_request_t * in, int result, Response & out);
+
+        /// 空闲检查定时器回调，关闭超时的连接
+        bool onIdleTimer();
+
+        /// 事件循环延迟检测定时器回调
+        bool onLagTimer();
+
+        /// 按domain所属类别的当前负载计算窗口，满载时返回0
+        int  currentWindow(char domain);
+    }; // end class Server::ImplClass
+
+    inline
+    void Server::ImplClass::onAccepted(int sfd, int cfd, const net::Address * remote)
+    {
+        if ( cfd == -1 )  {
+            SYM_TRACE_VA("[error] listener error, fd: %d", sfd);
+            m_loop.exitLoop();   // 获取连接失败，退出server循环
+            return;
+        }
+
+        SYM_TRACE_VA("[info] accept new channel, fd: %d", cfd);
+        err::Error error;
+        m_loop.acceptChannel(cfd,
+            [this](int fd, int status, io::MutableBuffer & buffer) { this->onReceived(fd, status, buffer); },
+            [this](int fd, int status, io::ConstBuffer & buffer) { this->onSent(fd, status, buffer); },
+            [this](int fd) { this->onClosed(fd); },
+            &error);
+        ChannelState & state = m_channels[cfd];
+        state.serial  = ++m_serial;
+        state.options = 0;
+        state.lastRecv = chrono::now();
+        state.sameHost = false;
+        state.local    = remote && remote->isUnix();
+
+        // 对端地址与本端地址IP相同即为同一主机，UNIX域连接不需要再切换
+        net::Address local;
+        if ( remote && !remote->isUnix() && net::Socket(cfd).localAddress(&local) ) {
+            state.sameHost = local.sameHost(*remote);
+        }
+
+        // 开始接收消息
+        size_t cap;
+        char * p = m_pool.allocate(1024, &cap);
+        io::MutableBuffer buffer(p, 0, cap);
+        buffer.limit(sizeof(message_header_t));
+        m_loop.beginReceive(cfd, buffer);
+    }
+
+    inline
+    void Server::ImplClass::onReceived(int fd, int status, io::MutableBuffer & buffer)
+    {
+        if ( status != 0 ) {
+            // 读消息失败，channel关闭
+            SYM_TRACE_VA("[error] channel read error, fd: %d", fd);
+            m_pool.deallocate(buffer.data(), buffer.capacity());
+            buffer.detach();
+            m_loop.closeChannel(fd);
+            return;
+        }
+
+        auto itState = m_channels.find(fd);
+        if ( itState != m_channels.end() ) itState->second.lastRecv = chrono::now();
+
+        message_t * msg = (message_t*)buffer.data();
+        bool isok = message_check_magic(msg);
+        if ( !isok ) {
+            // 消息头magic不正确，连接需要关闭
+            SYM_TRACE_VA("[error] channel message magic word invalid, fd: %d", fd);
+            m_pool.deallocate(buffer.data(), buffer.capacity());
+            buffer.detach();
+            m_loop.closeChannel(fd);
+            return;
+        }
+
+        // 检查收到的消息长度，是否接收完整。
+        size_t rsize = buffer.size();    // 当前已经接收到的数据大小
+        size_t msize = (uint32_t)io::btoh(msg->header.length);
+        int16_t type = io::btoh(msg->header.body_type);
+        bool   isService = ( type == typeServiceRequest || type == typeStreamRequest );
+        if ( rsize == msize && !(isService && msize < sizeof(service_request_t)) ) {
+            if ( isService ) {
+                // 服务请求可能在工作线程中处理，请求缓存所有权移交给处理过程，channel使用新缓存继续接收
+                size_t cap = buffer.capacity();
+                buffer.detach();
+                bool pause = false;
+                if ( type == typeStreamRequest ) {
+                    pause = this->onStreamChunkReceived(fd, (service_request_t*)msg, cap);
+                } else {
+                    this->onServiceRequestReceived(fd, (service_request_t*)msg, cap);
+                }
+
+                // 暂停时不再提供接收缓存，事件循环取消读事件，待分块处理完或数据发出后恢复
+                if ( pause ) {
+                    m_channels[fd].detached = true;
+                    return;
+                }
+                size_t ncap;
+                char * p = m_pool.allocate(1024, &ncap);
+                buffer.attach(p, 0, ncap);
+                buffer.limit(sizeof(message_header_t));
+            } else {
+                buffer.reset();
+                buffer.limit(sizeof(message_header_t));
+                this->onMessageReceived(fd, msg);
+            }
+            return ;
+        }
+
+        // 消息长度和当前收到的不一致，通常是收到消息头，需要扩充内存，继续接收
+        if ( msize <= rsize || rsize != sizeof(message_header_t) ) {
+            SYM_TRACE_VA("[error] bad message length, fd: %d, length: %d", fd, (int)msize);
+            m_pool.deallocate(buffer.data(), buffer.capacity());
+            buffer.detach();
+            m_loop.closeChannel(fd);
+            return;
+        }
+
+        if ( m_maxMessage > 0 && msize > m_maxMessage ) {
+            SYM_TRACE_VA("[error] message too large, fd: %d, length: %llu", fd, (unsigned long long)msize);
+            m_pool.deallocate(buffer.data(), buffer.capacity());
+            buffer.detach();
+            m_loop.closeChannel(fd);
+            return;
+        }
+
+        // 收到了包头，但还有包体要收，如果缓存不够，就扩充
+        if ( msize > buffer.capacity()) {
+            size_t cap;
+            char * p = m_pool.allocate(msize, &cap);
+            if ( p == nullptr ) {
+                SYM_TRACE_VA("[error] out of memory, fd: %d, length: %llu", fd, (unsigned long long)msize);
+                m_pool.deallocate(buffer.data(), buffer.capacity());
+                buffer.detach();
+                m_loop.closeChannel(fd);
+                return;
+            }
+            memcpy(p, buffer.data(), rsize);
+            m_pool.deallocate(buffer.data(), buffer.capacity());
+            buffer.attach(p, rsize, cap);
+        }
+        buffer.limit(msize);
+    }
+
+    inline
+    void Server::ImplClass::onSent(int fd, int status, io::ConstBuffer & buffer)
+    {
+        if ( status != 0 ) {
+            SYM_TRACE_VA("[error] message response send failed, fd: %d, status: %d", fd, status);
+        }
+
+        // 发送回调与发送队列顺序一致，队首即为当前缓存对应的归还项
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || it->second.sending.empty() ) return;
+        ChannelState & state = it->second;
+        this->completeSlot(state.sending.front());
+        state.sending.pop_front();
+        state.pendingOut -= std::min(state.pendingOut, (size_t)buffer.limit());
+        if ( state.shm && state.shm->fdsPending && state.sending.empty() ) this->sendShmFds(fd, state);
+        if ( state.paused ) this->resumeReceive(fd, state);
+    }
+
+    inline
+    void Server::ImplClass::onClosed(int fd)
+    {
+        SYM_TRACE_VA("[info] channel closed, fd: %d", fd);
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() ) return;
+
+        // 关闭时未发送完的缓存不再回调
+        for ( auto slot = it->second.sending.begin(); slot != it->second.sending.end(); ++slot ) this->releaseSlot(*slot);
+        if ( it->second.shm ) this->closeShm(it->second);
+
+        // 未结束的流以空分块通知处理函数
+        std::map<int32_t, StreamPtr> streams;
+        streams.swap(it->second.streams);
+        m_channels.erase(it);
+        for ( auto its = streams.begin(); its != streams.end(); ++its ) {
+            const StreamPtr & st = its->second;
+            if ( !st ) continue;
+            mt::mutex_lock(&st->mutex);
+            st->pending.push_back(StreamChunk { nullptr, 0, nullptr, 0, true });
+            bool running = st->running;
+            st->running = true;
+            mt::mutex_unlock(&st->mutex);
+            if ( !running ) this->scheduleStream(st);
+        }
+    }
+
+    inline
+    void Server::ImplClass::onMessageReceived(int fd, message_t * in)
+    {
+        int16_t type = io::btoh(in->header.body_type);
+        if ( type == TYPE_HEARTBEAT_REQ ) {
+            this->onHeartbeatRequestReceived(fd, in);
+        }
+        else if ( type == typeLogonRequest ) {
+            this->onLogonRequestReceived(fd, (logon_request_t*)in);
+        }
+        else {
+            // 未知报文类型，无法继续解析后续报文，关闭连接
+            SYM_TRACE_VA("[error] unknown message body type, fd: %d, type: %d", fd, type);
+            m_loop.closeChannel(fd);
+        }
+    }
+
+    inline
+    void Server::ImplClass::onHeartbeatRequestReceived(int fd, message_t * in)
+    {
+        size_t cap;
+        message_t * p = (message_t *)m_pool.allocate(sizeof(message_header_t), &cap);
+        p->header = in->header;
+        p->header.body_type = io::htob((int16_t)TYPE_HEARTBEAT_RES);
+        if ( m_channels[fd].options & optionWindow ) p->header.option = io::htob((int32_t)this->currentWindow(in->header.domain));
+        p->header.timestamp = io::htob((int64_t)chrono::now());
+        p->header.length = io::htob((int32_t)sizeof(message_header_t));
+
+        io::ConstBuffer out((const char *)p, sizeof(message_header_t), cap);
+        this->sendMessage(fd, out);
+    }
+
+    inline
+    void Server::ImplClass::onLogonRequestReceived(int fd, logon_request_t * in)
+    {
+        int size = io::btoh(in->client_length) + io::btoh(in->server_length);
+        std::string str(in->body, size);
+        SYM_TRACE_VA("[trace] ON_LOGON_REQUEST_RECV, %s", str.c_str());
+
+        // 特性协商，返回双方都支持的特性
+        ChannelState & state = m_channels[fd];
+        int options = io::btoh(in->header.option) & m_options;
+        if ( !state.sameHost ) options &= ~optionLocal;
+
+        // 描述字紧跟登录响应发送，此前不能有其他待发送的报文
+        if ( !state.local || state.shm || !state.sending.empty() ) options &= ~optionShm;
+        if ( ( options & optionShm ) && !this->openShm(fd, state) ) options &= ~optionShm;
+        if ( options & optionShm ) options &= ~optionCompress;   // 内存复制比压缩便宜
+        state.options = options;
+
+        size_t pathlen = ( options & optionLocal ) ? m_localPath.size() : 0;
+        size_t length = sizeof(logon_reply_t) + pathlen;
+        size_t cap;
+        logon_reply_t * p  = (logon_reply_t*)m_pool.allocate(length, &cap);
+
+        p->header = in->header;
+        p->header.body_type = io::htob((int16_t)typeLogonResponse);
+        p->header.timestamp = io::htob((int64_t)chrono::now());
+        p->header.length = io::htob((int32_t)length);
+        p->header.option = io::htob((int32_t)options);
+        memcpy(p->body, m_localPath.data(), pathlen);
+
+        p->regcode = io::htob((int64_t)1);
+        p->result  = 0;
+        p->suspend = 0;
+        p->window  = io::htob((int16_t)1);
+        if ( options & optionWindow ) {
+            int window = this->currentWindow(in->header.domain);
+            p->window = io::htob((int16_t)window);
+            if ( window == 0 ) {
+                // 满载时拒绝登录，客户端挂起后再连接，不再增加排队的请求
+                SYM_TRACE_VA("[warn] logon rejected for overload, fd: %d, suspend: %d", fd, m_suspend);
+                p->result  = io::htob((int32_t)resultOverload);
+                p->suspend = io::htob((int16_t)m_suspend);
+            }
+        }
+
+        io::ConstBuffer out((const char *)p, length, cap);
+        this->sendMessage(fd, out);
+    }
+
+    inline
+    void Server::ImplClass::onServiceRequestReceived(int fd, service_request_t * in, size_t cap)
+    {
+        const ChannelState & state = m_channels[fd];
+        uint64_t serial  = state.serial;
+        int      options = state.options;
+
+        // 请求到达时计算剩余预算，已超时的请求直接拒绝
+        int64_t now      = chrono::now();
+        int64_t recvTime = ( options & optionTrace ) ? now : 0;
+        int64_t deadline = request_deadline(in, now);
+        int32_t remain   = deadline_remaining(deadline, now);
+        if ( remain == 0 ) {
+            SYM_TRACE_VA("[warn] request expired on arrival, fd: %d, sequence: %d", fd, io::btoh(in->header.sequence));
+            Response out;
+            this->makeResultResponse(in, resultTimeout, out);
+            m_pool.deallocate((char *)in, cap);
+            this->sendResponse(fd, out);
+            return;
+        }
+
+        int cls = this->requestClass(in->header);
+        if ( !m_workers.running() || cls == inlineClass ) {
+            Response out;
+            this->executeService(in, cap, options, deadline, recvTime, out);
+            this->sendResponse(fd, out);
+            return;
+        }
+
+        bool isok = m_workers.postTo(cls, [this, fd, serial, options, deadline, recvTime, in, cap]() {
+            Response out;
+            this->executeService(in, cap, options, deadline, recvTime, out);
+            m_loop.post([this, fd, serial, out]() mutable { this->onServiceCompleted(fd, serial, out); });
+        }, deadline ? deadline : mt::WorkerPool::noDeadline);
+        if ( isok ) return;
+
+        // 该类别的工作队列已满，不执行处理函数，直接返回过载响应
+        SYM_TRACE_VA("[warn] worker queue full, fd: %d, sequence: %d, class: %d", fd, io::btoh(in->header.sequence), cls);
+        Response out;
+        this->makeResultResponse(in, resultOverload, out);
+        m_pool.deallocate((char *)in, cap);
+        this->sendResponse(fd, out);
+    }
+
+    inline
+    void Server::ImplClass::executeService(service_request_t * in, size_t cap, int options, int64_t deadline, int64_t recvTime, Response & out)
+    {
+        int64_t dispatch = chrono::now();
+        int     result;
+        if ( deadline_remaining(deadline, dispatch) == 0 ) {
+            // 排队期间已超时，调用方已放弃等待
+            SYM_TRACE_VA("[warn] request expired in queue, sequence: %d", io::btoh(in->header.sequence));
+            this->makeResultResponse(in, resultTimeout, out);
+        } else if ( ( result = this->decompressRequest(&in, &cap) ) == resultOk ) {
+            out = Response(m_pool, in);
+            set_current_deadline(deadline);
+            m_handler(in, out);
+            set_current_deadline(0);
+            if ( recvTime != 0 ) this->attachTrace(out, recvTime, dispatch);
+            out.finish();
+            if ( options & optionCompress ) this->compressResponse(out);
+        } else {
+            SYM_TRACE_VA("[error] bad compressed request, sequence: %d, result: %d", io::btoh(in->header.sequence), result);
+            this->makeResultResponse(in, result, out);
+        }
+
+        // 响应引用了请求中的数据时，请求缓存随响应一起发送完成后释放
+        if ( out.m_segments.empty() ) {
+            m_pool.deallocate((char *)in, cap);
+        } else {
+            out.hold((char *)in, cap);
+        }
+    }
+
+    inline
+    void Server::ImplClass::attachTrace(Response & out, int64_t recvTime, int64_t dispatch)
+    {
+        // 时间戳作为最后一个数据块，在压缩之前加入，与服务数据一起压缩
+        out.m_traced = true;
+        out.m_trace.recv        = recvTime;
+        out.m_trace.dispatch    = dispatch;
+        out.m_trace.handler_end = chrono::now();
+
+        trace_stamps_t * p = (trace_stamps_t *)out.allocBlock(sizeof(trace_stamps_t));
+        p->recv        = io::htob(out.m_trace.recv);
+        p->dispatch    = io::htob(out.m_trace.dispatch);
+        p->handler_end = io::htob(out.m_trace.handler_end);
+
+        service_response_t * resp = out.header();
+        resp->header.option = io::htob(io::btoh(resp->header.option) | (int32_t)responseTraced);
+    }
+
+    inline
+    int64_t Server::ImplClass::recordTrace(const Response & out)
+    {
+        mt::mutex_lock(&m_statMutex);
+        if ( m_traces.empty() ) {
+            mt::mutex_unlock(&m_statMutex);
+            return -1;
+        }
+        const service_response_t * resp = (const service_response_t *)out.m_buf;
+        int64_t id = m_traceCount++;
+        TraceRecord & r = m_traces[id % m_traces.size()];
+        r.service      = service_name(&resp->service);
+        r.sequence     = io::btoh(resp->header.sequence);
+        r.recv         = out.m_trace.recv;
+        r.dispatch     = out.m_trace.dispatch;
+        r.handlerEnd   = out.m_trace.handler_end;
+        r.sendComplete = 0;
+        mt::mutex_unlock(&m_statMutex);
+        return id;
+    }
+
+    inline
+    int Server::ImplClass::decompressRequest(service_request_t ** pin, size_t * pcap)
+    {
+        service_request_t * in = *pin;
+        if ( in->service.compress == compressNone ) return resultOk;
+        if ( in->service.compress != compressLz ) return resultBadMessage;
+
+        // 解压后的长度来自对端，先按消息上限和压缩格式的最大压缩比检查，再分配内存
+        int32_t rawlen = io::btoh(in->service.rpc_body_len);
+        int32_t packed = io::btoh(in->header.length) - (int32_t)sizeof(service_request_t);
+        if ( rawlen < 0 || packed < 0 ) return resultBadMessage;
+        if ( (int64_t)rawlen > (int64_t)packed * 255 + 16 ) return resultBadMessage;
+        if ( m_maxMessage > 0 && sizeof(service_request_t) + rawlen > m_maxMessage ) return resultBadMessage;
+
+        size_t cap;
+        char * p = m_pool.allocate(sizeof(service_request_t) + rawlen, &cap);
+        if ( p == nullptr ) return resultOverload;
+        int64_t t0 = chrono::thread_cputime();
+        int n = io::lz_decompress((const char *)in->data, packed, p + sizeof(service_request_t), rawlen);
+        int64_t t1 = chrono::thread_cputime();
+        if ( n != rawlen ) {
+            m_pool.deallocate(p, cap);
+            return resultBadMessage;
+        }
+
+        service_request_t * req = (service_request_t *)p;
+        memcpy(req, in, sizeof(service_request_t));
+        req->header.length = io::htob((int32_t)(sizeof(service_request_t) + rawlen));
+        req->service.compress = compressNone;
+
+        mt::mutex_lock(&m_statMutex);
+        CompressCounter & counter = m_compressCounters[service_name(&in->service)];
+        counter.decompressCount += 1;
+        counter.rawBytes    += rawlen;
+        counter.packedBytes += packed;
+        counter.cpuNanos    += t1 - t0;
+        mt::mutex_unlock(&m_statMutex);
+
+        m_pool.deallocate((char *)in, *pcap);
+        *pin  = req;
+        *pcap = cap;
+        return resultOk;
+    }
+
+    inline
+    void Server::ImplClass::compressResponse(Response & out)
+    {
+        const service_response_t * resp = out.header();
+        int32_t total  = (int32_t)out.length();
+        int32_t rawlen = total - (int32_t)sizeof(service_response_t);
+        if ( m_compressThreshold < 0 || rawlen < m_compressThreshold ) return;
+
+        // 引用了请求数据的响应先合并为连续的报文体再压缩
+        const char * body = (const char *)resp->data;
+        char * flat = nullptr;
+        size_t flatCap = 0;
+        if ( !out.m_segments.empty() ) {
+            flat = m_pool.allocate(rawlen, &flatCap);
+            out.copyBody(flat);
+            body = flat;
+        }
+
+        size_t cap;
+        char * p = m_pool.allocate(sizeof(service_response_t) + io::lz_compress_bound(rawlen), &cap);
+        int64_t t0 = chrono::thread_cputime();
+        int n = io::lz_compress(body, rawlen, p + sizeof(service_response_t), (int)(cap - sizeof(service_response_t)));
+        int64_t t1 = chrono::thread_cputime();
+        m_pool.deallocate(flat, flatCap);
+
+        bool smaller = ( n > 0 && n < rawlen );
+        mt::mutex_lock(&m_statMutex);
+        CompressCounter & counter = m_compressCounters[service_name(&resp->service)];
+        counter.cpuNanos += t1 - t0;
+        if ( smaller ) {
+            counter.compressCount += 1;
+            counter.rawBytes    += rawlen;
+            counter.packedBytes += n;
+        } else {
+            counter.skipCount += 1;
+        }
+        mt::mutex_unlock(&m_statMutex);
+
+        if ( !smaller ) {
+            m_pool.deallocate(p, cap);   // 压缩后没有变小，按原文发送
+            return;
+        }
+
+        service_response_t * zresp = (service_response_t *)p;
+        memcpy(zresp, resp, sizeof(service_response_t));
+        zresp->header.length = io::htob((int32_t)(sizeof(service_response_t) + n));
+        zresp->service.compress = compressLz;
+        zresp->service.rpc_body_len = io::htob(rawlen);
+
+        out.assign(p, sizeof(service_response_t) + n, cap);
+    }
+
+    inline
+    void Server::ImplClass::onServiceCompleted(int fd, uint64_t serial, Response & out)
+    {
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || it->second.serial != serial ) {
+            // 处理期间连接已关闭
+            out.release();
+            return;
+        }
+        this->sendResponse(fd, out);
+    }
+
+    inline
+    bool Server::ImplClass::onStreamChunkReceived(int fd, service_request_t * in, size_t cap)
+    {
+        ChannelState & state = m_channels[fd];
+        int32_t sequence = io::btoh(in->header.sequence);
+        bool    last     = ( io::btoh(in->header.option) & streamEnd ) != 0;
+        int32_t size     = io::btoh(in->header.length) - (int32_t)sizeof(service_request_t);
+
+        StreamPtr st;
+        auto it = state.streams.find(sequence);
+        if ( it != state.streams.end() ) {
+            st = it->second;
+        } else if ( (state.options & optionStream) && m_streamHandler && in->service.compress == compressNone ) {
+            st = std::make_shared<StreamState>();
+            st->stream.m_server = m_owner;
+            st->stream.m_fd     = fd;
+            st->stream.m_serial = state.serial;
+            st->stream.m_inline = !m_workers.running() || this->requestClass(in->header) == inlineClass;
+            memcpy(&st->stream.m_request, in, sizeof(service_request_t));
+            st->stream.m_deadline = request_deadline(in, chrono::now());
+            if ( !last ) state.streams[sequence] = st;
+        } else {
+            // 未协商流式调用或分块被压缩，直接结束该流，后续分块丢弃
+            SYM_TRACE_VA("[error] stream rejected, fd: %d, sequence: %d", fd, sequence);
+            Stream rejected;
+            rejected.m_server = m_owner;
+            rejected.m_fd     = fd;
+            rejected.m_serial = state.serial;
+            rejected.m_inline = true;
+            memcpy(&rejected.m_request, in, sizeof(service_request_t));
+            rejected.finish(resultBadMessage);
+            if ( !last ) state.streams[sequence] = nullptr;
+        }
+        if ( last ) state.streams.erase(sequence);
+
+        if ( !st ) {
+            m_pool.deallocate((char *)in, cap);
+            return false;
+        }
+
+        mt::mutex_lock(&st->mutex);
+        st->pending.push_back(StreamChunk { (char *)in, cap, (const char *)in->data, size, last });
+        bool running = st->running;
+        st->running = true;
+        mt::mutex_unlock(&st->mutex);
+        ++state.pendingChunks;
+        if ( !running ) this->scheduleStream(st);
+
+        state.paused = ( state.pendingChunks >= maxPendingChunks || state.pendingOut >= maxPendingOut || state.stalled > 0 );
+        return state.paused;
+    }
+
+    inline
+    void Server::ImplClass::scheduleStream(const StreamPtr & st)
+    {
+        if ( st->stream.m_inline ) {
+            this->drainStream(st);
+            return;
+        }
+
+        if ( this->postStream(st) ) return;
+
+        // 工作队列已满时流的分块不能丢弃，也不在事件循环线程执行处理函数：
+        // 暂停该连接的接收，流保持running状态，由定时器或其他分块完成时重新投递
+        SYM_TRACE_VA("[warn] worker queue full, stream deferred, fd: %d", st->stream.m_fd);
+        m_stalled.push_back(st);
+        ChannelState * state = this->streamChannel(st);
+        if ( state ) {
+            ++state->stalled;
+            state->paused = true;
+        }
+        if ( m_stallTimer < 0 ) {
+            m_stallTimer = m_loop.addTimer(stallRetryInterval, [this](int timer) {
+                this->retryStalled();
+                if ( !m_stalled.empty() ) return true;
+                m_stallTimer = -1;
+                return false;
+            });
+        }
+    }
+
+    inline
+    bool Server::ImplClass::postStream(const StreamPtr & st)
+    {
+        if ( !m_workers.running() ) {
+            // 工作线程已停止，只能在事件循环线程处理
+            this->drainStream(st);
+            return true;
+        }
+        int64_t deadline = st->stream.m_deadline;
+        int cls = this->requestClass(st->stream.m_request.header);
+        return m_workers.postTo(cls, [this, st]() { this->drainStream(st); }, deadline ? deadline : mt::WorkerPool::noDeadline);
+    }
+
+    inline
+    Server::ImplClass::ChannelState * Server::ImplClass::streamChannel(const StreamPtr & st)
+    {
+        auto it = m_channels.find(st->stream.m_fd);
+        if ( it == m_channels.end() || it->second.serial != st->stream.m_serial ) return nullptr;
+        return &it->second;
+    }
+
+    inline
+    void Server::ImplClass::retryStalled()
+    {
+        // 按原顺序投递，队列再次满时保留剩余的流
+        while ( !m_stalled.empty() ) {
+            StreamPtr st = m_stalled.front();
+            if ( !this->postStream(st) ) return;
+            m_stalled.pop_front();
+
+            ChannelState * state = this->streamChannel(st);
+            if ( state == nullptr ) continue;
+            --state->stalled;
+            if ( state->paused ) this->resumeReceive(st->stream.m_fd, *state);
+        }
+    }
+
+    inline
+    void Server::ImplClass::drainStream(const StreamPtr & st)
+    {
+        Stream & stream = st->stream;
+        while ( true ) {
+            mt::mutex_lock(&st->mutex);
+            if ( st->pending.empty() ) {
+                st->running = false;
+                mt::mutex_unlock(&st->mutex);
+                return;
+            }
+            StreamChunk chunk = st->pending.front();
+            st->pending.pop_front();
+            mt::mutex_unlock(&st->mutex);
+
+            // buf为空表示连接已关闭
+            bool abort = ( chunk.buf == nullptr );
+            if ( abort ) stream.m_aborted = true;
+            if ( !stream.m_finished ) {
+                set_current_deadline(stream.m_deadline);
+                m_streamHandler(stream, BlockView(chunk.data, chunk.size), chunk.last);
+                set_current_deadline(0);
+                if ( chunk.last ) stream.finish(resultOk);
+            }
+            if ( abort ) continue;
+
+            m_pool.deallocate(chunk.buf, chunk.cap);
+            int      fd     = stream.m_fd;
+            uint64_t serial = stream.m_serial;
+            if ( stream.m_inline ) {
+                this->onStreamChunkDone(fd, serial);
+            } else {
+                m_loop.post([this, fd, serial]() { this->onStreamChunkDone(fd, serial); });
+            }
+        }
+    }
+
+    inline
+    void Server::ImplClass::onStreamChunkDone(int fd, uint64_t serial)
+    {
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || it->second.serial != serial ) return;
+        ChannelState & state = it->second;
+        if ( state.pendingChunks > 0 ) --state.pendingChunks;
+        if ( state.paused ) this->resumeReceive(fd, state);
+
+        // 工作线程刚完成一个任务，队列可能有空位
+        if ( !m_stalled.empty() ) this->retryStalled();
+    }
+
+    inline
+    void Server::ImplClass::resumeReceive(int fd, ChannelState & state)
+    {
+        if ( state.pendingChunks >= maxPendingChunks || state.pendingOut >= maxPendingOut || state.stalled > 0 ) return;
+        state.paused = false;
+
+        if ( state.shm ) {
+            // 投递到下一次迭代读取消息环，不在发送完成或分块完成的回调中重入
+            uint64_t serial = state.serial;
+            m_loop.post([this, fd, serial]() { this->onShmReadable(fd, serial); });
+        }
+        if ( !state.detached ) return;
+        state.detached = false;
+
+        size_t cap;
+        char * p = m_pool.allocate(1024, &cap);
+        io::MutableBuffer buffer(p, 0, cap);
+        buffer.limit(sizeof(message_header_t));
+        m_loop.beginReceive(fd, buffer);
+    }
+
+    inline
+    void Server::ImplClass::sendStreamChunk(int fd, uint64_t serial, char * p, size_t size, size_t cap)
+    {
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || it->second.serial != serial ) {
+            m_pool.deallocate(p, cap);   // 连接已关闭
+            return;
+        }
+        io::ConstBuffer out(p, size, cap);
+        this->sendMessage(fd, out);
+    }
+
+    inline
+    void Server::ImplClass::sendMessage(int fd, io::ConstBuffer & out)
+    {
+        if ( out.data() == nullptr ) return;
+        SendSlot slot { (char *)out.data(), out.capacity(), nullptr, 0, -1 };
+        struct iovec iov { (void *)out.data(), (size_t)out.limit() };
+        if ( !this->sendShm(fd, &iov, 1, slot) ) this->sendSegment(fd, out.data(), out.limit(), slot);
+        out.detach();
+    }
+
+    inline
+    void Server::ImplClass::sendResponse(int fd, Response & out)
+    {
+        if ( out.m_buf == nullptr ) return;
+
+        // 输出缓存与引用数据交替分段发送，缓存在最后一段发送完成后归还
+        std::vector<struct iovec> pieces;
+        size_t pos = 0;
+        for ( auto it = out.m_segments.begin(); it != out.m_segments.end(); ++it ) {
+            pieces.push_back(iovec { out.m_buf + pos, it->offset - pos });
+            pieces.push_back(iovec { (void *)it->data, (size_t)it->size });
+            pos = it->offset;
+        }
+        if ( pos < out.m_size ) pieces.push_back(iovec { out.m_buf + pos, out.m_size - pos });
+
+        SendSlot none { nullptr, 0, nullptr, 0, -1 };
+        SendSlot last { out.m_buf, out.m_cap, out.m_hold, out.m_holdCap, out.m_traced ? this->recordTrace(out) : -1 };
+        if ( !this->sendShm(fd, pieces.data(), (int)pieces.size(), last) ) {
+            for ( size_t i = 0; i < pieces.size(); ++i ) {
+                bool tail = ( i + 1 == pieces.size() );
+                if ( !this->sendSegment(fd, (const char *)pieces[i].iov_base, pieces[i].iov_len, tail ? last : none) ) {
+                    if ( !tail ) this->releaseSlot(last);
+                    break;
+                }
+            }
+        }
+
+        // 缓存所有权已转移到发送队列
+        out.m_buf  = out.m_hold = nullptr;
+        out.m_segments.clear();
+    }
+
+    inline
+    bool Server::ImplClass::sendSegment(int fd, const char * data, size_t size, const SendSlot & slot)
+    {
+        auto it = m_channels.find(fd);
+        if ( it != m_channels.end() ) {
+            io::ConstBuffer buffer(data, size, size);
+            it->second.sending.push_back(slot);
+            if ( m_loop.send(fd, buffer) ) {
+                it->second.pendingOut += size;
+                return true;
+            }
+            it->second.sending.pop_back();
+        }
+        this->releaseSlot(slot);
+        return false;
+    }
+
+    inline
+    void Server::ImplClass::completeSlot(const SendSlot & slot)
+    {
+        if ( slot.trace >= 0 ) {
+            // 记录可能已被新的记录覆盖
+            mt::mutex_lock(&m_statMutex);
+            if ( !m_traces.empty() && m_traceCount - slot.trace <= (int64_t)m_traces.size() ) {
+                m_traces[slot.trace % m_traces.size()].sendComplete = chrono::now();
+            }
+            mt::mutex_unlock(&m_statMutex);
+        }
+        this->releaseSlot(slot);
+    }
+
+    inline
+    void Server::ImplClass::releaseSlot(const SendSlot & slot)
+    {
+        m_pool.deallocate(slot.buf, slot.cap);
+        m_pool.deallocate(slot.hold, slot.holdCap);
+    }
+
+    inline
+    bool Server::ImplClass::openShm(int fd, ChannelState & state)
+    {
+        ShmPtr shm = std::make_shared<ShmLink>();
+        uint64_t serial = state.serial;
+        err::Error error;
+        if ( shm->requests.create(shmRingSize, &error) && shm->responses.create(shmRingSize, &error) ) {
+            shm->dataWatcher = m_loop.addWatcher(shm->requests.dataFd(),
+                [this, fd, serial](int watcher) { this->onShmReadable(fd, serial); }, &error);
+            shm->spaceWatcher = shm->dataWatcher < 0 ? -1 : m_loop.addWatcher(shm->responses.spaceFd(),
+                [this, fd, serial](int watcher) { this->onShmWritable(fd, serial); }, &error);
+        }
+        if ( shm->spaceWatcher < 0 ) {
+            SYM_TRACE_VA("[warn] shared memory ring unavailable, fd: %d, %s", fd, error.message());
+            if ( shm->dataWatcher >= 0 ) m_loop.removeWatcher(shm->dataWatcher);
+            return false;
+        }
+
+        // 声明在等待请求，客户端写入第一条请求时敲门铃
+        shm->requests.prepareWait();
+        state.shm = shm;
+        return true;
+    }
+
+    inline
+    void Server::ImplClass::closeShm(ChannelState & state)
+    {
+        ShmLink & shm = *state.shm;
+        m_loop.removeWatcher(shm.dataWatcher);
+        m_loop.removeWatcher(shm.spaceWatcher);
+        for ( auto it = shm.backlog.begin(); it != shm.backlog.end(); ++it ) this->releaseSlot(it->slot);
+        state.shm.reset();
+    }
+
+    inline
+    void Server::ImplClass::sendShmFds(int fd, ChannelState & state)
+    {
+        ShmLink & shm = *state.shm;
+        int fds[6] = { shm.requests.memFd(),  shm.requests.dataFd(),  shm.requests.spaceFd(),
+                       shm.responses.memFd(), shm.responses.dataFd(), shm.responses.spaceFd() };
+        err::Error error;
+        if ( !net::Socket(fd).sendFds(fds, 6, &error) ) {
+            SYM_TRACE_VA("[error] send shared memory fds failed, fd: %d, %s", fd, error.message());
+            m_loop.closeChannel(fd);
+            return;
+        }
+        shm.fdsPending = false;
+    }
+
+    inline
+    void Server::ImplClass::onShmReadable(int fd, uint64_t serial)
+    {
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || it->second.serial != serial || !it->second.shm ) return;
+        ShmPtr shm = it->second.shm;
+        io::ShmRing & ring = shm->requests;
+        ring.clearDoorbell();
+
+        while ( true ) {
+            ChannelState & state = m_channels[fd];
+            if ( state.paused || state.shm != shm ) return;
+
+            size_t size;
+            const char * p = ring.peek(&size);
+            if ( p == nullptr ) {
+                if ( ring.corrupt() ) {
+                    SYM_TRACE_VA("[error] shared memory ring corrupt, fd: %d", fd);
+                    m_loop.closeChannel(fd);
+                    return;
+                }
+                if ( ring.prepareWait() ) return;
+                continue;
+            }
+            state.lastRecv = chrono::now();
+
+            // 报文复制到缓存池后立即归还环空间，请求可能交给工作线程处理
+            size_t cap = 0;
+            char * buf = ( size >= sizeof(message_header_t) && ( m_maxMessage == 0 || size <= m_maxMessage ) )
+                ? m_pool.allocate(size, &cap) : nullptr;
+            if ( buf != nullptr ) memcpy(buf, p, size);
+            ring.pop();
+
+            message_t * msg = (message_t *)buf;
+            int16_t type = msg ? io::btoh(msg->header.body_type) : 0;
+            bool    isService = ( type == typeServiceRequest || type == typeStreamRequest );
+            if ( msg == nullptr || !message_check_magic(msg) || (uint32_t)io::btoh(msg->header.length) != size
+              || ( isService && size < sizeof(service_request_t) ) ) {
+                SYM_TRACE_VA("[error] bad shared memory message, fd: %d, length: %llu", fd, (unsigned long long)size);
+                m_pool.deallocate(buf, cap);
+                m_loop.closeChannel(fd);
+                return;
+            }
+
+            if ( type == typeStreamRequest ) {
+                this->onStreamChunkReceived(fd, (service_request_t*)msg, cap);
+            } else if ( type == typeServiceRequest ) {
+                this->onServiceRequestReceived(fd, (service_request_t*)msg, cap);
+            } else {
+                this->onMessageReceived(fd, msg);
+                m_pool.deallocate(buf, cap);
+            }
+        }
+    }
+
+    inline
+    void Server::ImplClass::onShmWritable(int fd, uint64_t serial)
+    {
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || it->second.serial != serial || !it->second.shm ) return;
+        ChannelState & state = it->second;
+        state.shm->responses.clearSpaceDoorbell();
+        this->flushShm(state);
+        if ( state.paused ) this->resumeReceive(fd, state);
+    }
+
+    inline
+    bool Server::ImplClass::sendShm(int fd, const struct iovec * iov, int count, const SendSlot & slot)
+    {
+        auto it = m_channels.find(fd);
+        if ( it == m_channels.end() || !it->second.shm || it->second.shm->fdsPending ) return false;
+        ChannelState & state = it->second;
+        ShmLink & shm = *state.shm;
+
+        size_t size = 0;
+        for ( int i = 0; i < count; ++i ) size += iov[i].iov_len;
+        if ( size > shm.responses.maxMessage() ) return false;
+
+        if ( shm.backlog.empty() && shm.responses.tryWritev(iov, count) ) {
+            this->completeSlot(slot);
+            return true;
+        }
+
+        // 环已满时按顺序排队，客户端取走消息后由空间门铃唤醒继续写入
+        shm.backlog.push_back(ShmFrame { std::vector<struct iovec>(iov, iov + count), size, slot });
+        state.pendingOut += size;
+        this->flushShm(state);
+        return true;
+    }
+
+    inline
+    void Server::ImplClass::flushShm(ChannelState & state)
+    {
+        ShmLink & shm = *state.shm;
+        while ( !shm.backlog.empty() ) {
+            ShmFrame & frame = shm.backlog.front();
+            if ( shm.responses.tryWritev(frame.pieces.data(), (int)frame.pieces.size()) ) {
+                state.pendingOut -= std::min(state.pendingOut, frame.size);
+                this->completeSlot(frame.slot);
+                shm.backlog.pop_front();
+            } else if ( shm.responses.prepareWriteWait(frame.size) ) {
+                return;
+            }
+        }
+    }
+
+    inline
+    bool Server::ImplClass::onIdleTimer()
+    {
+        if ( m_idleTimeout <= 0 ) {
+            m_idleTimer = -1;
+            return false;
+        }
+
+        int64_t expire = chrono::now() - m_idleTimeout * 1000LL;
+        for ( auto it = m_channels.begin(); it != m_channels.end(); ++it ) {
+            if ( it->second.lastRecv < expire ) {
+                SYM_TRACE_VA("[warn] channel idle timeout, fd: %d", it->first);
+                it->second.lastRecv = INT64_MAX;   // 关闭请求在下一次循环迭代执行，避免重复关闭
+                m_loop.closeChannel(it->first);
+            }
+        }
+        return true;
+    }
+
+    inline
+    bool Server::ImplClass::onLagTimer()
+    {
+        if ( m_maxWindow <= 0 ) {
+            m_lagTimer = -1;
+            return false;
+        }
+
+        // 定时器实际触发时间晚于预期的部分即为事件循环延迟
+        int64_t now = chrono::steady_now();
+        int64_t lag = now - m_lagCheck - lagInterval * 1000LL;
+        m_loopLag  = lag > 0 ? (int)(lag / 1000) : 0;
+        m_lagCheck = now;
+        return true;
+    }
+
+    inline
+    int Server::ImplClass::currentWindow(char domain)
+    {
+        double load = m_maxLoopLag > 0 ? (double)m_loopLag / m_maxLoopLag : 0;
+        int cls = m_domainClass[(uint8_t)domain];
+        if ( m_workers.running() && cls != inlineClass ) {
+            size_t limit = m_workers.queueLimit(cls);
+            double usage = limit > 0 ? (double)m_workers.queueSize(cls) / limit : 1;
+            load = std::max(load, usage);
+        }
+        if ( load >= 1 ) return 0;
+        return std::max(1, (int)(m_maxWindow * (1 - load)));
+    }
+
+    inline
+    void Server::ImplClass::makeResultResponse(const service_request_t * in, int result, Response & out)
+    {
+        out = Response(m_pool, in);
+        out.setResult(result);
+        out.finish();
+    }
+
+} // end namespace srpc
+
+namespace srpc {
+
+    inline
+    void Stream::write(const char * data, size_t size)
+    {
+        while ( size > 0 ) {
+            size_t n = size < (size_t)Server::ImplClass::streamChunkSize ? size : (size_t)Server::ImplClass::streamChunkSize;
+            this->sendChunk(data, n, 0, resultOk);
+            data += n;
+            size -= n;
+        }
+    }
+
+    inline
+    void Stream::finish(int32_t result)
+    {
+        if ( m_finished ) return;
+        this->sendChunk(nullptr, 0, streamEnd, result);
+        m_finished = true;
+    }
+
+    inline
+    void Stream::sendChunk(const char * data, size_t size, int32_t flags, int32_t result)
+    {
+        if ( m_finished || m_aborted ) return;
+
+        Server::ImplClass * impl = m_server->m_impl;
+        size_t cap;
+        size_t length = sizeof(service_response_t) + size;
+        char * p = impl->m_pool.allocate(length, &cap);
+
+        service_response_t * resp = (service_response_t *)p;
+        resp->header = m_request.header;
+        resp->header.body_type = io::htob((int16_t)typeStreamResponse);
+        resp->header.length    = io::htob((int32_t)length);
+        resp->header.timestamp = io::htob((int64_t)chrono::now());
+        resp->header.option    = io::htob(flags);
+        resp->service = m_request.service;
+        resp->service.result       = io::htob(result);
+        resp->service.rpc_body_len = io::htob((int32_t)size);
+        resp->service.compress     = compressNone;
+        if ( size > 0 ) memcpy(resp->data, data, size);
+
+        // 工作线程中产生的分块投递到事件循环发送，投递顺序即发送顺序
+        int      fd     = m_fd;
+        uint64_t serial = m_serial;
+        if ( m_inline ) {
+            impl->sendStreamChunk(fd, serial, p, length, cap);
+        } else {
+            impl->m_loop.post([impl, fd, serial, p, length, cap]() { impl->sendStreamChunk(fd, serial, p, length, cap); });
+        }
+    }
+
+    inline
+    Server::Server(nio::SimpleSocketServer & loop)
+        : m_impl(new ImplClass(loop))
+    {
+        m_impl->m_owner = this;
+    }
+
+    inline
+    Server::~Server()
+    {
+        if ( m_impl ) {
+            if ( m_impl->m_idleTimer >= 0 ) m_impl->m_loop.cancelTimer(m_impl->m_idleTimer);
+            if ( m_impl->m_stallTimer >= 0 ) m_impl->m_loop.cancelTimer(m_impl->m_stallTimer);
+            m_impl->m_workers.stop();
+            delete m_impl;
+            m_impl = nullptr;
+        }
+    }
+
+    inline
+    int Server::addListener(const net::Address & loc, err::Error * e)
+    {
+        ImplClass * impl = m_impl;
+        return impl->m_loop.addListener(loc,
+            [impl](int sfd, int cfd, const net::Address * remote) { impl->onAccepted(sfd, cfd, remote); }, e);
+    }
+
+    inline
+    int Server::addLocalListener(const char * path, err::Error * e)
+    {
+        assert( m_impl->m_localPath.empty() );
+        net::Address loc(path, e);
+        if ( !loc.isUnix() ) return -1;
+
+        int fd = this->addListener(loc, e);
+        if ( fd < 0 ) return -1;
+        m_impl->m_localPath = path;
+        m_impl->m_options |= optionLocal | optionShm;
+        return fd;
+    }
+
+    inline
+    void Server::setServiceHandler(const ServiceHandler & handler)
+    {
+        m_impl->m_handler = handler;
+    }
+
+    inline
+    void Server::setStreamHandler(const StreamHandler & handler)
+    {
+        m_impl->m_streamHandler = handler;
+        m_impl->m_options |= optionStream;
+    }
+
+    inline
+    void Server::setMaxMessageSize(size_t bytes)
+    {
+        m_impl->m_maxMessage = bytes;
+    }
+
+    inline
+    bool Server::startWorkers(int threads, int maxQueue, err::Error * e)
+    {
+        return m_impl->m_workers.start(threads, maxQueue, e);
+    }
+
+    inline
+    void Server::stopWorkers()
+    {
+        m_impl->m_workers.stop();
+    }
+
+    inline
+    int Server::addPriorityClass(int weight, int maxQueue)
+    {
+        return m_impl->m_workers.addLane(weight, maxQueue);
+    }
+
+    inline
+    bool Server::setDomainClass(int domain, int cls)
+    {
+        // 不存在的类别投递总是失败，该域的请求都会得到过载响应
+        if ( domain < 0 || domain >= 256 ) return false;
+        if ( cls != inlineClass && ( cls < 0 || cls >= m_impl->m_workers.laneCount() ) ) return false;
+        m_impl->m_domainClass[domain] = cls;
+        return true;
+    }
+
+    inline
+    void Server::setCompressThreshold(int bytes)
+    {
+        m_impl->m_compressThreshold = bytes;
+    }
+
+    inline
+    void Server::setIdleTimeout(int timeout)
+    {
+        ImplClass * impl = m_impl;
+        impl->m_idleTimeout = timeout;
+        if ( timeout > 0 && impl->m_idleTimer < 0 ) {
+            // 检查间隔为超时的1/4，连接最迟在超时后1/4个超时时长内关闭
+            int interval = timeout / 4 > 100 ? timeout / 4 : 100;
+            impl->m_idleTimer = impl->m_loop.addTimer(interval, [impl](int timer) { return impl->onIdleTimer(); });
+        }
+    }
+
+    inline
+    void Server::setLoadShedding(int maxWindow, int maxLoopLag, int suspend)
+    {
+        ImplClass * impl = m_impl;
+        impl->m_maxWindow  = std::min(maxWindow, (int)INT16_MAX);
+        impl->m_maxLoopLag = maxLoopLag;
+        impl->m_suspend    = suspend;
+        if ( maxWindow > 0 ) {
+            impl->m_options |= optionWindow;
+        } else {
+            impl->m_options &= ~optionWindow;
+        }
+        if ( maxWindow > 0 && impl->m_lagTimer < 0 ) {
+            impl->m_lagCheck = chrono::steady_now();
+            impl->m_lagTimer = impl->m_loop.addTimer(ImplClass::lagInterval, [impl](int timer) { return impl->onLagTimer(); });
+        }
+    }
+
+    inline
+    void Server::setTraceRing(size_t capacity)
+    {
+        mt::mutex_lock(&m_impl->m_statMutex);
+        m_impl->m_traces.assign(capacity, TraceRecord());
+        m_impl->m_traceCount = 0;
+        mt::mutex_unlock(&m_impl->m_statMutex);
+    }
+
+    inline
+    std::vector<TraceRecord> Server::traceRecords()
+    {
+        std::vector<TraceRecord> records;
+        mt::mutex_lock(&m_impl->m_statMutex);
+        size_t size = m_impl->m_traces.size();
+        int64_t count = m_impl->m_traceCount;
+        for ( int64_t i = std::max((int64_t)0, count - (int64_t)size); i < count; ++i ) {
+            records.push_back(m_impl->m_traces[i % size]);
+        }
+        mt::mutex_unlock(&m_impl->m_statMutex);
+        return records;
+    }
+
+    inline
+    CompressCounterMap Server::compressCounters()
+    {
+        mt::mutex_lock(&m_impl->m_statMutex);
+        CompressCounterMap counters = m_impl->m_compressCounters;
+        mt::mutex_unlock(&m_impl->m_statMutex);
+        return counters;
+    }
+
+} // end namespace srpc
+
+END_SYM_NAMESPACE
@@ -1,7 +1,14 @@
 #pragma once 
 
 #include <pthread.h>
+#include <assert.h>
+#include <stdint.h>
 #include <sym/symdef.h>
+#include <sym/error.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
 
 BEGIN_SYM_NAMESPACE
 
@@ -16,6 +23,91 @@ namespace mt {
     bool mutex_lock(mutex_t * m, err::Error * err = nullptr);
 
     bool mutex_unlock(mutex_t * m, err::Error * err = nullptr);
+
+    /// 有界工作线程池。
+    ///
+    ///     任务队列长度达到上限时post失败，由调用方决定如何降级处理（如直接返回过载响应），
+    ///     避免队列无限增长。stop时等待已入队的任务全部执行完成后再退出线程。
+    ///     排队的任务按截止时间从早到晚执行(EDF)，截止时间相同或未指定截止时间的任务按投递顺序执行。
+    ///
+    ///     任务可分为多个通道(lane)，每个通道有独立的队列和上限，某个通道积压不影响其它通道入队。
+    ///     工作线程按通道权重加权公平地取任务(stride调度)：权重为w的通道在各通道都有积压时
+    ///     得到w/总权重的执行机会，通道内仍按截止时间排序。通道0在构造时创建，权重为1。
+    class WorkerPool {
+    public:
+        typedef std::function<void ()> Task;
+
+        static const int64_t noDeadline = INT64_MAX;
+
+    private:
+        struct TaskEntry {
+            int64_t  deadline;
+            uint64_t order;
+            Task     task;
+
+            /// 小顶堆比较，截止时间早的优先，其次投递早的优先
+            bool operator<(const TaskEntry & other) const {
+                if ( deadline != other.deadline ) return deadline > other.deadline;
+                return order > other.order;
+            }
+        };
+
+        struct Lane {
+            std::vector<TaskEntry> tasks;       ///< 按截止时间组织的堆
+            size_t                 maxQueue;
+            uint64_t               stride;      ///< 每次出队后pass的增量，与权重成反比
+            uint64_t               pass;        ///< 虚拟时间，pass最小的非空通道先出队
+        };
+
+        static const uint64_t strideBase = 1 << 20;
+
+    private:
+        mutex_t                m_mutex;
+        pthread_cond_t         m_cond;
+        std::vector<Lane>      m_lanes;
+        size_t                 m_pending  { 0 };    ///< 各通道排队任务总数
+        uint64_t               m_pass     { 0 };    ///< 最近出队通道的pass，空通道重新入队时以此为起点
+        uint64_t               m_order    { 0 };
+        std::vector<pthread_t> m_threads;
+        bool                   m_stop     { false };
+
+    public:
+        WorkerPool();
+        ~WorkerPool();
+        SYM_NONCOPYABLE(WorkerPool)
+
+        /// 启动threads个工作线程，通道0的队列最多容纳maxQueue个待执行任务。
+        bool   start(int threads, size_t maxQueue, err::Error * e = nullptr);
+
+        /// 增加权重为weight(>0)、队列上限为maxQueue的通道，返回通道编号。
+        int    addLane(int weight, size_t maxQueue);
+
+        /// 停止线程池，已入队的任务执行完成后返回。
+        void   stop();
+
+        /// 投递任务，队列已满或线程池未运行时返回false，任务不会被执行。
+        /// deadline为任务截止时间，仅用于排队顺序，超时任务仍会执行，由任务自行检查。
+        bool   post(const Task & task, int64_t deadline = noDeadline);
+
+        /// 投递任务到指定通道，通道不存在时返回false
+        bool   postTo(int lane, const Task & task, int64_t deadline = noDeadline);
+
+        /// 各通道排队任务总数
+        size_t queueSize();
+        size_t queueSize(int lane);
+
+        /// 通道的队列上限，通道不存在时返回0
+        size_t queueLimit(int lane);
+        /// 通道数，通道编号为0 ~ laneCount()-1
+        int    laneCount();
+        bool   running() const { return !m_threads.empty(); }
+
+    private:
+        static void * threadProc(void * arg);
+        void   runTasks();
+        /// 取出下一个任务，调用方持有锁且队列不为空
+        Task   popTask();
+    }; // end class WorkerPool
 } // end namespace mt
 
 namespace mt {
@@ -65,6 +157,174 @@ bool mutex_unlock(mutex_t *m, err::Error *e ) {
     }
 }
 
+inline 
+WorkerPool::WorkerPool()
+{
+    mutex_init(&m_mutex);
+    pthread_cond_init(&m_cond, nullptr);
+    m_lanes.push_back(Lane { {}, 0, strideBase, 0 });
+}
+
+inline 
+WorkerPool::~WorkerPool()
+{
+    this->stop();
+    pthread_cond_destroy(&m_cond);
+    mutex_free(&m_mutex);
+}
+
+inline 
+bool WorkerPool::start(int threads, size_t maxQueue, err::Error * e)
+{
+    assert( m_threads.empty() && threads > 0 );
+    mutex_lock(&m_mutex);
+    m_lanes[0].maxQueue = maxQueue;
+    m_stop = false;
+    mutex_unlock(&m_mutex);
+
+    for ( int i = 0; i < threads; ++i ) {
+        pthread_t tid;
+        int r = pthread_create(&tid, nullptr, &WorkerPool::threadProc, this);
+        if ( r != 0 ) {
+            if ( e ) *e = err::Error(r, err::dmSystem);
+            this->stop();
+            return false;
+        }
+        m_threads.push_back(tid);
+    }
+    return true;
+}
+
+inline 
+void WorkerPool::stop()
+{
+    mutex_lock(&m_mutex);
+    m_stop = true;
+    pthread_cond_broadcast(&m_cond);
+    mutex_unlock(&m_mutex);
+
+    for ( auto it = m_threads.begin(); it != m_threads.end(); ++it ) {
+        pthread_join(*it, nullptr);
+    }
+    m_threads.clear();
+}
+
+inline 
+int WorkerPool::addLane(int weight, size_t maxQueue)
+{
+    assert( weight > 0 );
+    mutex_lock(&m_mutex);
+    m_lanes.push_back(Lane { {}, maxQueue, strideBase / weight, m_pass });
+    int lane = (int)m_lanes.size() - 1;
+    mutex_unlock(&m_mutex);
+    return lane;
+}
+
+inline 
+bool WorkerPool::post(const Task & task, int64_t deadline)
+{
+    return this->postTo(0, task, deadline);
+}
+
+inline 
+bool WorkerPool::postTo(int lane, const Task & task, int64_t deadline)
+{
+    mutex_lock(&m_mutex);
+    if ( m_stop || m_threads.empty() || lane < 0 || lane >= (int)m_lanes.size()
+      || m_lanes[lane].tasks.size() >= m_lanes[lane].maxQueue ) {
+        mutex_unlock(&m_mutex);
+        return false;
+    }
+    Lane & l = m_lanes[lane];
+    // 空闲过的通道从当前虚拟时间开始计，不能用积攒的额度长时间独占工作线程
+    if ( l.tasks.empty() && l.pass < m_pass ) l.pass = m_pass;
+    TaskEntry entry { deadline, m_order++, task };
+    l.tasks.push_back(std::move(entry));
+    std::push_heap(l.tasks.begin(), l.tasks.end());
+    ++m_pending;
+    pthread_cond_signal(&m_cond);
+    mutex_unlock(&m_mutex);
+    return true;
+}
+
+inline 
+size_t WorkerPool::queueSize()
+{
+    mutex_lock(&m_mutex);
+    size_t n = m_pending;
+    mutex_unlock(&m_mutex);
+    return n;
+}
+
+inline 
+size_t WorkerPool::queueSize(int lane)
+{
+    mutex_lock(&m_mutex);
+    size_t n = lane >= 0 && lane < (int)m_lanes.size() ? m_lanes[lane].tasks.size() : 0;
+    mutex_unlock(&m_mutex);
+    return n;
+}
+
+inline 
+size_t WorkerPool::queueLimit(int lane)
+{
+    mutex_lock(&m_mutex);
+    size_t n = lane >= 0 && lane < (int)m_lanes.size() ? m_lanes[lane].maxQueue : 0;
+    mutex_unlock(&m_mutex);
+    return n;
+}
+
+inline 
+int WorkerPool::laneCount()
+{
+    mutex_lock(&m_mutex);
+    int n = (int)m_lanes.size();
+    mutex_unlock(&m_mutex);
+    return n;
+}
+
+inline 
+WorkerPool::Task WorkerPool::popTask()
+{
+    Lane * next = nullptr;
+    for ( auto it = m_lanes.begin(); it != m_lanes.end(); ++it ) {
+        if ( !it->tasks.empty() && ( next == nullptr || it->pass < next->pass ) ) next = &*it;
+    }
+    m_pass = next->pass;
+    next->pass += next->stride;
+
+    std::pop_heap(next->tasks.begin(), next->tasks.end());
+    Task task = std::move(next->tasks.back().task);
+    next->tasks.pop_back();
+    --m_pending;
+    return task;
+}
+
+inline 
+void * WorkerPool::threadProc(void * arg)
+{
+    ((WorkerPool *)arg)->runTasks();
+    return nullptr;
+}
+
+inline 
+void WorkerPool::runTasks()
+{
+    while (1) {
+        mutex_lock(&m_mutex);
+        while ( m_pending == 0 && !m_stop ) pthread_cond_wait(&m_cond, &m_mutex);
+        if ( m_pending == 0 ) {
+            // 已停止且队列为空，线程退出
+            mutex_unlock(&m_mutex);
+            break;
+        }
+        Task task = this->popTask();
+        mutex_unlock(&m_mutex);
+
+        task();
+    }
+}
+
 } // end namespace mt
 
 END_SYM_NAMESPACE
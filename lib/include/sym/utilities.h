@@ -3,3 +3,6 @@
 
 #include <sym/utilities/allocator.h>
 #include <sym/utilities/array.h>
+#include <sym/utilities/buffer_pool.h>
+#include <sym/utilities/histogram.h>
+#include <sym/utilities/sha1.h>
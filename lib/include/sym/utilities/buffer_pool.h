@@ -0,0 +1,124 @@
+#pragma once
+
+# include <sym/symdef.h>
+# include <sym/thread.h>
+# include <stdlib.h>
+# include <assert.h>
+# include <vector>
+
+BEGIN_SYM_NAMESPACE
+
+namespace util
+{
+    /**
+     * @brief 按2的幂次分级缓存的内存块池，线程安全。
+     *
+     * 分配的内存块大小向上取整到所在级别，释放时按级别缓存以供复用，超出最大级别的内存块直接malloc/free。
+     * deallocate接受任何malloc分配的内存块，capacity不是级别大小时直接free，因此调用方必须传入实际分配的大小。
+     */
+    class BufferPool
+    {
+    public:
+        static const size_t minBlockSize = 1024;
+        static const int    numClasses   = 13;     ///< 1KB ~ 4MB
+
+    private:
+        struct SizeClass {
+            mt::mutex_t         mutex;
+            std::vector<char *> blocks;
+        };
+
+        SizeClass m_classes[numClasses];
+        size_t    m_maxCached;
+
+    public:
+        /// maxCached为每个级别最多缓存的空闲内存块数
+        BufferPool(size_t maxCached = 64);
+        ~BufferPool();
+        SYM_NONCOPYABLE(BufferPool)
+
+        /// 分配至少size字节的内存块，cap输出实际大小，内存不足时返回nullptr
+        char * allocate(size_t size, size_t * cap);
+
+        void   deallocate(char * p, size_t cap);
+
+    private:
+        static int sizeClass(size_t size);
+    }; // end class BufferPool
+
+} // end namespace util
+
+namespace util
+{
+    inline
+    BufferPool::BufferPool(size_t maxCached) : m_maxCached(maxCached)
+    {
+        for ( int i = 0; i < numClasses; ++i ) mt::mutex_init(&m_classes[i].mutex);
+    }
+
+    inline
+    BufferPool::~BufferPool()
+    {
+        for ( int i = 0; i < numClasses; ++i ) {
+            SizeClass & sc = m_classes[i];
+            for ( auto it = sc.blocks.begin(); it != sc.blocks.end(); ++it ) free(*it);
+            mt::mutex_free(&sc.mutex);
+        }
+    }
+
+    inline
+    int BufferPool::sizeClass(size_t size)
+    {
+        int    c = 0;
+        size_t n = minBlockSize;
+        while ( n < size && c < numClasses ) { n <<= 1; ++c; }
+        return c;    // numClasses表示超出最大级别
+    }
+
+    inline
+    char * BufferPool::allocate(size_t size, size_t * cap)
+    {
+        int c = sizeClass(size);
+        if ( c == numClasses ) {
+            *cap = size;
+            return (char *)malloc(size);
+        }
+
+        *cap = minBlockSize << c;
+        SizeClass & sc = m_classes[c];
+        char * p = nullptr;
+        mt::mutex_lock(&sc.mutex);
+        if ( !sc.blocks.empty() ) {
+            p = sc.blocks.back();
+            sc.blocks.pop_back();
+        }
+        mt::mutex_unlock(&sc.mutex);
+
+        if ( p == nullptr ) p = (char *)malloc(*cap);
+        return p;
+    }
+
+    inline
+    void BufferPool::deallocate(char * p, size_t cap)
+    {
+        if ( p == nullptr ) return;
+
+        int c = sizeClass(cap);
+        if ( c == numClasses || (minBlockSize << c) != cap ) {
+            free(p);
+            return;
+        }
+
+        SizeClass & sc = m_classes[c];
+        mt::mutex_lock(&sc.mutex);
+        if ( sc.blocks.size() < m_maxCached ) {
+            sc.blocks.push_back(p);
+            p = nullptr;
+        }
+        mt::mutex_unlock(&sc.mutex);
+        if ( p ) free(p);
+    }
+
+} // end namespace util
+
+END_SYM_NAMESPACE
@@ -0,0 +1,128 @@
+#pragma once
+
+# include <sym/symdef.h>
+# include <stdint.h>
+# include <string.h>
+
+BEGIN_SYM_NAMESPACE
+
+namespace util
+{
+    /**
+     * @brief 对数-线性分桶的数值直方图，用于统计延迟分位数，非线程安全。
+     *
+     * 小于64的值精确记录，更大的值每个2的幂次区间再均分为32个桶，相对误差不超过1/32。
+     * 各线程分别记录后用merge合并。
+     */
+    class Histogram
+    {
+    public:
+        static const int subBucketBits = 5;
+        static const int subBuckets    = 1 << subBucketBits;
+        static const int numBuckets    = (63 - subBucketBits) * subBuckets + 2 * subBuckets;
+
+    private:
+        uint64_t m_counts[numBuckets];
+        uint64_t m_total;
+        int64_t  m_min;
+        int64_t  m_max;
+        double   m_sum;
+
+    public:
+        Histogram() { this->reset(); }
+
+        /// 记录n次value，负值按0记录
+        void     record(int64_t value, uint64_t n = 1);
+
+        void     merge(const Histogram & other);
+        void     reset();
+
+        /// 返回分位数q(0~1)对应的值，取所在桶的上界
+        int64_t  percentile(double q) const;
+
+        uint64_t count() const { return m_total; }
+        int64_t  min() const   { return m_total ? m_min : 0; }
+        int64_t  max() const   { return m_max; }
+        double   mean() const  { return m_total ? m_sum / m_total : 0; }
+
+    private:
+        static int     bucketIndex(int64_t value);
+        static int64_t bucketHigh(int index);
+    }; // end class Histogram
+
+} // end namespace util
+
+namespace util
+{
+    inline
+    int Histogram::bucketIndex(int64_t value)
+    {
+        if ( value < 2 * subBuckets ) return (int)value;
+        int msb   = 63 - __builtin_clzll((uint64_t)value);
+        int shift = msb - subBucketBits;
+        return shift * subBuckets + (int)(value >> shift);
+    }
+
+    inline
+    int64_t Histogram::bucketHigh(int index)
+    {
+        if ( index < 2 * subBuckets ) return index;
+        int shift = index / subBuckets - 1;
+        int64_t sub = index % subBuckets + subBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    inline
+    void Histogram::record(int64_t value, uint64_t n)
+    {
+        if ( value < 0 ) value = 0;
+        m_counts[bucketIndex(value)] += n;
+        if ( m_total == 0 || value < m_min ) m_min = value;
+        if ( value > m_max ) m_max = value;
+        m_total += n;
+        m_sum   += (double)value * n;
+    }
+
+    inline
+    void Histogram::merge(const Histogram & other)
+    {
+        if ( other.m_total == 0 ) return;
+        for ( int i = 0; i < numBuckets; ++i ) m_counts[i] += other.m_counts[i];
+        if ( m_total == 0 || other.m_min < m_min ) m_min = other.m_min;
+        if ( other.m_max > m_max ) m_max = other.m_max;
+        m_total += other.m_total;
+        m_sum   += other.m_sum;
+    }
+
+    inline
+    void Histogram::reset()
+    {
+        memset(m_counts, 0, sizeof(m_counts));
+        m_total = 0;
+        m_min   = 0;
+        m_max   = 0;
+        m_sum   = 0;
+    }
+
+    inline
+    int64_t Histogram::percentile(double q) const
+    {
+        if ( m_total == 0 ) return 0;
+        uint64_t target = (uint64_t)(q * m_total + 0.5);
+        if ( target < 1 ) target = 1;
+        if ( target > m_total ) target = m_total;
+
+        uint64_t seen = 0;
+        for ( int i = 0; i < numBuckets; ++i ) {
+            seen += m_counts[i];
+            if ( seen >= target ) {
+                int64_t high = bucketHigh(i);
+                return high < m_max ? high : m_max;
+            }
+        }
+        return m_max;
+    }
+
+} // end namespace util
+
+END_SYM_NAMESPACE
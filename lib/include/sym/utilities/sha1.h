@@ -0,0 +1,151 @@
+#pragma once
+
+# include <sym/symdef.h>
+# include <stdint.h>
+# include <string.h>
+# include <algorithm>
+# include <string>
+
+BEGIN_SYM_NAMESPACE
+
+namespace util
+{
+    /**
+     * @brief SHA-1摘要，用于内容寻址(如Redis脚本的EVALSHA)，不用于安全相关的场合。
+     *
+     * 数据可以分多次update，final之后对象不再可用，需要reset。
+     */
+    class Sha1
+    {
+    public:
+        static const int digestSize = 20;
+
+    private:
+        uint32_t m_state[5];
+        uint64_t m_length;          ///< 已输入的字节数
+        uint8_t  m_block[64];
+        size_t   m_used;
+
+    public:
+        Sha1() { this->reset(); }
+
+        void reset();
+        void update(const void * data, size_t len);
+
+        /// 输出20字节的摘要
+        void final(uint8_t digest[digestSize]);
+
+    private:
+        void transform(const uint8_t * block);
+    }; // end class Sha1
+
+    /// 数据的SHA-1摘要，40个小写十六进制字符
+    std::string sha1_hex(const void * data, size_t len);
+
+} // end namespace util
+
+namespace util
+{
+    inline
+    void Sha1::reset()
+    {
+        m_state[0] = 0x67452301;
+        m_state[1] = 0xefcdab89;
+        m_state[2] = 0x98badcfe;
+        m_state[3] = 0x10325476;
+        m_state[4] = 0xc3d2e1f0;
+        m_length   = 0;
+        m_used     = 0;
+    }
+
+    inline
+    void Sha1::transform(const uint8_t * block)
+    {
+        uint32_t w[80];
+        for ( int i = 0; i < 16; ++i ) {
+            w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        }
+        for ( int i = 16; i < 80; ++i ) {
+            uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (x << 1) | (x >> 31);
+        }
+
+        uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3], e = m_state[4];
+        for ( int i = 0; i < 80; ++i ) {
+            uint32_t f, k;
+            if ( i < 20 )      { f = (b & c) | (~b & d);          k = 0x5a827999; }
+            else if ( i < 40 ) { f = b ^ c ^ d;                   k = 0x6ed9eba1; }
+            else if ( i < 60 ) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+            else               { f = b ^ c ^ d;                   k = 0xca62c1d6; }
+            uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = t;
+        }
+        m_state[0] += a;
+        m_state[1] += b;
+        m_state[2] += c;
+        m_state[3] += d;
+        m_state[4] += e;
+    }
+
+    inline
+    void Sha1::update(const void * data, size_t len)
+    {
+        const uint8_t * p = (const uint8_t *)data;
+        m_length += len;
+        if ( m_used > 0 ) {
+            size_t n = std::min(len, sizeof(m_block) - m_used);
+            memcpy(m_block + m_used, p, n);
+            m_used += n;
+            p      += n;
+            len    -= n;
+            if ( m_used < sizeof(m_block) ) return;
+            this->transform(m_block);
+            m_used = 0;
+        }
+        for ( ; len >= sizeof(m_block); p += sizeof(m_block), len -= sizeof(m_block) ) this->transform(p);
+        memcpy(m_block, p, len);
+        m_used = len;
+    }
+
+    inline
+    void Sha1::final(uint8_t digest[digestSize])
+    {
+        // 补一个0x80和若干0，最后8字节为比特长度，大端
+        uint64_t bits = m_length * 8;
+        uint8_t  pad[72] = { 0x80 };
+        size_t   n = ( m_used < 56 ) ? 56 - m_used : 120 - m_used;
+        for ( int i = 0; i < 8; ++i ) pad[n + i] = (uint8_t)(bits >> (56 - i * 8));
+        this->update(pad, n + 8);
+
+        for ( int i = 0; i < 5; ++i ) {
+            digest[i * 4]     = (uint8_t)(m_state[i] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(m_state[i] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(m_state[i] >> 8);
+            digest[i * 4 + 3] = (uint8_t)m_state[i];
+        }
+    }
+
+    inline
+    std::string sha1_hex(const void * data, size_t len)
+    {
+        static const char hex[] = "0123456789abcdef";
+        Sha1 sha;
+        uint8_t digest[Sha1::digestSize];
+        sha.update(data, len);
+        sha.final(digest);
+
+        std::string out(Sha1::digestSize * 2, '\0');
+        for ( int i = 0; i < Sha1::digestSize; ++i ) {
+            out[i * 2]     = hex[digest[i] >> 4];
+            out[i * 2 + 1] = hex[digest[i] & 0xf];
+        }
+        return out;
+    }
+
+} // end namespace util
+
+END_SYM_NAMESPACE
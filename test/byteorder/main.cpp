@@ -0,0 +1,123 @@
+# include <sym/io.h>
+# include <sym/srpc.h>
+# include <sym/chrono.h>
+# include <assert.h>
+# include <stdio.h>
+# include <string.h>
+# include <vector>
+
+namespace sio  = sym::io;
+namespace srpc = sym::srpc;
+
+// 标量转换可在编译期求值
+static_assert( sio::btoh((int16_t)0x0102) == 0x0201, "btoh int16" );
+static_assert( sio::htob((int32_t)0x01020304) == 0x04030201, "htob int32" );
+static_assert( sio::btoh((int64_t)0x0102030405060708LL) == 0x0807060504030201LL, "btoh int64" );
+
+/// 原有的逐字节宏实现，作为正确性和性能的对照
+template<class T> static T macro_swap(T n);
+template<> int16_t macro_swap(int16_t n) { int16_t r; unsigned char *s = (unsigned char *)&n, *t = (unsigned char *)&r; SYM_BYTEORDER_CONVERT_16(s, t); return r; }
+template<> int32_t macro_swap(int32_t n) { int32_t r; unsigned char *s = (unsigned char *)&n, *t = (unsigned char *)&r; SYM_BYTEORDER_CONVERT_32(s, t); return r; }
+template<> int64_t macro_swap(int64_t n) { int64_t r; unsigned char *s = (unsigned char *)&n, *t = (unsigned char *)&r; SYM_BYTEORDER_CONVERT_64(s, t); return r; }
+
+template<class T>
+static void check_bulk()
+{
+    // 覆盖SIMD主循环和尾部的各种长度
+    for ( size_t n = 0; n < 100; ++n ) {
+        std::vector<T> src(n), dst(n);
+        for ( size_t i = 0; i < n; ++i ) src[i] = (T)(0x0123456789abcdefLL * (i + 1));
+        sio::btoh(dst.data(), src.data(), n);
+        for ( size_t i = 0; i < n; ++i ) assert( dst[i] == macro_swap(src[i]) );
+
+        // 原地转换
+        sio::htob(dst.data(), dst.data(), n);
+        assert( dst == src );
+    }
+}
+
+static void check_headers()
+{
+    srpc::message_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic     = srpc::srpc_magic_word;
+    h.version   = 1;
+    h.length    = 1234;
+    h.sequence  = -5;
+    h.ttl       = 3000;
+    h.timestamp = 1700000000123456LL;
+    h.body_type = srpc::typeServiceRequest;
+    h.option    = 0x10203;
+
+    srpc::message_header_t w;
+    srpc::message_header_encode(&w, &h);
+    assert( w.magic == h.magic );
+    assert( w.length == sio::htob(h.length) && w.sequence == sio::htob(h.sequence) );
+    assert( w.timestamp == sio::htob(h.timestamp) && w.body_type == sio::htob(h.body_type) );
+    srpc::message_header_decode(&w, &w);
+    assert( memcmp(&w, &h, sizeof(h)) == 0 );
+
+    srpc::service_header_t s;
+    memset(&s, 0, sizeof(s));
+    s.reg_code = 7;
+    s.session_id = -1;
+    s.task_create_time = h.timestamp;
+    s.task_timeout = 500;
+    s.rpc_body_len = 99;
+    s.compress = srpc::compressLz;
+    s.service_name_length = 4;
+    memcpy(s.service_name, "echo", 4);
+
+    srpc::service_header_t ws;
+    srpc::service_header_encode(&ws, &s);
+    assert( ws.task_timeout == sio::htob(s.task_timeout) && ws.compress == s.compress );
+    assert( srpc::service_name(&ws) == "echo" );
+    srpc::service_header_decode(&ws, &ws);
+    assert( memcmp(&ws, &s, sizeof(s)) == 0 );
+}
+
+template<class T>
+static void bench(const char * name, size_t n, int rounds)
+{
+    std::vector<T> src(n), dst(n);
+    for ( size_t i = 0; i < n; ++i ) src[i] = (T)(i * 2654435761U);
+
+    int64_t t0 = sym::chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        for ( size_t i = 0; i < n; ++i ) dst[i] = macro_swap(src[i]);
+        __asm__ __volatile__("" : : "r"(dst.data()) : "memory");
+    }
+    int64_t t1 = sym::chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        for ( size_t i = 0; i < n; ++i ) dst[i] = sio::btoh(src[i]);
+        __asm__ __volatile__("" : : "r"(dst.data()) : "memory");
+    }
+    int64_t t2 = sym::chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        sio::btoh(dst.data(), src.data(), n);
+        __asm__ __volatile__("" : : "r"(dst.data()) : "memory");
+    }
+    int64_t t3 = sym::chrono::steady_now();
+
+    double mb = (double)n * sizeof(T) * rounds / (1 << 20);
+    printf("%s: macro %.0f MB/s, builtin %.0f MB/s, bulk %.0f MB/s\n", name,
+        mb / ((t1 - t0) / 1e6), mb / ((t2 - t1) / 1e6), mb / ((t3 - t2) / 1e6));
+}
+
+/**
+ * command:  testbyteorder [bench]
+ */
+int main(int argc, char **argv)
+{
+    check_bulk<int16_t>();
+    check_bulk<int32_t>();
+    check_bulk<int64_t>();
+    check_headers();
+
+    if ( argc > 1 && strcmp(argv[1], "bench") == 0 ) {
+        bench<int16_t>("int16", 1 << 16, 2000);
+        bench<int32_t>("int32", 1 << 15, 2000);
+        bench<int64_t>("int64", 1 << 14, 2000);
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+# include <sym/io/lz.h>
+# include <assert.h>
+# include <stdlib.h>
+# include <stdio.h>
+# include <string>
+# include <vector>
+
+namespace sio = sym::io;
+
+static void roundtrip(const std::string & data)
+{
+    int size = (int)data.size();
+    std::vector<char> packed(sio::lz_compress_bound(size));
+    int n = sio::lz_compress(data.data(), size, &packed[0], (int)packed.size());
+    assert( n > 0 );
+
+    std::vector<char> unpacked(size + 1);
+    int m = sio::lz_decompress(&packed[0], n, &unpacked[0], (int)unpacked.size());
+    assert( m == size );
+    assert( std::string(&unpacked[0], m) == data );
+
+    // 输出缓存不足时解压失败而不越界
+    if ( size > 0 ) {
+        m = sio::lz_decompress(&packed[0], n, &unpacked[0], size - 1);
+        assert( m == -1 );
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // 空数据和短数据只有字面量
+    roundtrip("");
+    roundtrip("a");
+    roundtrip("abcdefghijkl");
+
+    // 重复的JSON数据应该有明显压缩率
+    std::string json;
+    for ( int i = 0; i < 200; ++i ) {
+        char item[128];
+        snprintf(item, sizeof(item), "{\"id\": %d, \"name\": \"item\", \"price\": 12.5, \"tags\": [\"a\", \"b\"]},", i);
+        json += item;
+    }
+    roundtrip(json);
+    std::vector<char> packed(sio::lz_compress_bound((int)json.size()));
+    int n = sio::lz_compress(json.data(), (int)json.size(), &packed[0], (int)packed.size());
+    assert( n < (int)json.size() / 3 );
+
+    // 长匹配和长字面量，覆盖长度扩展字节
+    roundtrip(std::string(100000, 'x'));
+    std::string noise;
+    srand(1);
+    for ( int i = 0; i < 70000; ++i ) noise.push_back((char)(rand() & 0xff));
+    roundtrip(noise);
+    roundtrip(noise + noise);
+
+    // 输出缓存不足时压缩返回0
+    assert( sio::lz_compress(noise.data(), (int)noise.size(), &packed[0], 16) == 0 );
+
+    // 损坏的输入不能越界
+    std::vector<char> out(json.size());
+    for ( int i = 0; i < 2000; ++i ) {
+        std::vector<char> bad(packed.begin(), packed.begin() + n);
+        bad[rand() % n] = (char)(rand() & 0xff);
+        int m = sio::lz_decompress(&bad[0], rand() % (n + 1), &out[0], (int)out.size());
+        assert( m <= (int)out.size() );
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+# include <sym/redis.h>
+# include <sym/nio.h>
+# include <sym/network.h>
+# include <sym/thread.h>
+# include <arpa/inet.h>
+# include <pthread.h>
+# include <deque>
+# include <functional>
+# include <map>
+# include <string>
+# include <vector>
+
+using namespace sym;
+
+/**
+ * @brief 测试用的Redis服务端，在独立线程中运行事件循环，监听127.0.0.1的随机端口。
+ *
+ * 每次收到数据后解码出全部完整的命令，逐个交给handler，handler把回复追加到out，
+ * 本次收到的命令的回复在处理完后一次发出。handler在服务端的循环线程中执行，
+ * 可以用send向其他连接推送数据，或用drop关闭连接。
+ * 每次读取到的命令名按顺序记录在reads中，用于检查客户端的分批方式。
+ */
+class FakeServer
+{
+public:
+    using Handler = std::function<void (FakeServer & server, int fd, std::vector<std::string> & args, std::string * out)>;
+
+private:
+    struct Session
+    {
+        redis::Reader              reader;
+        io::MutableBuffer          inbuf;
+        std::deque<std::string *>  sending;
+        bool                       dropping { false };
+    };
+
+    nio::SimpleSocketServer   m_loop;
+    Handler                   m_handler;
+    std::map<int, Session>    m_sessions;
+    pthread_t                 m_tid;
+    int                       m_port     { 0 };
+    int                       m_current  { -1 };      ///< 正在处理命令的连接
+    bool                      m_running  { false };
+    mt::mutex_t               m_mutex;
+    std::vector<std::vector<std::string> > m_reads;   ///< 受m_mutex保护
+    int                       m_accepted { 0 };       ///< 受m_mutex保护
+
+public:
+    FakeServer(const Handler & handler) : m_handler(handler) { mt::mutex_init(&m_mutex); }
+    ~FakeServer() { this->stop(); mt::mutex_free(&m_mutex); }
+
+    bool start(err::Error * e = nullptr);
+    void stop();
+
+    int          port() const { return m_port; }
+    net::Address address() const { return net::Address("127.0.0.1", m_port, nullptr); }
+    std::string  name() const { return "127.0.0.1:" + std::to_string(m_port); }
+
+    /// 以下两个方法只能在handler中调用。drop当前连接时，已生成的回复发完后关闭
+    void send(int fd, const std::string & data);
+    void drop(int fd);
+
+    /// 已接受的连接数，以及每次读取到的命令名
+    int  accepted();
+    std::vector<std::vector<std::string> > reads();
+    void clearReads();
+
+private:
+    static void * threadProc(void * arg);
+    void onAccepted(int cfd);
+    void onReceived(int fd, int status, io::MutableBuffer & buf);
+    void onSent(int fd);
+    void onClosed(int fd);
+}; // end class FakeServer
+
+/// 把s编码为批量字符串回复追加到out
+inline
+void append_bulk(std::string * out, const std::string & s)
+{
+    out->append("$" + std::to_string(s.size()) + "\r\n" + s + "\r\n");
+}
+
+inline
+bool FakeServer::start(err::Error * e)
+{
+    net::Address loc("127.0.0.1", 0, e);
+    int sfd = m_loop.addListener(loc,
+        [this](int sfd, int cfd, const net::Address * remote) { if ( cfd >= 0 ) this->onAccepted(cfd); }, e);
+    if ( sfd < 0 ) return false;
+
+    net::Address bound;
+    if ( !net::Socket(sfd).localAddress(&bound, e) ) return false;
+    m_port = ntohs(((const sockaddr_in *)bound.data())->sin_port);
+
+    if ( pthread_create(&m_tid, nullptr, threadProc, this) != 0 ) return false;
+    m_running = true;
+    return true;
+}
+
+inline
+void FakeServer::stop()
+{
+    if ( !m_running ) return;
+    m_running = false;
+    m_loop.post([this]() { m_loop.exitLoop(); });
+    pthread_join(m_tid, nullptr);
+    for ( auto it = m_sessions.begin(); it != m_sessions.end(); ++it ) {
+        for ( auto s = it->second.sending.begin(); s != it->second.sending.end(); ++s ) delete *s;
+    }
+}
+
+inline
+void * FakeServer::threadProc(void * arg)
+{
+    FakeServer * server = (FakeServer *)arg;
+    err::Error e;
+    server->m_loop.run(&e);
+    return nullptr;
+}
+
+inline
+void FakeServer::onAccepted(int cfd)
+{
+    m_loop.acceptChannel(cfd,
+        [this](int fd, int status, io::MutableBuffer & buf) { this->onReceived(fd, status, buf); },
+        [this](int fd, int status, io::ConstBuffer & buf) { this->onSent(fd); },
+        [this](int fd) { this->onClosed(fd); });
+
+    Session & s = m_sessions[cfd];
+    size_t avail;
+    char * p = s.reader.prepare(4096, &avail);
+    s.inbuf.attach(p, 0, avail);
+    m_loop.setPartialReceive(cfd, true);
+    m_loop.beginReceive(cfd, s.inbuf);
+
+    mt::mutex_lock(&m_mutex);
+    ++m_accepted;
+    mt::mutex_unlock(&m_mutex);
+}
+
+inline
+void FakeServer::onReceived(int fd, int status, io::MutableBuffer & buf)
+{
+    auto it = m_sessions.find(fd);
+    if ( status != nio::SimpleSocketServer::statusOk || it == m_sessions.end() ) {
+        m_loop.closeChannel(fd);
+        return;
+    }
+
+    Session & s = it->second;
+    s.reader.commit(buf.size());
+
+    std::vector<std::string> names;
+    std::string out;
+    redis::Value cmd;
+    while ( !s.dropping && s.reader.next(&cmd) == redis::Reader::complete ) {
+        std::vector<std::string> args;
+        redis::Value::ValueList & items = cmd.list();
+        for ( auto a = items.begin(); a != items.end(); ++a ) args.push_back(a->getString());
+        if ( args.empty() ) continue;
+        names.push_back(args[0]);
+        m_current = fd;
+        m_handler(*this, fd, args, &out);
+        m_current = -1;
+    }
+
+    if ( !names.empty() ) {
+        mt::mutex_lock(&m_mutex);
+        m_reads.push_back(names);
+        mt::mutex_unlock(&m_mutex);
+    }
+
+    if ( !out.empty() ) this->send(fd, out);
+    if ( s.dropping ) {
+        // 已生成的回复发完后再关闭
+        buf.detach();
+        if ( s.sending.empty() ) m_loop.closeChannel(fd);
+        return;
+    }
+
+    size_t avail;
+    char * p = s.reader.prepare(4096, &avail);
+    buf.attach(p, 0, avail);
+}
+
+inline
+void FakeServer::send(int fd, const std::string & data)
+{
+    auto it = m_sessions.find(fd);
+    if ( it == m_sessions.end() ) return;
+    std::string * copy = new std::string(data);
+    io::ConstBuffer buf(copy->data(), copy->size(), copy->size());
+    if ( !m_loop.send(fd, buf) ) {
+        delete copy;
+        return;
+    }
+    it->second.sending.push_back(copy);
+}
+
+inline
+void FakeServer::onSent(int fd)
+{
+    auto it = m_sessions.find(fd);
+    if ( it == m_sessions.end() || it->second.sending.empty() ) return;
+    Session & s = it->second;
+    delete s.sending.front();
+    s.sending.pop_front();
+    if ( s.dropping && s.sending.empty() ) m_loop.closeChannel(fd);
+}
+
+inline
+void FakeServer::onClosed(int fd)
+{
+    auto it = m_sessions.find(fd);
+    if ( it == m_sessions.end() ) return;
+    for ( auto s = it->second.sending.begin(); s != it->second.sending.end(); ++s ) delete *s;
+    m_sessions.erase(it);
+}
+
+inline
+void FakeServer::drop(int fd)
+{
+    auto it = m_sessions.find(fd);
+    if ( it == m_sessions.end() ) return;
+    it->second.dropping = true;
+    if ( fd != m_current && it->second.sending.empty() ) m_loop.closeChannel(fd);
+}
+
+inline
+int FakeServer::accepted()
+{
+    mt::mutex_lock(&m_mutex);
+    int n = m_accepted;
+    mt::mutex_unlock(&m_mutex);
+    return n;
+}
+
+inline
+std::vector<std::vector<std::string> > FakeServer::reads()
+{
+    mt::mutex_lock(&m_mutex);
+    std::vector<std::vector<std::string> > r = m_reads;
+    mt::mutex_unlock(&m_mutex);
+    return r;
+}
+
+inline
+void FakeServer::clearReads()
+{
+    mt::mutex_lock(&m_mutex);
+    m_reads.clear();
+    mt::mutex_unlock(&m_mutex);
+}
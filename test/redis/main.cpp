@@ -0,0 +1,1302 @@
+# include <sym/redis.h>
+# include <sym/redis/async_client.h>
+# include <sym/redis/cache.h>
+# include <sym/redis/cluster.h>
+# include <sym/redis/pool.h>
+# include <sym/redis/script.h>
+# include <sym/redis/subscriber.h>
+# include <sym/chrono.h>
+# include <assert.h>
+# include <fnmatch.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <unistd.h>
+# include <atomic>
+# include <fstream>
+# include <iterator>
+# include <new>
+# include <set>
+# include <string>
+# include "fake_server.h"
+
+using namespace sym;
+
+/// 统计堆分配次数，检查编码是否分配内存
+static size_t G_allocs = 0;
+
+void * operator new(size_t size)
+{
+    ++G_allocs;
+    void * p = malloc(size ? size : 1);
+    if ( p == nullptr ) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void * p) noexcept { free(p); }
+
+static const char * sample =
+    "+OK\r\n"
+    "-ERR unknown\r\n"
+    ":-42\r\n"
+    "$5\r\nhe\r\no\r\n"
+    "$-1\r\n"
+    "*0\r\n"
+    "*3\r\n:1\r\n*2\r\n$1\r\na\r\n*1\r\n+x\r\n$0\r\n\r\n";
+
+static void check_values(redis::Reader & reader)
+{
+    redis::Value v;
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtStatus && v.status() && v.getString() == "OK" );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtStatus && !v.status() );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtInteger && v.getInt() == -42 );
+    assert( reader.next(&v) == redis::Reader::complete && v.getString() == std::string("he\r\no") );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtNull );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtList && v.list().empty() );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtList && v.list().size() == 3 );
+    redis::Value & inner = v.list()[1];
+    assert( inner.list().size() == 2 && inner.list()[0].getString() == "a" && inner.list()[1].list()[0].getString() == "x" );
+    assert( v.list()[2].type() == redis::Value::vtString && v.list()[2].getString().empty() );
+    assert( reader.next(&v) == redis::Reader::needMore && reader.buffered() == 0 );
+}
+
+/// 一次性输入和逐字节输入结果相同
+static void check_split()
+{
+    redis::Reader whole;
+    whole.feed(sample, strlen(sample));
+    check_values(whole);
+
+    redis::Reader bytes;
+    std::vector<redis::Value> values;
+    redis::Value v;
+    for ( const char * p = sample; *p; ++p ) {
+        bytes.feed(p, 1);
+        int r;
+        while ( (r = bytes.next(&v)) == redis::Reader::complete ) values.push_back(v);
+        assert( r == redis::Reader::needMore );
+    }
+    assert( values.size() == 7 && values[6].list()[1].list()[1].list()[0].getString() == "x" );
+
+    redis::Reader bad;
+    err::Error e;
+    bad.feed("$3\r\nabcd\r\n", 10);
+    assert( bad.next(&v, &e) == redis::Reader::failed && e );
+    redis::Reader badnum;
+    badnum.feed(":12a\r\n", 6);
+    assert( badnum.next(&v) == redis::Reader::failed );
+}
+
+/// 数组长度行超出元素总数上限时报错，不按长度预留节点
+static void check_limit()
+{
+    redis::Value v;
+    err::Error e;
+    redis::Reader huge;
+    huge.feed("*2147483647\r\n", 14);
+    assert( huge.next(&v, &e) == redis::Reader::failed && strcmp(e.message(), "array too long") == 0 );
+
+    // 上限为4：嵌套数组和映射的键值都计入总数
+    const char * ok = "*4\r\n:1\r\n:2\r\n:3\r\n:4\r\n*1\r\n*3\r\n:1\r\n:2\r\n:3\r\n%2\r\n:1\r\n:2\r\n:3\r\n:4\r\n";
+    redis::Reader reader;
+    reader.setMaxElements(4);
+    reader.feed(ok, strlen(ok));
+    assert( reader.next(&v) == redis::Reader::complete && v.list().size() == 4 );
+    assert( reader.next(&v) == redis::Reader::complete && v.list()[0].list().size() == 3 );
+    assert( reader.next(&v) == redis::Reader::complete && v.list().size() == 4 );
+
+    const char * bad[] = { "*5\r\n", "*2\r\n*3\r\n", "%3\r\n" };
+    for ( size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i ) {
+        redis::Reader r;
+        r.setMaxElements(4);
+        r.feed(bad[i], strlen(bad[i]));
+        assert( r.next(&v) == redis::Reader::failed );
+    }
+}
+
+/// RESP3类型，推送消息交给PushHandler，不作为命令回复返回
+static void check_resp3()
+{
+    static const char * resp3 =
+        "%2\r\n$6\r\nserver\r\n$5\r\nredis\r\n$5\r\nproto\r\n:3\r\n"
+        "~2\r\n#t\r\n#f\r\n"
+        "_\r\n"
+        ",3.14\r\n"
+        "(3492890328409238509324850943850943825024385\r\n"
+        "!9\r\nERR bad\r\n\r\n"
+        "=9\r\ntxt:hello\r\n"
+        ">2\r\n$10\r\ninvalidate\r\n*1\r\n$3\r\nfoo\r\n"
+        "$3\r\nbar\r\n";
+    redis::Reader reader;
+    reader.feed(resp3, strlen(resp3));
+    redis::Value v;
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtMap && v.list().size() == 4 );
+    assert( v.list()[0].getString() == "server" && v.list()[3].getInt() == 3 );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtSet && v.list().size() == 2 );
+    assert( v.list()[0].getInt() == 1 && v.list()[1].getInt() == 0 );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtNull );
+    assert( reader.next(&v) == redis::Reader::complete && v.getString() == "3.14" );
+    assert( reader.next(&v) == redis::Reader::complete && v.getString().size() == 43 );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtStatus && !v.status() && v.getString() == "ERR bad\r\n" );
+    assert( reader.next(&v) == redis::Reader::complete && v.type() == redis::Value::vtString && v.getString() == "hello" );
+
+    redis::Reply reply;
+    assert( reader.next(&reply) == redis::Reader::complete && reply.root().type() == redis::Value::vtPush );
+    assert( reply.root().size() == 2 && reply.root()[1][0].getString() == "foo" );
+
+    // 同步解码器跳过推送消息，只返回命令的回复
+    size_t pos = 0, len = strlen(resp3);
+    redis::ValueDecoder decoder([&](char * buf, int n, int, err::Error *) {
+        int r = (int)std::min((size_t)n, len - pos);
+        memcpy(buf, resp3 + pos, r);
+        pos += r;
+        return r;
+    });
+    std::vector<std::string> pushed;
+    decoder.setPushHandler([&](redis::Value & value) { pushed.push_back(value.list()[1].list()[0].getString()); });
+    for ( int i = 0; i < 7; ++i ) assert( decoder.parse(&v, 0) == 1 );
+    assert( decoder.parse(&v, 0) == 1 && v.getString() == "bar" && pushed.size() == 1 && pushed[0] == "foo" );
+    assert( decoder.dispatch() == 0 );
+
+    redis::Reader bad;
+    bad.feed("#x\r\n", 4);
+    assert( bad.next(&v) == redis::Reader::failed );
+}
+
+/// 各种起点和长度下与memchr结果相同，整数超出int64_t时报错
+static void check_scan()
+{
+    std::string buf(200, 'x');
+    for ( size_t nl = 0; nl < buf.size(); nl += 13 ) {
+        buf[nl] = '\n';
+        for ( size_t from = 0; from < buf.size(); ++from ) {
+            for ( size_t len = 0; from + len <= buf.size(); len += 7 ) {
+                const char * p = buf.data() + from;
+                assert( redis::find_newline(p, p + len) == memchr(p, '\n', len) );
+            }
+        }
+        buf[nl] = 'x';
+    }
+
+    redis::Value v;
+    redis::Reader reader;
+    const char * ok = ":9223372036854775807\r\n:-9223372036854775808\r\n:0000000000000000001\r\n";
+    reader.feed(ok, strlen(ok));
+    assert( reader.next(&v) == redis::Reader::complete && v.getInt() == INT64_MAX );
+    assert( reader.next(&v) == redis::Reader::complete && v.getInt() == INT64_MIN );
+    assert( reader.next(&v) == redis::Reader::complete && v.getInt() == 1 );
+    const char * bad[] = { ":9223372036854775808\r\n", ":-9223372036854775809\r\n", ":00000000000000000001\r\n", ":-\r\n", "$1a\r\n" };
+    for ( size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i ) {
+        redis::Reader r;
+        r.feed(bad[i], strlen(bad[i]));
+        assert( r.next(&v) == redis::Reader::failed );
+    }
+}
+
+/// 字符串分段交给sink或直接接收到调用者的缓存，其他回复照常解码，之后的回复不受影响
+static void check_stream()
+{
+    std::string big(100000, '\0');
+    for ( size_t i = 0; i < big.size(); ++i ) big[i] = (char)(i * 131);
+    std::string data = "$" + std::to_string(big.size()) + "\r\n" + big + "\r\n"
+        + ">2\r\n$10\r\ninvalidate\r\n_\r\n" + "$" + std::to_string(big.size()) + "\r\n" + big + "\r\n"
+        + "$-1\r\n-ERR wrong type\r\n:7\r\n$5\r\nhello\r\n$5\r\nworld\r\n+OK\r\n";
+    size_t pos = 0;
+    redis::ValueDecoder decoder([&](char * buf, int n, int, err::Error *) {
+        int r = (int)std::min(std::min((size_t)n, data.size() - pos), (size_t)3000);   // 每次最多收到3000字节
+        memcpy(buf, data.data() + pos, r);
+        pos += r;
+        return r;
+    });
+    int pushes = 0;
+    decoder.setPushHandler([&](redis::Value &) { ++pushes; });
+
+    redis::Value v;
+    int64_t length;
+    std::string out;
+    size_t chunks = 0;
+    redis::ChunkSink sink = [&](const char * p, size_t n) { out.append(p, n); ++chunks; return true; };
+    assert( decoder.parse(&v, sink, &length, 0) == 1 && length == (int64_t)big.size() && out == big && chunks > 1 );
+
+    std::vector<char> buf(big.size());
+    assert( decoder.parse(&v, buf.data(), buf.size(), &length, 0) == 1 && length == (int64_t)big.size() && pushes == 1 );
+    assert( memcmp(buf.data(), big.data(), big.size()) == 0 );
+
+    assert( decoder.parse(&v, sink, &length, 0) == 1 && length == -1 && v.type() == redis::Value::vtNull );
+    assert( decoder.parse(&v, sink, &length, 0) == 1 && length == -1 && v.type() == redis::Value::vtStatus && !v.status() );
+    assert( decoder.parse(&v, sink, &length, 0) == 1 && length == -1 && v.getInt() == 7 );
+
+    // 缓存不够时只保存前面部分，其余丢弃
+    char small[3];
+    assert( decoder.parse(&v, small, sizeof(small), &length, 0) == 1 && length == 5 && memcmp(small, "hel", 3) == 0 );
+    assert( decoder.parse(&v, 0) == 1 && v.getString() == "world" );
+    assert( decoder.parse(&v, 0) == 1 && v.type() == redis::Value::vtStatus && v.status() );
+}
+
+/// 深度嵌套和大量元素，逐块输入的耗时与输入长度成线性关系
+static void check_linear(int depth, int chunk)
+{
+    std::string data;
+    for ( int i = 0; i < depth; ++i ) data += "*2\r\n:1\r\n";
+    data += ":0\r\n";
+
+    int64_t t0 = chrono::steady_now();
+    redis::Reader reader;
+    redis::Value v;
+    int r = redis::Reader::needMore;
+    for ( size_t pos = 0; pos < data.size(); pos += chunk ) {
+        reader.feed(data.data() + pos, std::min((size_t)chunk, data.size() - pos));
+        r = reader.next(&v);
+    }
+    int64_t t1 = chrono::steady_now();
+    assert( r == redis::Reader::complete );
+    int n = 0;
+    for ( redis::Value * p = &v; p->type() == redis::Value::vtList; p = &p->list()[1] ) ++n;
+    assert( n == depth );
+    printf("depth %d, chunk %d: %lld us\n", depth, chunk, (long long)(t1 - t0));
+
+    // 展开嵌套结构，避免析构时递归过深
+    while ( v.type() == redis::Value::vtList ) {
+        redis::Value child = std::move(v.list()[1]);
+        v = std::move(child);
+    }
+}
+
+/// 零拷贝回复与Value的内容一致，逐字节输入时未完成回复的字符串位置在缓存移动后仍然正确
+static void check_reply()
+{
+    redis::Reader reader;
+    redis::Reply  reply;
+    std::string data = std::string(sample) + "*2\r\n$3\r\nfoo\r\n*1\r\n$" + std::to_string(10000) + "\r\n"
+        + std::string(10000, 'z') + "\r\n";
+    std::vector<std::string> seen;
+    for ( size_t i = 0; i < data.size(); ++i ) {
+        reader.feed(&data[i], 1);
+        while ( reader.next(&reply) == redis::Reader::complete ) {
+            redis::Value v;
+            reply.root().toValue(&v);
+            redis::ValueRef root = reply.root();
+            if ( root.type() == redis::Value::vtList ) seen.push_back(std::to_string(root.size()));
+            else if ( root.type() == redis::Value::vtInteger ) seen.push_back(std::to_string(root.getInt()));
+            else seen.push_back(root.type() == redis::Value::vtNull ? "(nil)" : root.getString());
+            if ( seen.size() == 7 ) {
+                redis::ValueRef r = reply.root();
+                assert( r.size() == 3 && r[0].getInt() == 1 && r[1][0].getString() == "a" && r[1][1][0].getString() == "x" );
+                assert( r[2].type() == redis::Value::vtString && r[2].length() == 0 && reply.nodes() == 7 );
+                assert( v.list()[1].list()[1].list()[0].getString() == "x" );
+            }
+            if ( seen.size() == 8 ) {
+                redis::ValueRef r = reply.root();
+                assert( r[0].length() == 3 && memcmp(r[0].data(), "foo", 3) == 0 );
+                assert( r[1][0].getString() == std::string(10000, 'z') && v.list()[1].list()[0].getString().size() == 10000 );
+            }
+        }
+    }
+    assert( seen.size() == 8 && seen[0] == "OK" && seen[2] == "-42" && seen[3] == "he\r\no" && seen[4] == "(nil)" && seen[5] == "0" );
+}
+
+/// MGET形式的回复：Value逐个元素分配，Reply只使用一个节点数组
+static void bench_mget(int keys, int rounds)
+{
+    std::string data = "*" + std::to_string(keys) + "\r\n";
+    for ( int i = 0; i < keys; ++i ) {
+        std::string val = "value-of-key-number-" + std::to_string(i);
+        data += "$" + std::to_string(val.size()) + "\r\n" + val + "\r\n";
+    }
+
+    redis::Reader reader;
+    redis::Value  value;
+    redis::Reply  reply;
+    size_t total = 0;
+    int64_t t0 = chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        reader.feed(data.data(), data.size());
+        reader.next(&value);
+        total += value.list().size();
+    }
+    int64_t t1 = chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        reader.feed(data.data(), data.size());
+        reader.next(&reply);
+        total += reply.root().size();
+    }
+    int64_t t2 = chrono::steady_now();
+    assert( total == (size_t)keys * rounds * 2 );
+    printf("mget %d keys: value %lld us, reply %lld us per reply\n", keys,
+        (long long)(t1 - t0) / rounds, (long long)(t2 - t1) / rounds);
+}
+
+/// 按行扫描和完整解码一份回复数据，比较memchr和find_newline
+static void bench_corpus(const char * name, const std::string & data, int rounds)
+{
+    const char * end = data.data() + data.size();
+    size_t lines[2] = { 0, 0 };
+    int64_t t0 = chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        for ( const char * p = data.data(); (p = (const char *)memchr(p, '\n', end - p)) != nullptr; ++p ) ++lines[0];
+    }
+    int64_t t1 = chrono::steady_now();
+    for ( int r = 0; r < rounds; ++r ) {
+        for ( const char * p = data.data(); (p = redis::find_newline(p, end)) != nullptr; ++p ) ++lines[1];
+    }
+    int64_t t2 = chrono::steady_now();
+    assert( lines[0] == lines[1] );
+
+    redis::Reader reader;
+    redis::Reply  reply;
+    size_t replies = 0;
+    for ( int r = 0; r < rounds; ++r ) {
+        reader.reset();     // 录制的数据末尾可能是不完整的回复
+        reader.feed(data.data(), data.size());
+        int ret;
+        while ( (ret = reader.next(&reply)) == redis::Reader::complete ) ++replies;
+        assert( ret == redis::Reader::needMore );
+    }
+    int64_t t3 = chrono::steady_now();
+    printf("corpus %s, %d bytes, %d replies: scan memchr %lld us, find_newline %lld us, decode %lld us (%.0f MB/s)\n",
+        name, (int)data.size(), (int)(replies / rounds), (long long)(t1 - t0) / rounds, (long long)(t2 - t1) / rounds,
+        (long long)(t3 - t2) / rounds, (double)data.size() * rounds / std::max<int64_t>(t3 - t2, 1));
+}
+
+/// 典型回复组成的语料，另外可以在命令行指定从连接上录制的原始回复数据文件
+static void bench_decode(int argc, char ** argv)
+{
+    std::string mget = "*10000\r\n", ints, status, hash = "*2000\r\n";
+    for ( int i = 0; i < 10000; ++i ) {
+        std::string val = "value-of-key-number-" + std::to_string(i);
+        mget += "$" + std::to_string(val.size()) + "\r\n" + val + "\r\n";
+    }
+    for ( int i = 0; i < 20000; ++i ) ints += ":" + std::to_string(i * 7919LL * 7919) + "\r\n";
+    for ( int i = 0; i < 5000; ++i ) status += "+OK\r\n-ERR wrong number of arguments for 'set' command\r\n";
+    for ( int i = 0; i < 1000; ++i ) {
+        std::string field = "field:" + std::to_string(i), val(100 + i % 50, 'v');
+        hash += "$" + std::to_string(field.size()) + "\r\n" + field + "\r\n$" + std::to_string(val.size()) + "\r\n" + val + "\r\n";
+    }
+    bench_corpus("mget", mget, 20);
+    bench_corpus("incr", ints, 20);
+    bench_corpus("status", status, 20);
+    bench_corpus("hgetall", hash, 20);
+
+    for ( int i = 1; i < argc; ++i ) {
+        std::ifstream in(argv[i], std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if ( !data.empty() ) bench_corpus(argv[i], data, 20);
+    }
+}
+
+static void check_encode()
+{
+    char buf[24];
+    const int64_t ints[] = { 0, 7, 9, 10, 99, 100, 12345, -1, -100, INT64_MAX, INT64_MIN };
+    for ( size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i ) {
+        size_t n = redis::format_int(ints[i], buf);
+        char expect[32];
+        snprintf(expect, sizeof(expect), "%lld", (long long)ints[i]);
+        assert( n == strlen(expect) && memcmp(buf, expect, n) == 0 );
+    }
+    size_t n = redis::format_uint(UINT64_MAX, buf);
+    assert( std::string(buf, n) == "18446744073709551615" );
+
+    // 各种参数形式的编码结果与字符串参数相同
+    std::string key = "key:1";
+    std::vector<char> a, b;
+    redis::encode_command({ "SET", key, std::string("v\0x", 3), "-12", "42" }, &a);
+    redis::encode_args(&b, "SET", key, redis::Arg("v\0x", 3), -12, 42u);
+    assert( a == b );
+    std::string text(b.begin(), b.end());
+    static const char expect[] = "*5\r\n$3\r\nSET\r\n$5\r\nkey:1\r\n$3\r\nv\0x\r\n$3\r\n-12\r\n$2\r\n42\r\n";
+    assert( text == std::string(expect, sizeof(expect) - 1) );
+
+    redis::Command cmd(nullptr, nullptr);
+    cmd.assign("SET", key, redis::Arg("v\0x", 3)) << "-12" << 42;
+    std::vector<char> c;
+    cmd.encode(&c);
+    assert( c == a );
+
+    // 输出缓存复用后，常见命令的编码不分配内存
+    std::vector<char> out;
+    out.reserve(4096);
+    size_t before = G_allocs;
+    for ( int i = 0; i < 1000; ++i ) {
+        out.clear();
+        redis::encode_args(&out, "SET", key, i);
+        redis::encode_args(&out, "GET", key);
+    }
+    assert( G_allocs == before );
+}
+
+/// CRC16校验值，以及带花括号的key的哈希槽
+static void check_slot()
+{
+    assert( redis::crc16("123456789", 9) == 0x31c3 );
+    assert( redis::key_slot("", 0) == 0 );
+    assert( redis::key_slot("foo", 3) == 12182 );
+    assert( redis::key_slot("bar", 3) == 5061 );
+    // 只计算第一个非空的{...}
+    assert( redis::key_slot("user1000", 8) == 3443 );
+    assert( redis::key_slot("{user1000}.following", 20) == 3443 );
+    assert( redis::key_slot("{}x", 3) == 10595 );
+    assert( redis::key_slot("a{}{b}", 6) == 15033 );
+    assert( redis::key_slot("{a}b{c}", 7) == 15495 );
+}
+
+static void check_script()
+{
+    assert( util::sha1_hex("", 0) == "da39a3ee5e6b4b0d3255bfef95601890afd80709" );
+    assert( util::sha1_hex("abc", 3) == "a9993e364706816aba3e25717850c26c9cd0d89d" );
+    std::string s(55, 'x'), t(64, 'x'), m(1000000, 'a');
+    assert( util::sha1_hex(s.data(), s.size()) == "cef734ba81a024479e09eb5a75b6ddae62e6abf1" );
+    assert( util::sha1_hex(t.data(), t.size()) == "bb2fa3ee7afb9f54c6dfb5d021f14b1ffe40c163" );
+
+    // 分多次输入的结果相同
+    util::Sha1 sha;
+    for ( size_t i = 0; i < m.size(); i += 999 ) sha.update(m.data() + i, std::min<size_t>(999, m.size() - i));
+    uint8_t digest[util::Sha1::digestSize];
+    sha.final(digest);
+    assert( digest[0] == 0x34 && digest[1] == 0xaa && digest[19] == 0x6f );
+
+    redis::Script script("return 1");
+    assert( script.sha1() == "e0e1f9fabfc9d4800c877a703b823ac0578ff8db" );
+    redis::Value v;
+    v.setStatus(false, "NOSCRIPT No matching script. Please use EVAL.", 45);
+    assert( redis::is_noscript(v) );
+    v.setStatus(false, "ERR unknown", 11);
+    assert( !redis::is_noscript(v) );
+}
+
+/// 流水线中的脚本调用：未加载的脚本与调用一起发出，调用和之后的命令保持顺序
+static void check_script_pipeline()
+{
+    // EVALSHA把计数加1并返回，GET返回计数；SCRIPT FLUSH之后回复NOSCRIPT
+    std::set<std::string> loaded;
+    int counter = 0;
+    FakeServer server([&](FakeServer & s, int fd, std::vector<std::string> & args, std::string * out) {
+        if ( args[0] == "SCRIPT" && args[1] == "LOAD" ) {
+            loaded.insert(util::sha1_hex(args[2].data(), args[2].size()));
+            append_bulk(out, util::sha1_hex(args[2].data(), args[2].size()));
+        } else if ( args[0] == "SCRIPT" ) {
+            loaded.clear();
+            out->append("+OK\r\n");
+        } else if ( args[0] == "EVALSHA" ) {
+            if ( loaded.count(args[1]) ) out->append(":" + std::to_string(++counter) + "\r\n");
+            else out->append("-NOSCRIPT No matching script. Please use EVAL.\r\n");
+        } else {
+            append_bulk(out, std::to_string(counter));
+        }
+    });
+    err::Error e;
+    bool isok = server.start(&e);
+    assert( isok );
+
+    redis::Script incr("return redis.call('INCR', KEYS[1])");
+    redis::Connection conn;
+    isok = conn.open(server.address(), 1000, &e);
+    assert( isok );
+
+    std::vector<redis::Value> values;
+    typedef std::vector<std::vector<std::string> > Reads;
+    redis::Pipeline & p = conn.pipeline();
+    incr.append(p, 1, "n");
+    p.append("GET", "n");
+    isok = redis::execute_with_scripts(conn, { &incr }, &values, &e);
+    assert( isok && values.size() == 2 && values[0].getInt() == 1 && values[1].getString() == "1" );
+    assert( conn.hasScript(incr.sha1()) && p.size() == 2 );
+    assert( server.reads() == (Reads { { "SCRIPT", "EVALSHA", "GET" } }) );
+
+    // 已加载的脚本不再发送SCRIPT LOAD
+    server.clearReads();
+    isok = redis::execute_with_scripts(conn, { &incr }, &values, &e);
+    assert( isok && values[0].getInt() == 2 && values[1].getString() == "2" );
+    assert( server.reads() == (Reads { { "EVALSHA", "GET" } }) );
+
+    // 服务端清空脚本后回复NOSCRIPT，重新加载并重发调用
+    redis::Value v;
+    isok = conn.command().assign("SCRIPT", "FLUSH").execute(&v, &e);
+    assert( isok );
+    isok = redis::execute_with_scripts(conn, { &incr }, &values, &e);
+    assert( isok && values[0].getInt() == 3 && conn.hasScript(incr.sha1()) );
+
+    // 重连后重新加载
+    conn.close();
+    assert( !conn.hasScript(incr.sha1()) );
+    server.stop();
+}
+
+static void check_queue()
+{
+    std::vector<redis::Message> msgs;
+    std::vector<std::string> texts;
+    for ( int i = 0; i < 10; ++i ) texts.push_back(std::to_string(i) + std::string(40, 'x'));
+    for ( int i = 0; i < 10; ++i ) msgs.push_back(redis::Message { "ch", 2, i % 2 ? "c*" : nullptr, i % 2 ? 2u : 0u, texts[i].data(), texts[i].size() });
+
+    // 背压：满了不再接受，取走后通知
+    redis::MessageQueue queue(4, redis::MessageQueue::backpressure);
+    int notified = 0;
+    queue.setSpaceCallback([&notified]() { ++notified; });
+    assert( queue.push(msgs.data(), 10) == 4 && queue.size() == 4 && queue.dropped() == 0 );
+    std::vector<redis::QueuedMessage> out;
+    assert( queue.pop(&out, 3, 0) == 3 && notified == 1 );
+    assert( out[0].data == texts[0] && out[1].pattern == "c*" && out[2].channel == "ch" );
+    assert( queue.push(msgs.data() + 4, 6) == 3 && queue.pop(&out, 10, 0) == 4 && out[0].data == texts[3] && out[3].data == texts[6] );
+    assert( notified == 2 && queue.pop(&out, 10, 0) == 0 );
+
+    // 稳定运行后出入队不再分配内存
+    size_t allocs = 0;
+    for ( int i = 0; i < 100; ++i ) {
+        if ( i == 2 ) allocs = G_allocs;    // 前两轮槽位和out中的字符串扩充到足够的容量
+        assert( queue.push(msgs.data(), 4) == 4 && queue.pop(&out, 4, 0) == 4 );
+    }
+    assert( G_allocs == allocs );
+
+    // 丢弃最早的和丢弃最新的
+    redis::MessageQueue oldest(4, redis::MessageQueue::dropOldest);
+    assert( oldest.push(msgs.data(), 10) == 10 && oldest.dropped() == 6 );
+    assert( oldest.pop(&out, 10, 0) == 4 && out[0].data == texts[6] && out[3].data == texts[9] );
+    redis::MessageQueue newest(4, redis::MessageQueue::dropNewest);
+    assert( newest.push(msgs.data(), 10) == 10 && newest.dropped() == 6 );
+    assert( newest.pop(&out, 10, 0) == 4 && out[0].data == texts[0] && out[3].data == texts[3] );
+
+    // 超时和关闭
+    int64_t start = chrono::steady_now();
+    assert( newest.pop(&out, 10, 20) == 0 && chrono::steady_now() - start >= 20000 );
+    newest.close();
+    assert( newest.pop(&out, 10, -1) == 0 );
+}
+
+/// 支持PING、ECHO，收到DROP时回复已处理的命令后断开连接
+static void echo_handler(FakeServer & server, int fd, std::vector<std::string> & args, std::string * out)
+{
+    if ( args[0] == "PING" ) out->append("+PONG\r\n");
+    else if ( args[0] == "ECHO" && args.size() == 2 ) append_bulk(out, args[1]);
+    else if ( args[0] == "DROP" ) server.drop(fd);
+    else out->append("-ERR unknown command\r\n");
+}
+
+/// AsyncClient：回复按顺序对应，同一次迭代的命令一起写出，断线时已写出的命令失败，断线期间的命令重连后发出
+static void check_async()
+{
+    FakeServer server(echo_handler);
+    err::Error e;
+    bool isok = server.start(&e);
+    assert( isok );
+
+    nio::SimpleSocketServer loop;
+    redis::AsyncClient client(loop, server.address());
+    client.setReconnectInterval(10);
+
+    std::vector<std::string> log;
+    redis::AsyncClient::ReplyCallback record = [&log](int status, redis::Value & value) {
+        log.push_back(status == nio::SimpleSocketServer::statusOk ? value.getString() : "error");
+    };
+
+    // 第3步：重连后收到f，结束
+    redis::AsyncClient::ReplyCallback last = [&](int status, redis::Value & value) {
+        record(status, value);
+        loop.exitLoop();
+    };
+
+    // 第2步：连接断开，断线期间发出f
+    redis::AsyncClient::ReplyCallback dropped = [&](int status, redis::Value & value) {
+        record(status, value);
+        assert( !client.isConnected() );
+        client.command(last, "ECHO", "f");
+    };
+
+    // 第1步：收到c后在同一次迭代中发出d、DROP和e，DROP之后的命令随连接断开而失败
+    redis::AsyncClient::ReplyCallback third = [&](int status, redis::Value & value) {
+        record(status, value);
+        client.command(record, "ECHO", "d");
+        client.command(record, "DROP");
+        client.command(dropped, "ECHO", "e");
+    };
+
+    // 连接前发出的命令在握手后发送
+    isok = client.connect(&e);
+    assert( isok );
+    client.command(record, "ECHO", "a");
+    client.command(std::vector<std::string> { "ECHO", "b" }, record);
+    client.command(third, "ECHO", "c");
+    assert( client.pending() == 3 );
+
+    loop.addTimer(5000, [&loop](int timer) { loop.exitLoop(); return false; });
+    isok = loop.run(&e);
+    assert( isok );
+
+    std::vector<std::string> expect { "a", "b", "c", "d", "error", "error", "f" };
+    assert( log == expect );
+    assert( client.pending() == 0 && client.isConnected() && server.accepted() == 2 );
+
+    // 每次读取到的命令：握手单独一次，之后每次迭代的命令一次写出；e在DROP之后不再处理
+    std::vector<std::vector<std::string> > reads = server.reads();
+    std::vector<std::vector<std::string> > batches {
+        { "PING" }, { "ECHO", "ECHO", "ECHO" }, { "ECHO", "DROP" }, { "PING" }, { "ECHO" } };
+    assert( reads == batches );
+
+    client.close();
+    server.stop();
+}
+
+/// check_pool_concurrent的共享状态
+struct PoolShared
+{
+    redis::Pool *        pool;
+    int                  rounds;
+    mt::mutex_t          mutex;
+    std::set<redis::Connection *> inUse;      ///< 已取出的连接，受mutex保护
+    std::atomic<int>     errors    { 0 };
+    std::atomic<size_t>  maxTotal  { 0 };
+};
+
+static void * pool_worker_proc(void * arg)
+{
+    PoolShared * shared = (PoolShared *)arg;
+    for ( int i = 0; i < shared->rounds; ++i ) {
+        err::Error e;
+        redis::Connection * conn = shared->pool->checkout(2000, &e);
+        if ( conn == nullptr ) {
+            ++shared->errors;
+            continue;
+        }
+        size_t total = shared->pool->size();
+        size_t seen = shared->maxTotal.load();
+        while ( total > seen && !shared->maxTotal.compare_exchange_weak(seen, total) ) ;
+
+        // 同一个连接不能同时交给两个线程
+        mt::mutex_lock(&shared->mutex);
+        bool fresh = shared->inUse.insert(conn).second;
+        mt::mutex_unlock(&shared->mutex);
+        if ( !fresh || !conn->ping(&e) ) ++shared->errors;
+        mt::mutex_lock(&shared->mutex);
+        shared->inUse.erase(conn);
+        mt::mutex_unlock(&shared->mutex);
+        shared->pool->checkin(conn);
+    }
+    return nullptr;
+}
+
+/// 连接池的并发取还：线程数多于连接上限，连接数不超过上限，连接不会同时交给两个线程；
+/// 连接用尽时等待超时返回nullptr，归还后等待者被唤醒
+static void check_pool_concurrent()
+{
+    FakeServer server(echo_handler);
+    err::Error e;
+    bool isok = server.start(&e);
+    assert( isok );
+
+    const size_t maxSize = 3;
+    const int    threads = 8;
+    redis::Pool pool(server.address(), maxSize);
+    pool.setTimeout(1000);
+
+    PoolShared shared;
+    shared.pool    = &pool;
+    shared.rounds  = 300;
+    mt::mutex_init(&shared.mutex);
+    pthread_t tids[threads];
+    for ( int i = 0; i < threads; ++i ) pthread_create(&tids[i], nullptr, pool_worker_proc, &shared);
+    for ( int i = 0; i < threads; ++i ) pthread_join(tids[i], nullptr);
+    mt::mutex_free(&shared.mutex);
+    assert( shared.errors == 0 && shared.maxTotal <= maxSize && pool.size() <= maxSize );
+    assert( pool.idle() == pool.size() && server.accepted() == (int)pool.size() );
+
+    // 全部取出后再取，等待超时
+    std::vector<redis::Connection *> held;
+    for ( size_t i = 0; i < maxSize; ++i ) {
+        redis::Connection * conn = pool.checkout(0, &e);
+        assert( conn );
+        held.push_back(conn);
+    }
+    int64_t start = chrono::steady_now();
+    assert( pool.checkout(50, &e) == nullptr && e && chrono::steady_now() - start >= 50000 );
+
+    // 等待中的线程在归还后被唤醒，不等到超时
+    struct Waiter {
+        redis::Pool *       pool;
+        redis::Connection * conn;
+        int64_t             waited;
+    } waiter { &pool, nullptr, 0 };
+    pthread_t tid;
+    pthread_create(&tid, nullptr, [](void * arg) -> void * {
+        Waiter * w = (Waiter *)arg;
+        int64_t begin = chrono::steady_now();
+        w->conn   = w->pool->checkout(5000);
+        w->waited = chrono::steady_now() - begin;
+        return nullptr;
+    }, &waiter);
+    usleep(50000);
+    pool.checkin(held.back());
+    pthread_join(tid, nullptr);
+    assert( waiter.conn == held.back() && waiter.waited >= 40000 && waiter.waited < 2000000 );
+    held.back() = waiter.conn;
+    for ( auto it = held.begin(); it != held.end(); ++it ) pool.checkin(*it);
+    assert( pool.idle() == maxSize );
+    server.stop();
+}
+
+/// 连接池的健康检查不阻塞事件循环：服务端不回复PING时循环的定时器照常执行，检查失败的连接被删除
+static void check_pool_keepalive()
+{
+    FakeServer server([](FakeServer & s, int fd, std::vector<std::string> & args, std::string * out) {});
+    err::Error e;
+    bool isok = server.start(&e);
+    assert( isok );
+
+    redis::Pool pool(server.address(), 2);
+    pool.setTimeout(300);
+    isok = pool.prewarm(1, &e);
+    assert( isok && pool.size() == 1 );
+
+    nio::SimpleSocketServer loop;
+    isok = pool.keepAlive(loop, 20, &e);
+    assert( isok );
+
+    int64_t last = chrono::steady_now(), maxGap = 0, start = last;
+    loop.addTimer(5, [&](int timer) {
+        int64_t now = chrono::steady_now();
+        maxGap = std::max(maxGap, now - last);
+        last = now;
+        if ( now - start < 500000 ) return true;
+        loop.exitLoop();
+        return false;
+    });
+    isok = loop.run(&e);
+    assert( isok );
+    pool.stopKeepAlive();
+
+    assert( maxGap < 100000 && pool.size() == 0 );
+    server.stop();
+}
+
+/**
+ * 两个节点的模拟集群，槽的归属和迁移状态由测试修改。
+ * 节点收到不属于自己的槽的命令时回复MOVED；迁移中的槽在源节点上没有该key时回复ASK，
+ * 目标节点只接受紧跟在ASKING之后的命令。key中包含crash时不回复并断开连接。
+ */
+struct FakeCluster
+{
+    mt::mutex_t                        mutex;
+    std::vector<int>                   owner;       ///< 槽所属的节点
+    std::map<int, int>                 migrating;   ///< 迁移中的槽和目标节点
+    std::map<std::string, std::string> data[2];
+    std::map<int, bool>                asking[2];   ///< 连接上一个命令是ASKING
+    std::unique_ptr<FakeServer>        nodes[2];
+
+    FakeCluster() : owner(redis::clusterSlots, 0)
+    {
+        mt::mutex_init(&mutex);
+        for ( int s = redis::clusterSlots / 2; s < redis::clusterSlots; ++s ) owner[s] = 1;
+        for ( int i = 0; i < 2; ++i ) {
+            nodes[i].reset(new FakeServer([this, i](FakeServer & server, int fd, std::vector<std::string> & args, std::string * out) {
+                // 读取crash时不回复，直接断开连接
+                if ( args.size() > 1 && args[1].find("crash") != std::string::npos ) {
+                    server.drop(fd);
+                    return;
+                }
+                mt::mutex_lock(&mutex);
+                this->handle(i, fd, args, out);
+                mt::mutex_unlock(&mutex);
+            }));
+            bool isok = nodes[i]->start();
+            assert( isok );
+        }
+    }
+    ~FakeCluster()
+    {
+        for ( int i = 0; i < 2; ++i ) nodes[i]->stop();
+        mt::mutex_free(&mutex);
+    }
+
+    void handle(int self, int fd, std::vector<std::string> & args, std::string * out)
+    {
+        bool ask = asking[self][fd];
+        asking[self][fd] = false;
+        if ( args[0] == "ASKING" ) {
+            asking[self][fd] = true;
+            out->append("+OK\r\n");
+            return;
+        }
+        if ( args[0] == "CLUSTER" ) {
+            // 连续的槽合并为一项
+            std::string items;
+            int count = 0;
+            for ( int from = 0, to; from < redis::clusterSlots; from = to + 1 ) {
+                for ( to = from; to + 1 < redis::clusterSlots && owner[to + 1] == owner[from]; ++to ) ;
+                items += "*3\r\n:" + std::to_string(from) + "\r\n:" + std::to_string(to) + "\r\n*3\r\n";
+                append_bulk(&items, "127.0.0.1");
+                items += ":" + std::to_string(nodes[owner[from]]->port()) + "\r\n";
+                append_bulk(&items, "node" + std::to_string(owner[from]));
+                ++count;
+            }
+            out->append("*" + std::to_string(count) + "\r\n" + items);
+            return;
+        }
+
+        const std::string & key = args[1];
+        int slot = redis::key_slot(key.data(), key.size());
+        auto m = migrating.find(slot);
+        bool serve = ( owner[slot] == self ) ? ( m == migrating.end() || data[self].count(key) )
+                                             : ( ask && m != migrating.end() && m->second == self );
+        if ( !serve ) {
+            int target = ( owner[slot] == self ) ? m->second : owner[slot];
+            out->append(std::string(owner[slot] == self ? "-ASK " : "-MOVED ") + std::to_string(slot) + " " + nodes[target]->name() + "\r\n");
+            return;
+        }
+        if ( args[0] == "SET" ) {
+            data[self][key] = args[2];
+            out->append("+OK\r\n");
+        } else if ( data[self].count(key) ) {
+            append_bulk(out, data[self][key]);
+        } else {
+            out->append("$-1\r\n");
+        }
+    }
+
+    /// 把key所在的槽整个移到node，已有的数据一起移动
+    void move(const std::string & key, int node)
+    {
+        mt::mutex_lock(&mutex);
+        int slot = redis::key_slot(key.data(), key.size());
+        owner[slot] = node;
+        data[node][key] = data[1 - node][key];
+        data[1 - node].erase(key);
+        mt::mutex_unlock(&mutex);
+    }
+
+    /// 开始把key所在的槽迁移到node，key已经迁移过去
+    void migrate(const std::string & key, int node)
+    {
+        mt::mutex_lock(&mutex);
+        int slot = redis::key_slot(key.data(), key.size());
+        migrating[slot] = node;
+        data[node][key] = data[1 - node][key];
+        data[1 - node].erase(key);
+        mt::mutex_unlock(&mutex);
+    }
+};
+
+/// ClusterClient：按槽路由，流水线按节点拆分，MOVED更新映射，ASK不更新映射
+static void check_cluster()
+{
+    FakeCluster cluster;
+    FakeServer & a = *cluster.nodes[0];
+    FakeServer & b = *cluster.nodes[1];
+    err::Error e;
+    redis::Value v;
+
+    // foo的槽12182在b，bar的槽5061在a
+    redis::ClusterClient client(std::vector<std::string> { a.name() });
+    bool isok = client.execute({ "SET", "foo", "1" }, &v, &e) && client.execute({ "SET", "bar", "2" }, &v, &e);
+    assert( isok && client.nodeOf("foo") == b.name() && client.nodeOf("bar") == a.name() );
+    typedef std::vector<std::vector<std::string> > Reads;
+    assert( a.reads() == (Reads { { "CLUSTER" }, { "SET" } }) && b.reads() == (Reads { { "SET" } }) );
+
+    // 流水线按节点拆分，每个节点一次收到自己的全部命令，回复按命令顺序
+    a.clearReads();
+    b.clearReads();
+    std::vector<redis::ClusterClient::Args> cmds {
+        { "GET", "foo" }, { "GET", "bar" }, { "SET", "{foo}2", "3" }, { "GET", "bar" }, { "GET", "foo" } };
+    std::vector<redis::Value> values;
+    isok = client.execute(cmds, &values, &e);
+    assert( isok && values.size() == 5 );
+    assert( values[0].getString() == "1" && values[1].getString() == "2" && values[2].getString() == "OK" );
+    assert( values[3].getString() == "2" && values[4].getString() == "1" );
+    assert( a.reads() == (Reads { { "GET", "GET" } }) && b.reads() == (Reads { { "GET", "SET", "GET" } }) );
+
+    // MOVED：在新节点上重发，立即更新该槽，下一次调用前重新加载映射
+    cluster.move("foo", 0);
+    a.clearReads();
+    b.clearReads();
+    isok = client.execute({ "GET", "foo" }, &v, &e);
+    assert( isok && v.getString() == "1" && client.nodeOf("foo") == a.name() );
+    assert( b.reads() == (Reads { { "GET" } }) && a.reads() == (Reads { { "GET" } }) );
+    isok = client.execute({ "GET", "foo" }, &v, &e);
+    assert( isok && v.getString() == "1" );
+    assert( a.reads().size() + b.reads().size() == 4 );   // 多了CLUSTER SLOTS和第二次GET
+
+    // ASK：流水线中被重定向的命令逐个按映射重发，源节点再次回复ASK后在目标节点上与ASKING一起发出，映射不变
+    cluster.migrate("bar", 1);
+    a.clearReads();
+    b.clearReads();
+    cmds = { { "GET", "bar" }, { "GET", "foo" } };
+    isok = client.execute(cmds, &values, &e);
+    assert( isok && values[0].getString() == "2" && values[1].getString() == "1" );
+    assert( client.nodeOf("bar") == a.name() );
+    assert( a.reads() == (Reads { { "GET", "GET" }, { "GET" } }) && b.reads() == (Reads { { "ASKING", "GET" } }) );
+}
+
+/// 流水线中途一个节点断开时，其他已发出命令的节点也关闭连接，之后的命令不会读到上一次流水线的回复
+static void check_cluster_failure()
+{
+    FakeCluster cluster;
+    FakeServer & a = *cluster.nodes[0];
+    FakeServer & b = *cluster.nodes[1];
+    err::Error e;
+    redis::Value v;
+
+    redis::ClusterClient client(std::vector<std::string> { a.name() });
+    bool isok = client.execute({ "SET", "foo", "1" }, &v, &e) && client.execute({ "SET", "{foo}x", "X" }, &v, &e);
+    assert( isok && b.accepted() == 1 );
+
+    // a先接收，断开时b的回复还没有读取
+    std::vector<redis::ClusterClient::Args> cmds { { "GET", "{foo}x" }, { "GET", "{bar}crash" } };
+    std::vector<redis::Value> values;
+    isok = client.execute(cmds, &values, &e);
+    assert( !isok );
+
+    isok = client.execute({ "GET", "foo" }, &v, &e);
+    assert( isok && v.getString() == "1" && b.accepted() == 2 );
+}
+
+/**
+ * 支持RESP3客户端跟踪的模拟服务端：HELLO 3回复映射，CLIENT TRACKING ON之后GET过的key被SET时
+ * 向读过的连接推送invalidate，修改者本身的推送在回复之前；FLUSHALL推送空值表示全部失效。
+ * 与Redis一样，推送之后需要再次读取才会重新跟踪。
+ */
+struct FakeTracking
+{
+    std::map<std::string, std::string>   data;
+    std::map<std::string, std::set<int> > readers;
+    std::set<int>                        tracking;
+
+    static std::string invalidate(const std::string * key)
+    {
+        std::string push = ">2\r\n$10\r\ninvalidate\r\n";
+        if ( key == nullptr ) return push + "_\r\n";
+        push += "*1\r\n";
+        append_bulk(&push, *key);
+        return push;
+    }
+
+    void notify(FakeServer & server, int self, const std::string * key, std::string * out)
+    {
+        std::set<int> fds;
+        if ( key == nullptr ) {
+            fds = tracking;
+            readers.clear();
+        } else {
+            fds.swap(readers[*key]);
+        }
+        for ( auto it = fds.begin(); it != fds.end(); ++it ) {
+            if ( *it == self ) out->append(invalidate(key));
+            else server.send(*it, invalidate(key));
+        }
+    }
+
+    void handle(FakeServer & server, int fd, std::vector<std::string> & args, std::string * out)
+    {
+        if ( args[0] == "HELLO" ) {
+            out->append("%1\r\n$6\r\nserver\r\n$5\r\nredis\r\n");
+        } else if ( args[0] == "CLIENT" ) {
+            tracking.insert(fd);
+            out->append("+OK\r\n");
+        } else if ( args[0] == "GET" ) {
+            if ( tracking.count(fd) ) readers[args[1]].insert(fd);
+            if ( data.count(args[1]) ) append_bulk(out, data[args[1]]);
+            else out->append("_\r\n");
+        } else if ( args[0] == "SET" ) {
+            data[args[1]] = args[2];
+            this->notify(server, fd, &args[1], out);
+            out->append("+OK\r\n");
+        } else if ( args[0] == "FLUSHALL" ) {
+            data.clear();
+            this->notify(server, fd, nullptr, out);
+            out->append("+OK\r\n");
+        } else {
+            out->append("-ERR unknown command\r\n");
+        }
+    }
+};
+
+/// CachingClient：命中不访问服务端，其他连接或本连接修改后按推送失效，FLUSHALL清空，超出容量按LRU淘汰
+static void check_caching()
+{
+    FakeTracking state;
+    FakeServer server([&state](FakeServer & s, int fd, std::vector<std::string> & args, std::string * out) {
+        state.handle(s, fd, args, out);
+    });
+    err::Error e;
+    bool isok = server.start(&e);
+    assert( isok );
+
+    redis::Connection writer;
+    redis::Value v;
+    isok = writer.open(server.address(), 1000, &e) && writer.command().assign("SET", "k1", "v1").execute(&v, &e);
+    assert( isok );
+
+    redis::CachingClient cache(server.address(), 2);
+    std::string value;
+    bool exists;
+    isok = cache.get("k1", &value, &exists, &e) && exists && value == "v1";
+    assert( isok && cache.stats().misses == 1 );
+    isok = cache.get("k1", &value, &exists, &e) && exists && value == "v1";
+    assert( isok && cache.stats().hits == 1 );
+    isok = cache.get("none", &value, &exists, &e) && !exists;
+    assert( isok && cache.get("none", &value, &exists, &e) && !exists && cache.stats().hits == 2 );
+
+    // 其他连接修改：推送在另一个连接上到达，到达前仍可能命中旧值
+    isok = writer.command().assign("SET", "k1", "v2").execute(&v, &e);
+    assert( isok );
+    for ( int i = 0; i < 100 && cache.stats().invalidations == 0; ++i ) {
+        isok = cache.get("k1", &value, &exists, &e);
+        assert( isok );
+        if ( cache.stats().invalidations == 0 ) usleep(1000);
+    }
+    isok = cache.get("k1", &value, &exists, &e) && value == "v2";
+    assert( isok && cache.stats().invalidations == 1 );
+
+    // 本连接修改：推送在回复之前到达，execute返回时已失效
+    isok = cache.execute({ "SET", "k1", "v3" }, &v, &e) && v.status();
+    assert( isok && cache.stats().invalidations == 2 );
+    isok = cache.get("k1", &value, &exists, &e) && value == "v3";
+    assert( isok );
+
+    // 容量为2，再读一个key淘汰最久未用的none
+    isok = cache.get("k2", &value, &exists, &e) && !exists;
+    assert( isok && cache.stats().evictions == 1 );
+    uint64_t misses = cache.stats().misses;
+    isok = cache.get("none", &value, &exists, &e);
+    assert( isok && cache.stats().misses == misses + 1 );
+
+    // FLUSHALL推送空值，全部失效
+    isok = writer.command().assign("FLUSHALL").execute(&v, &e);
+    assert( isok );
+    uint64_t before = cache.stats().invalidations;
+    for ( int i = 0; i < 100 && cache.stats().invalidations == before; ++i ) {
+        usleep(1000);
+        isok = cache.execute({ "GET", "k1" }, &v, &e);   // 不经过缓存，只为处理推送
+        assert( isok );
+    }
+    assert( cache.stats().invalidations == before + 2 );
+    isok = cache.get("k1", &value, &exists, &e) && !exists;
+    assert( isok );
+
+    cache.close();
+    writer.close();
+    server.stop();
+}
+
+/**
+ * 发布/订阅的模拟服务端：记录每个连接订阅的频道和模式，PUBLISH向匹配的连接推送message或pmessage，
+ * PUBNULL推送内容为空值的消息，KILL断开其他全部连接。订阅状态由测试线程读取，用mutex保护。
+ */
+struct FakePubSub
+{
+    mt::mutex_t                           mutex;
+    std::map<int, std::set<std::string> > channels;
+    std::map<int, std::set<std::string> > patterns;
+
+    FakePubSub()  { mt::mutex_init(&mutex); }
+    ~FakePubSub() { mt::mutex_free(&mutex); }
+
+    size_t subscriptions()
+    {
+        mt::mutex_lock(&mutex);
+        size_t n = 0;
+        for ( auto it = channels.begin(); it != channels.end(); ++it ) n += it->second.size();
+        for ( auto it = patterns.begin(); it != patterns.end(); ++it ) n += it->second.size();
+        mt::mutex_unlock(&mutex);
+        return n;
+    }
+
+    static void confirm(std::string * out, const std::string & kind, const std::string * name, size_t count)
+    {
+        out->append("*3\r\n");
+        append_bulk(out, kind);
+        if ( name ) append_bulk(out, *name);
+        else out->append("$-1\r\n");
+        out->append(":" + std::to_string(count) + "\r\n");
+    }
+
+    void handle(FakeServer & server, int fd, std::vector<std::string> & args, std::string * out)
+    {
+        mt::mutex_lock(&mutex);
+        const std::string & cmd = args[0];
+        if ( cmd == "SUBSCRIBE" || cmd == "PSUBSCRIBE" ) {
+            std::set<std::string> & names = ( cmd == "SUBSCRIBE" ? channels : patterns )[fd];
+            for ( size_t i = 1; i < args.size(); ++i ) {
+                names.insert(args[i]);
+                confirm(out, cmd == "SUBSCRIBE" ? "subscribe" : "psubscribe", &args[i], names.size());
+            }
+        } else if ( cmd == "UNSUBSCRIBE" || cmd == "PUNSUBSCRIBE" ) {
+            std::set<std::string> & names = ( cmd == "UNSUBSCRIBE" ? channels : patterns )[fd];
+            std::vector<std::string> drop(args.begin() + 1, args.end());
+            if ( drop.empty() ) drop.assign(names.begin(), names.end());
+            if ( drop.empty() ) confirm(out, cmd == "UNSUBSCRIBE" ? "unsubscribe" : "punsubscribe", nullptr, 0);
+            for ( auto it = drop.begin(); it != drop.end(); ++it ) {
+                names.erase(*it);
+                confirm(out, cmd == "UNSUBSCRIBE" ? "unsubscribe" : "punsubscribe", &*it, names.size());
+            }
+        } else if ( cmd == "PUBLISH" || cmd == "PUBNULL" ) {
+            std::string data = ( cmd == "PUBLISH" ) ? "$" + std::to_string(args[2].size()) + "\r\n" + args[2] + "\r\n" : "$-1\r\n";
+            int receivers = 0;
+            for ( auto it = channels.begin(); it != channels.end(); ++it ) {
+                if ( !it->second.count(args[1]) ) continue;
+                std::string msg = "*3\r\n$7\r\nmessage\r\n";
+                append_bulk(&msg, args[1]);
+                server.send(it->first, msg + data);
+                ++receivers;
+            }
+            for ( auto it = patterns.begin(); it != patterns.end(); ++it ) {
+                for ( auto p = it->second.begin(); p != it->second.end(); ++p ) {
+                    if ( fnmatch(p->c_str(), args[1].c_str(), 0) != 0 ) continue;
+                    std::string msg = "*4\r\n$8\r\npmessage\r\n";
+                    append_bulk(&msg, *p);
+                    append_bulk(&msg, args[1]);
+                    server.send(it->first, msg + data);
+                    ++receivers;
+                }
+            }
+            out->append(":" + std::to_string(receivers) + "\r\n");
+        } else if ( cmd == "KILL" ) {
+            std::set<int> fds;
+            for ( auto it = channels.begin(); it != channels.end(); ++it ) fds.insert(it->first);
+            for ( auto it = patterns.begin(); it != patterns.end(); ++it ) fds.insert(it->first);
+            for ( auto it = fds.begin(); it != fds.end(); ++it ) {
+                if ( *it != fd ) server.drop(*it);
+            }
+            channels.clear();
+            patterns.clear();
+            out->append("+OK\r\n");
+        } else {
+            out->append("+PONG\r\n");
+        }
+        mt::mutex_unlock(&mutex);
+    }
+};
+
+/// 运行事件循环直到done返回true，最多timeout毫秒，返回done的结果
+static bool run_until(nio::SimpleSocketServer & loop, const std::function<bool ()> & done, int timeout)
+{
+    int64_t deadline = chrono::steady_now() + timeout * 1000LL;
+    loop.addTimer(1, [&](int timer) {
+        if ( !done() && chrono::steady_now() < deadline ) return true;
+        loop.exitLoop();
+        return false;
+    });
+    err::Error e;
+    loop.run(&e);
+    return done();
+}
+
+/// Subscriber：频道和模式消息，非字符串内容的data为nullptr，退订全部后重连不再订阅
+static void check_subscriber()
+{
+    FakePubSub state;
+    FakeServer server([&state](FakeServer & s, int fd, std::vector<std::string> & args, std::string * out) {
+        state.handle(s, fd, args, out);
+    });
+    err::Error e;
+    bool isok = server.start(&e);
+    assert( isok );
+
+    struct Received {
+        std::string channel;
+        std::string pattern;
+        std::string data;
+        bool        null;
+    };
+    std::vector<Received> received;
+
+    nio::SimpleSocketServer loop;
+    redis::Subscriber sub(loop, server.address());
+    sub.setReconnectInterval(10);
+    sub.setHandler([&received](const redis::Message * msgs, size_t count) {
+        for ( size_t i = 0; i < count; ++i ) {
+            const redis::Message & m = msgs[i];
+            received.push_back(Received { std::string(m.channel, m.channelLength),
+                m.pattern ? std::string(m.pattern, m.patternLength) : std::string(),
+                m.data ? std::string(m.data, m.length) : std::string(), m.data == nullptr });
+        }
+        return count;
+    });
+    sub.subscribe({ "a", "b" });
+    sub.psubscribe({ "p*" });
+    isok = sub.connect(&e);
+    assert( isok && run_until(loop, [&]() { return state.subscriptions() == 3; }, 2000) );
+
+    redis::Connection pub;
+    redis::Value v;
+    isok = pub.open(server.address(), 1000, &e)
+        && pub.command().assign("PUBLISH", "a", "hello").execute(&v, &e) && v.getInt() == 1
+        && pub.command().assign("PUBLISH", "p1", "world").execute(&v, &e) && v.getInt() == 1
+        && pub.command().assign("PUBNULL", "b").execute(&v, &e) && v.getInt() == 1;
+    assert( isok && run_until(loop, [&]() { return received.size() == 3; }, 2000) );
+    assert( received[0].channel == "a" && received[0].pattern.empty() && received[0].data == "hello" && !received[0].null );
+    assert( received[1].channel == "p1" && received[1].pattern == "p*" && received[1].data == "world" );
+    assert( received[2].channel == "b" && received[2].null );
+
+    // 空列表退订全部，断线重连后只有握手，不再订阅
+    sub.unsubscribe({});
+    sub.punsubscribe({});
+    assert( run_until(loop, [&]() { return state.subscriptions() == 0; }, 2000) );
+    isok = pub.command().assign("KILL").execute(&v, &e);
+    assert( isok );
+    server.clearReads();
+    assert( run_until(loop, [&]() { return server.accepted() == 3 && sub.isConnected(); }, 2000) );
+    run_until(loop, []() { return false; }, 50);
+    assert( server.reads() == (std::vector<std::vector<std::string> > { { "PING" } }) );
+
+    sub.close();
+    pub.close();
+    server.stop();
+}
+
+/// 常见的SET命令，std::string参数和直接编码
+static void bench_encode(int rounds)
+{
+    std::vector<char> out;
+    out.reserve(4096);
+    const char * key = "user:session:12345";
+    size_t total = 0;
+
+    size_t a0 = G_allocs;
+    int64_t t0 = chrono::steady_now();
+    for ( int i = 0; i < rounds; ++i ) {
+        out.clear();
+        redis::encode_command({ "SET", key, std::to_string(i) }, &out);
+        total += out.size();
+    }
+    int64_t t1 = chrono::steady_now();
+    size_t a1 = G_allocs;
+    for ( int i = 0; i < rounds; ++i ) {
+        out.clear();
+        redis::encode_args(&out, "SET", key, i);
+        total += out.size();
+    }
+    int64_t t2 = chrono::steady_now();
+    assert( total > 0 );
+    printf("encode SET x%d: strings %lld us (%zu allocs), args %lld us (%zu allocs)\n", rounds,
+        (long long)(t1 - t0), a1 - a0, (long long)(t2 - t1), G_allocs - a1);
+}
+
+/**
+ * command:  testredis [corpus ...]
+ *
+ * corpus为从连接上录制的原始回复字节流，用于对比解码性能
+ */
+int main(int argc, char **argv)
+{
+    check_split();
+    check_limit();
+    check_resp3();
+    check_reply();
+    check_encode();
+    check_slot();
+    check_script();
+    check_script_pipeline();
+    check_queue();
+    check_async();
+    check_pool_concurrent();
+    check_pool_keepalive();
+    check_cluster();
+    check_cluster_failure();
+    check_caching();
+    check_subscriber();
+    check_scan();
+    check_stream();
+    check_linear(10000, 7);
+    check_linear(20000, 7);
+    bench_mget(10000, 20);
+    bench_decode(argc, argv);
+    bench_encode(1000000);
+    return 0;
+}
@@ -0,0 +1,141 @@
+# include <sym/io/shm_ring.h>
+# include <sym/network.h>
+# include <assert.h>
+# include <stdio.h>
+# include <string.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/wait.h>
+# include <string>
+
+using namespace sym;
+
+static std::string make_message(int i)
+{
+    // 长度变化覆盖空消息、未对齐长度和末尾跳转
+    std::string s((i * 37) % 1500, '\0');
+    for ( size_t k = 0; k < s.size(); ++k ) s[k] = (char)(i + k);
+    return s;
+}
+
+static void check_address()
+{
+    err::Error e;
+    net::Address a("/tmp/sym-test.sock", &e);
+    assert( !e && a.isUnix() && a.path() == "/tmp/sym-test.sock" );
+
+    net::Address b("@sym-test", &e);
+    assert( !e && b.isUnix() && b.path() == "@sym-test" );
+    assert( a.sameHost(b) );
+
+    net::Address l1("127.0.0.1", 1, &e), l2("127.0.0.2", 2, &e), r("10.1.2.3", 1, &e), r2("10.1.2.3", 3, &e);
+    assert( l1.sameHost(l2) && r.sameHost(r2) );
+    assert( !l1.sameHost(r) && !l1.sameHost(a) );
+
+    net::Address bad(std::string(200, 'x').c_str(), &e);
+    assert( e && !bad.isUnix() );
+}
+
+/// 对端写坏消息长度时，读取端不越界，标记损坏
+static void check_corrupt()
+{
+    io::ShmRing w, r;
+    err::Error e;
+    bool isok = w.create(4096, &e) && r.attach(::dup(w.memFd()), ::dup(w.dataFd()), ::dup(w.spaceFd()), &e);
+    assert( isok );
+    isok = w.tryWrite("hello", 5);
+    assert( isok );
+
+    // 数据区在共享内存末尾，第一条消息的长度在开头
+    struct stat st;
+    ::fstat(w.memFd(), &st);
+    char * base = (char *)::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, w.memFd(), 0);
+    assert( base != MAP_FAILED );
+    uint32_t len = 0x7ffffff0;
+    memcpy(base + st.st_size - w.capacity(), &len, sizeof(len));
+
+    size_t size;
+    assert( r.peek(&size) == nullptr && r.corrupt() );
+    assert( r.wait(&size, 100, &e) == nullptr && e );
+    ::munmap(base, st.st_size);
+}
+
+/// 子进程：从请求环读消息原样写入响应环，空消息表示结束
+static int echo_proc(int sock)
+{
+    int fds[6];
+    net::Socket s(sock);
+    int n = s.receiveFds(fds, 6);
+    assert( n == 6 );
+
+    io::ShmRing in, out;
+    bool isok = in.attach(fds[0], fds[1], fds[2]) && out.attach(fds[3], fds[4], fds[5]);
+    assert( isok );
+
+    size_t size;
+    const char * p;
+    while ( (p = in.wait(&size, 5000)) != nullptr ) {
+        if ( size == 0 ) return 0;
+        isok = out.write(p, size, 5000);
+        assert( isok );
+        in.pop();
+    }
+    return 1;
+}
+
+/**
+ * command:  testshmring
+ */
+int main(int argc, char **argv)
+{
+    check_address();
+    check_corrupt();
+
+    int sv[2];
+    int r = ::socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert( r == 0 );
+
+    pid_t pid = fork();
+    if ( pid == 0 ) {
+        ::close(sv[0]);
+        _exit(echo_proc(sv[1]));
+    }
+    ::close(sv[1]);
+
+    // 请求环取最小容量，让生产者经常等待空间
+    io::ShmRing req, resp;
+    err::Error e;
+    bool isok = req.create(4096, &e) && resp.create(64 * 1024, &e);
+    assert( isok );
+    int fds[6] = { req.memFd(), req.dataFd(), req.spaceFd(), resp.memFd(), resp.dataFd(), resp.spaceFd() };
+    net::Socket s(sv[0]);
+    isok = s.sendFds(fds, 6, &e);
+    assert( isok );
+
+    const int count = 20000, window = 8;
+    size_t size;
+    for ( int i = 1; i <= count + window; ++i ) {
+        if ( i <= count ) {
+            std::string m = make_message(i) + "#";
+            isok = req.write(m.data(), m.size(), 5000, &e);
+            assert( isok );
+        }
+        if ( i > window ) {
+            const char * p = resp.wait(&size, 5000, &e);
+            std::string expect = make_message(i - window) + "#";
+            assert( p != nullptr && size == expect.size() && memcmp(p, expect.data(), size) == 0 );
+            resp.pop();
+        }
+    }
+    assert( resp.peek(&size) == nullptr );
+
+    isok = req.write("", 0, 5000, &e);
+    assert( isok );
+    int status = -1;
+    waitpid(pid, &status, 0);
+    assert( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+    ::close(sv[0]);
+
+    printf("shm ring ok, %d messages\n", count);
+    return 0;
+}
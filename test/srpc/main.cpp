@@ -0,0 +1,727 @@
+# include <sym/srpc.h>
+# include <sym/srpc/server.h>
+# include <sym/srpc/client.h>
+# include <sym/thread.h>
+# include <sym/chrono.h>
+# include <arpa/inet.h>
+# include <assert.h>
+# include <signal.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <sys/socket.h>
+# include <unistd.h>
+# include <algorithm>
+# include <string>
+# include <vector>
+# include "test_server.h"
+
+using namespace sym;
+
+/// 测试连接只用TCP，不切换UNIX域连接
+static const int tcpOptions = srpc::optionCompress;
+
+/// 处理函数阻塞在工作线程时，事件循环照常处理其它连接的请求
+static void check_offload()
+{
+    Gate gate;
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        if ( srpc::service_name(&in->service) == "block" ) gate.wait();
+        out.addBlock("ok");
+    });
+    err::Error e;
+    bool isok = server.rpc().startWorkers(2, 16, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client a, b;
+    isok = a.open(server.address(), tcpOptions, &e) && b.open(server.address(), tcpOptions, &e);
+    assert( isok );
+
+    int32_t sequence;
+    isok = a.send("block", {}, &sequence, &e);
+    assert( isok && gate.waitEntered(1) );
+
+    // a的处理函数还在阻塞，b的调用不需要等待
+    srpc::Reply reply;
+    int64_t begin = chrono::steady_now();
+    isok = b.call("echo", { "x" }, &reply, &e);
+    assert( isok && reply.result == srpc::resultOk && chrono::steady_now() - begin < 100000 );
+
+    gate.open();
+    int32_t received;
+    isok = a.receive(&received, &reply, &e);
+    assert( isok && received == sequence && reply.result == srpc::resultOk );
+    assert( reply.blocks.size() == 1 && reply.blocks[0] == "ok" );
+    server.stop();
+}
+
+/// 工作队列已满时不执行处理函数，直接返回resultOverload，排队的请求仍正常完成
+static void check_overload()
+{
+    Gate gate;
+    std::atomic<int> calls { 0 };
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        ++calls;
+        gate.wait();
+    });
+    err::Error e;
+    bool isok = server.rpc().startWorkers(1, 1, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client client;
+    isok = client.open(server.address(), tcpOptions, &e);
+    assert( isok );
+
+    // 同一连接上的请求按到达顺序分派：第一个占住工作线程，第二个占满队列，第三个过载
+    int32_t running, queued, rejected;
+    isok = client.send("work", {}, &running, &e);
+    assert( isok && gate.waitEntered(1) );
+    isok = client.send("work", {}, &queued, &e) && client.send("work", {}, &rejected, &e);
+    assert( isok );
+
+    srpc::Reply reply;
+    int32_t sequence;
+    isok = client.receive(&sequence, &reply, &e);
+    assert( isok && sequence == rejected && reply.result == srpc::resultOverload && reply.blocks.empty() );
+
+    gate.open();
+    isok = client.receive(&sequence, &reply, &e);
+    assert( isok && sequence == running && reply.result == srpc::resultOk );
+    isok = client.receive(&sequence, &reply, &e);
+    assert( isok && sequence == queued && reply.result == srpc::resultOk );
+    assert( calls == 2 );
+    server.stop();
+}
+
+/// 到达时已超时和排队期间超时的请求都返回resultTimeout，不执行处理函数
+static void check_deadline()
+{
+    Gate gate;
+    std::atomic<int> calls { 0 };
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        if ( srpc::service_name(&in->service) == "block" ) {
+            gate.wait();
+            return;
+        }
+        ++calls;
+    });
+    err::Error e;
+    bool isok = server.rpc().startWorkers(1, 16, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client a, b;
+    isok = a.open(server.address(), tcpOptions, &e) && b.open(server.address(), tcpOptions, &e);
+    assert( isok );
+
+    int32_t blocked, expired, sequence;
+    isok = a.send("block", {}, &blocked, &e);
+    assert( isok && gate.waitEntered(1) );
+
+    // 上游预算已用完，下游请求到达时直接拒绝，不排在阻塞的工作线程之后
+    srpc::Reply reply;
+    srpc::set_current_deadline(chrono::now() - 1000);
+    b.setTimeout(500);
+    isok = b.call("work", {}, &reply, &e);
+    srpc::set_current_deadline(0);
+    assert( isok && reply.result == srpc::resultTimeout && calls == 0 );
+
+    // 排在阻塞的工作线程之后，出队时已超过100ms的预算
+    b.setTimeout(100);
+    isok = b.send("work", {}, &expired, &e);
+    b.setTimeout(5000);
+    assert( isok );
+    usleep(200000);
+    gate.open();
+
+    isok = b.receive(&sequence, &reply, &e);
+    assert( isok && sequence == expired && reply.result == srpc::resultTimeout && calls == 0 );
+    isok = a.receive(&sequence, &reply, &e);
+    assert( isok && sequence == blocked && reply.result == srpc::resultOk );
+
+    // 未超时的请求照常执行
+    isok = b.call("work", {}, &reply, &e);
+    assert( isok && reply.result == srpc::resultOk && calls == 1 );
+    server.stop();
+}
+
+/// 处理函数中发起的下游调用按current_deadline()传递剩余预算，而不是使用下游客户端自己的超时
+static void check_deadline_propagation()
+{
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        int32_t budget = srpc::deadline_remaining(srpc::current_deadline(), chrono::now());
+        if ( srpc::service_name(&in->service) == "inner" ) {
+            out.addBlock(std::to_string(budget));
+            return;
+        }
+
+        srpc::Client nested;
+        srpc::Reply reply;
+        err::Error error;
+        if ( !nested.open(server.address(), tcpOptions, &error) || !nested.call("inner", {}, &reply, &error) ) {
+            out.setResult(-1);
+            return;
+        }
+        out.addBlock(std::to_string(budget));
+        for ( auto it = reply.blocks.begin(); it != reply.blocks.end(); ++it ) out.addBlock(*it);
+    });
+    err::Error e;
+    bool isok = server.rpc().startWorkers(2, 16, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client client;
+    client.setTimeout(1000);
+    isok = client.open(server.address(), tcpOptions, &e);
+    assert( isok );
+
+    srpc::Reply reply;
+    isok = client.call("outer", {}, &reply, &e);
+    assert( isok && reply.result == srpc::resultOk && reply.blocks.size() == 2 );
+    int outer = atoi(reply.blocks[0].c_str());
+    int inner = atoi(reply.blocks[1].c_str());
+    assert( outer > 0 && outer <= 1000 );
+    assert( inner > 0 && inner <= outer );
+    server.stop();
+}
+
+/// 低权重的域积压大量慢请求时，高权重的域仍能及时完成；不存在的域或类别不能映射
+static void check_domains()
+{
+    const int slowDomain = 2, fastDomain = 1, flood = 60;
+    TestServer server;
+    srpc::Server & rpc = server.rpc();
+    rpc.setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        if ( in->header.domain == slowDomain ) usleep(20000);
+    });
+    err::Error e;
+    bool isok = rpc.startWorkers(2, 16, &e);
+    assert( isok );
+    int slow = rpc.addPriorityClass(1, 256);
+    int fast = rpc.addPriorityClass(8, 16);
+    assert( rpc.setDomainClass(slowDomain, slow) && rpc.setDomainClass(fastDomain, fast) );
+
+    assert( !rpc.setDomainClass(-1, fast) && !rpc.setDomainClass(256, fast) );
+    assert( !rpc.setDomainClass(3, fast + 1) && !rpc.setDomainClass(3, -2) );
+    assert( rpc.setDomainClass(3, srpc::Server::inlineClass) && rpc.setDomainClass(3, 0) );
+    isok = server.start(&e);
+    assert( isok );
+
+    // 60个20ms的请求由2个线程处理需要约600ms
+    srpc::Client batch, control;
+    batch.setDomain(slowDomain);
+    control.setDomain(fastDomain);
+    isok = batch.open(server.address(), tcpOptions, &e) && control.open(server.address(), tcpOptions, &e);
+    assert( isok );
+    int32_t sequence;
+    for ( int i = 0; i < flood; ++i ) {
+        isok = batch.send("batch", {}, &sequence, &e);
+        assert( isok );
+    }
+    usleep(50000);   // 事件循环每次迭代只读取连接上的一个报文，等全部请求进入队列
+
+    // 高权重的域只需等待正在执行的慢请求
+    srpc::Reply reply;
+    int64_t maxLatency = 0;
+    for ( int i = 0; i < 10; ++i ) {
+        int64_t begin = chrono::steady_now();
+        isok = control.call("control", {}, &reply, &e);
+        assert( isok && reply.result == srpc::resultOk );
+        maxLatency = std::max(maxLatency, chrono::steady_now() - begin);
+    }
+    assert( maxLatency < 100000 );
+
+    for ( int i = 0; i < flood; ++i ) {
+        isok = batch.receive(&sequence, &reply, &e);
+        assert( isok && reply.result == srpc::resultOk );
+    }
+    server.stop();
+}
+
+/**
+ * 空载时服务端下发的窗口为2：流水线客户端第三个在途请求直接失败，连接池同时只能取出两个连接。
+ * 工作队列占满后窗口为0：新连接被拒绝并挂起1秒，挂起期间连接池不再建立连接；
+ * 已有连接的心跳应答把窗口降为1。挂起结束、负载下降后恢复。
+ */
+static void check_window()
+{
+    Gate gate;
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        if ( srpc::service_name(&in->service) == "block" ) gate.wait();
+    });
+    server.rpc().setLoadShedding(2, 10000, 1);
+    err::Error e;
+    bool isok = server.rpc().startWorkers(1, 2, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client pipe, busy1, busy2;
+    isok = pipe.open(server.address(), tcpOptions, &e) && busy1.open(server.address(), tcpOptions, &e)
+        && busy2.open(server.address(), tcpOptions, &e);
+    assert( isok && pipe.window() == 2 );
+
+    int32_t sequence;
+    srpc::Reply reply;
+    isok = pipe.send("work", {}, &sequence, &e) && pipe.send("work", {}, &sequence, &e);
+    assert( isok && pipe.inflight() == 2 );
+    err::Error overload;
+    isok = pipe.send("work", {}, &sequence, &overload);
+    assert( !isok && overload.code() == srpc::resultOverload && pipe.isOpen() );
+    isok = pipe.receive(&sequence, &reply, &e) && pipe.send("work", {}, &sequence, &e);
+    assert( isok );
+    isok = pipe.receive(&sequence, &reply, &e) && pipe.receive(&sequence, &reply, &e);
+    assert( isok && pipe.inflight() == 0 );
+
+    srpc::ClientPool pool(server.address(), tcpOptions);
+    srpc::Client * c1 = pool.checkout(&e);
+    srpc::Client * c2 = pool.checkout(&e);
+    assert( c1 != nullptr && c2 != nullptr );
+    overload = err::Error();
+    assert( pool.checkout(&overload) == nullptr && overload.code() == srpc::resultOverload );
+    pool.checkin(c1);
+    pool.checkin(c2);
+
+    // 一个请求执行、两个排队，默认类别的队列占满
+    int32_t blocked[3];
+    isok = busy1.send("block", {}, &blocked[0], &e);
+    assert( isok && gate.waitEntered(1) );
+    isok = busy1.send("block", {}, &blocked[1], &e) && busy2.send("block", {}, &blocked[2], &e);
+    assert( isok );
+    usleep(20000);
+
+    srpc::Client rejected;
+    overload = err::Error();
+    isok = rejected.open(server.address(), tcpOptions, &overload);
+    assert( !isok && overload.code() == srpc::resultOverload && rejected.suspendUntil() > chrono::steady_now() );
+    overload = err::Error();
+    isok = rejected.open(server.address(), tcpOptions, &overload);
+    assert( !isok && overload.code() == srpc::resultOverload );
+
+    srpc::ClientPool suspended(server.address(), tcpOptions);
+    overload = err::Error();
+    assert( suspended.checkout(&overload) == nullptr && overload.code() == srpc::resultOverload );
+    overload = err::Error();
+    assert( suspended.checkout(&overload) == nullptr && overload.code() == srpc::resultOverload );
+
+    isok = pipe.heartbeat(&e);
+    assert( isok && pipe.window() == 1 );
+    isok = pipe.send("work", {}, &sequence, &e);
+    assert( isok );
+    assert( !pipe.send("work", {}, &sequence, &e) && pipe.isOpen() );
+
+    gate.open();
+    isok = pipe.receive(&sequence, &reply, &e);
+    assert( isok );
+    for ( int i = 0; i < 3; ++i ) {
+        srpc::Client & busy = i < 2 ? busy1 : busy2;
+        isok = busy.receive(&sequence, &reply, &e);
+        assert( isok && reply.result == srpc::resultOk );
+    }
+
+    // 挂起结束后重新登录，负载已降下来
+    usleep(1100000);
+    srpc::Client * client = suspended.checkout(&e);
+    assert( client != nullptr && client->window() == 2 );
+    isok = client->call("work", {}, &reply, &e);
+    assert( isok && reply.result == srpc::resultOk );
+    suspended.checkin(client);
+    server.stop();
+}
+
+/**
+ * 协商optionTrace后，响应末尾的时间戳数据块被客户端剥离，返回的数据块与回显的请求一致(包括压缩的大数据块)；
+ * 服务端跟踪环中每次调用的各阶段时间不递减，汇总的各项耗时分布都恰好记录了每次调用。
+ */
+static void check_trace()
+{
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) {
+        srpc::DataBlocks blocks(in);
+        for ( auto it = blocks.begin(); it != blocks.end(); ++it ) out.addBlockRef(*it);
+    });
+    server.rpc().setTraceRing(64);
+    err::Error e;
+    bool isok = server.rpc().startWorkers(2, 16, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::TraceCollector collector;
+    srpc::Client client;
+    client.setTraceCollector(&collector);
+    isok = client.open(server.address(), tcpOptions, &e);
+    assert( isok && ( client.options() & srpc::optionTrace ) );
+
+    std::vector<std::vector<std::string>> requests = {
+        {},
+        { "a" },
+        { "hello", "", "world" },
+        { std::string(8192, 'x'), "tail" },
+    };
+    const int rounds = 5;
+    for ( int i = 0; i < rounds; ++i ) {
+        for ( auto it = requests.begin(); it != requests.end(); ++it ) {
+            srpc::Reply reply;
+            isok = client.call("echo", *it, &reply, &e);
+            assert( isok && reply.result == srpc::resultOk && reply.blocks == *it );
+        }
+    }
+    const size_t calls = rounds * requests.size();
+
+    // 发送完成时间在响应写入socket后由事件循环填写，可能晚于客户端收到响应
+    std::vector<srpc::TraceRecord> records;
+    int64_t deadline = chrono::steady_now() + 2000000;
+    for ( ;; ) {
+        records = server.rpc().traceRecords();
+        bool complete = records.size() == calls;
+        for ( auto it = records.begin(); complete && it != records.end(); ++it ) complete = it->sendComplete != 0;
+        if ( complete || chrono::steady_now() > deadline ) break;
+        usleep(1000);
+    }
+    assert( records.size() == calls );
+    for ( auto it = records.begin(); it != records.end(); ++it ) {
+        assert( it->service == "echo" );
+        assert( it->recv > 0 && it->recv <= it->dispatch && it->dispatch <= it->handlerEnd );
+        assert( it->handlerEnd <= it->sendComplete );
+    }
+
+    srpc::TraceStatsMap stats = collector.snapshot();
+    assert( stats.size() == 1 && stats.count("echo") == 1 );
+    const srpc::TraceStats & echo = stats["echo"];
+    assert( echo.total.count() == calls && echo.network.count() == calls );
+    assert( echo.queue.count() == calls && echo.handler.count() == calls );
+    assert( echo.queue.min() >= 0 && echo.handler.min() >= 0 );
+    server.stop();
+}
+
+/// 心跳在报文接收层直接应答，不受工作线程积压影响；设置空闲超时后不发送任何报文的连接被关闭，
+/// 连接池的保活心跳使池内连接不被关闭
+static void check_heartbeat()
+{
+    Gate gate;
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) { gate.wait(); });
+    server.rpc().setIdleTimeout(200);
+    err::Error e;
+    bool isok = server.rpc().startWorkers(1, 1, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client busy, live, dead;
+    isok = busy.open(server.address(), tcpOptions, &e) && live.open(server.address(), tcpOptions, &e)
+        && dead.open(server.address(), tcpOptions, &e);
+    assert( isok );
+
+    // 工作线程阻塞、队列已满时心跳照常应答
+    int32_t running, queued, sequence;
+    isok = busy.send("work", {}, &running, &e);
+    assert( isok && gate.waitEntered(1) );
+    isok = busy.send("work", {}, &queued, &e);
+    assert( isok );
+    int64_t begin = chrono::steady_now();
+    isok = live.heartbeat(&e);
+    assert( isok && chrono::steady_now() - begin < 50000 );
+
+    gate.open();
+    srpc::Reply reply;
+    isok = busy.receive(&sequence, &reply, &e) && busy.receive(&sequence, &reply, &e);
+    assert( isok );
+
+    // 按短于空闲超时的间隔发送心跳的连接保持打开，不收发报文的连接被服务端关闭
+    for ( int i = 0; i < 10; ++i ) {
+        isok = live.heartbeat(&e);
+        assert( isok );
+        usleep(50000);
+    }
+    assert( !dead.heartbeat(&e) && !dead.isOpen() );
+    isok = live.call("work", {}, &reply, &e);
+    assert( isok && reply.result == srpc::resultOk );
+
+    // 只有启用保活的连接池里的连接在空闲超时后仍可用
+    srpc::ClientPool kept(server.address(), tcpOptions), idle(server.address(), tcpOptions);
+    isok = kept.prewarm(1, &e) && idle.prewarm(1, &e);
+    assert( isok );
+
+    nio::SimpleSocketServer loop;
+    isok = kept.keepAlive(loop, 50, &e);
+    assert( isok );
+    int64_t start = chrono::steady_now();
+    loop.addTimer(10, [&](int timer) {
+        if ( chrono::steady_now() - start < 500000 ) return true;
+        loop.exitLoop();
+        return false;
+    });
+    isok = loop.run(&e);
+    assert( isok );
+    kept.stopKeepAlive();
+
+    srpc::Client * client = kept.checkout(&e);
+    assert( client != nullptr );
+    isok = client->call("work", {}, &reply, &e);
+    assert( isok && reply.result == srpc::resultOk );
+    kept.checkin(client);
+
+    client = idle.checkout(&e);
+    assert( client != nullptr );
+    isok = client->call("work", {}, &reply, &e);
+    assert( !isok && !client->isOpen() );
+    idle.checkin(client);
+    server.stop();
+}
+
+/// 流式调用的参数和结果，可在独立线程中执行
+struct StreamCall {
+    srpc::Client * client;
+    std::string    service;
+    std::string    payload;
+    std::string    received;
+    size_t         maxSink  { 0 };    ///< 最大的响应分块
+    int            sources  { 0 };    ///< 读取请求数据的次数
+    int            result   { -1 };
+    bool           isok     { false };
+};
+
+static void stream_call(StreamCall * call)
+{
+    size_t offset = 0;
+    err::Error e;
+    call->isok = call->client->callStream(call->service,
+        [call, &offset](char * buf, size_t cap) {
+            ++call->sources;
+            size_t n = std::min(cap, call->payload.size() - offset);
+            memcpy(buf, call->payload.data() + offset, n);
+            offset += n;
+            return n;
+        },
+        [call](const char * data, size_t size) {
+            call->maxSink = std::max(call->maxSink, size);
+            call->received.append(data, size);
+        },
+        &call->result, &e);
+}
+
+static void * stream_call_proc(void * arg)
+{
+    stream_call((StreamCall *)arg);
+    return nullptr;
+}
+
+/// 流式echo：远大于分块的数据按分块往返，内容不变，两端每次处理的数据都不超过分块上限；
+/// 服务端提前结束时客户端停止读取请求数据；工作队列已满时流延后处理，队列有空位后完成
+static void check_stream()
+{
+    const size_t chunk = 16 * 1024, responseChunk = 64 * 1024;
+    Gate gate;
+    std::atomic<size_t> maxChunk { 0 };
+    std::atomic<int64_t> firstChunk { 0 };
+    TestServer server;
+    server.rpc().setServiceHandler([&](const srpc::service_request_t * in, srpc::Response & out) { gate.wait(); });
+    server.rpc().setStreamHandler([&](srpc::Stream & stream, const srpc::BlockView & view, bool last) {
+        if ( firstChunk == 0 ) firstChunk = chrono::steady_now();
+        if ( (size_t)view.size > maxChunk ) maxChunk = view.size;
+        if ( stream.service() == "early" ) {
+            stream.write("stop");
+            stream.finish(0x200);
+            return;
+        }
+        stream.write(view.data, view.size);
+    });
+    // 分块报文之外的数据不会整体缓存，超过上限的报文直接关闭连接
+    server.rpc().setMaxMessageSize(sizeof(srpc::service_request_t) + responseChunk);
+    err::Error e;
+    bool isok = server.rpc().startWorkers(1, 1, &e) && server.start(&e);
+    assert( isok );
+
+    srpc::Client client;
+    client.setStreamChunkSize(chunk);
+    isok = client.open(server.address(), tcpOptions, &e);
+    assert( isok && ( client.options() & srpc::optionStream ) );
+
+    StreamCall echo;
+    echo.client  = &client;
+    echo.service = "echo";
+    for ( size_t i = 0; i < 4 * 1024 * 1024; ++i ) echo.payload.push_back((char)(i * 31 % 251));
+    stream_call(&echo);
+    assert( echo.isok && echo.result == srpc::resultOk && echo.received == echo.payload );
+    assert( maxChunk <= chunk && echo.maxSink <= responseChunk );
+
+    // 服务端处理第一个分块就结束，64MB的请求只读取了很少一部分
+    StreamCall early;
+    early.client  = &client;
+    early.service = "early";
+    early.payload.assign(64 * 1024 * 1024, 'x');
+    stream_call(&early);
+    assert( early.isok && early.result == 0x200 && early.received == "stop" );
+    assert( early.sources < (int)( early.payload.size() / chunk ) );
+
+    // 唯一的工作线程阻塞且队列已满，流的分块等到队列有空位后才处理，数据不丢失
+    srpc::Client busy;
+    isok = busy.open(server.address(), tcpOptions, &e);
+    int32_t running, queued, sequence;
+    isok = isok && busy.send("work", {}, &running, &e);
+    assert( isok && gate.waitEntered(1) );
+    isok = busy.send("work", {}, &queued, &e);
+    assert( isok );
+
+    StreamCall stalled;
+    stalled.client  = &client;
+    stalled.service = "echo";
+    stalled.payload = echo.payload.substr(0, 256 * 1024);
+    firstChunk = 0;
+    pthread_t tid;
+    pthread_create(&tid, nullptr, stream_call_proc, &stalled);
+    usleep(200000);
+    int64_t released = chrono::steady_now();
+    gate.open();
+    pthread_join(tid, nullptr);
+    assert( stalled.isok && stalled.result == srpc::resultOk && stalled.received == stalled.payload );
+    assert( firstChunk >= released );
+
+    srpc::Reply reply;
+    isok = busy.receive(&sequence, &reply, &e) && busy.receive(&sequence, &reply, &e);
+    assert( isok );
+    server.stop();
+}
+
+static void * loop_thread_proc(void * arg)
+{
+    err::Error e;
+    ((nio::SimpleSocketServer *)arg)->run(&e);
+    return nullptr;
+}
+
+/**
+ * 计数的对端一次写入n个8字节的请求，服务端在同一个接收回调中对每个请求各send一次8字节的响应。
+ * 合并发送时n个响应在迭代结束时一次集中写出，对端一次读取就收到全部响应；
+ * 不合并时各响应单独发送。两种方式的响应内容、顺序和发送回调次数都相同。
+ */
+static void check_corked(bool corked)
+{
+    const int count = 16, size = 8;
+    nio::SimpleSocketServer loop;
+    loop.setCorked(corked);
+
+    std::vector<std::string> responses;
+    responses.reserve(count);
+    char inbuf[count * size];
+    int  sent = 0;
+    err::Error e;
+    net::Address loc("127.0.0.1", 0, &e);
+    int sfd = loop.addListener(loc, [&](int sfd, int cfd, const net::Address * remote) {
+        if ( cfd < 0 ) return;
+        loop.acceptChannel(cfd,
+            [&](int fd, int status, io::MutableBuffer & buf) {
+                if ( status != nio::SimpleSocketServer::statusOk ) {
+                    loop.closeChannel(fd);
+                    return;
+                }
+                for ( size_t pos = 0; pos + size <= buf.size(); pos += size ) {
+                    responses.push_back(std::string(buf.data() + pos, size));
+                    responses.back()[0] = 'r';
+                    io::ConstBuffer out(responses.back().data(), size, size);
+                    loop.send(fd, out);
+                }
+                buf.reset();
+            },
+            [&](int fd, int status, io::ConstBuffer & buf) { if ( status == nio::SimpleSocketServer::statusOk ) ++sent; },
+            [&](int fd) {});
+        io::MutableBuffer in(inbuf, 0, sizeof(inbuf));
+        loop.setPartialReceive(cfd, true);
+        loop.beginReceive(cfd, in);
+    }, &e);
+    assert( sfd >= 0 );
+    net::Address bound;
+    bool isok = net::Socket(sfd).localAddress(&bound, &e);
+    assert( isok );
+
+    pthread_t tid;
+    pthread_create(&tid, nullptr, loop_thread_proc, &loop);
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int r = ::connect(fd, (const sockaddr *)bound.data(), sizeof(sockaddr_in));
+    assert( r == 0 );
+    std::string requests;
+    for ( int i = 0; i < count; ++i ) {
+        char req[size + 1];
+        snprintf(req, sizeof(req), "q%06d", i);
+        requests.append(req, size);
+    }
+    r = (int)::write(fd, requests.data(), requests.size());
+    assert( r == (int)requests.size() );
+
+    std::string received;
+    int reads = 0;
+    while ( received.size() < requests.size() ) {
+        char buf[1024];
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        assert( n > 0 );
+        received.append(buf, n);
+        ++reads;
+    }
+    ::close(fd);
+    loop.post([&]() { loop.exitLoop(); });
+    pthread_join(tid, nullptr);
+
+    for ( int i = 0; i < count; ++i ) {
+        char expected[size + 1];
+        snprintf(expected, sizeof(expected), "r%06d", i);
+        assert( received.compare(i * size, size, expected, size) == 0 );
+    }
+    assert( sent == count && received.size() == requests.size() );
+    if ( corked ) assert( reads == 1 );
+}
+
+/// 各通道都有积压时按权重比例出队，通道内按截止时间从早到晚执行
+static void check_lanes()
+{
+    mt::WorkerPool pool;
+    err::Error e;
+    bool isok = pool.start(1, 1000, &e);
+    assert( isok );
+    int heavy = pool.addLane(3, 1000);
+    int edf   = pool.addLane(1, 100);
+
+    // 唯一的工作线程阻塞期间投递，放行后各通道同时积压
+    Gate gate;
+    std::vector<int> lanes;
+    std::vector<int> order;
+    pool.post([&]() { gate.wait(); });
+    assert( gate.waitEntered(1) );
+    for ( int i = 0; i < 400; ++i ) {
+        pool.postTo(0, [&]() { lanes.push_back(0); });
+        pool.postTo(heavy, [&]() { lanes.push_back(1); });
+    }
+
+    int64_t deadlines[] = { 50, 10, 40, mt::WorkerPool::noDeadline, 20, 30, mt::WorkerPool::noDeadline, 10 };
+    for ( int i = 0; i < 8; ++i ) {
+        pool.postTo(edf, [&order, i]() { order.push_back(i); }, deadlines[i]);
+    }
+    gate.open();
+    pool.stop();   // 等待队列执行完
+
+    assert( lanes.size() == 800 );
+    int heavyCount = 0;
+    for ( int i = 0; i < 400; ++i ) heavyCount += lanes[i];
+    assert( heavyCount >= 290 && heavyCount <= 310 );
+
+    // 截止时间相同或未指定时按投递顺序
+    std::vector<int> expected { 1, 7, 4, 5, 2, 0, 3, 6 };
+    assert( order == expected );
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+    check_lanes();
+    check_offload();
+    check_overload();
+    check_deadline();
+    check_deadline_propagation();
+    check_domains();
+    check_heartbeat();
+    check_window();
+    check_trace();
+    check_stream();
+    check_corked(true);
+    check_corked(false);
+    printf("srpc ok\n");
+    return 0;
+}
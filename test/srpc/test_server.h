@@ -0,0 +1,113 @@
+#pragma once
+
+# include <sym/srpc.h>
+# include <sym/srpc/server.h>
+# include <sym/srpc/client.h>
+# include <sym/nio.h>
+# include <sym/network.h>
+# include <arpa/inet.h>
+# include <pthread.h>
+# include <unistd.h>
+# include <atomic>
+
+using namespace sym;
+
+/**
+ * @brief 测试用的SRPC服务端，在独立线程中运行事件循环，监听127.0.0.1的随机端口。
+ *
+ * 处理函数、工作线程、空闲超时等通过rpc()和loop()在start之前设置，
+ * 添加定时器的设置(setIdleTimeout、setLoadShedding)不是线程安全的，不能在start之后调用。
+ */
+class TestServer
+{
+private:
+    nio::SimpleSocketServer m_loop;
+    srpc::Server            m_rpc;
+    pthread_t               m_tid;
+    int                     m_port    { 0 };
+    bool                    m_running { false };
+
+public:
+    TestServer() : m_rpc(m_loop) {}
+    ~TestServer() { this->stop(); }
+
+    nio::SimpleSocketServer & loop() { return m_loop; }
+    srpc::Server &            rpc()  { return m_rpc; }
+
+    bool start(err::Error * e = nullptr);
+    void stop();
+
+    int          port() const { return m_port; }
+    net::Address address() const { return net::Address("127.0.0.1", m_port, nullptr); }
+
+private:
+    static void * threadProc(void * arg);
+}; // end class TestServer
+
+/// 处理函数中等待测试放行的闸门，用于制造阻塞的工作线程
+class Gate
+{
+private:
+    std::atomic<bool> m_open    { false };
+    std::atomic<int>  m_waiting { 0 };
+
+public:
+    void open()  { m_open = true; }
+    void close() { m_open = false; }
+
+    /// 等待放行，返回前计入进入过闸门的次数
+    void wait()
+    {
+        ++m_waiting;
+        while ( !m_open ) usleep(1000);
+    }
+
+    /// 进入过闸门的次数
+    int  entered() const { return m_waiting; }
+
+    /// 等待至少n次进入，超时返回false
+    bool waitEntered(int n, int timeout = 2000)
+    {
+        int64_t deadline = chrono::steady_now() + timeout * 1000LL;
+        while ( m_waiting < n ) {
+            if ( chrono::steady_now() > deadline ) return false;
+            usleep(1000);
+        }
+        return true;
+    }
+}; // end class Gate
+
+inline
+bool TestServer::start(err::Error * e)
+{
+    net::Address loc("127.0.0.1", 0, e);
+    int sfd = m_rpc.addListener(loc, e);
+    if ( sfd < 0 ) return false;
+
+    net::Address bound;
+    if ( !net::Socket(sfd).localAddress(&bound, e) ) return false;
+    m_port = ntohs(((const sockaddr_in *)bound.data())->sin_port);
+
+    if ( pthread_create(&m_tid, nullptr, threadProc, this) != 0 ) return false;
+    m_running = true;
+    return true;
+}
+
+inline
+void TestServer::stop()
+{
+    if ( !m_running ) return;
+    m_running = false;
+    m_loop.post([this]() { m_loop.exitLoop(); });
+    pthread_join(m_tid, nullptr);
+    m_rpc.stopWorkers();
+}
+
+inline
+void * TestServer::threadProc(void * arg)
+{
+    TestServer * server = (TestServer *)arg;
+    err::Error e;
+    server->m_loop.run(&e);
+    return nullptr;
+}
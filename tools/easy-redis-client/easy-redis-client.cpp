@@ -2,30 +2,37 @@
 #include <sym/network.h>
 #include <sym/io.h>
 #include <sym/redis.h>
+#include <sym/redis/async_client.h>
+#include <sym/redis/cache.h>
+#include <sym/redis/pool.h>
+#include <sym/chrono.h>
+#include <pthread.h>
 
-volatile int G_stop = 0;
+using namespace sym;
 
-int G_seq = 0;
+/// 多线程共用连接池，每次操作取出连接，执行后归还
+struct PoolWorker {
+    redis::Pool * pool;
+    int           count;
+    int           failed { 0 };
+    pthread_t     tid;
+};
 
-nio::SocketChannel * G_channel = nullptr;
-
-int on_send(const char * cmd, int len, int timeout, err::Error *e)
-{
-    nio::SocketChannel * channel = G_channel;
-
-    io::ConstBuffer buffer(cmd, len, len);
-    int r = channel->sendN(buffer, timeout, e);
-    SYM_TRACE_VA("on send: %d, %s", r, cmd);
-    return r;
-}
-
-int on_recv(char * cmd, int len, int timeout, err::Error *e)
+static void * pool_worker_proc(void * arg)
 {
-    io::MutableBuffer buffer(cmd, 0, len);
-    nio::SocketChannel * channel = G_channel;
-    int r = channel->receiveSome(buffer, timeout);
-    SYM_TRACE_VA("on recv: %d", r);
-    return r;
+    PoolWorker * w = (PoolWorker *)arg;
+    redis::Value value;
+    for ( int i = 0; i < w->count; ++i ) {
+        err::Error e;
+        redis::Connection * conn = w->pool->checkout(1000, &e);
+        if ( conn == nullptr ) {
+            ++w->failed;
+            continue;
+        }
+        if ( !conn->command().assign("INCR", "pool:counter").execute(&value, &e) ) ++w->failed;
+        w->pool->checkin(conn);
+    }
+    return nullptr;
 }
 
 void print_redis_value(redis::Value * value)
@@ -36,9 +43,10 @@ void print_redis_value(redis::Value * value)
     else if ( value->type() == redis::Value::vtInteger ) {
         printf("%lld\n", value->getInt());
     } 
-    else if ( value->type() == redis::Value::vtList ) {
+    else if ( redis::Value::isAggregate(value->type()) ) {
+        static const char * names[] = { "list", "map", "set", "push" };
         auto it = value->list().begin();
-        printf("list count: %d\n", (int)value->list().size());
+        printf("%s count: %d\n", names[value->type() - redis::Value::vtList], (int)value->list().size());
         for( ; it != value->list().end(); ++it) print_redis_value(&(*it));
     }
     else if ( value->type() == redis::Value::vtStatus ) {
@@ -58,19 +66,17 @@ int main(int argc, char **argv)
         return -1;
     }
     
-    nio::SocketChannel channel;
-    bool isok = channel.open(remote, 5000, &e);
-    if ( !isok ) {
-        SYM_TRACE_VA("channel open error, %s", e.message());
+    redis::Pool pool(remote, 8);
+    pool.setTimeout(5000);
+    if ( !pool.prewarm(4, &e) ) {
+        SYM_TRACE_VA("connect error, %s", e.message());
         return -1;
     }
-    G_channel = &channel;
-
-    SYM_TRACE("channel open ok");
+    redis::Connection * conn = pool.checkout(0, &e);
+    SYM_TRACE("connection ok");
 
     redis::Value result;
-    redis::Command command(on_send, on_recv);
-    command.setTimeout(1000);
+    redis::Command & command = conn->command();
     command.execute(&result, "set a abcd", &e);
     
     printf("type of result: %d\n", result.type());
@@ -81,9 +87,113 @@ int main(int argc, char **argv)
     printf("type of result: %d\n", result.type());
     print_redis_value(&result);
 
-    sleep(1);
+    // 流水线写入和读取一批key，只需要少数几次往返
+    const int count = argc > 1 ? atoi(argv[1]) : 100000;
+    redis::Pipeline & pipeline = conn->pipeline();
+    char key[32];
+    for ( int i = 0; i < count; ++i ) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        pipeline.append("SET", key, i);
+    }
+    int64_t t0 = chrono::steady_now();
+    int failed = 0;
+    bool isok = pipeline.execute([&failed](size_t index, redis::Value & value) {
+        if ( value.type() != redis::Value::vtStatus || !value.status() ) ++failed;
+    }, &e);
+    int64_t t1 = chrono::steady_now();
+    printf("pipeline set %d keys: %s, failed: %d, %lld us\n", count, isok ? "ok" : e.message(), failed, (long long)(t1 - t0));
+
+    pipeline.reset();
+    for ( int i = 0; i < count; ++i ) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        pipeline.add({ "GET", key });
+    }
+    std::vector<redis::Value> values;
+    isok = pipeline.execute(&values, &e);
+    int64_t t2 = chrono::steady_now();
+    int mismatch = 0;
+    for ( size_t i = 0; i < values.size(); ++i ) {
+        if ( values[i].type() != redis::Value::vtString || atoi(values[i].getString().c_str()) != (int)i ) ++mismatch;
+    }
+    printf("pipeline get %d keys: %s, replies: %d, mismatch: %d, %lld us\n", count, isok ? "ok" : e.message(),
+        (int)values.size(), mismatch, (long long)(t2 - t1));
 
-    channel.close();
+    // 很大的值流式接收，数据分段交给回调，不在接收缓存中保存完整的值
+    std::string large(32 << 20, 'x');
+    command.assign("SET", "large", large).execute(&result, &e);
+    int64_t length = 0;
+    uint64_t received = 0;
+    int64_t t9 = chrono::steady_now();
+    isok = command.assign("GET", "large").execute(&result, [&received](const char * data, size_t len) {
+        received += len;
+        return true;
+    }, &length, &e);
+    int64_t t10 = chrono::steady_now();
+    printf("stream get %lld bytes: %s, received: %llu, %lld us\n", (long long)length, isok ? "ok" : e.message(),
+        (unsigned long long)received, (long long)(t10 - t9));
+
+    pool.checkin(conn);
+
+    // 多个线程共用连接池
+    const int threads = 8;
+    std::vector<PoolWorker> workers(threads);
+    int64_t t5 = chrono::steady_now();
+    for ( int i = 0; i < threads; ++i ) {
+        workers[i].pool  = &pool;
+        workers[i].count = count / threads;
+        pthread_create(&workers[i].tid, nullptr, pool_worker_proc, &workers[i]);
+    }
+    int poolFailed = 0;
+    for ( int i = 0; i < threads; ++i ) {
+        pthread_join(workers[i].tid, nullptr);
+        poolFailed += workers[i].failed;
+    }
+    int64_t t6 = chrono::steady_now();
+    printf("pool incr %d times in %d threads: failed: %d, connections: %d, %lld us\n", count / threads * threads, threads,
+        poolFailed, (int)pool.size(), (long long)(t6 - t5));
+
+    // 客户端缓存，热点key在失效前直接从本地读取
+    redis::CachingClient cache(remote, 1024);
+    if ( cache.open(&e) ) {
+        std::string text;
+        bool exists;
+        int64_t t7 = chrono::steady_now();
+        for ( int i = 0; i < count; ++i ) {
+            snprintf(key, sizeof(key), "key:%d", i % 16);
+            if ( i == count / 2 ) cache.execute({ "SET", "key:0", "0" }, &result, &e);   // 服务端推送失效消息
+            if ( !cache.get(key, &text, &exists, &e) ) break;
+        }
+        int64_t t8 = chrono::steady_now();
+        const redis::CacheStats & stats = cache.stats();
+        printf("cached get %d times: hits: %llu, misses: %llu, invalidations: %llu, evictions: %llu, %lld us\n", count,
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.invalidations,
+            (unsigned long long)stats.evictions, (long long)(t8 - t7));
+    } else {
+        SYM_TRACE_VA("client side caching unavailable, %s", e.message());
+    }
+
+    // 异步客户端，同一次迭代发出的命令合并写出，回复按顺序回调
+    nio::SimpleSocketServer loop;
+    redis::AsyncClient client(loop, remote);
+    if ( !client.connect(&e) ) {
+        SYM_TRACE_VA("async client connect error, %s", e.message());
+        return -1;
+    }
+    int replies = 0, disorder = 0;
+    int64_t last = -1;
+    int64_t t3 = chrono::steady_now();
+    client.command({ "DEL", "counter" }, nullptr);
+    for ( int i = 0; i < count; ++i ) {
+        client.command([&](int status, redis::Value & value) {
+            if ( status != nio::SimpleSocketServer::statusOk || (last >= 0 && value.getInt() != last + 1) ) ++disorder;
+            if ( status == nio::SimpleSocketServer::statusOk ) last = value.getInt();
+            if ( ++replies == count ) loop.exitLoop();
+        }, "INCR", "counter");
+    }
+    loop.run(&e);
+    int64_t t4 = chrono::steady_now();
+    printf("async incr %d times: replies: %d, disorder: %d, last: %lld, %lld us\n", count, replies, disorder,
+        (long long)last, (long long)(t4 - t3));
 
     return 0;
 }
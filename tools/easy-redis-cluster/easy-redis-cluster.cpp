@@ -0,0 +1,69 @@
+#include <sym/redis/cluster.h>
+#include <sym/chrono.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+
+using namespace sym;
+
+/**
+ * command:  easyrediscluster [count] [host:port ...]
+ *
+ * 对本地集群写入并读回count个key，默认种子节点为127.0.0.1:7000-7002。
+ */
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+    std::vector<std::string> seeds;
+    for ( int i = 2; i < argc; ++i ) seeds.push_back(argv[i]);
+    if ( seeds.empty() ) seeds = { "127.0.0.1:7000", "127.0.0.1:7001", "127.0.0.1:7002" };
+
+    err::Error e;
+    redis::ClusterClient cluster(seeds);
+    if ( !cluster.refresh(&e) ) {
+        SYM_TRACE_VA("load cluster slots error, %s", e.message());
+        return -1;
+    }
+
+    // 流水线写入，按节点拆分并行发送
+    std::vector<redis::ClusterClient::Args> cmds;
+    std::map<std::string, int> distribution;
+    char key[32];
+    for ( int i = 0; i < count; ++i ) {
+        snprintf(key, sizeof(key), "key:%d", i);
+        cmds.push_back({ "SET", key, std::to_string(i) });
+        ++distribution[cluster.nodeOf(key)];
+    }
+    std::vector<redis::Value> values;
+    int64_t t0 = chrono::steady_now();
+    bool isok = cluster.execute(cmds, &values, &e);
+    int64_t t1 = chrono::steady_now();
+    int failed = 0;
+    for ( auto it = values.begin(); it != values.end(); ++it ) {
+        if ( it->type() != redis::Value::vtStatus || !it->status() ) ++failed;
+    }
+    printf("pipeline set %d keys: %s, failed: %d, %lld us\n", count, isok ? "ok" : e.message(), failed, (long long)(t1 - t0));
+    for ( auto it = distribution.begin(); it != distribution.end(); ++it ) {
+        printf("  node %s: %d keys\n", it->first.c_str(), it->second);
+    }
+
+    for ( int i = 0; i < count; ++i ) cmds[i] = { "GET", cmds[i][1] };
+    isok = cluster.execute(cmds, &values, &e);
+    int64_t t2 = chrono::steady_now();
+    int mismatch = 0;
+    for ( int i = 0; i < (int)values.size(); ++i ) {
+        if ( values[i].type() != redis::Value::vtString || atoi(values[i].getString().c_str()) != i ) ++mismatch;
+    }
+    printf("pipeline get %d keys: %s, mismatch: %d, %lld us\n", count, isok ? "ok" : e.message(), mismatch, (long long)(t2 - t1));
+
+    // 逐个执行，作为对照
+    int n = std::min(count, 1000);
+    redis::Value value;
+    mismatch = 0;
+    for ( int i = 0; i < n; ++i ) {
+        if ( !cluster.execute(cmds[i], &value, &e) || atoi(value.getString().c_str()) != i ) ++mismatch;
+    }
+    int64_t t3 = chrono::steady_now();
+    printf("single get %d keys: mismatch: %d, %lld us\n", n, mismatch, (long long)(t3 - t2));
+    return 0;
+}
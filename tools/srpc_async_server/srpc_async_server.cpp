@@ -1,59 +1,26 @@
 
 #include <sym/srpc.h>
+#include <sym/srpc/server.h>
 #include <sym/utilities.h>
 #include <assert.h>
 #include <map>
 #include <memory.h>
 
 #define LOCAL_URL "0.0.0.0:8899"
+#define LOCAL_PATH "/tmp/srpc_async_server.sock"   ///< 同一主机的客户端登录后切换到该UNIX域地址
+#define WORKER_THREADS      4       ///< 服务处理线程数
+#define WORKER_QUEUE_LIMIT  1024    ///< 待处理请求上限，超出后返回过载响应
+#define IDLE_TIMEOUT        60000   ///< 连接空闲超时(毫秒)，客户端应以更短的间隔发送心跳
+#define CORKED_SEND         true    ///< 同一次循环迭代产生的响应合并发送
+#define MAX_MESSAGE_SIZE    (16 << 20)   ///< 非流式报文上限，更大的数据走流式调用
+#define SHED_MAX_WINDOW     64      ///< 空载时下发给客户端的建议并发请求数
+#define SHED_MAX_LOOP_LAG   200     ///< 事件循环延迟达到该值(毫秒)视为满载
+#define SHED_SUSPEND        5       ///< 满载时客户端挂起的秒数
+#define TRACE_RING          1024    ///< 保留最近的请求时间线条数
+#define DOMAIN_CONTROL      1       ///< 控制面请求的应用域，权重较高，队列较短
+#define DOMAIN_BATCH        2       ///< 批量任务的应用域，权重较低，允许较长的积压
 using namespace sym;
 
-class ListenerCallback
-{
-private:
-    nio::SimpleSocketServer & m_server;
-public:
-    ListenerCallback(nio::SimpleSocketServer & server) : m_server(server) {}
-    void operator()(int sfd, int cfd, const net::Address * remote);
-};
-
-class RecvCallback
-{
-private:
-    nio::SimpleSocketServer & m_server;
-    int  m_sendTimeout;
-
-public:
-    RecvCallback(nio::SimpleSocketServer & server, int sendtimeout = 5000) 
-        : m_server(server) , m_sendTimeout(sendtimeout) {}
-
-    void sendResponse(int fd, io::ConstBuffer & outbuf);
-    void operator()(int fd, int status, io::MutableBuffer & buffer);
-
-    void onMessageReceived(srpc::message_t * in, io::ConstBuffer & out);
-protected:
-    void onLogonRequestReceived(srpc::logon_request_t *in, io::ConstBuffer & out);
-    void onServiceRequestReceived(srpc::service_request_t *in, io::ConstBuffer & out);
-};
-
-class SendCallback
-{
-private:
-    nio::SimpleSocketServer & m_server;
-public:
-    SendCallback(nio::SimpleSocketServer & server) : m_server(server) {}
-    void operator()(int fd, int status, io::ConstBuffer & buffer);
-};
-
-class CloseCallback
-{
-private:
-    nio::SimpleSocketServer & m_server;
-public:
-    CloseCallback(nio::SimpleSocketServer & server) : m_server(server) {}
-    void operator()(int fd);
-};
-
 class TimerCallback
 {
 private:
@@ -68,22 +35,68 @@ public:
 
 class ServerCallback 
 {
+private:
+    srpc::Server & m_rpcServer;
 public:
+    ServerCallback(srpc::Server & rpcServer) : m_rpcServer(rpcServer) {}
+
     void operator()(int status) {
         SYM_TRACE_VA("[trace] ServerCallback, status %d", status);
+
+        // 空闲时输出各服务的压缩统计
+        srpc::CompressCounterMap counters = m_rpcServer.compressCounters();
+        for ( auto it = counters.begin(); it != counters.end(); ++it ) {
+            const srpc::CompressCounter & c = it->second;
+            SYM_TRACE_VA("[info] compress stat, service: %s, compress: %llu, decompress: %llu, skip: %llu, "
+                "raw: %llu, packed: %llu, cpu(us): %llu", it->first.c_str(), 
+                (unsigned long long)c.compressCount, (unsigned long long)c.decompressCount, 
+                (unsigned long long)c.skipCount, (unsigned long long)c.rawBytes, 
+                (unsigned long long)c.packedBytes, (unsigned long long)(c.cpuNanos / 1000));
+        }
+
+        // 最近一条请求时间线
+        std::vector<srpc::TraceRecord> traces = m_rpcServer.traceRecords();
+        if ( !traces.empty() ) {
+            const srpc::TraceRecord & t = traces.back();
+            SYM_TRACE_VA("[info] last trace, service: %s, sequence: %d, queue(us): %lld, handler(us): %lld, send(us): %lld",
+                t.service.c_str(), t.sequence, (long long)(t.dispatch - t.recv), (long long)(t.handlerEnd - t.dispatch),
+                (long long)(t.sendComplete ? t.sendComplete - t.handlerEnd : -1));
+        }
     }
 };
 
+void onServiceRequest(const srpc::service_request_t * in, srpc::Response & out);
+void onStreamRequest(srpc::Stream & stream, const srpc::BlockView & chunk, bool last);
+
 int main(int argc, char **argv)
 {
     err::Error e;
     nio::SimpleSocketServer server;
 
-    server.setServerCallback(ServerCallback());
+    srpc::Server rpcServer(server);
+
+    server.setServerCallback(ServerCallback(rpcServer));
     server.setIdleInterval(10);    // 10s空闲回调。
+    server.setCorked(CORKED_SEND);
     net::Address loc("0.0.0.0", 8899, &e);
 
-    int listenerId = server.addListener(loc, ListenerCallback(server), &e);
+    rpcServer.setServiceHandler(onServiceRequest);
+    rpcServer.setStreamHandler(onStreamRequest);
+    rpcServer.setMaxMessageSize(MAX_MESSAGE_SIZE);
+    if ( !rpcServer.startWorkers(WORKER_THREADS, WORKER_QUEUE_LIMIT, &e) ) {
+        SYM_TRACE_VA("[error] start workers failed, %s", e.message());
+        return -1;
+    }
+    rpcServer.setDomainClass(DOMAIN_CONTROL, rpcServer.addPriorityClass(8, 64));
+    rpcServer.setDomainClass(DOMAIN_BATCH, rpcServer.addPriorityClass(1, 4 * WORKER_QUEUE_LIMIT));
+
+    rpcServer.setIdleTimeout(IDLE_TIMEOUT);
+    rpcServer.setLoadShedding(SHED_MAX_WINDOW, SHED_MAX_LOOP_LAG, SHED_SUSPEND);
+    rpcServer.setTraceRing(TRACE_RING);
+    int listenerId = rpcServer.addListener(loc, &e);
+    if ( rpcServer.addLocalListener(LOCAL_PATH, &e) < 0 ) {
+        SYM_TRACE_VA("[warn] listen on %s failed, local clients use tcp, %s", LOCAL_PATH, e.message());
+    }
 
     // server.addTimer(1000, TimerCallback( server ), &e); 
     server.run(&e);
@@ -91,211 +104,49 @@ int main(int argc, char **argv)
     return 0;
 }
 
-void ListenerCallback::operator()(int sfd, int cfd, const net::Address * remote)
-{
-    if ( cfd == -1 )  {
-        SYM_TRACE_VA("[error] listener error, fd: %d", sfd);
-        m_server.exitLoop();   // 获取连接失败，退出server循环
-        return;
-    }
-
-    SYM_TRACE_VA("[info] accept new channel, fd: %d", cfd);
-    err::Error error;
-    m_server.acceptChannel(cfd, RecvCallback(m_server), SendCallback(m_server), CloseCallback(m_server), &error);
-    
-    // 开始接收消息
-    io::MutableBuffer buffer(new char[1024], 0, 1024);
-    buffer.limit(sizeof(srpc::srpc_message_header));
-    SYM_TRACE_VA("[trace] recv buffer created, ptr: %p, cap: %d", buffer.data(), buffer.capacity());
-    m_server.beginReceive(cfd, buffer);
-}
-
-void RecvCallback::operator()(int fd, int status, io::MutableBuffer & buffer) 
-{
-    if ( status != 0 ) {
-        // 读消息失败，channel关闭
-        SYM_TRACE_VA("[error] channel read error, fd: %d", fd);
-        if ( buffer.data()) free(buffer.detach());
-        m_server.closeChannel(fd);
-        // return false;  // 回调后不再接收消息, b不需要返回
-        return;
-    }
-
-    // 一般首次读消息时，缓存还没分配，先分配缓存
-    // 如果调用的beginReceive已经分配了缓存，这里就不用再分配。
-    if ( buffer.data() == nullptr ) {
-        SYM_TRACE_VA("[error] ON_RECV, buffer alloc, fd: %d", fd);
-        char * p = (char *)malloc(1024);
-        buffer.attach(p, 0, 1024);   // 缓存挂到buffer
-        buffer.limit(sizeof(srpc::message_header_t));  // 先接收报文头
-        return; // 回调后自动继续接收 不需要返回
-    }
-
-    // 后续缓存已经分配，就检查收到的数据
-    srpc::message_t * msg = (srpc::message_t*)buffer.data();
-    bool isok = message_check_magic(msg);
-    if ( !isok ) {
-        // 消息头magic不正确，连接需要关闭
-        SYM_TRACE_VA("[error] channel message magic word invalid, fd: %d", fd);
-        free(buffer.detach());
-        m_server.closeChannel(fd);
-        return;
-    }
-
-    // 检查收到的消息长度，是否接收完整。
-    size_t rsize = buffer.size();    // 当前已经接收到的数据大小
-    size_t msize = io::btoh(msg->header.length);
-    if ( rsize == msize ) {
-        // 消息总长等于收到的长度，当前消息接收完成
-        SYM_TRACE_VA("[info] message received, fd: %d, timestamp: %lld， len: %d", 
-            fd, io::btoh(msg->header.timestamp), (int)msize);
-        
-        io::ConstBuffer out;
-        this->onMessageReceived(msg, out);
-
-        // 将消息发回
-        this->sendResponse(fd, out);
-        
-        buffer.reset();  // 缓存倒回, limit = cap, size = 0;
-        buffer.limit(sizeof(srpc::message_header_t));
-        // return true;  // 接续接收
-        return ;
-    }
-
-    // 消息长度和当前收到的不一致，通常是收到消息头，需要扩充内存，继续接收
-    assert( msize > rsize);   // 这里必然 msize > rsize, 收到的比消息总长还长，就有问题了
-    if ( rsize == sizeof(srpc::message_header_t) ) {
-
-        // 收到了包头，但还有包体要收，如果缓存不够，就扩充
-        // 包总长等于包头长度，则是个空包，按以完成处理。
-        if ( msize > buffer.capacity()) {
-            char * p = (char *)realloc(buffer.data(), msize);
-            buffer.attach(p, rsize, msize);
-        }
-
-        buffer.limit(msize);
-        SYM_TRACE_VA("[trace] ON_RECV, buffer realloc, %d", (int)msize);
-        return ;
-    } else {
-        // 收到了一半消息体或消息头，一般不会有这种问题。
-        assert("bad message length" == nullptr);
-    }
-}
-
-void RecvCallback::onMessageReceived(srpc::message_t * in, io::ConstBuffer & out)
-{
-    int16_t logon_req = io::htob((int16_t)srpc::typeLogonRequest);
-    int16_t service_req = io::htob((int16_t)srpc::typeServiceRequest); 
-
-    if ( in->header.body_type == logon_req ) {
-        this->onLogonRequestReceived((srpc::logon_request_t*)in, out);
-    }
-    else if (in->header.body_type == service_req) {
-        this->onServiceRequestReceived((srpc::service_request_t*)in, out);
-    } 
-    else {
-        abort();
-    }
-}
-
-void RecvCallback::onServiceRequestReceived(srpc::service_request_t * in, io::ConstBuffer &out)
+void onServiceRequest(const srpc::service_request_t * in, srpc::Response & out)
 {
     const char * replydata = "SDS0{{0x8, \\{\"result\": \"1234567\"\\}}}";
-    srpc::service_response_t * resp = (srpc::service_response_t*)malloc(1024);
-    
     int64_t sid = io::btoh(in->service.session_id);
-    srpc::datablock_t * session = in->data;
-    int32_t sessionlen = io::btoh(session->length);
-    std::string strsession((char *)session->value, sessionlen);
 
-    const char * p = (const char *)session;
-    p += sizeof(int32_t) + sessionlen;
-
-    srpc::datablock_t * stream = (srpc::datablock_t*)(p);
-    int32_t streamlen  = io::btoh(stream->length);
-    std::string strstream((char *)stream->value, streamlen);
-
-    SYM_TRACE_VA("ON_SERVICE_REQUEST, sid: %lld, sessionlen: %d, session: %s, streamlen: %d, stream: %s",
-        sid, sessionlen, strsession.c_str(), streamlen, strstream.c_str());
-    
-    resp->header = in->header;
-    resp->service = in->service;
-
-    resp->header.body_type = io::htob((int16_t)srpc::typeServiceResponse);
-    
-    srpc::datablock_t * osess = resp->data;
-    osess->length = session->length;
-    memcpy(osess->value, session->value, sessionlen);
-
-    srpc::datablock_t * ostream = (srpc::datablock_t * )((char *) (&osess->value) + sessionlen);
-    int32_t oslen = strlen(replydata);
-    ostream->length = io::htob(oslen);
-    memcpy(ostream->value, replydata, oslen);
-
-    int32_t svcbodylen = 2 * sizeof(int32_t) + sessionlen + oslen;
-    int32_t totallen = sizeof(srpc::message_header_t) + sizeof(srpc::service_request_t)
-                     + sessionlen + oslen + 2 * sizeof(int32_t);
-    resp->header.length = io::htob(totallen);
-    resp->service.rpc_body_len = io::htob(svcbodylen);
-
-    out.attach((const char *)resp, totallen, 1024);
-    out.limit(totallen);
-
-    sleep(1);  // 停止几秒模拟运行，以便前端超时测试
-    return ;
-}
+    srpc::DataBlocks blocks(in);
+    if ( !blocks.valid() ) {
+        out.setResult(srpc::resultBadMessage);
+        return;
+    }
 
-void RecvCallback::onLogonRequestReceived(srpc::logon_request_t *in, io::ConstBuffer & out)
-{
-        int size = io::btoh(in->client_length) + io::btoh(in->server_length);
-        std::string str(in->body, size);
-        SYM_TRACE_VA("[trace] ON_LOGON_REQUEST_RECV, %s", str.c_str());
+    // 剩余预算，下游调用通过srpc::request_set_deadline(req, srpc::current_deadline())传递
+    int32_t budget = srpc::deadline_remaining(srpc::current_deadline(), chrono::now());
 
-        srpc::logon_reply_t * p  = (srpc::logon_reply_t*)malloc(sizeof(srpc::logon_reply_t));
-        
-        p->header = in->header;
-        p->header.body_type = io::htob((int16_t)srpc::typeLogonResponse);
-        p->header.timestamp = io::htob((int64_t)chrono::now());
-        p->header.length = io::htob((int32_t)sizeof(srpc::logon_reply_t));
+    SYM_TRACE_VA("ON_SERVICE_REQUEST, sid: %lld, budget(ms): %d, blocks: %d",
+        sid, budget, (int)blocks.size());
 
-        p->regcode = io::htob(1);
-        p->result  = 0;
-        p->suspend = 0;
-        p->window  = 1;
-        
-        out.attach((char *)p, sizeof(srpc::logon_reply_t), sizeof(srpc::logon_reply_t));
-        out.limit(sizeof(srpc::logon_reply_t));
-}
+    // 原样返回请求的数据块(引用请求报文，不复制)，再附加处理结果
+    for ( auto it = blocks.begin(); it != blocks.end(); ++it ) out.addBlockRef(*it);
+    out.addBlock(replydata, strlen(replydata));
 
-void RecvCallback::sendResponse(int fd, io::ConstBuffer & outbuf) 
-{
-    SYM_TRACE_VA("SRPC_SEND_RESPONSE, buf: %p, pos: %d, limit: %d", 
-        outbuf.data(), outbuf.position(), outbuf.limit());
-    
-    bool isok = m_server.send(fd, outbuf);
-    assert( isok );
+    sleep(1);  // 停止几秒模拟运行，以便前端超时测试。处理函数在工作线程执行，不阻塞事件循环
     return ;
 }
 
-void SendCallback::operator()(int fd, int status, io::ConstBuffer & buffer)
+/// 流式echo：原样返回每个请求分块，最后附加收到的总字节数
+void onStreamRequest(srpc::Stream & stream, const srpc::BlockView & chunk, bool last)
 {
-    // 发送回复数据完成，释放缓存，关闭连接。
-    const srpc::message_t * msg = (const srpc::message_t*)buffer.data();
-    if ( status == 0 ) {
-        SYM_TRACE_VA("[info] message response sent, fd: %d, timestamp: %lld", 
-            fd, io::btoh(msg->header.timestamp));
-    } else {
-        SYM_TRACE_VA("[error] message response send failed, fd: %d, timestamp: %lld", 
-            fd, io::btoh(msg->header.timestamp));
+    uint64_t * total = (uint64_t *)stream.context();
+    if ( total == nullptr ) {
+        total = new uint64_t(0);
+        stream.setContext(total);
+    }
+    *total += chunk.size;
+    stream.write(chunk.data, chunk.size);
+
+    if ( last ) {
+        SYM_TRACE_VA("ON_STREAM_REQUEST, service: %s, bytes: %llu, aborted: %d",
+            stream.service().c_str(), (unsigned long long)*total, (int)stream.aborted());
+        char summary[64];
+        int n = snprintf(summary, sizeof(summary), "bytes=%llu", (unsigned long long)*total);
+        stream.write(summary, n);
+        stream.finish();
+        delete total;
     }
-
-    free((void *)buffer.detach());
-
-    // m_server.closeChannel(fd);
 }
-
-void CloseCallback::operator()(int fd)
-{
-    SYM_TRACE_VA("[info] channel closed, fd: %d", fd);
-    // 该回调说明channel已经关闭，fd相关资源不再可用
-}
\ No newline at end of file
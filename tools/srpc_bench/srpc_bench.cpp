@@ -0,0 +1,285 @@
+# include <sym/srpc/client.h>
+# include <sym/utilities/histogram.h>
+# include <stdio.h>
+# include <stdlib.h>
+# include <unistd.h>
+
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+#define REMOTE_HOST "127.0.0.1"
+#define REMOTE_PORT 8899
+
+using namespace sym;
+
+/// 压测参数
+struct BenchOptions {
+    const char * host        { REMOTE_HOST };
+    int          port        { REMOTE_PORT };
+    int          connections { 4 };
+    int          depth       { 1 };      ///< 每个连接同时在途的请求数
+    int          duration    { 10 };     ///< 统计时长，秒
+    int          warmup      { 1 };      ///< 预热时长，秒，期间的请求不计入统计
+    double       rate        { 0 };      ///< 总请求速率，0表示闭环模式
+    int          payload     { 64 };     ///< 每个请求数据块的大小
+    int          options     { srpc::optionCompress | srpc::optionLocal | srpc::optionShm };
+    int          timeout     { 5000 };
+    int          domain      { 0 };
+    bool         trace       { false };   ///< 统计服务端排队和处理耗时
+    std::string  service     { "echo" };
+    const char * json        { nullptr };
+};
+
+/// 每个连接一个线程，同一连接上最多depth个请求在途，多于1个时按流水线发送
+struct BenchWorker {
+    const BenchOptions * opts;
+    srpc::TraceCollector * trace;
+    int                  index;
+    net::Address         remote;
+    int64_t              start;        ///< 开始统计的时间
+    int64_t              end;
+    pthread_t            tid;
+
+    util::Histogram      latency;
+    uint64_t             requests { 0 };
+    uint64_t             failed   { 0 };   ///< 服务返回非0结果
+    uint64_t             errors   { 0 };   ///< 网络或协议错误
+};
+
+/// 连接断开时在途的请求都计为错误
+static void bench_fail(BenchWorker * w, std::unordered_map<int32_t, int64_t> & inflight)
+{
+    for ( auto it = inflight.begin(); it != inflight.end(); ++it ) {
+        if ( it->second < w->start ) continue;
+        ++w->requests;
+        ++w->errors;
+    }
+    inflight.clear();
+}
+
+static void * bench_worker_proc(void * arg)
+{
+    BenchWorker * w = (BenchWorker *)arg;
+    const BenchOptions & opts = *w->opts;
+    // 与示例echo服务一致，请求由会话块和数据块组成
+    char session[32];
+    snprintf(session, sizeof(session), "bench-%d", w->index);
+    std::vector<std::string> blocks { session, std::string(opts.payload, 'x') };
+
+    // 开环模式下每个连接按固定间隔发送，各连接错开起点
+    int64_t interval = opts.rate > 0 ? (int64_t)(1000000.0 * opts.connections / opts.rate) : 0;
+    int64_t next = w->start - opts.warmup * 1000000LL + interval * w->index / opts.connections;
+    if ( interval <= 0 ) next = chrono::steady_now();
+
+    srpc::Client client;
+    client.setTimeout(opts.timeout);
+    client.setDomain(opts.domain);
+    if ( opts.trace ) client.setTraceCollector(w->trace);
+    srpc::Reply reply;
+    err::Error e;
+    std::unordered_map<int32_t, int64_t> inflight;   // 请求序号到计时起点
+
+    while ( true ) {
+        // 开环模式下计划在结束前发送的请求全部发出，服务端停顿造成的推迟正是需要统计的延迟
+        int64_t now  = chrono::steady_now();
+        bool    more = interval > 0 ? next < w->end : now < w->end;
+        if ( !more && inflight.empty() ) break;
+
+        // 深度不超过服务端下发的窗口，窗口随心跳变化，每次重新计算
+        int depth = opts.depth;
+        if ( client.window() > 0 && depth > client.window() ) depth = client.window();
+
+        // 达到深度、下一个请求还没到计划时间或不再发送时，先收取一个响应
+        bool due = more && ( interval <= 0 || now >= next );
+        if ( !inflight.empty() && ( !due || (int)inflight.size() >= depth ) ) {
+            int32_t sequence;
+            bool isok = client.receive(&sequence, &reply, &e);
+            int64_t finish = chrono::steady_now();
+            if ( !isok ) {
+                bench_fail(w, inflight);
+                continue;
+            }
+            auto it = inflight.find(sequence);
+            if ( it == inflight.end() ) continue;
+            int64_t begin = it->second;
+            inflight.erase(it);
+            if ( begin >= w->start ) {
+                ++w->requests;
+                if ( reply.result != srpc::resultOk ) ++w->failed;
+                w->latency.record(finish - begin);
+            }
+            continue;
+        }
+        if ( !due ) {
+            usleep(next - now);
+            continue;
+        }
+
+        if ( !client.isOpen() && !client.open(w->remote, opts.options, &e) ) {
+            ++w->errors;
+            usleep(100000);
+            next = interval > 0 ? next + interval : chrono::steady_now();
+            continue;
+        }
+
+        // 闭环模式从实际发送开始计时；开环模式从计划发送时间开始计时，
+        // 服务端变慢导致的发送推迟也计入延迟，避免coordinated omission
+        int64_t begin = interval > 0 ? next : now;
+        int32_t sequence;
+        if ( client.send(opts.service, blocks, &sequence, &e) ) {
+            inflight[sequence] = begin;
+        } else {
+            if ( begin >= w->start ) {
+                ++w->requests;
+                ++w->errors;
+            }
+            if ( !client.isOpen() ) bench_fail(w, inflight);   // 超出窗口时连接仍可用
+        }
+        if ( interval > 0 ) next += interval;
+    }
+    return nullptr;
+}
+
+static void print_report(const BenchOptions & opts, const util::Histogram & h,
+    uint64_t requests, uint64_t failed, uint64_t errors, double elapsed)
+{
+    double throughput = elapsed > 0 ? h.count() / elapsed : 0;
+    printf("mode: %s, connections: %d, depth: %d, rate: %.0f, payload: %d, duration: %.2fs\n",
+        opts.rate > 0 ? "open" : "closed", opts.connections, opts.depth, opts.rate, opts.payload, elapsed);
+    printf("requests: %llu, completed: %llu, failed: %llu, errors: %llu, throughput: %.1f req/s\n",
+        (unsigned long long)requests, (unsigned long long)h.count(), (unsigned long long)failed,
+        (unsigned long long)errors, throughput);
+    printf("latency(us): min %lld, mean %.1f, p50 %lld, p90 %lld, p99 %lld, p999 %lld, max %lld\n",
+        (long long)h.min(), h.mean(), (long long)h.percentile(0.5), (long long)h.percentile(0.9),
+        (long long)h.percentile(0.99), (long long)h.percentile(0.999), (long long)h.max());
+
+    if ( opts.json == nullptr ) return;
+    FILE * fp = strcmp(opts.json, "-") == 0 ? stdout : fopen(opts.json, "w");
+    if ( fp == nullptr ) {
+        SYM_TRACE_VA("[error] open %s failed", opts.json);
+        return;
+    }
+    fprintf(fp, "{\"mode\": \"%s\", \"service\": \"%s\", \"connections\": %d, \"depth\": %d, \"rate\": %.1f, "
+        "\"payload\": %d, \"duration_s\": %.3f, \"requests\": %llu, \"completed\": %llu, "
+        "\"failed\": %llu, \"errors\": %llu, \"throughput_rps\": %.1f, "
+        "\"latency_us\": {\"min\": %lld, \"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, "
+        "\"p99\": %lld, \"p999\": %lld, \"max\": %lld}}\n",
+        opts.rate > 0 ? "open" : "closed", opts.service.c_str(), opts.connections, opts.depth, opts.rate,
+        opts.payload, elapsed, (unsigned long long)requests, (unsigned long long)h.count(),
+        (unsigned long long)failed, (unsigned long long)errors, throughput,
+        (long long)h.min(), h.mean(), (long long)h.percentile(0.5), (long long)h.percentile(0.9),
+        (long long)h.percentile(0.99), (long long)h.percentile(0.999), (long long)h.max());
+    if ( fp != stdout ) fclose(fp);
+}
+
+static void print_trace(srpc::TraceCollector & trace)
+{
+    srpc::TraceStatsMap stats = trace.snapshot();
+    for ( auto it = stats.begin(); it != stats.end(); ++it ) {
+        const srpc::TraceStats & t = it->second;
+        printf("trace %s (us, p50/p99): total %lld/%lld, network %lld/%lld, queue %lld/%lld, handler %lld/%lld\n",
+            it->first.c_str(),
+            (long long)t.total.percentile(0.5),   (long long)t.total.percentile(0.99),
+            (long long)t.network.percentile(0.5), (long long)t.network.percentile(0.99),
+            (long long)t.queue.percentile(0.5),   (long long)t.queue.percentile(0.99),
+            (long long)t.handler.percentile(0.5), (long long)t.handler.percentile(0.99));
+    }
+}
+
+static void usage()
+{
+    printf("usage: srpc_bench [-h host|path] [-p port] [-c connections] [-q depth] [-d seconds] [-w warmup]\n"
+           "                  [-r rate] [-s payload] [-S service] [-t timeout] [-D domain] [-z] [-T] [-M] [-x] [-j file|-]\n"
+           "  -h  host name or address, or a unix socket path starting with '/' or '@'\n"
+           "  -q  requests in flight per connection, pipelined on the connection when above 1,\n"
+           "      capped by the window the server grants\n"
+           "  -r  total requests per second, open loop; omitted or 0 for closed loop\n"
+           "  -D  domain byte of request headers, selects the server's priority class\n"
+           "  -z  disable compression negotiation\n"
+           "  -T  stay on tcp, do not switch to the server's unix socket on the same host\n"
+           "  -M  do not use shared memory rings on unix socket connections\n"
+           "  -x  trace server side timestamps, report network/queue/handler time per service\n"
+           "  -j  write machine-readable result as json, '-' for stdout\n");
+}
+
+/**
+ * command:  srpc_bench [options]
+ */
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    int c;
+    while ( (c = getopt(argc, argv, "h:p:c:q:d:w:r:s:S:t:D:zTMxj:")) != -1 ) {
+        switch ( c ) {
+        case 'h': opts.host        = optarg; break;
+        case 'p': opts.port        = atoi(optarg); break;
+        case 'c': opts.connections = atoi(optarg); break;
+        case 'q': opts.depth       = atoi(optarg); break;
+        case 'd': opts.duration    = atoi(optarg); break;
+        case 'w': opts.warmup      = atoi(optarg); break;
+        case 'r': opts.rate        = atof(optarg); break;
+        case 's': opts.payload     = atoi(optarg); break;
+        case 'S': opts.service     = optarg; break;
+        case 't': opts.timeout     = atoi(optarg); break;
+        case 'D': opts.domain      = atoi(optarg); break;
+        case 'z': opts.options    &= ~srpc::optionCompress; break;
+        case 'T': opts.options    &= ~srpc::optionLocal; break;
+        case 'M': opts.options    &= ~srpc::optionShm; break;
+        case 'x': opts.trace       = true; break;
+        case 'j': opts.json        = optarg; break;
+        default:  usage(); return -1;
+        }
+    }
+    if ( opts.connections <= 0 || opts.depth <= 0 || opts.duration <= 0 || opts.warmup < 0 || opts.payload < 0 ) {
+        usage();
+        return -1;
+    }
+
+    // host以'/'或'@'开头时直接连接UNIX域地址
+    err::Error e;
+    bool isPath = opts.host[0] == '/' || opts.host[0] == '@';
+    net::Address remote = isPath ? net::Address(opts.host, &e) : net::Address(opts.host, opts.port, &e);
+    if ( e ) {
+        SYM_TRACE_VA("[error] init remote addr error, %s", e.message());
+        return -1;
+    }
+
+    int64_t start = chrono::steady_now() + opts.warmup * 1000000LL;
+    int64_t end   = start + opts.duration * 1000000LL;
+
+    srpc::TraceCollector trace;
+    std::vector<BenchWorker *> workers;
+    for ( int i = 0; i < opts.connections; ++i ) {
+        BenchWorker * w = new BenchWorker();
+        w->opts   = &opts;
+        w->trace  = &trace;
+        w->index  = i;
+        w->remote = remote;
+        w->start  = start;
+        w->end    = end;
+        if ( pthread_create(&w->tid, nullptr, bench_worker_proc, w) != 0 ) {
+            SYM_TRACE("[error] create bench thread failed");
+            delete w;
+            break;
+        }
+        workers.push_back(w);
+    }
+
+    util::Histogram total;
+    uint64_t requests = 0, failed = 0, errors = 0;
+    for ( auto it = workers.begin(); it != workers.end(); ++it ) {
+        pthread_join((*it)->tid, nullptr);
+        total.merge((*it)->latency);
+        requests += (*it)->requests;
+        failed   += (*it)->failed;
+        errors   += (*it)->errors;
+        delete *it;
+    }
+
+    double elapsed = (chrono::steady_now() - start) / 1000000.0;
+    if ( elapsed > opts.duration ) elapsed = opts.duration;   // 排除最后一批在途请求的收尾时间
+    print_report(opts, total, requests, failed, errors, elapsed);
+    if ( opts.trace ) print_trace(trace);
+    return errors > 0 ? 1 : 0;
+}
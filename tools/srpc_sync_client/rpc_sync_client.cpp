@@ -1,16 +1,96 @@
-
-# include <sym/utilities.h>
+# include <sym/srpc/client.h>
 # include <assert.h>
+# include <stdio.h>
+# include <algorithm>
+
+#define REMOTE_HOST "127.0.0.1"
+#define REMOTE_PORT 8899
+
+using namespace sym;
+
+static void call_echo(srpc::ClientPool & pool)
+{
+    err::Error e;
+    srpc::Client * client = pool.checkout(&e);
+    if ( client == nullptr ) {
+        SYM_TRACE_VA("[error] checkout client failed, %s", e.message());
+        return;
+    }
+
+    srpc::Reply reply;
+    bool isok = client->call("echo", {"session", "hello"}, &reply, &e);
+    if ( isok ) {
+        printf("result: %d, blocks: %d\n", reply.result, (int)reply.blocks.size());
+        for ( auto it = reply.blocks.begin(); it != reply.blocks.end(); ++it ) printf("  %s\n", it->c_str());
+    } else {
+        SYM_TRACE_VA("[error] call failed, %s", e.message());
+    }
+    pool.checkin(client);
+}
 
-#define REMOTE_URL "127.0.0.1:40001"
+static void call_stream(srpc::ClientPool & pool, size_t total)
+{
+    err::Error e;
+    srpc::Client * client = pool.checkout(&e);
+    if ( client == nullptr ) {
+        SYM_TRACE_VA("[error] checkout client failed, %s", e.message());
+        return;
+    }
+
+    // 请求数据按分块生成，两端都不需要容纳整个报文
+    size_t sent = 0, received = 0;
+    std::string tail;
+    int result = 0;
+    bool isok = client->callStream("echo-stream",
+        [&sent, total](char * buf, size_t cap) {
+            size_t n = std::min(cap, total - sent);
+            for ( size_t i = 0; i < n; ++i ) buf[i] = (char)('a' + (sent + i) % 26);
+            sent += n;
+            return n;
+        },
+        [&received, &tail, total](const char * data, size_t size) {
+            for ( size_t i = 0; i < size && received + i < total; ++i ) assert( data[i] == (char)('a' + (received + i) % 26) );
+            if ( received + size > total ) tail.append(data + (total > received ? total - received : 0), data + size);
+            received += size;
+        },
+        &result, &e);
+    if ( isok ) {
+        printf("stream result: %d, sent: %zu, received: %zu, %s\n", result, sent, received, tail.c_str());
+    } else {
+        SYM_TRACE_VA("[error] stream call failed, %s", e.message());
+    }
+    pool.checkin(client);
+}
 
+/**
+ * command:  srpccli [host] [port]
+ */
 int main( int argc, char **argv)
 {
-    sym::util::Array<char> array(64);
-    
-    for( int i =0; i < 16; ++i) array[i] = i;
+    const char * host = argc > 1 ? argv[1] : REMOTE_HOST;
+    int          port = argc > 2 ? atoi(argv[2]) : REMOTE_PORT;
+
+    err::Error e;
+    net::Address remote(host, port, &e);
+    if ( e ) {
+        SYM_TRACE_VA("[error] init remote addr error, %s", e.message());
+        return -1;
+    }
 
-    for( int i =0; i < 16; ++i) assert(array[i] == i);
+    nio::SimpleSocketServer loop;     // 保活定时器所在的事件循环，须在连接池之后析构
+    srpc::ClientPool pool(remote);
+    if ( !pool.prewarm(2, &e) ) {
+        SYM_TRACE_VA("[error] prewarm failed, %s", e.message());
+        return -1;
+    }
+    call_echo(pool);
+    call_stream(pool, 32 << 20);
+
+    // 事件循环定时向池内空闲连接发送心跳，运行几个周期后退出
+    pool.keepAlive(loop, 1000);
+    loop.addTimer(3500, [&loop](int timer) { loop.exitLoop(); return false; });
+    loop.run(&e);
+
+    call_echo(pool);
     return 0;
 }
-